@@ -10,7 +10,9 @@ enum class EnclaveCallType {
     GET_ENCLAVE_INSTANCE_INFO_QUOTE,
     GET_KDS_PERSISTENCE_KEY_SPEC,
     SET_KDS_PERSISTENCE_KEY,
-    CALL_MESSAGE_HANDLER;
+    CALL_MESSAGE_HANDLER,
+    SNAPSHOT_IN_MEMORY_FILE_SYSTEM,
+    WARM_UP;
 
     fun toByte(): Byte = ordinal.toByte()
 
@@ -0,0 +1,16 @@
+package com.r3.conclave.common.internal
+
+/**
+ * Backend of the in-memory filesystem of the enclave (IN_MEMORY_BACKEND_* in cpp/fatfs/enclave/src/api.cpp).
+ */
+enum class InMemoryFileSystemBackend(val id: Int) {
+    /**
+     * A FatFs volume formatted on a disk in the enclave memory.
+     */
+    FATFS(0),
+
+    /**
+     * A tree of files kept directly in the enclave memory, which can be snapshotted and restored.
+     */
+    TMPFS(1)
+}
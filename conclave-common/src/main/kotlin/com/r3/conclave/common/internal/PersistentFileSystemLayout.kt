@@ -0,0 +1,18 @@
+package com.r3.conclave.common.internal
+
+/**
+ * Layout of the sectors of the persistent filesystem in its file on the host
+ * (PERSISTENT_LAYOUT_* in cpp/fatfs/enclave/include/persistent_disk.hpp).
+ * The layout is chosen when the filesystem is created, the layout of an existing filesystem is kept.
+ */
+enum class PersistentFileSystemLayout(val id: Int) {
+    /**
+     * Each sector has a fixed position in the file, the writes go through a journal.
+     */
+    IN_PLACE(0),
+
+    /**
+     * The sectors are appended to a log, so that the writes to the file are sequential.
+     */
+    LOG(1)
+}
@@ -96,27 +96,257 @@ public class Native {
     public static native int plaintextSizeFromSealedData(byte[] sealedBlob);
 
     /**
-     * Thin JNI wrapper around `sgx_get_key`.
+     * Returns the size of a sealed batch, see [sealDataBatch].
+     * @param offsets record offsets, record i is [offsets[i], offsets[i + 1]).
+     */
+    public static native int sealedBatchSize(int[] offsets);
+
+    /**
+     * Seals many records with a single derivation of the sealing key. The key of the batch is random and
+     * sealed (wrapper of sgx_seal_data) into the header of the batch, followed by the AES-GCM records.
+     * @param plaintext packed records to be encrypted.
+     * @param offsets record offsets into [plaintext], record i is [offsets[i], offsets[i + 1]).
+     * @param sealedBatchOut sealed batch output, must be pre-allocated by the caller (see [sealedBatchSize]).
+     */
+    public static native void sealDataBatch(byte[] plaintext, int[] offsets, byte[] sealedBatchOut);
+
+    /**
+     * Unseals all the records of a batch.
+     * @param sealedBatch batch written by [sealDataBatch].
+     * @param sealedBatchOffset batch offset.
+     * @param sealedBatchSize batch size.
+     * @param offsets record offsets the batch was sealed with.
+     * @param plaintextOut records output, each record is written at its offset.
+     */
+    public static native void unsealDataBatch(
+            byte[] sealedBatch,
+            int sealedBatchOffset,
+            int sealedBatchSize,
+            int[] offsets,
+            byte[] plaintextOut
+    );
+
+    /**
+     * Returns the size of the header of a sealed stream, see [sealStreamInit].
+     */
+    public static native int sealStreamHeaderSize();
+
+    /**
+     * Starts sealing a stream. Each stream is encrypted with its own random key, which is sealed
+     * (wrapper of sgx_seal_data) into the header of the stream.
+     * @param headerOut header output, must be pre-allocated by the caller (see [sealStreamHeaderSize]).
+     * @return handle of the stream, to be freed with [sealStreamFree].
+     */
+    public static native long sealStreamInit(byte[] headerOut);
+
+    /**
+     * Starts unsealing a stream from its header.
+     * @param header header written by [sealStreamInit].
+     * @param headerOffset header offset.
+     * @param headerSize header size.
+     * @return handle of the stream, to be freed with [sealStreamFree].
+     */
+    public static native long unsealStreamInit(byte[] header, int headerOffset, int headerSize);
+
+    /**
+     * Seals the next chunk of a stream (AES-GCM), directly into [output].
+     * @param stream handle returned by [sealStreamInit].
+     * @param plaintext data to be encrypted.
+     * @param plaintextOffset data offset.
+     * @param plaintextSize data size.
+     * @param output sealed chunk output, [plaintextSize] + 16 bytes (the tag) are written.
+     * @param outputOffset sealed chunk offset.
+     * @param last whether this is the last chunk of the stream.
+     */
+    public static native void sealStreamUpdate(
+            long stream,
+            byte[] plaintext,
+            int plaintextOffset,
+            int plaintextSize,
+            byte[] output,
+            int outputOffset,
+            boolean last
+    );
+
+    /**
+     * Unseals the next chunk of a stream, directly into [output].
+     * @param stream handle returned by [unsealStreamInit].
+     * @param sealedChunk chunk written by [sealStreamUpdate].
+     * @param sealedChunkOffset chunk offset.
+     * @param sealedChunkSize chunk size, including the tag.
+     * @param output data output, [sealedChunkSize] - 16 bytes are written.
+     * @param outputOffset data offset.
+     * @param last whether this is the last chunk of the stream, as when it was sealed.
+     */
+    public static native void unsealStreamUpdate(
+            long stream,
+            byte[] sealedChunk,
+            int sealedChunkOffset,
+            int sealedChunkSize,
+            byte[] output,
+            int outputOffset,
+            boolean last
+    );
+
+    /**
+     * Frees a stream and erases its key.
+     * @param stream handle returned by [sealStreamInit] or [unsealStreamInit].
+     */
+    public static native void sealStreamFree(long stream);
+
+    /**
+     * JNI wrapper around `sgx_get_key`. The derived keys are cached in the enclave (see key_cache.h), so that
+     * the same key is only derived once.
      * @param keyRequestIn The bytes of a [SgxKeyRequest] object used for selecting the appropriate key and any
      * additional parameters required in the derivation of that key.
      * @param keyOut Output buffer of at least size [SgxKey128Bit] for receiving the cryptographic key output.
      */
     public static native void getKey(byte[] keyRequestIn, byte[] keyOut);
 
+    /**
+     * Bulk version of [getKey].
+     * @param keyRequestsIn The bytes of consecutive [SgxKeyRequest] objects.
+     * @param keysOut Output buffer of at least size [SgxKey128Bit] times the number of key requests, for receiving
+     * the keys in the same order.
+     */
+    public static native void getKeys(byte[] keyRequestsIn, byte[] keysOut);
+
+    /**
+     * AES-GCM encryption with the SDK crypto (wrapper of sgx_rijndael128GCM_encrypt).
+     * @param key 128-bit key.
+     * @param iv 12-byte IV.
+     * @param aad additional authenticated data, can be null.
+     * @param aadOffset additional authenticated data offset.
+     * @param aadSize additional authenticated data size.
+     * @param plaintext data to be encrypted.
+     * @param plaintextOffset data offset.
+     * @param plaintextSize data size.
+     * @param output ciphertext output, [plaintextSize] + 16 bytes (the tag) are written. It can be the same region
+     * as the plaintext, for in-place encryption.
+     * @param outputOffset ciphertext offset.
+     */
+    public static native void aesGcmEncrypt(
+            byte[] key,
+            byte[] iv,
+            byte[] aad,
+            int aadOffset,
+            int aadSize,
+            byte[] plaintext,
+            int plaintextOffset,
+            int plaintextSize,
+            byte[] output,
+            int outputOffset
+    );
+
+    /**
+     * AES-GCM decryption with the SDK crypto (wrapper of sgx_rijndael128GCM_decrypt).
+     * @param ciphertext data to be decrypted, followed by the tag.
+     * @param output plaintext output, [ciphertextSize] - 16 bytes are written. It can be the same region as the
+     * ciphertext, for in-place decryption.
+     * @see #aesGcmEncrypt
+     */
+    public static native void aesGcmDecrypt(
+            byte[] key,
+            byte[] iv,
+            byte[] aad,
+            int aadOffset,
+            int aadSize,
+            byte[] ciphertext,
+            int ciphertextOffset,
+            int ciphertextSize,
+            byte[] output,
+            int outputOffset
+    );
+
+    /**
+     * Starts an incremental SHA-256 with the SDK crypto (wrapper of sgx_sha256_init).
+     * @return handle of the hash state, to be freed with [sha256Free].
+     */
+    public static native long sha256Init();
+
+    /**
+     * Adds data to a SHA-256 (wrapper of sgx_sha256_update).
+     * @param handle handle returned by [sha256Init].
+     */
+    public static native void sha256Update(long handle, byte[] input, int inputOffset, int inputSize);
+
+    /**
+     * Computes the hash of the data added so far (wrapper of sgx_sha256_get_hash). The state must then be freed.
+     * @param handle handle returned by [sha256Init].
+     * @param output hash output, 32 bytes are written at [outputOffset].
+     */
+    public static native void sha256Final(long handle, byte[] output, int outputOffset);
+
+    /**
+     * Frees the state of a SHA-256 (wrapper of sgx_sha256_close).
+     * @param handle handle returned by [sha256Init].
+     */
+    public static native void sha256Free(long handle);
+
+    /**
+     * Starts an incremental HMAC-SHA256 with the SDK crypto (wrapper of sgx_hmac256_init).
+     * @param key HMAC key, must not be empty.
+     * @return handle of the MAC state, to be freed with [hmacSha256Free].
+     */
+    public static native long hmacSha256Init(byte[] key);
+
+    /**
+     * Adds data to an HMAC-SHA256 (wrapper of sgx_hmac256_update).
+     * @param handle handle returned by [hmacSha256Init].
+     */
+    public static native void hmacSha256Update(long handle, byte[] input, int inputOffset, int inputSize);
+
+    /**
+     * Computes the MAC of the data added so far (wrapper of sgx_hmac256_final). The state must then be freed.
+     * @param handle handle returned by [hmacSha256Init].
+     * @param output MAC output, 32 bytes are written at [outputOffset].
+     */
+    public static native void hmacSha256Final(long handle, byte[] output, int outputOffset);
+
+    /**
+     * Frees the state of an HMAC-SHA256 (wrapper of sgx_hmac256_close).
+     * @param handle handle returned by [hmacSha256Init].
+     */
+    public static native void hmacSha256Free(long handle);
+
+    /**
+     * X25519 (RFC 7748) in constant time, see x25519.h. Used by the mail in place of the Java Curve25519.
+     * @param privateKey 32-byte private key.
+     * @param publicKey 32-byte public key of the peer, or null for the base point to compute the public key.
+     * @param output 32-byte result output.
+     * @param outputOffset result offset.
+     */
+    public static native void x25519(byte[] privateKey, byte[] publicKey, byte[] output, int outputOffset);
+
     /**
      * JNI function (implemented in api.cpp) to pass the encryption key and
      * the filesystem sizes to FatFs encryption layer.
      * @param inMemoryFsSize Size (bytes) of the in-memory filesystem.
      * @param persistentFsSize Size (bytes) of the persistent encrypted filesystem.
+     * @param persistentLayout Layout of a new persistent filesystem in its file on the Host, see
+     *                         PersistentFileSystemLayout.
+     * @param inMemoryBackend Backend of the in-memory filesystem, see InMemoryFileSystemBackend.
      * @param inMemoryMountPath Mount point of the in-memory filesystem.
      * @param persistentMountPath Mount point of the persistent filesystem.
      * @param encryptionKey Byte array of the encryption key.
+     * @param inMemorySnapshot Sealed snapshot (see [snapshotInMemoryFileSystem]) restored into the in-memory
+     *                         filesystem, or null to start with an empty one.
      */
     public static native void setupFileSystems(
             long inMemoryFsSize,
             long persistentFsSize,
+            int persistentLayout,
+            int inMemoryBackend,
             String inMemoryMountPath,
             String persistentMountPath,
-            byte[] encryptionKey
+            byte[] encryptionKey,
+            byte[] inMemorySnapshot
     );
+
+    /**
+     * JNI function (implemented in api.cpp) which serialises the content of the in-memory filesystem,
+     * compresses it and seals it.
+     * @return the sealed snapshot, or null if the in-memory filesystem does not support snapshots.
+     */
+    public static native byte[] snapshotInMemoryFileSystem();
 }
@@ -266,6 +266,8 @@ abstract class Enclave {
             registerCallHandler(EnclaveCallType.SET_KDS_PERSISTENCE_KEY, setKdsPersistenceKeyCallHandler)
             registerCallHandler(EnclaveCallType.GET_ENCLAVE_INSTANCE_INFO_QUOTE, getEnclaveInstanceInfoQuoteCallHandler)
             registerCallHandler(EnclaveCallType.CALL_MESSAGE_HANDLER, enclaveMessageHandler)
+            registerCallHandler(EnclaveCallType.SNAPSHOT_IN_MEMORY_FILE_SYSTEM, SnapshotInMemoryFileSystemCallHandler())
+            registerCallHandler(EnclaveCallType.WARM_UP, WarmUpCallHandler())
         }
 
         env.setEnclaveInfo(signatureKey, encryptionKeyPair)
@@ -371,16 +373,36 @@ abstract class Enclave {
         aesPersistenceKey = getLocalSecretKey()
     }
 
-    private fun setupFileSystems() {
+    private fun setupFileSystems(inMemorySnapshot: ByteArray?) {
         val inMemorySize = env.inMemoryFileSystemSize
         val persistentSize = env.persistentFileSystemSize
+        val persistentLayout = env.persistentFileSystemLayout
+        val inMemoryBackend = env.inMemoryFileSystemBackend
 
         if (inMemorySize > 0L && persistentSize == 0L ||
             inMemorySize == 0L && persistentSize > 0L) {
             //  We do not allow other mount point apart from "/" when only one filesystem is present
-            env.setupFileSystems(inMemorySize, persistentSize,"/", "/", aesPersistenceKey)
+            env.setupFileSystems(
+                inMemorySize,
+                persistentSize,
+                persistentLayout,
+                inMemoryBackend,
+                "/",
+                "/",
+                aesPersistenceKey,
+                inMemorySnapshot
+            )
         } else if (inMemorySize > 0L && persistentSize > 0L) {
-            env.setupFileSystems(inMemorySize, persistentSize, "/tmp/", "/", aesPersistenceKey)
+            env.setupFileSystems(
+                inMemorySize,
+                persistentSize,
+                persistentLayout,
+                inMemoryBackend,
+                "/tmp/",
+                "/",
+                aesPersistenceKey,
+                inMemorySnapshot
+            )
         }
     }
 
@@ -580,7 +602,8 @@ abstract class Enclave {
                 filesystem file path for it and by having the call here allows us to handle this gracefully.
                  */
                 enclaveStateManager.transitionStateFrom<New>(to = Started)
-                val sealedStateBlob = parameterBuffer.getNullable { this }
+                val sealedStateBlob = parameterBuffer.getNullable { getIntLengthPrefixSlice() }
+                val inMemorySnapshot = parameterBuffer.getNullable { getIntLengthPrefixBytes() }
 
                 initialiseLocalPersistenceKeyIfNecessary()
 
@@ -588,7 +611,7 @@ abstract class Enclave {
                     if (sealedStateBlob != null) {
                         applySealedState(sealedStateBlob)
                     }
-                    setupFileSystems()
+                    setupFileSystems(inMemorySnapshot)
                     onStartup()
                 } catch (e: EnclaveStartException) {
                     throw e
@@ -600,6 +623,34 @@ abstract class Enclave {
         }
     }
 
+    /**
+     * Handler which handles the warm-up call from the host, which comes before the enclave is started.
+     */
+    private inner class WarmUpCallHandler : CallHandler {
+        private var isWarmedUp = false
+
+        override fun handleCall(parameterBuffer: ByteBuffer): ByteBuffer? {
+            lock.withLock {
+                enclaveStateManager.checkStateIs<New> { "The enclave has already been started." }
+                if (!isWarmedUp) {
+                    isWarmedUp = true
+                    onWarmUp()
+                }
+            }
+            return null
+        }
+    }
+
+    /**
+     * Handler which services requests from the host for a sealed snapshot of the in-memory filesystem.
+     */
+    private inner class SnapshotInMemoryFileSystemCallHandler : CallHandler {
+        override fun handleCall(parameterBuffer: ByteBuffer): ByteBuffer? {
+            enclaveStateManager.checkStateIs<Started> { "The enclave has not been started." }
+            return env.snapshotInMemoryFileSystem()?.let { ByteBuffer.wrap(it) }
+        }
+    }
+
     /**
      * Handler which handles stop calls from the host.
      */
@@ -633,6 +684,17 @@ abstract class Enclave {
 
     }
 
+    /**
+     * Override this method to do work which would otherwise slow down the first calls into the enclave, such as
+     * loading classes or filling caches. It is called once, after the enclave is created and before it is started,
+     * so [onStartup] has not been called yet and neither the sealed state nor the filesystems are available.
+     *
+     * Any exceptions thrown by this method propagate out to the host.
+     */
+    open fun onWarmUp() {
+
+    }
+
     /**
      * Override this method to release any resources held by the enclave. This method is called when the enclave is
      * asked to be shut down. This gives an opportunity to the enclave to release its resources before being destroyed.
@@ -4,9 +4,12 @@ import com.r3.conclave.common.EnclaveMode
 import com.r3.conclave.common.internal.*
 import com.r3.conclave.common.internal.attestation.Attestation
 import com.r3.conclave.common.internal.kds.EnclaveKdsConfig
+import java.io.InputStream
+import java.io.OutputStream
 import java.nio.ByteBuffer
 import java.security.KeyPair
 import java.security.PublicKey
+import java.security.SecureRandom
 import java.util.*
 
 abstract class EnclaveEnvironment(enclaveProperties: Properties, kdsConfig: EnclaveKdsConfig?) {
@@ -22,12 +25,16 @@ abstract class EnclaveEnvironment(enclaveProperties: Properties, kdsConfig: Encl
             setProperty("maxPersistentMapSize", (16 * 1024 * 1024).toString())
             setProperty("inMemoryFileSystemSize", (64 * 1024 * 1024).toString())
             setProperty("persistentFileSystemSize", 0.toString())
+            setProperty("persistentFileSystemLayout", PersistentFileSystemLayout.IN_PLACE.toString())
+            setProperty("inMemoryFileSystemBackend", InMemoryFileSystemBackend.FATFS.toString())
             // If this property is not set to true, then the kds is assumed not to be in use, and won't be configured
             // during enclave startup. By default, the KDS is not enabled.
             setProperty("kds.configurationPresent", "false")
             setProperty("kds.persistentKeySpec.configurationPresent", "false")
         }
 
+        private val secureRandom = SecureRandom()
+
         // Load enclave properties or optionally get defaults, throw an error if this was unsuccessful
         @JvmStatic
         protected fun loadEnclaveProperties(enclaveClass: Class<*>, allowDefaults: Boolean): Properties {
@@ -55,6 +62,10 @@ abstract class EnclaveEnvironment(enclaveProperties: Properties, kdsConfig: Encl
     open val maxPersistentMapSize: Long = enclaveProperties.getProperty("maxPersistentMapSize").toLong()
     open val inMemoryFileSystemSize: Long = enclaveProperties.getProperty("inMemoryFileSystemSize").toLong()
     open val persistentFileSystemSize: Long = enclaveProperties.getProperty("persistentFileSystemSize").toLong()
+    open val persistentFileSystemLayout: PersistentFileSystemLayout =
+        PersistentFileSystemLayout.valueOf(enclaveProperties.getProperty("persistentFileSystemLayout"))
+    open val inMemoryFileSystemBackend: InMemoryFileSystemBackend =
+        InMemoryFileSystemBackend.valueOf(enclaveProperties.getProperty("inMemoryFileSystemBackend"))
 
     // KDS configuration from build system
     open val kdsConfiguration: EnclaveKdsConfig? = kdsConfig ?: EnclaveKdsConfig.loadConfiguration(enclaveProperties)
@@ -104,6 +115,84 @@ abstract class EnclaveEnvironment(enclaveProperties: Properties, kdsConfig: Encl
      */
     abstract fun unsealData(sealedBlob: ByteBuffer): PlaintextAndEnvelope
 
+    /**
+     * Seals many records at once, record i being the slice `[offsets[i], offsets[i + 1])` of [plaintext]. Unlike
+     * calling [sealData] for each record, the sealing key is only derived once for the whole batch, so the cost
+     * depends on the size of the records rather than on their number. The offsets have to be kept to unseal the
+     * batch with [unsealDataBatch].
+     *
+     * @return the sealed batch.
+     */
+    open fun sealDataBatch(plaintext: ByteArray, offsets: IntArray): ByteArray {
+        val recordsSize = SealedBatches.recordsSize(offsets)
+        require(offsets.last() <= plaintext.size) { "The record offsets are outside the plaintext" }
+        val key = ByteArray(16).also(secureRandom::nextBytes)
+        try {
+            val header = sealData(PlaintextAndEnvelope(key, SealedBatches.HEADER_AUTHENTICATED_DATA))
+            val sealedBatch = header.copyOf(header.size + recordsSize)
+            SealedBatches.seal(key, plaintext, offsets, sealedBatch, header.size)
+            return sealedBatch
+        } finally {
+            key.fill(0)
+        }
+    }
+
+    /**
+     * Unseals a batch sealed with [sealDataBatch] and the same [offsets].
+     *
+     * @return the plaintext, of size `offsets.last()`, with each record at its offset.
+     */
+    open fun unsealDataBatch(sealedBatch: ByteArray, offsets: IntArray): ByteArray {
+        val recordsSize = SealedBatches.recordsSize(offsets)
+        require(sealedBatch.size > recordsSize) { "The sealed batch does not match the record offsets" }
+        val headerSize = sealedBatch.size - recordsSize
+        val unsealed = unsealData(ByteBuffer.wrap(sealedBatch, 0, headerSize))
+        require(unsealed.authenticatedData.contentEquals(SealedBatches.HEADER_AUTHENTICATED_DATA)) {
+            "Invalid sealed batch header"
+        }
+        try {
+            val plaintext = ByteArray(offsets.last())
+            SealedBatches.unseal(unsealed.plaintext, sealedBatch, headerSize, offsets, plaintext)
+            return plaintext
+        } finally {
+            unsealed.plaintext.fill(0)
+        }
+    }
+
+    /**
+     * Returns a stream which seals the bytes written to it into [out], in chunks of [chunkSize] bytes. Unlike
+     * [sealData], the memory needed does not depend on the size of the data, which makes it suitable for large
+     * state. The stream has to be closed to write the last chunk, it can be unsealed with [unsealingInputStream].
+     */
+    fun sealingOutputStream(out: OutputStream, chunkSize: Int = SealedStreams.DEFAULT_CHUNK_SIZE): OutputStream {
+        val (header, cipher) = newStreamSealer()
+        return SealingOutputStream(out, header, cipher, chunkSize)
+    }
+
+    /**
+     * Returns a stream which unseals the data written by [sealingOutputStream] and read from [input]. Reading from
+     * it throws an [java.io.IOException] if the data is truncated or has been tampered with.
+     */
+    fun unsealingInputStream(input: InputStream): InputStream = UnsealingInputStream(input, ::newStreamUnsealer)
+
+    /**
+     * Creates the cipher of a new sealed stream, and the header of the stream from which [newStreamUnsealer] gets
+     * the same key. By default the random key of the stream is sealed with [sealData].
+     */
+    protected open fun newStreamSealer(): Pair<ByteArray, SealedChunkCipher> {
+        val key = ByteArray(16).also(secureRandom::nextBytes)
+        val header = sealData(PlaintextAndEnvelope(key, SealedStreams.HEADER_AUTHENTICATED_DATA))
+        return Pair(header, AesGcmChunkCipher(key, sealing = true))
+    }
+
+    protected open fun newStreamUnsealer(header: ByteArray): SealedChunkCipher {
+        val unsealed = unsealData(ByteBuffer.wrap(header))
+        require(unsealed.authenticatedData.contentEquals(SealedStreams.HEADER_AUTHENTICATED_DATA)) {
+            "Invalid sealed stream header"
+        }
+        return AesGcmChunkCipher(unsealed.plaintext, sealing = false)
+    }
+
     /**
      * Returns a 128-bit stable pseudo-random secret key based on the given [SgxKeyRequest] object.
      * @param keyRequest Object for selecting the appropriate key and any additional parameters required in the
@@ -118,20 +207,41 @@ abstract class EnclaveEnvironment(enclaveProperties: Properties, kdsConfig: Encl
         return getSecretKey(keyRequest)
     }
 
+    /**
+     * Returns the secret keys of several [SgxKeyRequest] objects at once, in the same order.
+     * @see getSecretKey
+     */
+    open fun getSecretKeys(keyRequests: List<ByteCursor<SgxKeyRequest>>): List<ByteArray> {
+        return keyRequests.map(::getSecretKey)
+    }
+
     /**
      * Set up the in-memory and the persistent filesystems.
      * @param inMemoryFsSize Size (bytes) of the in-memory filesystem.
      * @param persistentFsSize Size (bytes) of the persistent encrypted filesystem.
+     * @param persistentLayout Layout of a new persistent filesystem in its file on the host.
+     * @param inMemoryBackend Backend of the in-memory filesystem.
      * @param inMemoryMountPath Mount point of the in-memory filesystem.
      * @param persistentMountPath Mount point of the persistent filesystem.
      * @param encryptionKey Byte array of the encryption key.
+     * @param inMemorySnapshot Sealed snapshot to restore into the in-memory filesystem, if any.
      */
     abstract fun setupFileSystems(
         inMemoryFsSize: Long,
         persistentFsSize: Long,
+        persistentLayout: PersistentFileSystemLayout,
+        inMemoryBackend: InMemoryFileSystemBackend,
         inMemoryMountPath: String,
         persistentMountPath: String,
-        encryptionKey: ByteArray)
+        encryptionKey: ByteArray,
+        inMemorySnapshot: ByteArray?)
+
+    /**
+     * Seal the content of the in-memory filesystem, so that it can be restored by [setupFileSystems]
+     * when the enclave is restarted.
+     * @return the sealed snapshot, or null if the in-memory filesystem cannot be snapshotted.
+     */
+    abstract fun snapshotInMemoryFileSystem(): ByteArray?
 
     /** Call interface functions */
     /**
@@ -78,13 +78,18 @@ class GramineDirectEnclaveEnvironment(
     override fun setupFileSystems(
         inMemoryFsSize: Long,
         persistentFsSize: Long,
+        persistentLayout: PersistentFileSystemLayout,
+        inMemoryBackend: InMemoryFileSystemBackend,
         inMemoryMountPath: String,
         persistentMountPath: String,
-        encryptionKey: ByteArray
+        encryptionKey: ByteArray,
+        inMemorySnapshot: ByteArray?
     ) {
         //  TODO: Gramine filesystem support
     }
 
+    override fun snapshotInMemoryFileSystem(): ByteArray? = null
+
     private val simulationMrEnclave: ByteArray by lazy {
         enclaveClass.protectionDomain.codeSource.location.openStream().use {
             it.digest("SHA-256")
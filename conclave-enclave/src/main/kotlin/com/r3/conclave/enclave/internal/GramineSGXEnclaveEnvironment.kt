@@ -81,13 +81,18 @@ class GramineSGXEnclaveEnvironment(
     override fun setupFileSystems(
         inMemoryFsSize: Long,
         persistentFsSize: Long,
+        persistentLayout: PersistentFileSystemLayout,
+        inMemoryBackend: InMemoryFileSystemBackend,
         inMemoryMountPath: String,
         persistentMountPath: String,
-        encryptionKey: ByteArray
+        encryptionKey: ByteArray,
+        inMemorySnapshot: ByteArray?
     ) {
         //  TODO: Gramine filesystem support
     }
 
+    override fun snapshotInMemoryFileSystem(): ByteArray? = null
+
     @Synchronized
     private fun retrieveReport(targetInfoBytes: ByteArray, userReportDataBytes: ByteArray): ByteArray {
         writeTargetInfo(targetInfoBytes)
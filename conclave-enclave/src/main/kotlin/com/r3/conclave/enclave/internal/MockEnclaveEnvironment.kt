@@ -169,10 +169,15 @@ class MockEnclaveEnvironment(
     override fun setupFileSystems(
         inMemoryFsSize: Long,
         persistentFsSize: Long,
+        persistentLayout: PersistentFileSystemLayout,
+        inMemoryBackend: InMemoryFileSystemBackend,
         inMemoryMountPath: String,
         persistentMountPath: String,
-        encryptionKey: ByteArray
+        encryptionKey: ByteArray,
+        inMemorySnapshot: ByteArray?
     ) {
         //  NO op for Mock mode
     }
+
+    override fun snapshotInMemoryFileSystem(): ByteArray? = null
 }
@@ -0,0 +1,423 @@
+package com.r3.conclave.enclave.internal
+
+import java.io.ByteArrayOutputStream
+import java.nio.ByteBuffer
+import java.security.*
+import java.security.spec.AlgorithmParameterSpec
+import javax.crypto.*
+import javax.crypto.spec.GCMParameterSpec
+
+/**
+ * JCA provider backed by the SGX SDK crypto of the enclave (see enclave_jni.cpp), which uses AES-NI and the SHA
+ * extensions. The Java crypto compiled by SubstrateVM doesn't have the HotSpot intrinsics, so the symmetric crypto of
+ * the enclave is much faster through this provider.
+ *
+ * The provider is installed with the highest priority, so existing code gets it with `Cipher.getInstance`,
+ * `MessageDigest.getInstance` and `Mac.getInstance`. The SDK only supports AES-GCM with 128-bit keys, 12-byte IVs
+ * and 128-bit tags. Other parameters are rejected on init, which makes the JCA fall back to the next provider.
+ *
+ * The services are created directly rather than by reflection, which SubstrateVM would require to be configured.
+ */
+class NativeCryptoProvider internal constructor(
+    private val primitives: Primitives
+) : Provider(PROVIDER_NAME, 1.0, "Conclave native enclave crypto") {
+    constructor() : this(SdkPrimitives)
+
+    /**
+     * The crypto primitives behind the services. The digest and MAC states are native handles which must be freed.
+     * Tests replace the SDK with the JDK here, as the enclave library can't be loaded outside an enclave.
+     */
+    internal interface Primitives {
+        fun aesGcmEncrypt(
+            key: ByteArray, iv: ByteArray, aad: ByteArray, aadOffset: Int, aadSize: Int,
+            plaintext: ByteArray, plaintextOffset: Int, plaintextSize: Int, output: ByteArray, outputOffset: Int
+        )
+        fun aesGcmDecrypt(
+            key: ByteArray, iv: ByteArray, aad: ByteArray, aadOffset: Int, aadSize: Int,
+            ciphertext: ByteArray, ciphertextOffset: Int, ciphertextSize: Int, output: ByteArray, outputOffset: Int
+        )
+        fun sha256Init(): Long
+        fun sha256Update(handle: Long, input: ByteArray, inputOffset: Int, inputSize: Int)
+        fun sha256Final(handle: Long, output: ByteArray, outputOffset: Int)
+        fun sha256Free(handle: Long)
+        fun hmacSha256Init(key: ByteArray): Long
+        fun hmacSha256Update(handle: Long, input: ByteArray, inputOffset: Int, inputSize: Int)
+        fun hmacSha256Final(handle: Long, output: ByteArray, outputOffset: Int)
+        fun hmacSha256Free(handle: Long)
+    }
+
+    private object SdkPrimitives : Primitives {
+        override fun aesGcmEncrypt(
+            key: ByteArray, iv: ByteArray, aad: ByteArray, aadOffset: Int, aadSize: Int,
+            plaintext: ByteArray, plaintextOffset: Int, plaintextSize: Int, output: ByteArray, outputOffset: Int
+        ) = Native.aesGcmEncrypt(
+            key, iv, aad, aadOffset, aadSize, plaintext, plaintextOffset, plaintextSize, output, outputOffset
+        )
+
+        override fun aesGcmDecrypt(
+            key: ByteArray, iv: ByteArray, aad: ByteArray, aadOffset: Int, aadSize: Int,
+            ciphertext: ByteArray, ciphertextOffset: Int, ciphertextSize: Int, output: ByteArray, outputOffset: Int
+        ) = Native.aesGcmDecrypt(
+            key, iv, aad, aadOffset, aadSize, ciphertext, ciphertextOffset, ciphertextSize, output, outputOffset
+        )
+
+        override fun sha256Init(): Long = Native.sha256Init()
+        override fun sha256Update(handle: Long, input: ByteArray, inputOffset: Int, inputSize: Int) =
+            Native.sha256Update(handle, input, inputOffset, inputSize)
+        override fun sha256Final(handle: Long, output: ByteArray, outputOffset: Int) =
+            Native.sha256Final(handle, output, outputOffset)
+        override fun sha256Free(handle: Long) = Native.sha256Free(handle)
+        override fun hmacSha256Init(key: ByteArray): Long = Native.hmacSha256Init(key)
+        override fun hmacSha256Update(handle: Long, input: ByteArray, inputOffset: Int, inputSize: Int) =
+            Native.hmacSha256Update(handle, input, inputOffset, inputSize)
+        override fun hmacSha256Final(handle: Long, output: ByteArray, outputOffset: Int) =
+            Native.hmacSha256Final(handle, output, outputOffset)
+        override fun hmacSha256Free(handle: Long) = Native.hmacSha256Free(handle)
+    }
+
+    companion object {
+        const val PROVIDER_NAME = "ConclaveNative"
+
+        private const val AES_KEY_SIZE_BYTES = 16
+        private const val GCM_IV_SIZE_BYTES = 12
+        private const val GCM_TAG_SIZE_BYTES = 16
+        private const val SHA256_SIZE_BYTES = 32
+
+        fun install() {
+            if (Security.getProvider(PROVIDER_NAME) == null) {
+                Security.insertProviderAt(NativeCryptoProvider(), 1)
+            }
+        }
+    }
+
+    init {
+        putService(NativeService(this, "Cipher", "AES/GCM/NoPadding", listOf("AES_128/GCM/NoPadding")) {
+            AesGcmCipherSpi(primitives)
+        })
+        putService(NativeService(this, "MessageDigest", "SHA-256", listOf("SHA256")) {
+            Sha256MessageDigestSpi(primitives)
+        })
+        putService(NativeService(this, "Mac", "HmacSHA256", emptyList()) { HmacSha256MacSpi(primitives) })
+    }
+
+    private class NativeService(
+        provider: Provider,
+        type: String,
+        algorithm: String,
+        aliases: List<String>,
+        private val spi: () -> Any
+    ) : Service(provider, type, algorithm, NativeService::class.java.name, aliases, null) {
+        override fun newInstance(constructorParameter: Any?): Any = spi()
+
+        override fun supportsParameter(parameter: Any?): Boolean {
+            return parameter !is Key || parameter.format == "RAW"
+        }
+    }
+
+    /**
+     * The input is buffered until [doFinal], as the SDK only has one-shot AES-GCM. When the whole input is given to
+     * [doFinal], which is the common case, it is encrypted or decrypted directly from and into the caller's arrays,
+     * in place if they are the same.
+     */
+    private class AesGcmCipherSpi(private val primitives: Primitives) : CipherSpi() {
+        private var key: ByteArray? = null
+        private var iv: ByteArray? = null
+        private var encrypting = false
+        private var lastEncryption: Pair<ByteArray, ByteArray>? = null
+        private val aad = ByteArrayOutputStream()
+        private val buffer = ByteArrayOutputStream()
+        private var ready = false
+
+        override fun engineSetMode(mode: String) {
+            if (!mode.equals("GCM", ignoreCase = true)) throw NoSuchAlgorithmException("Unsupported mode $mode")
+        }
+
+        override fun engineSetPadding(padding: String) {
+            if (!padding.equals("NoPadding", ignoreCase = true)) {
+                throw NoSuchPaddingException("Unsupported padding $padding")
+            }
+        }
+
+        override fun engineGetBlockSize(): Int = 16
+
+        override fun engineGetOutputSize(inputLen: Int): Int {
+            val total = buffer.size() + inputLen
+            return if (encrypting) total + GCM_TAG_SIZE_BYTES else maxOf(total - GCM_TAG_SIZE_BYTES, 0)
+        }
+
+        override fun engineGetIV(): ByteArray? = iv?.clone()
+
+        override fun engineGetParameters(): AlgorithmParameters? {
+            val iv = iv ?: return null
+            return AlgorithmParameters.getInstance("GCM").apply {
+                init(GCMParameterSpec(GCM_TAG_SIZE_BYTES * 8, iv))
+            }
+        }
+
+        override fun engineInit(opmode: Int, key: Key, random: SecureRandom?) {
+            if (opmode == Cipher.DECRYPT_MODE || opmode == Cipher.UNWRAP_MODE) {
+                throw InvalidKeyException("Decryption requires the GCM parameters")
+            }
+            val iv = ByteArray(GCM_IV_SIZE_BYTES).also { (random ?: SecureRandom()).nextBytes(it) }
+            init(opmode, key, iv)
+        }
+
+        override fun engineInit(opmode: Int, key: Key, params: AlgorithmParameterSpec?, random: SecureRandom?) {
+            if (params == null) {
+                engineInit(opmode, key, random)
+                return
+            }
+            if (params !is GCMParameterSpec) throw InvalidAlgorithmParameterException("GCMParameterSpec required")
+            if (params.tLen != GCM_TAG_SIZE_BYTES * 8 || params.iv.size != GCM_IV_SIZE_BYTES) {
+                throw InvalidAlgorithmParameterException("Only 12-byte IVs and 128-bit tags are supported")
+            }
+            init(opmode, key, params.iv)
+        }
+
+        override fun engineInit(opmode: Int, key: Key, params: AlgorithmParameters?, random: SecureRandom?) {
+            engineInit(opmode, key, params?.getParameterSpec(GCMParameterSpec::class.java), random)
+        }
+
+        private fun init(opmode: Int, key: Key, iv: ByteArray) {
+            val keyBytes = key.encoded
+            if (!key.algorithm.equals("AES", ignoreCase = true) || keyBytes?.size != AES_KEY_SIZE_BYTES) {
+                throw InvalidKeyException("Only 128-bit AES keys are supported")
+            }
+            val encrypting = opmode == Cipher.ENCRYPT_MODE || opmode == Cipher.WRAP_MODE
+            if (encrypting) {
+                // Like the JDK, refuse to reuse the same key and IV for another encryption
+                val last = lastEncryption
+                if (last != null && last.first.contentEquals(keyBytes) && last.second.contentEquals(iv)) {
+                    throw InvalidAlgorithmParameterException("Cannot reuse iv for GCM encryption")
+                }
+                lastEncryption = Pair(keyBytes, iv)
+            }
+            this.key = keyBytes
+            this.iv = iv
+            this.encrypting = encrypting
+            reset()
+            ready = true
+        }
+
+        private fun reset() {
+            aad.reset()
+            buffer.reset()
+        }
+
+        override fun engineUpdateAAD(src: ByteArray, offset: Int, len: Int) {
+            check(ready) { "Cipher not initialized" }
+            check(buffer.size() == 0) { "AAD must be supplied before encryption/decryption starts" }
+            aad.write(src, offset, len)
+        }
+
+        override fun engineUpdateAAD(src: ByteBuffer) {
+            val bytes = ByteArray(src.remaining())
+            src.get(bytes)
+            engineUpdateAAD(bytes, 0, bytes.size)
+        }
+
+        override fun engineUpdate(input: ByteArray?, inputOffset: Int, inputLen: Int): ByteArray {
+            check(ready) { "Cipher not initialized" }
+            if (input != null) buffer.write(input, inputOffset, inputLen)
+            return ByteArray(0)
+        }
+
+        override fun engineUpdate(
+            input: ByteArray?,
+            inputOffset: Int,
+            inputLen: Int,
+            output: ByteArray?,
+            outputOffset: Int
+        ): Int {
+            engineUpdate(input, inputOffset, inputLen)
+            return 0
+        }
+
+        override fun engineDoFinal(input: ByteArray?, inputOffset: Int, inputLen: Int): ByteArray {
+            val output = ByteArray(engineGetOutputSize(if (input == null) 0 else inputLen))
+            engineDoFinal(input, inputOffset, inputLen, output, 0)
+            return output
+        }
+
+        override fun engineDoFinal(
+            input: ByteArray?,
+            inputOffset: Int,
+            inputLen: Int,
+            output: ByteArray,
+            outputOffset: Int
+        ): Int {
+            check(ready) { "Cipher not initialized" }
+            var src = input ?: ByteArray(0)
+            var srcOffset = if (input == null) 0 else inputOffset
+            var srcLen = if (input == null) 0 else inputLen
+            if (buffer.size() > 0) {
+                buffer.write(src, srcOffset, srcLen)
+                src = buffer.toByteArray()
+                srcOffset = 0
+                srcLen = src.size
+            }
+            if (!encrypting && srcLen < GCM_TAG_SIZE_BYTES) throw AEADBadTagException("Input too short for GCM tag")
+            val outputSize = if (encrypting) srcLen + GCM_TAG_SIZE_BYTES else srcLen - GCM_TAG_SIZE_BYTES
+            if (outputOffset < 0 || output.size - outputOffset < outputSize) {
+                throw ShortBufferException("Output buffer too short, $outputSize bytes are needed")
+            }
+            // Partially overlapping regions are not supported natively, unlike the same region
+            if (src === output && srcOffset != outputOffset &&
+                srcOffset < outputOffset + outputSize && outputOffset < srcOffset + srcLen) {
+                src = src.copyOfRange(srcOffset, srcOffset + srcLen)
+                srcOffset = 0
+            }
+            val key = checkNotNull(key)
+            val iv = checkNotNull(iv)
+            val aadBytes = aad.toByteArray()
+            try {
+                if (encrypting) {
+                    primitives.aesGcmEncrypt(
+                        key, iv, aadBytes, 0, aadBytes.size, src, srcOffset, srcLen, output, outputOffset
+                    )
+                    // Encrypting again with the same IV requires a new init
+                    ready = false
+                } else {
+                    try {
+                        primitives.aesGcmDecrypt(
+                            key, iv, aadBytes, 0, aadBytes.size, src, srcOffset, srcLen, output, outputOffset
+                        )
+                    } catch (e: RuntimeException) {
+                        throw AEADBadTagException(e.message)
+                    }
+                }
+            } finally {
+                reset()
+            }
+            return outputSize
+        }
+    }
+
+    /**
+     * The input of a digest or a MAC, kept until it completes. The native state is only created for the duration of
+     * [digest], as SubstrateVM never runs finalizers and a state held by a digest which is dropped would never be
+     * freed. The bytes are cleared once they have been digested.
+     */
+    private class InputBuffer : ByteArrayOutputStream() {
+        fun copy(): InputBuffer = InputBuffer().also { it.write(buf, 0, count) }
+
+        fun digest(
+            init: () -> Long,
+            update: (Long, ByteArray, Int, Int) -> Unit,
+            finish: (Long) -> Unit,
+            free: (Long) -> Unit
+        ) {
+            try {
+                val handle = init()
+                try {
+                    if (count > 0) update(handle, buf, 0, count)
+                    finish(handle)
+                } finally {
+                    free(handle)
+                }
+            } finally {
+                clear()
+            }
+        }
+
+        fun clear() {
+            buf.fill(0, 0, count)
+            reset()
+        }
+    }
+
+    /**
+     * The input is buffered and digested in one go by [engineDigest], see [InputBuffer].
+     */
+    private class Sha256MessageDigestSpi(private val primitives: Primitives) : MessageDigestSpi(), Cloneable {
+        private var input = InputBuffer()
+
+        override fun engineGetDigestLength(): Int = SHA256_SIZE_BYTES
+
+        override fun engineUpdate(input: Byte) {
+            this.input.write(input.toInt())
+        }
+
+        override fun engineUpdate(input: ByteArray, offset: Int, len: Int) {
+            this.input.write(input, offset, len)
+        }
+
+        override fun engineDigest(): ByteArray {
+            val digest = ByteArray(SHA256_SIZE_BYTES)
+            engineDigest(digest, 0, digest.size)
+            return digest
+        }
+
+        override fun engineDigest(buf: ByteArray, offset: Int, len: Int): Int {
+            if (len < SHA256_SIZE_BYTES) throw DigestException("Output buffer too short")
+            input.digest(
+                primitives::sha256Init,
+                primitives::sha256Update,
+                { handle -> primitives.sha256Final(handle, buf, offset) },
+                primitives::sha256Free
+            )
+            return SHA256_SIZE_BYTES
+        }
+
+        override fun engineReset() {
+            input.clear()
+        }
+
+        override fun clone(): Any {
+            val copy = super.clone() as Sha256MessageDigestSpi
+            copy.input = input.copy()
+            return copy
+        }
+    }
+
+    /**
+     * Like [Sha256MessageDigestSpi], the input is buffered and the MAC computed in one go by [engineDoFinal].
+     */
+    private class HmacSha256MacSpi(private val primitives: Primitives) : MacSpi(), Cloneable {
+        private var key: ByteArray? = null
+        private var input = InputBuffer()
+
+        override fun engineGetMacLength(): Int = SHA256_SIZE_BYTES
+
+        override fun engineInit(key: Key, params: AlgorithmParameterSpec?) {
+            if (params != null) throw InvalidAlgorithmParameterException("HMAC does not use parameters")
+            val keyBytes = key.encoded
+            if (keyBytes == null || keyBytes.isEmpty()) throw InvalidKeyException("Missing key data")
+            input.clear()
+            this.key?.fill(0)
+            this.key = keyBytes
+        }
+
+        override fun engineUpdate(input: Byte) {
+            this.input.write(input.toInt())
+        }
+
+        override fun engineUpdate(input: ByteArray, offset: Int, len: Int) {
+            this.input.write(input, offset, len)
+        }
+
+        override fun engineDoFinal(): ByteArray {
+            val key = checkNotNull(key) { "MAC not initialized" }
+            val mac = ByteArray(SHA256_SIZE_BYTES)
+            input.digest(
+                { primitives.hmacSha256Init(key) },
+                primitives::hmacSha256Update,
+                { handle -> primitives.hmacSha256Final(handle, mac, 0) },
+                primitives::hmacSha256Free
+            )
+            return mac
+        }
+
+        override fun engineReset() {
+            input.clear()
+        }
+
+        override fun clone(): Any {
+            val copy = super.clone() as HmacSha256MacSpi
+            // The key is cleared when either is initialised again
+            copy.key = key?.clone()
+            copy.input = input.copy()
+            return copy
+        }
+    }
+}
@@ -0,0 +1,16 @@
+package com.r3.conclave.enclave.internal
+
+import com.r3.conclave.mail.internal.noise.crypto.Curve25519
+
+/**
+ * [Curve25519.Implementation] backed by the constant-time X25519 of the enclave, [Native.x25519], which takes its
+ * arguments in a different order.
+ */
+internal class NativeCurve25519(
+    private val x25519: (privateKey: ByteArray, publicKey: ByteArray?, output: ByteArray, outputOffset: Int) -> Unit =
+        Native::x25519
+) : Curve25519.Implementation {
+    override fun eval(result: ByteArray, offset: Int, privateKey: ByteArray, publicKey: ByteArray?) {
+        x25519(privateKey, publicKey, result, offset)
+    }
+}
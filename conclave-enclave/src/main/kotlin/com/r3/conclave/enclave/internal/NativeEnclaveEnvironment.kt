@@ -6,6 +6,7 @@ import com.r3.conclave.common.internal.SgxAttributes.flags
 import com.r3.conclave.common.internal.SgxReport.body
 import com.r3.conclave.common.internal.SgxReportBody.attributes
 import com.r3.conclave.enclave.Enclave
+import com.r3.conclave.mail.internal.noise.crypto.Curve25519
 import com.r3.conclave.utilities.internal.EnclaveContext
 import com.r3.conclave.utilities.internal.getRemainingBytes
 import com.r3.conclave.utilities.internal.getRemainingString
@@ -89,6 +90,8 @@ class NativeEnclaveEnvironment(
 
         private fun initialiseEnclave(buffer: ByteBuffer) {
             seedRandom()
+            NativeCryptoProvider.install()
+            Curve25519.setImplementation(NativeCurve25519())
 
             val enclaveClassName = buffer.getRemainingString()
             // TODO We need to load the enclave in a custom classloader that locks out internal packages of the public API.
@@ -137,9 +140,12 @@ class NativeEnclaveEnvironment(
     override fun setupFileSystems(
         inMemoryFsSize: Long,
         persistentFsSize: Long,
+        persistentLayout: PersistentFileSystemLayout,
+        inMemoryBackend: InMemoryFileSystemBackend,
         inMemoryMountPath: String,
         persistentMountPath: String,
-        encryptionKey: ByteArray
+        encryptionKey: ByteArray,
+        inMemorySnapshot: ByteArray?
     ) {
         val inMemoryMountPathModified =
             if (inMemoryMountPath.endsWith("/")) inMemoryMountPath else "$inMemoryMountPath/"
@@ -148,12 +154,17 @@ class NativeEnclaveEnvironment(
         Native.setupFileSystems(
             inMemoryFsSize,
             persistentFsSize,
+            persistentLayout.id,
+            inMemoryBackend.id,
             inMemoryMountPathModified,
             persistentMountPathModified,
-            encryptionKey
+            encryptionKey,
+            inMemorySnapshot
         )
     }
 
+    override fun snapshotInMemoryFileSystem(): ByteArray? = Native.snapshotInMemoryFileSystem()
+
     override val enclaveMode: EnclaveMode
         get() {
             return when {
@@ -185,7 +196,8 @@ class NativeEnclaveEnvironment(
 
     override fun unsealData(sealedBlob: ByteBuffer): PlaintextAndEnvelope {
         require(sealedBlob.hasRemaining())
-        val sealedBytes = sealedBlob.getRemainingBytes()
+        // The sealed blob is only read, it is unsealed directly from its array when possible
+        val sealedBytes = sealedBlob.getRemainingBytes(avoidCopying = true)
         val plaintext = ByteArray(Native.plaintextSizeFromSealedData(sealedBytes))
         val authenticatedData = Native.authenticatedDataSize(sealedBytes).let { if (it > 0) ByteArray(it) else null }
 
@@ -204,12 +216,77 @@ class NativeEnclaveEnvironment(
         return PlaintextAndEnvelope(plaintext, authenticatedData)
     }
 
+    override fun sealDataBatch(plaintext: ByteArray, offsets: IntArray): ByteArray {
+        val sealedBatch = ByteArray(Native.sealedBatchSize(offsets))
+        Native.sealDataBatch(plaintext, offsets, sealedBatch)
+        return sealedBatch
+    }
+
+    override fun unsealDataBatch(sealedBatch: ByteArray, offsets: IntArray): ByteArray {
+        val plaintext = ByteArray(offsets.last())
+        Native.unsealDataBatch(sealedBatch, 0, sealedBatch.size, offsets, plaintext)
+        return plaintext
+    }
+
+    override fun newStreamSealer(): Pair<ByteArray, SealedChunkCipher> {
+        val header = ByteArray(Native.sealStreamHeaderSize())
+        return Pair(header, NativeChunkCipher(Native.sealStreamInit(header), sealing = true))
+    }
+
+    override fun newStreamUnsealer(header: ByteArray): SealedChunkCipher {
+        return NativeChunkCipher(Native.unsealStreamInit(header, 0, header.size), sealing = false)
+    }
+
+    /**
+     * [SealedChunkCipher] whose key never leaves the native stream (see enclave_jni.cpp).
+     */
+    private class NativeChunkCipher(private var stream: Long, private val sealing: Boolean) : SealedChunkCipher {
+        private companion object {
+            const val SEALED_CHUNK_TAG_SIZE = 16
+        }
+
+        override fun outputSize(inputSize: Int): Int {
+            return if (sealing) inputSize + SEALED_CHUNK_TAG_SIZE else inputSize - SEALED_CHUNK_TAG_SIZE
+        }
+
+        override fun update(
+            input: ByteArray,
+            inputOffset: Int,
+            inputSize: Int,
+            output: ByteArray,
+            outputOffset: Int,
+            last: Boolean
+        ) {
+            check(stream != 0L) { "The stream is closed." }
+            if (sealing) {
+                Native.sealStreamUpdate(stream, input, inputOffset, inputSize, output, outputOffset, last)
+            } else {
+                Native.unsealStreamUpdate(stream, input, inputOffset, inputSize, output, outputOffset, last)
+            }
+        }
+
+        override fun close() {
+            Native.sealStreamFree(stream)
+            stream = 0L
+        }
+    }
+
     override fun getSecretKey(keyRequest: ByteCursor<SgxKeyRequest>): ByteArray {
         val keyOut = ByteArray(SgxKey128Bit.size)
         Native.getKey(keyRequest.buffer.getRemainingBytes(avoidCopying = true), keyOut)
         return keyOut
     }
 
+    override fun getSecretKeys(keyRequests: List<ByteCursor<SgxKeyRequest>>): List<ByteArray> {
+        val keyRequestsIn = ByteBuffer.allocate(keyRequests.size * SgxKeyRequest.size)
+        keyRequests.forEach { keyRequestsIn.put(it.buffer) }
+        val keysOut = ByteArray(keyRequests.size * SgxKey128Bit.size)
+        Native.getKeys(keyRequestsIn.array(), keysOut)
+        return List(keyRequests.size) { i ->
+            keysOut.copyOfRange(i * SgxKey128Bit.size, (i + 1) * SgxKey128Bit.size)
+        }.also { keysOut.fill(0) }
+    }
+
     /**
      * @return true if the enclave was loaded in debug mode, i.e. its report's `DEBUG` flag is set, false otherwise.
      */
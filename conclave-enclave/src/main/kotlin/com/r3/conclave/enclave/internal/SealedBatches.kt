@@ -0,0 +1,72 @@
+package com.r3.conclave.enclave.internal
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import javax.crypto.Cipher
+import javax.crypto.spec.GCMParameterSpec
+import javax.crypto.spec.SecretKeySpec
+
+/**
+ * JCA implementation of the sealed batch format of enclave_jni.cpp, used when the enclave is not running natively.
+ * A batch is a header holding its sealed random key, followed by the records. Each record is its AES-GCM ciphertext
+ * followed by its tag, the IV is the index of the record and the authenticated data is the index followed by the
+ * number of records in the batch. Record i is the slice `[offsets[i], offsets[i + 1])` of the plaintext.
+ *
+ * @see EnclaveEnvironment.sealDataBatch
+ */
+object SealedBatches {
+    private const val TAG_SIZE_BYTES = 16
+    private const val IV_SIZE_BYTES = 12
+
+    /** Authenticated data of the sealed key in the header of a batch. */
+    val HEADER_AUTHENTICATED_DATA = "conclave-seal-batch-1".toByteArray()
+
+    /**
+     * Size of the records of a batch, without the header.
+     */
+    fun recordsSize(offsets: IntArray): Int {
+        require(offsets.isNotEmpty()) { "The offsets table must have at least one entry" }
+        require(offsets[0] >= 0) { "Negative record offset" }
+        for (i in 1 until offsets.size) {
+            require(offsets[i] >= offsets[i - 1]) { "The record offsets must be in increasing order" }
+        }
+        val size = offsets.last().toLong() - offsets[0] + (offsets.size - 1).toLong() * TAG_SIZE_BYTES
+        require(size <= Int.MAX_VALUE) { "Batch too big" }
+        return size.toInt()
+    }
+
+    fun seal(key: ByteArray, plaintext: ByteArray, offsets: IntArray, output: ByteArray, outputOffset: Int) {
+        process(Cipher.ENCRYPT_MODE, key, offsets) { cipher, i, size, position ->
+            cipher.doFinal(plaintext, offsets[i], size, output, outputOffset + position)
+        }
+    }
+
+    fun unseal(key: ByteArray, sealedBatch: ByteArray, sealedBatchOffset: Int, offsets: IntArray, output: ByteArray) {
+        process(Cipher.DECRYPT_MODE, key, offsets) { cipher, i, size, position ->
+            cipher.doFinal(sealedBatch, sealedBatchOffset + position, size + TAG_SIZE_BYTES, output, offsets[i])
+        }
+    }
+
+    private inline fun process(
+        mode: Int,
+        key: ByteArray,
+        offsets: IntArray,
+        block: (cipher: Cipher, index: Int, size: Int, position: Int) -> Unit
+    ) {
+        val keySpec = SecretKeySpec(key, "AES")
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding")
+        val count = offsets.size - 1
+        val iv = ByteBuffer.allocate(IV_SIZE_BYTES).order(ByteOrder.LITTLE_ENDIAN)
+        val authenticatedData = ByteBuffer.allocate(Long.SIZE_BYTES + Int.SIZE_BYTES).order(ByteOrder.LITTLE_ENDIAN)
+        var position = 0
+        for (i in 0 until count) {
+            iv.putLong(IV_SIZE_BYTES - Long.SIZE_BYTES, i.toLong())
+            authenticatedData.putLong(0, i.toLong()).putInt(Long.SIZE_BYTES, count)
+            cipher.init(mode, keySpec, GCMParameterSpec(TAG_SIZE_BYTES * 8, iv.array()))
+            cipher.updateAAD(authenticatedData.array())
+            val size = offsets[i + 1] - offsets[i]
+            block(cipher, i, size, position)
+            position += size + TAG_SIZE_BYTES
+        }
+    }
+}
@@ -0,0 +1,243 @@
+package com.r3.conclave.enclave.internal
+
+import java.io.*
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import javax.crypto.Cipher
+import javax.crypto.spec.GCMParameterSpec
+import javax.crypto.spec.SecretKeySpec
+
+/**
+ * Encrypts or decrypts the chunks of a sealed stream, in order. Each chunk is authenticated with its index and
+ * whether it is the last one, so that chunks cannot be reordered or dropped and a truncated stream is detected.
+ *
+ * @see EnclaveEnvironment.sealingOutputStream
+ */
+interface SealedChunkCipher : Closeable {
+    /**
+     * Size of the output of [update] for an input of [inputSize] bytes.
+     */
+    fun outputSize(inputSize: Int): Int
+
+    /**
+     * Encrypts or decrypts the next chunk of the stream into [output]. No chunk can follow the [last] one.
+     */
+    fun update(input: ByteArray, inputOffset: Int, inputSize: Int, output: ByteArray, outputOffset: Int, last: Boolean)
+}
+
+/**
+ * [SealedChunkCipher] using the JCA AES-GCM implementation. It has the same chunk format as the native one
+ * (see enclave_jni.cpp): the IV is the index of the chunk and the authenticated data is the index followed by
+ * the last chunk flag.
+ */
+class AesGcmChunkCipher(key: ByteArray, private val sealing: Boolean) : SealedChunkCipher {
+    companion object {
+        private const val TAG_SIZE_BYTES = 16
+        private const val IV_SIZE_BYTES = 12
+    }
+
+    private val key = SecretKeySpec(key, "AES")
+    private val cipher = Cipher.getInstance("AES/GCM/NoPadding")
+    private var nextChunk = 0L
+    private var finished = false
+
+    override fun outputSize(inputSize: Int): Int {
+        return if (sealing) inputSize + TAG_SIZE_BYTES else inputSize - TAG_SIZE_BYTES
+    }
+
+    override fun update(
+        input: ByteArray,
+        inputOffset: Int,
+        inputSize: Int,
+        output: ByteArray,
+        outputOffset: Int,
+        last: Boolean
+    ) {
+        check(!finished) { "The last chunk of the stream has already been processed." }
+        val iv = ByteBuffer.allocate(IV_SIZE_BYTES).order(ByteOrder.LITTLE_ENDIAN)
+        iv.position(IV_SIZE_BYTES - Long.SIZE_BYTES)
+        iv.putLong(nextChunk)
+        val authenticatedData = ByteBuffer.allocate(Long.SIZE_BYTES + 1).order(ByteOrder.LITTLE_ENDIAN)
+        authenticatedData.putLong(nextChunk)
+        authenticatedData.put(if (last) 1 else 0)
+
+        cipher.init(
+            if (sealing) Cipher.ENCRYPT_MODE else Cipher.DECRYPT_MODE,
+            key,
+            GCMParameterSpec(TAG_SIZE_BYTES * 8, iv.array())
+        )
+        cipher.updateAAD(authenticatedData.array())
+        cipher.doFinal(input, inputOffset, inputSize, output, outputOffset)
+        nextChunk++
+        finished = last
+    }
+
+    override fun close() {
+    }
+}
+
+/**
+ * Seals the bytes written to it into [out] in chunks of [chunkSize] bytes, so that the memory needed does not
+ * depend on the size of the data. The stream is made of the header, with the sealed key of the stream, followed by
+ * the chunks. Each chunk is preceded by its last chunk flag and its size. The last chunk is written by [close].
+ */
+class SealingOutputStream(
+    out: OutputStream,
+    header: ByteArray,
+    private val cipher: SealedChunkCipher,
+    chunkSize: Int
+) : OutputStream() {
+    init {
+        require(chunkSize in 1..SealedStreams.MAX_CHUNK_SIZE) { "Invalid chunk size $chunkSize" }
+    }
+
+    private val out = DataOutputStream(out)
+    private val buffer = ByteArray(chunkSize)
+    private val sealedBuffer = ByteArray(cipher.outputSize(chunkSize))
+    private var bufferSize = 0
+    private var closed = false
+
+    init {
+        this.out.writeInt(header.size)
+        this.out.write(header)
+    }
+
+    override fun write(b: Int) {
+        write(byteArrayOf(b.toByte()), 0, 1)
+    }
+
+    override fun write(b: ByteArray, off: Int, len: Int) {
+        check(!closed) { "The stream is closed." }
+        var offset = off
+        var remaining = len
+        while (remaining > 0) {
+            // A full chunk is only written once more data comes, as the last one is written by close
+            if (bufferSize == buffer.size) {
+                writeChunk(false)
+            }
+            val size = minOf(remaining, buffer.size - bufferSize)
+            System.arraycopy(b, offset, buffer, bufferSize, size)
+            bufferSize += size
+            offset += size
+            remaining -= size
+        }
+    }
+
+    private fun writeChunk(last: Boolean) {
+        val sealedSize = cipher.outputSize(bufferSize)
+        cipher.update(buffer, 0, bufferSize, sealedBuffer, 0, last)
+        out.writeBoolean(last)
+        out.writeInt(sealedSize)
+        out.write(sealedBuffer, 0, sealedSize)
+        bufferSize = 0
+    }
+
+    override fun flush() {
+        out.flush()
+    }
+
+    override fun close() {
+        if (closed) return
+        closed = true
+        try {
+            writeChunk(true)
+            buffer.fill(0)
+            out.close()
+        } finally {
+            cipher.close()
+        }
+    }
+}
+
+/**
+ * Unseals a stream written by [SealingOutputStream]. [newCipher] is given the header of the stream.
+ *
+ * @throws IOException If the stream is truncated or has been tampered with.
+ */
+class UnsealingInputStream(
+    input: InputStream,
+    newCipher: (ByteArray) -> SealedChunkCipher
+) : InputStream() {
+    private val input = DataInputStream(input)
+    private val cipher: SealedChunkCipher
+    private var sealedBuffer = ByteArray(0)
+    private var buffer = ByteArray(0)
+    private var bufferPosition = 0
+    private var bufferSize = 0
+    private var finished = false
+
+    init {
+        val headerSize = this.input.readInt()
+        if (headerSize !in 1..SealedStreams.MAX_HEADER_SIZE) {
+            throw IOException("Invalid sealed stream header")
+        }
+        val header = ByteArray(headerSize)
+        this.input.readFully(header)
+        cipher = newCipher(header)
+    }
+
+    override fun read(): Int {
+        val b = ByteArray(1)
+        return if (read(b, 0, 1) == -1) -1 else b[0].toInt() and 0xFF
+    }
+
+    override fun read(b: ByteArray, off: Int, len: Int): Int {
+        if (len == 0) return 0
+        while (bufferPosition == bufferSize) {
+            if (finished) return -1
+            readChunk()
+        }
+        val size = minOf(len, bufferSize - bufferPosition)
+        System.arraycopy(buffer, bufferPosition, b, off, size)
+        bufferPosition += size
+        return size
+    }
+
+    override fun available(): Int = bufferSize - bufferPosition
+
+    private fun readChunk() {
+        val last: Boolean
+        val sealedSize: Int
+        try {
+            last = input.readBoolean()
+            sealedSize = input.readInt()
+        } catch (e: EOFException) {
+            throw IOException("The sealed stream is truncated", e)
+        }
+        val size = cipher.outputSize(sealedSize)
+        if (sealedSize < 0 || size !in 0..SealedStreams.MAX_CHUNK_SIZE) {
+            throw IOException("Invalid sealed chunk size $sealedSize")
+        }
+        if (sealedBuffer.size < sealedSize) {
+            sealedBuffer = ByteArray(sealedSize)
+            buffer = ByteArray(size)
+        }
+        input.readFully(sealedBuffer, 0, sealedSize)
+        try {
+            cipher.update(sealedBuffer, 0, sealedSize, buffer, 0, last)
+        } catch (e: Exception) {
+            throw IOException("The sealed stream has been tampered with", e)
+        }
+        bufferPosition = 0
+        bufferSize = size
+        finished = last
+    }
+
+    override fun close() {
+        buffer.fill(0)
+        try {
+            input.close()
+        } finally {
+            cipher.close()
+        }
+    }
+}
+
+object SealedStreams {
+    const val DEFAULT_CHUNK_SIZE = 1024 * 1024
+    const val MAX_CHUNK_SIZE = 64 * 1024 * 1024
+    const val MAX_HEADER_SIZE = 64 * 1024
+
+    /** Authenticated data of the sealed key in the header of a stream. */
+    val HEADER_AUTHENTICATED_DATA = "conclave-seal-stream-1".toByteArray()
+}
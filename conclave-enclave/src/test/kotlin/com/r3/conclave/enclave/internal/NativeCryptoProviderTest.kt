@@ -0,0 +1,302 @@
+package com.r3.conclave.enclave.internal
+
+import org.assertj.core.api.Assertions.assertThat
+import org.assertj.core.api.Assertions.assertThatExceptionOfType
+import org.junit.jupiter.api.AfterEach
+import org.junit.jupiter.api.Test
+import org.junit.jupiter.params.ParameterizedTest
+import org.junit.jupiter.params.provider.ValueSource
+import java.security.InvalidAlgorithmParameterException
+import java.security.MessageDigest
+import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicLong
+import javax.crypto.AEADBadTagException
+import javax.crypto.Cipher
+import javax.crypto.Mac
+import javax.crypto.spec.GCMParameterSpec
+import javax.crypto.spec.SecretKeySpec
+import kotlin.random.Random
+
+/**
+ * Checks the services of [NativeCryptoProvider] against the JDK. The SDK primitives are replaced by the JDK ones, as
+ * the enclave library can't be loaded here, so this covers the JCA plumbing and the handling of the native states.
+ */
+class NativeCryptoProviderTest {
+    private companion object {
+        private val sizes = intArrayOf(0, 1, 31, 32, 33, 64, 1000, 65537)
+    }
+
+    /** The JDK primitives, with the digest and MAC states kept behind handles like the native ones. */
+    private class JdkPrimitives : NativeCryptoProvider.Primitives {
+        val states = ConcurrentHashMap<Long, Any>()
+        private val nextHandle = AtomicLong(1)
+
+        override fun aesGcmEncrypt(
+            key: ByteArray, iv: ByteArray, aad: ByteArray, aadOffset: Int, aadSize: Int,
+            plaintext: ByteArray, plaintextOffset: Int, plaintextSize: Int, output: ByteArray, outputOffset: Int
+        ) {
+            val cipher = jdkCipher(Cipher.ENCRYPT_MODE, key, iv)
+            cipher.updateAAD(aad, aadOffset, aadSize)
+            cipher.doFinal(plaintext, plaintextOffset, plaintextSize, output, outputOffset)
+        }
+
+        override fun aesGcmDecrypt(
+            key: ByteArray, iv: ByteArray, aad: ByteArray, aadOffset: Int, aadSize: Int,
+            ciphertext: ByteArray, ciphertextOffset: Int, ciphertextSize: Int, output: ByteArray, outputOffset: Int
+        ) {
+            val cipher = jdkCipher(Cipher.DECRYPT_MODE, key, iv)
+            cipher.updateAAD(aad, aadOffset, aadSize)
+            try {
+                cipher.doFinal(ciphertext, ciphertextOffset, ciphertextSize, output, outputOffset)
+            } catch (e: AEADBadTagException) {
+                // The native decryption fails with a RuntimeException
+                throw IllegalStateException("SGX_ERROR_MAC_MISMATCH", e)
+            }
+        }
+
+        override fun sha256Init(): Long = newHandle(MessageDigest.getInstance("SHA-256", "SUN"))
+
+        override fun sha256Update(handle: Long, input: ByteArray, inputOffset: Int, inputSize: Int) {
+            (states.getValue(handle) as MessageDigest).update(input, inputOffset, inputSize)
+        }
+
+        override fun sha256Final(handle: Long, output: ByteArray, outputOffset: Int) {
+            (states.getValue(handle) as MessageDigest).digest(output, outputOffset, 32)
+        }
+
+        override fun sha256Free(handle: Long) {
+            checkNotNull(states.remove(handle))
+        }
+
+        override fun hmacSha256Init(key: ByteArray): Long {
+            val mac = Mac.getInstance("HmacSHA256", "SunJCE")
+            mac.init(SecretKeySpec(key, "HmacSHA256"))
+            return newHandle(mac)
+        }
+
+        override fun hmacSha256Update(handle: Long, input: ByteArray, inputOffset: Int, inputSize: Int) {
+            (states.getValue(handle) as Mac).update(input, inputOffset, inputSize)
+        }
+
+        override fun hmacSha256Final(handle: Long, output: ByteArray, outputOffset: Int) {
+            (states.getValue(handle) as Mac).doFinal(output, outputOffset)
+        }
+
+        override fun hmacSha256Free(handle: Long) {
+            checkNotNull(states.remove(handle))
+        }
+
+        private fun newHandle(state: Any): Long = nextHandle.getAndIncrement().also { states[it] = state }
+
+        private fun jdkCipher(mode: Int, key: ByteArray, iv: ByteArray): Cipher {
+            return Cipher.getInstance("AES/GCM/NoPadding", "SunJCE").apply {
+                init(mode, SecretKeySpec(key, "AES"), GCMParameterSpec(128, iv))
+            }
+        }
+    }
+
+    private val primitives = JdkPrimitives()
+    private val provider = NativeCryptoProvider(primitives)
+
+    @AfterEach
+    fun `make sure the native states are freed`() {
+        assertThat(primitives.states).isEmpty()
+    }
+
+    @Test
+    fun `SHA-256 matches the JDK`() {
+        for (size in sizes) {
+            val input = Random.nextBytes(size)
+            assertThat(MessageDigest.getInstance("SHA-256", provider).digest(input)).isEqualTo(jdkSha256(input))
+        }
+    }
+
+    @Test
+    fun `SHA-256 of incremental updates`() {
+        val input = Random.nextBytes(10000)
+        val digest = MessageDigest.getInstance("SHA-256", provider)
+        var position = 0
+        while (position < input.size) {
+            val size = minOf(Random.nextInt(0, 700), input.size - position)
+            if (size == 1) digest.update(input[position]) else digest.update(input, position, size)
+            position += size
+        }
+        assertThat(digest.digest()).isEqualTo(jdkSha256(input))
+    }
+
+    @Test
+    fun `SHA-256 instance is reusable after a digest or a reset`() {
+        val digest = MessageDigest.getInstance("SHA-256", provider)
+        val input1 = Random.nextBytes(100)
+        val input2 = Random.nextBytes(200)
+        assertThat(digest.digest(input1)).isEqualTo(jdkSha256(input1))
+        digest.update(input1)
+        digest.reset()
+        assertThat(digest.digest(input2)).isEqualTo(jdkSha256(input2))
+        val output = ByteArray(40)
+        digest.update(input1)
+        assertThat(digest.digest(output, 8, 32)).isEqualTo(32)
+        assertThat(output.copyOfRange(8, 40)).isEqualTo(jdkSha256(input1))
+    }
+
+    @Test
+    fun `SHA-256 clone continues independently`() {
+        val input1 = Random.nextBytes(100)
+        val input2 = Random.nextBytes(200)
+        val digest = MessageDigest.getInstance("SHA-256", provider)
+        digest.update(input1)
+        val copy = digest.clone() as MessageDigest
+        digest.update(input2)
+        assertThat(copy.digest()).isEqualTo(jdkSha256(input1))
+        assertThat(digest.digest()).isEqualTo(jdkSha256(input1 + input2))
+        copy.update(input2)
+        assertThat(copy.digest()).isEqualTo(jdkSha256(input2))
+    }
+
+    @Test
+    fun `SHA-256 holds no native state between calls`() {
+        val digest = MessageDigest.getInstance("SHA-256", provider)
+        digest.update(Random.nextBytes(100))
+        digest.update(Random.nextBytes(1))
+        // The digest is dropped here, nothing would free a native state
+        assertThat(primitives.states).isEmpty()
+    }
+
+    @ParameterizedTest(name = "{displayName} {argumentsWithNames}")
+    @ValueSource(ints = [1, 16, 32, 64, 100])
+    fun `HMAC-SHA256 matches the JDK`(keySize: Int) {
+        val key = SecretKeySpec(Random.nextBytes(keySize), "HmacSHA256")
+        val mac = Mac.getInstance("HmacSHA256", provider)
+        val jdkMac = Mac.getInstance("HmacSHA256", "SunJCE")
+        mac.init(key)
+        jdkMac.init(key)
+        for (size in sizes) {
+            val input = Random.nextBytes(size)
+            assertThat(mac.doFinal(input)).isEqualTo(jdkMac.doFinal(input))
+        }
+    }
+
+    @Test
+    fun `HMAC-SHA256 of incremental updates and after a reset`() {
+        val key = SecretKeySpec(Random.nextBytes(32), "HmacSHA256")
+        val mac = Mac.getInstance("HmacSHA256", provider)
+        val jdkMac = Mac.getInstance("HmacSHA256", "SunJCE")
+        mac.init(key)
+        jdkMac.init(key)
+        val input = Random.nextBytes(5000)
+        mac.update(Random.nextBytes(10))
+        mac.reset()
+        mac.update(input[0])
+        mac.update(input, 1, 999)
+        mac.update(input, 1000, 4000)
+        assertThat(mac.doFinal()).isEqualTo(jdkMac.doFinal(input))
+
+        val key2 = SecretKeySpec(Random.nextBytes(32), "HmacSHA256")
+        mac.update(input)
+        mac.init(key2)
+        jdkMac.init(key2)
+        assertThat(mac.doFinal(input)).isEqualTo(jdkMac.doFinal(input))
+    }
+
+    @Test
+    fun `HMAC-SHA256 clone continues independently`() {
+        val key = SecretKeySpec(Random.nextBytes(32), "HmacSHA256")
+        val input1 = Random.nextBytes(100)
+        val input2 = Random.nextBytes(200)
+        val mac = Mac.getInstance("HmacSHA256", provider)
+        val jdkMac = Mac.getInstance("HmacSHA256", "SunJCE")
+        mac.init(key)
+        jdkMac.init(key)
+        mac.update(input1)
+        val copy = mac.clone() as Mac
+        mac.update(input2)
+        assertThat(copy.doFinal()).isEqualTo(jdkMac.doFinal(input1))
+        assertThat(mac.doFinal()).isEqualTo(jdkMac.doFinal(input1 + input2))
+
+        // Initialising the original again doesn't clear the key of the copy
+        mac.init(SecretKeySpec(Random.nextBytes(32), "HmacSHA256"))
+        assertThat(copy.doFinal(input2)).isEqualTo(jdkMac.doFinal(input2))
+    }
+
+    @Test
+    fun `HMAC-SHA256 holds no native state between calls`() {
+        val mac = Mac.getInstance("HmacSHA256", provider)
+        mac.init(SecretKeySpec(Random.nextBytes(32), "HmacSHA256"))
+        mac.update(Random.nextBytes(100))
+        // The MAC is dropped here, nothing would free a native state
+        assertThat(primitives.states).isEmpty()
+    }
+
+    @Test
+    fun `AES-GCM matches the JDK`() {
+        val key = SecretKeySpec(Random.nextBytes(16), "AES")
+        for (size in sizes) {
+            val iv = GCMParameterSpec(128, Random.nextBytes(12))
+            val aad = Random.nextBytes(size % 50)
+            val input = Random.nextBytes(size)
+            val cipher = Cipher.getInstance("AES/GCM/NoPadding", provider)
+            val jdkCipher = Cipher.getInstance("AES/GCM/NoPadding", "SunJCE")
+            cipher.init(Cipher.ENCRYPT_MODE, key, iv)
+            jdkCipher.init(Cipher.ENCRYPT_MODE, key, iv)
+            cipher.updateAAD(aad)
+            jdkCipher.updateAAD(aad)
+            // Part of the input is given to update, which is buffered until doFinal
+            cipher.update(input, 0, size / 2)
+            val ciphertext = cipher.doFinal(input, size / 2, size - size / 2)
+            assertThat(ciphertext).isEqualTo(jdkCipher.doFinal(input))
+
+            cipher.init(Cipher.DECRYPT_MODE, key, iv)
+            cipher.updateAAD(aad)
+            assertThat(cipher.doFinal(ciphertext)).isEqualTo(input)
+        }
+    }
+
+    @Test
+    fun `AES-GCM in place`() {
+        val key = SecretKeySpec(Random.nextBytes(16), "AES")
+        val iv = GCMParameterSpec(128, Random.nextBytes(12))
+        val input = Random.nextBytes(100)
+        val buffer = input.copyOf(116)
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding", provider)
+        cipher.init(Cipher.ENCRYPT_MODE, key, iv)
+        assertThat(cipher.doFinal(buffer, 0, 100, buffer, 0)).isEqualTo(116)
+        cipher.init(Cipher.DECRYPT_MODE, key, iv)
+        assertThat(cipher.doFinal(buffer, 0, 116, buffer, 0)).isEqualTo(100)
+        assertThat(buffer.copyOf(100)).isEqualTo(input)
+    }
+
+    @Test
+    fun `AES-GCM rejects a modified ciphertext`() {
+        val key = SecretKeySpec(Random.nextBytes(16), "AES")
+        val iv = GCMParameterSpec(128, Random.nextBytes(12))
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding", provider)
+        cipher.init(Cipher.ENCRYPT_MODE, key, iv)
+        val ciphertext = cipher.doFinal(Random.nextBytes(100))
+        ciphertext[3] = (ciphertext[3] + 1).toByte()
+        cipher.init(Cipher.DECRYPT_MODE, key, iv)
+        assertThatExceptionOfType(AEADBadTagException::class.java).isThrownBy { cipher.doFinal(ciphertext) }
+    }
+
+    @Test
+    fun `AES-GCM rejects reusing the IV for encryption`() {
+        val key = SecretKeySpec(Random.nextBytes(16), "AES")
+        val iv = GCMParameterSpec(128, Random.nextBytes(12))
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding", provider)
+        cipher.init(Cipher.ENCRYPT_MODE, key, iv)
+        cipher.doFinal(ByteArray(10))
+        assertThatExceptionOfType(InvalidAlgorithmParameterException::class.java).isThrownBy {
+            cipher.init(Cipher.ENCRYPT_MODE, key, iv)
+        }
+    }
+
+    @Test
+    fun `AES-GCM rejects unsupported parameters`() {
+        val iv = Random.nextBytes(12)
+        val cipher = Cipher.getInstance("AES/GCM/NoPadding", provider)
+        assertThatExceptionOfType(InvalidAlgorithmParameterException::class.java).isThrownBy {
+            cipher.init(Cipher.ENCRYPT_MODE, SecretKeySpec(Random.nextBytes(16), "AES"), GCMParameterSpec(96, iv))
+        }
+    }
+
+    private fun jdkSha256(input: ByteArray): ByteArray = MessageDigest.getInstance("SHA-256", "SUN").digest(input)
+}
@@ -0,0 +1,79 @@
+package com.r3.conclave.enclave.internal
+
+import com.r3.conclave.mail.internal.noise.crypto.Curve25519
+import org.assertj.core.api.Assertions.assertThat
+import org.junit.jupiter.api.AfterEach
+import org.junit.jupiter.api.Test
+import kotlin.random.Random
+
+/**
+ * The native X25519 can't be loaded outside an enclave (see x25519-tests.cpp for its tests), so it is replaced here by
+ * the Java path of [Curve25519], which checks that [NativeCurve25519] passes the arguments in the right order.
+ */
+class NativeCurve25519Test {
+    private class Call(val privateKey: ByteArray, val publicKey: ByteArray?, val output: ByteArray, val offset: Int)
+
+    /** Stands in for [Native.x25519], with the same argument order. */
+    private val javaX25519 = { privateKey: ByteArray, publicKey: ByteArray?, output: ByteArray, outputOffset: Int ->
+        Curve25519.eval(output, outputOffset, privateKey, publicKey)
+    }
+
+    @AfterEach
+    fun resetImplementation() {
+        Curve25519.setImplementation(null)
+    }
+
+    @Test
+    fun `matches the Java path`() {
+        val implementation = NativeCurve25519(javaX25519)
+        repeat(20) {
+            val privateKey = Random.nextBytes(32)
+            val publicKey = Random.nextBytes(32).also { it[31] = (it[31].toInt() and 0x7F).toByte() }
+            for (peer in listOf(null, publicKey)) {
+                val expected = ByteArray(32)
+                Curve25519.eval(expected, 0, privateKey, peer)
+                val result = ByteArray(40)
+                implementation.eval(result, 5, privateKey, peer)
+                assertThat(result.copyOfRange(5, 37)).isEqualTo(expected)
+            }
+        }
+    }
+
+    @Test
+    fun `matches the RFC 7748 test vector`() {
+        val result = ByteArray(32)
+        NativeCurve25519(javaX25519).eval(
+            result,
+            0,
+            hex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4"),
+            hex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c")
+        )
+        assertThat(result).isEqualTo(hex("c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"))
+    }
+
+    @Test
+    fun `Curve25519 dispatches to the implementation`() {
+        val recorded = ArrayList<Call>()
+        Curve25519.setImplementation(NativeCurve25519 { privateKey, publicKey, output, outputOffset ->
+            recorded += Call(privateKey, publicKey, output, outputOffset)
+        })
+        val privateKey = Random.nextBytes(32)
+        val publicKey = ByteArray(32).also { it[0] = 9 }
+        val result = ByteArray(40)
+        Curve25519.eval(result, 3, privateKey, publicKey)
+        assertThat(recorded).hasSize(1)
+        assertThat(recorded[0].privateKey).isSameAs(privateKey)
+        assertThat(recorded[0].publicKey).isSameAs(publicKey)
+        assertThat(recorded[0].output).isSameAs(result)
+        assertThat(recorded[0].offset).isEqualTo(3)
+
+        // The Java path reduces the public keys with the top bit set differently from the RFC, so it keeps them
+        publicKey[31] = 0x80.toByte()
+        Curve25519.eval(result, 3, privateKey, publicKey)
+        assertThat(recorded).hasSize(1)
+    }
+
+    private fun hex(string: String): ByteArray {
+        return ByteArray(string.length / 2) { string.substring(it * 2, it * 2 + 2).toInt(16).toByte() }
+    }
+}
@@ -0,0 +1,117 @@
+package com.r3.conclave.enclave.internal
+
+import com.r3.conclave.common.internal.MockCallInterfaceConnector
+import com.r3.conclave.enclave.Enclave
+import org.assertj.core.api.Assertions.assertThat
+import org.assertj.core.api.Assertions.assertThatExceptionOfType
+import org.assertj.core.api.Assertions.assertThatIllegalArgumentException
+import org.junit.jupiter.api.Test
+import org.junit.jupiter.params.ParameterizedTest
+import org.junit.jupiter.params.provider.ValueSource
+import java.security.GeneralSecurityException
+import kotlin.random.Random
+
+class SealedBatchesTest {
+    private companion object {
+        private const val TAG_SIZE = 16
+    }
+
+    class BatchEnclaveA : Enclave()
+
+    class BatchEnclaveB : Enclave()
+
+    private val env = createMockEnclaveEnvironment<BatchEnclaveA>()
+
+    @ParameterizedTest(name = "{displayName} {argumentsWithNames}")
+    @ValueSource(ints = [0, 4])
+    fun `sealed batch round trip`(start: Int) {
+        val offsets = offsetsOf(start, 5, 0, 17, 3)
+        val plaintext = Random.nextBytes(offsets.last())
+        val sealed = env.sealDataBatch(plaintext, offsets)
+        assertThat(SealedBatches.recordsSize(offsets)).isEqualTo(25 + 4 * TAG_SIZE)
+
+        val unsealed = env.unsealDataBatch(sealed, offsets)
+        assertThat(unsealed.copyOfRange(start, unsealed.size)).isEqualTo(plaintext.copyOfRange(start, plaintext.size))
+    }
+
+    @Test
+    fun `sealed batch without records`() {
+        val offsets = offsetsOf(0)
+        val sealed = env.sealDataBatch(ByteArray(0), offsets)
+        assertThat(env.unsealDataBatch(sealed, offsets)).isEmpty()
+    }
+
+    @Test
+    fun `sealed batch can be unsealed by another instance of the same enclave`() {
+        val offsets = offsetsOf(0, 10, 20)
+        val plaintext = Random.nextBytes(offsets.last())
+        val sealed = env.sealDataBatch(plaintext, offsets)
+        assertThat(createMockEnclaveEnvironment<BatchEnclaveA>().unsealDataBatch(sealed, offsets)).isEqualTo(plaintext)
+    }
+
+    @Test
+    fun `sealed batch cannot be unsealed by another enclave`() {
+        val offsets = offsetsOf(0, 10, 20)
+        val sealed = env.sealDataBatch(Random.nextBytes(offsets.last()), offsets)
+        assertThatExceptionOfType(GeneralSecurityException::class.java).isThrownBy {
+            createMockEnclaveEnvironment<BatchEnclaveB>().unsealDataBatch(sealed, offsets)
+        }
+    }
+
+    @Test
+    fun `swapped records are rejected`() {
+        val offsets = offsetsOf(0, 10, 10, 10)
+        val sealed = env.sealDataBatch(Random.nextBytes(offsets.last()), offsets)
+        val record0 = headerSize(sealed, offsets)
+        val record1 = record0 + 10 + TAG_SIZE
+        val swapped = sealed.copyOf()
+        sealed.copyInto(swapped, record0, record1, record1 + 10 + TAG_SIZE)
+        sealed.copyInto(swapped, record1, record0, record0 + 10 + TAG_SIZE)
+        assertThatExceptionOfType(GeneralSecurityException::class.java).isThrownBy {
+            env.unsealDataBatch(swapped, offsets)
+        }
+    }
+
+    @Test
+    fun `dropped record is rejected`() {
+        val offsets = offsetsOf(0, 10, 10, 10)
+        val sealed = env.sealDataBatch(Random.nextBytes(offsets.last()), offsets)
+        val truncated = sealed.copyOf(sealed.size - 10 - TAG_SIZE)
+        assertThatExceptionOfType(GeneralSecurityException::class.java).isThrownBy {
+            env.unsealDataBatch(truncated, offsets.copyOf(offsets.size - 1))
+        }
+    }
+
+    @Test
+    fun `modified record is rejected`() {
+        val offsets = offsetsOf(0, 10, 10)
+        val sealed = env.sealDataBatch(Random.nextBytes(offsets.last()), offsets)
+        sealed[sealed.size - 1] = (sealed[sealed.size - 1] + 1).toByte()
+        assertThatExceptionOfType(GeneralSecurityException::class.java).isThrownBy {
+            env.unsealDataBatch(sealed, offsets)
+        }
+    }
+
+    @Test
+    fun `offsets must be in increasing order`() {
+        assertThatIllegalArgumentException().isThrownBy {
+            env.sealDataBatch(ByteArray(20), intArrayOf(0, 10, 5))
+        }
+    }
+
+    /** Offsets of the records of the given sizes, the first one starting at [start]. */
+    private fun offsetsOf(start: Int, vararg sizes: Int): IntArray {
+        val offsets = IntArray(sizes.size + 1)
+        offsets[0] = start
+        sizes.forEachIndexed { i, size -> offsets[i + 1] = offsets[i] + size }
+        return offsets
+    }
+
+    private fun headerSize(sealed: ByteArray, offsets: IntArray): Int {
+        return sealed.size - SealedBatches.recordsSize(offsets)
+    }
+
+    private inline fun <reified E : Enclave> createMockEnclaveEnvironment(): MockEnclaveEnvironment {
+        return MockEnclaveEnvironment(E::class.java.getConstructor().newInstance(), null, null, MockCallInterfaceConnector())
+    }
+}
@@ -0,0 +1,140 @@
+package com.r3.conclave.enclave.internal
+
+import com.r3.conclave.common.internal.MockCallInterfaceConnector
+import com.r3.conclave.enclave.Enclave
+import org.assertj.core.api.Assertions.assertThat
+import org.assertj.core.api.Assertions.assertThatIOException
+import org.junit.jupiter.api.Test
+import org.junit.jupiter.params.ParameterizedTest
+import org.junit.jupiter.params.provider.ValueSource
+import java.io.ByteArrayInputStream
+import java.io.ByteArrayOutputStream
+import java.io.DataInputStream
+import java.io.DataOutputStream
+import kotlin.random.Random
+
+class SealingStreamsTest {
+    private companion object {
+        private const val CHUNK_SIZE = 1000
+    }
+
+    class StreamEnclave : Enclave()
+
+    private val env = MockEnclaveEnvironment(StreamEnclave(), null, null, MockCallInterfaceConnector())
+
+    private class SealedStream(val header: ByteArray, val chunks: MutableList<Pair<Boolean, ByteArray>>) {
+        fun toByteArray(): ByteArray {
+            val bytes = ByteArrayOutputStream()
+            DataOutputStream(bytes).use { out ->
+                out.writeInt(header.size)
+                out.write(header)
+                for ((last, chunk) in chunks) {
+                    out.writeBoolean(last)
+                    out.writeInt(chunk.size)
+                    out.write(chunk)
+                }
+            }
+            return bytes.toByteArray()
+        }
+    }
+
+    @ParameterizedTest(name = "{displayName} {argumentsWithNames}")
+    @ValueSource(ints = [0, 1, CHUNK_SIZE - 1, CHUNK_SIZE, CHUNK_SIZE + 1, 10 * CHUNK_SIZE + 7])
+    fun `sealed stream round trip`(size: Int) {
+        val data = Random.nextBytes(size)
+        val sealed = seal(data)
+        assertThat(parse(sealed).chunks).hasSize(maxOf((size + CHUNK_SIZE - 1) / CHUNK_SIZE, 1))
+        assertThat(unseal(sealed)).isEqualTo(data)
+    }
+
+    @Test
+    fun `data written a byte at a time`() {
+        val data = Random.nextBytes(2 * CHUNK_SIZE + 3)
+        val out = ByteArrayOutputStream()
+        env.sealingOutputStream(out, CHUNK_SIZE).use { sealing ->
+            data.forEach { sealing.write(it.toInt()) }
+        }
+        val unsealing = env.unsealingInputStream(ByteArrayInputStream(out.toByteArray()))
+        val unsealed = ByteArrayOutputStream()
+        while (true) {
+            val b = unsealing.read()
+            if (b == -1) break
+            unsealed.write(b)
+        }
+        assertThat(unsealed.toByteArray()).isEqualTo(data)
+    }
+
+    @Test
+    fun `each stream has its own key`() {
+        val data = Random.nextBytes(CHUNK_SIZE)
+        val stream1 = parse(seal(data))
+        val stream2 = parse(seal(data))
+        assertThat(stream1.chunks[0].second).isNotEqualTo(stream2.chunks[0].second)
+    }
+
+    @Test
+    fun `reordered chunks are rejected`() {
+        val stream = parse(seal(Random.nextBytes(3 * CHUNK_SIZE)))
+        val first = stream.chunks[0]
+        stream.chunks[0] = stream.chunks[1]
+        stream.chunks[1] = first
+        assertThatIOException().isThrownBy { unseal(stream.toByteArray()) }.withMessageContaining("tampered with")
+    }
+
+    @Test
+    fun `chunks from another stream are rejected`() {
+        val stream1 = parse(seal(Random.nextBytes(2 * CHUNK_SIZE)))
+        val stream2 = parse(seal(Random.nextBytes(2 * CHUNK_SIZE)))
+        stream1.chunks[0] = stream2.chunks[0]
+        assertThatIOException().isThrownBy { unseal(stream1.toByteArray()) }.withMessageContaining("tampered with")
+    }
+
+    @Test
+    fun `stream without its last chunk is rejected`() {
+        val stream = parse(seal(Random.nextBytes(3 * CHUNK_SIZE)))
+        stream.chunks.removeAt(stream.chunks.lastIndex)
+        assertThatIOException().isThrownBy { unseal(stream.toByteArray()) }.withMessageContaining("truncated")
+    }
+
+    @Test
+    fun `chunk marked as the last one is rejected`() {
+        val stream = parse(seal(Random.nextBytes(3 * CHUNK_SIZE)))
+        stream.chunks[1] = Pair(true, stream.chunks[1].second)
+        stream.chunks.removeAt(stream.chunks.lastIndex)
+        assertThatIOException().isThrownBy { unseal(stream.toByteArray()) }.withMessageContaining("tampered with")
+    }
+
+    @Test
+    fun `stream truncated in a chunk is rejected`() {
+        val sealed = seal(Random.nextBytes(2 * CHUNK_SIZE))
+        assertThatIOException().isThrownBy { unseal(sealed.copyOf(sealed.size - 1)) }
+    }
+
+    @Test
+    fun `modified chunk is rejected`() {
+        val stream = parse(seal(Random.nextBytes(2 * CHUNK_SIZE)))
+        stream.chunks[1].second[5] = (stream.chunks[1].second[5] + 1).toByte()
+        assertThatIOException().isThrownBy { unseal(stream.toByteArray()) }.withMessageContaining("tampered with")
+    }
+
+    private fun seal(data: ByteArray): ByteArray {
+        val out = ByteArrayOutputStream()
+        env.sealingOutputStream(out, CHUNK_SIZE).use { it.write(data) }
+        return out.toByteArray()
+    }
+
+    private fun unseal(sealed: ByteArray): ByteArray {
+        return env.unsealingInputStream(ByteArrayInputStream(sealed)).use { it.readBytes() }
+    }
+
+    private fun parse(sealed: ByteArray): SealedStream {
+        val input = DataInputStream(ByteArrayInputStream(sealed))
+        val header = ByteArray(input.readInt()).also(input::readFully)
+        val chunks = ArrayList<Pair<Boolean, ByteArray>>()
+        while (input.available() > 0) {
+            val last = input.readBoolean()
+            chunks += Pair(last, ByteArray(input.readInt()).also(input::readFully))
+        }
+        return SealedStream(header, chunks)
+    }
+}
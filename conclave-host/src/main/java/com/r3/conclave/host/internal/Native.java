@@ -10,6 +10,17 @@ public class Native {
 
     public static native void jvmECall(long enclaveId, byte callType, byte messageTypeID, byte[] data);
 
+    /**
+     * Creates the isolate of the enclave, which is otherwise done lazily by the first [jvmECall].
+     */
+    public static native void warmUpEnclave(long enclaveId);
+
+    /**
+     * Returns the duration in nanoseconds of each startup phase of the enclave, indexed by the StartupPhase enum of
+     * startup_phase.h, or -1 for the phases which haven't run.
+     */
+    public static native long[] getStartupProfile(long enclaveId);
+
     /**
      * sgx_status_t sgx_init_quote(sgx_target_info_t *p_target_info, sgx_epid_group_id_t *p_gid)
      */
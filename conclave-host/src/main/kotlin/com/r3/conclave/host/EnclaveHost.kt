@@ -234,7 +234,9 @@ class EnclaveHost private constructor(
             return EnclaveHost(enclaveHandle)
         }
 
-        private fun createEnclaveHost(result: ScanResult, mockConfiguration: MockConfiguration?): EnclaveHost {
+        @JvmSynthetic
+        @JvmStatic
+        internal fun createEnclaveHost(result: ScanResult, mockConfiguration: MockConfiguration?): EnclaveHost {
             try {
                 return when (result) {
                     is ScanResult.Mock -> {
@@ -318,6 +320,7 @@ class EnclaveHost private constructor(
     private var fileSystemHandler: FileSystemHandler? = null
 
     private val hostStateManager = StateManager<HostState>(New)
+    private var preparedWith: PreparedAttestation? = null
     private val setEnclaveInfoCallHandler = SetEnclaveInfoCallHandler()
 
     @PotentialPackagePrivate("Access for EnclaveHostMockTest")
@@ -359,6 +362,18 @@ class EnclaveHost private constructor(
         start(attestationParameters, sealedState, enclaveFileSystemFile, null, commandsCallback)
     }
 
+    @Throws(EnclaveLoadException::class)
+    @Synchronized
+    fun start(
+        attestationParameters: AttestationParameters?,
+        sealedState: ByteArray?,
+        enclaveFileSystemFile: Path?,
+        kdsConfiguration: KDSConfiguration?,
+        commandsCallback: Consumer<List<MailCommand>>
+    ) {
+        start(attestationParameters, sealedState, enclaveFileSystemFile, kdsConfiguration, null, commandsCallback)
+    }
+
     /**
      * Causes the enclave to be loaded and the [com.r3.conclave.enclave.Enclave] object constructed inside.
      * This method must be called before sending is possible. Remember to call
@@ -386,6 +401,10 @@ class EnclaveHost private constructor(
      * @param kdsConfiguration Configuration for connecting to a key derivation service (KDS) in case the enclave needs
      * to use one for encrypting persisted data. More information can be found [here](https://docs.conclave.net/kds-configuration.html).
      *
+     * @param inMemoryFileSystemSnapshot A snapshot previously returned by [snapshotInMemoryFileSystem]. Its content is
+     * restored into the enclave's in-memory file system before the enclave starts, instead of starting with an empty
+     * one. This can be null.
+     *
      * @param commandsCallback A callback that is automatically invoked after the end of every [callEnclave] and
      * [deliverMail] call. The callback returns a list of actions, or [MailCommand]s, which need to be actioned together,
      * ideally within the scope single transaction.
@@ -405,6 +424,7 @@ class EnclaveHost private constructor(
         sealedState: ByteArray?,
         enclaveFileSystemFile: Path?,
         kdsConfiguration: KDSConfiguration?,
+        inMemoryFileSystemSnapshot: ByteArray?,
         commandsCallback: Consumer<List<MailCommand>>
     ) {
         if (hostStateManager.state is Started) return
@@ -413,18 +433,20 @@ class EnclaveHost private constructor(
         // This can throw IllegalArgumentException which we don't want wrapped in a EnclaveLoadException.
         attestationService = AttestationServiceFactory.getService(enclaveMode, attestationParameters)
 
+        val prepared = preparedWith
+        if (prepared != null) {
+            require(prepared.isSameAttestation(attestationParameters)) {
+                "The enclave was initialised by its pool with different attestation parameters."
+            }
+        }
+
         try {
             this.commandsCallback = commandsCallback
 
-            // Register call handlers
-            enclaveHandle.enclaveInterface.apply {
-                registerCallHandler(HostCallType.GET_ATTESTATION, GetAttestationHandler())
-                registerCallHandler(HostCallType.SET_ENCLAVE_INFO, setEnclaveInfoCallHandler)
-                registerCallHandler(HostCallType.CALL_MESSAGE_HANDLER, enclaveMessageHandler)
+            // Initialise the enclave before fetching enclave instance info, unless its pool already has
+            if (prepared == null) {
+                prepare(attestationParameters)
             }
-
-            // Initialise the enclave before fetching enclave instance info
-            enclaveHandle.initialise(attestationParameters)
             updateAttestation()
             log.debug { enclaveInstanceInfo.toString() }
 
@@ -446,17 +468,74 @@ class EnclaveHost private constructor(
                 log.info("Setting up persistent enclave file system...")
             }
             fileSystemHandler = prepareFileSystemHandler(enclaveFileSystemFile)
-            enclaveHandle.startEnclave(sealedState)
+            enclaveHandle.startEnclave(sealedState, inMemoryFileSystemSnapshot)
             if (enclaveFileSystemFile != null) {
                 log.info("Setup of the file system completed successfully.")
             }
 
             hostStateManager.state = Started
+            log.debug { "Enclave startup profile: ${enclaveHandle.startupProfile}" }
         } catch (e: Exception) {
             throw EnclaveLoadException("Unable to start enclave", e)
         }
     }
 
+    /**
+     * Registers the host call handlers, and initialises and warms up the enclave. These steps only need the
+     * attestation parameters, so [EnclaveHostPool] runs them before the host is handed out.
+     */
+    private fun prepare(attestationParameters: AttestationParameters?) {
+        enclaveHandle.enclaveInterface.apply {
+            registerCallHandler(HostCallType.GET_ATTESTATION, GetAttestationHandler())
+            registerCallHandler(HostCallType.SET_ENCLAVE_INFO, setEnclaveInfoCallHandler)
+            registerCallHandler(HostCallType.CALL_MESSAGE_HANDLER, enclaveMessageHandler)
+        }
+        enclaveHandle.initialise(attestationParameters)
+        enclaveHandle.warmUpEnclave()
+    }
+
+    // The internal modifier prevents this from appearing in the API docs, however because we shade Kotlin it will
+    // still be available to Java users. We solve that by making it synthetic which hides it from the Java compiler.
+    @JvmSynthetic
+    @Synchronized
+    internal fun internalPrepare(attestationParameters: AttestationParameters?) {
+        hostStateManager.checkStateIs<New> { "The host has already been started or closed." }
+        check(preparedWith == null) { "The enclave has already been initialised." }
+        try {
+            prepare(attestationParameters)
+        } catch (e: Exception) {
+            throw EnclaveLoadException("Unable to initialise enclave", e)
+        }
+        preparedWith = PreparedAttestation(attestationParameters)
+    }
+
+    /**
+     * Destroys the enclave of a host which was never started, as [close] only releases started hosts.
+     */
+    @JvmSynthetic
+    @Synchronized
+    internal fun internalDiscard() {
+        if (hostStateManager.state !is New) return
+        try {
+            enclaveHandle.destroy()
+        } finally {
+            hostStateManager.state = Closed
+        }
+    }
+
+    /**
+     * The attestation parameters the enclave was initialised with by its pool. [AttestationParameters.DCAP] has no
+     * state, so any instance matches another.
+     */
+    private class PreparedAttestation(private val attestationParameters: AttestationParameters?) {
+        fun isSameAttestation(other: AttestationParameters?): Boolean {
+            return when (attestationParameters) {
+                is AttestationParameters.DCAP -> other is AttestationParameters.DCAP
+                else -> attestationParameters == other
+            }
+        }
+    }
+
     private fun prepareFileSystemHandler(enclaveFileSystemFile: Path?): FileSystemHandler? {
         return if (isFileSystemSupported()) {
             val fileSystemFilePaths = if (enclaveFileSystemFile != null) listOf(enclaveFileSystemFile) else emptyList()
@@ -515,6 +594,23 @@ class EnclaveHost private constructor(
         return kdsPrivateKeyResponse
     }
 
+    /**
+     * Returns a snapshot of the content of the enclave's in-memory file system, sealed to the enclave. Pass it to
+     * [start] when the enclave is restarted to find the in-memory file system as it was when the snapshot was taken,
+     * without recomputing its content. The snapshot is not kept up to date with the following changes, and restoring
+     * an old one does not trigger a rollback detection.
+     *
+     * @return the sealed snapshot, or null if the enclave has no in-memory file system or it runs in a mode where
+     * the file system is not supported (mock mode and Gramine).
+     *
+     * @throws IllegalStateException If the host has not been started.
+     */
+    @Synchronized
+    fun snapshotInMemoryFileSystem(): ByteArray? {
+        hostStateManager.checkStateIs<Started> { "The enclave host has not been started." }
+        return enclaveHandle.snapshotInMemoryFileSystem()
+    }
+
     /**
      * Perform a fresh attestation with the attestation service. On successful completion the [enclaveInstanceInfo]
      * property may be updated to a newer one. If so make sure to provide this to end clients.
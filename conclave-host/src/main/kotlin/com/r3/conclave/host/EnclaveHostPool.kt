@@ -0,0 +1,287 @@
+package com.r3.conclave.host
+
+import com.r3.conclave.host.internal.EnclaveScanner
+import com.r3.conclave.host.internal.debug
+import com.r3.conclave.host.internal.loggerFor
+import java.time.Duration
+import java.util.concurrent.ExecutorService
+import java.util.concurrent.Executors
+import java.util.concurrent.LinkedBlockingDeque
+import java.util.concurrent.RejectedExecutionException
+import java.util.concurrent.atomic.AtomicInteger
+import java.util.concurrent.atomic.AtomicLong
+
+/**
+ * Keeps a number of loaded [EnclaveHost]s of the same enclave ready, so that [acquire] can hand one out without
+ * waiting for the enclave to be created. Loading an enclave adds its whole heap to the enclave page cache and creates
+ * the enclave JVM, which can take seconds for large enclaves.
+ *
+ * The hosts which are handed out are replaced in the background. A host returned by [acquire] belongs to the caller,
+ * who must start it and close it when done with it, as with [EnclaveHost.load]. If the pool is empty, [acquire]
+ * loads the enclave itself.
+ *
+ * If [attestationParameters] is provided, the enclaves in the pool are also initialised and their
+ * [com.r3.conclave.enclave.Enclave.onWarmUp] hook is called, and the hosts must then be started with the same
+ * attestation parameters. Only the filesystem setup and [com.r3.conclave.enclave.Enclave.onStartup] are left to
+ * [EnclaveHost.start].
+ *
+ * Note that every enclave in the pool holds its heap in the enclave page cache, which is shared by all the enclaves
+ * of the machine.
+ *
+ * @property size The number of loaded enclaves the pool keeps ready.
+ */
+class EnclaveHostPool private constructor(
+    private val scanResult: EnclaveScanner.ScanResult,
+    val size: Int,
+    private val initialise: Boolean,
+    private val attestationParameters: AttestationParameters?,
+    private val mockConfiguration: MockConfiguration?
+) : AutoCloseable {
+    /**
+     * Suppress kotlin specific companion objects from our API documentation.
+     * The public items within the object are still published in the documentation.
+     * @suppress
+     */
+    companion object {
+        private val log = loggerFor<EnclaveHostPool>()
+
+        /**
+         * Create a pool of loaded enclaves for the given enclave class name.
+         *
+         * @param enclaveClassName The name of the enclave class to load.
+         * @param size The number of enclaves to keep ready.
+         *
+         * @throws IllegalArgumentException if there is no enclave file for the given class name or if [size] is not
+         *                                  positive.
+         * @throws IllegalStateException if more than one enclave file is found.
+         */
+        @JvmStatic
+        fun create(enclaveClassName: String, size: Int): EnclaveHostPool {
+            return EnclaveHostPool(EnclaveScanner().findEnclave(enclaveClassName), size, false, null, null)
+        }
+
+        /**
+         * Create a pool of initialised and warmed up enclaves for the given enclave class name.
+         *
+         * @param enclaveClassName The name of the enclave class to load.
+         * @param size The number of enclaves to keep ready.
+         * @param attestationParameters The attestation parameters which the hosts will be started with. See
+         *                              [EnclaveHost.start].
+         *
+         * @throws IllegalArgumentException if there is no enclave file for the given class name or if [size] is not
+         *                                  positive.
+         * @throws IllegalStateException if more than one enclave file is found.
+         */
+        @JvmStatic
+        fun create(
+            enclaveClassName: String,
+            size: Int,
+            attestationParameters: AttestationParameters?
+        ): EnclaveHostPool {
+            return EnclaveHostPool(
+                EnclaveScanner().findEnclave(enclaveClassName),
+                size,
+                true,
+                attestationParameters,
+                null
+            )
+        }
+
+        /**
+         * Create a pool of enclaves for the given enclave class name.
+         *
+         * @param enclaveClassName The name of the enclave class to load.
+         * @param size The number of enclaves to keep ready.
+         * @param initialise Whether the enclaves should also be initialised and warmed up, in which case the hosts
+         *                   must be started with [attestationParameters].
+         * @param attestationParameters The attestation parameters which the hosts will be started with. This is
+         *                              ignored if [initialise] is false.
+         * @param mockConfiguration Defines the configuration to use when loading the enclave in mock mode. This
+         *                          parameter is ignored when not using mock mode.
+         *
+         * @throws IllegalArgumentException if there is no enclave file for the given class name or if [size] is not
+         *                                  positive.
+         * @throws IllegalStateException if more than one enclave file is found.
+         */
+        @JvmStatic
+        fun create(
+            enclaveClassName: String,
+            size: Int,
+            initialise: Boolean,
+            attestationParameters: AttestationParameters?,
+            mockConfiguration: MockConfiguration?
+        ): EnclaveHostPool {
+            return EnclaveHostPool(
+                EnclaveScanner().findEnclave(enclaveClassName),
+                size,
+                initialise,
+                attestationParameters,
+                mockConfiguration
+            )
+        }
+    }
+
+    /**
+     * Counters of the pool since it was created.
+     *
+     * @property hits The number of [acquire] calls which were given a ready enclave.
+     * @property misses The number of [acquire] calls which had to load the enclave themselves.
+     * @property created The number of enclaves which were loaded, by the pool or by [acquire].
+     * @property failed The number of enclaves which failed to load.
+     * @property averageCreateTime The average time it took to load, and initialise if enabled, an enclave.
+     * @property maxCreateTime The longest time it took to load, and initialise if enabled, an enclave.
+     * @property ready The number of enclaves ready to be handed out.
+     */
+    data class Metrics(
+        val hits: Long,
+        val misses: Long,
+        val created: Long,
+        val failed: Long,
+        val averageCreateTime: Duration,
+        val maxCreateTime: Duration,
+        val ready: Int
+    )
+
+    private val ready = LinkedBlockingDeque<EnclaveHost>()
+    // Enclaves which are queued or being created by the background thread
+    private val pending = AtomicInteger()
+    private val hits = AtomicLong()
+    private val misses = AtomicLong()
+    private val created = AtomicLong()
+    private val failed = AtomicLong()
+    private val totalCreateNanos = AtomicLong()
+    private val maxCreateNanos = AtomicLong()
+
+    // Enclaves are created one at a time, so that replenishing the pool doesn't compete with the enclaves in use
+    // for the CPU and the enclave page cache.
+    private val executor: ExecutorService = Executors.newSingleThreadExecutor { task ->
+        Thread(task, "Conclave enclave pool").apply { isDaemon = true }
+    }
+
+    @Volatile
+    private var closed = false
+
+    init {
+        require(size > 0) { "The pool size must be positive." }
+        replenish()
+    }
+
+    /**
+     * The counters of the pool.
+     */
+    val metrics: Metrics
+        get() {
+            val count = created.get()
+            return Metrics(
+                hits.get(),
+                misses.get(),
+                count,
+                failed.get(),
+                Duration.ofNanos(if (count == 0L) 0 else totalCreateNanos.get() / count),
+                Duration.ofNanos(maxCreateNanos.get()),
+                ready.size
+            )
+        }
+
+    /**
+     * Take a loaded enclave out of the pool, or load one if the pool is empty. The pool is replenished in the
+     * background.
+     *
+     * @return An [EnclaveHost] which hasn't been started. The caller must start it and close it.
+     *
+     * @throws EnclaveLoadException if the pool is empty and the enclave does not load correctly.
+     * @throws PlatformSupportException if the pool is empty and the platform does not support the enclave mode.
+     * @throws IllegalStateException if the pool has been closed.
+     */
+    @Throws(EnclaveLoadException::class, PlatformSupportException::class)
+    fun acquire(): EnclaveHost {
+        check(!closed) { "The pool has been closed." }
+        val host = ready.pollFirst()
+        replenish()
+        if (host != null) {
+            hits.incrementAndGet()
+            return host
+        }
+        misses.incrementAndGet()
+        return createHost()
+    }
+
+    /**
+     * Destroys the enclaves which are still in the pool. Hosts which have been handed out are not affected.
+     */
+    override fun close() {
+        closed = true
+        executor.shutdownNow()
+        while (true) {
+            val host = ready.pollFirst() ?: break
+            discard(host)
+        }
+    }
+
+    private fun replenish() {
+        while (!closed) {
+            val current = pending.get()
+            if (ready.size + current >= size) return
+            if (!pending.compareAndSet(current, current + 1)) continue
+            try {
+                executor.execute(::createPooledHost)
+            } catch (e: RejectedExecutionException) {
+                pending.decrementAndGet()
+                return
+            }
+        }
+    }
+
+    private fun createPooledHost() {
+        try {
+            if (closed) return
+            val host = try {
+                createHost()
+            } catch (e: Exception) {
+                // Don't retry straight away, the next acquire will
+                log.warn("Unable to create an enclave for the pool", e)
+                return
+            }
+            ready.addLast(host)
+            // The host may have been added after close emptied the pool
+            if (closed && ready.remove(host)) {
+                discard(host)
+            }
+        } finally {
+            pending.decrementAndGet()
+        }
+    }
+
+    private fun createHost(): EnclaveHost {
+        val start = System.nanoTime()
+        val host = try {
+            EnclaveHost.createEnclaveHost(scanResult, mockConfiguration).also { host ->
+                if (initialise) {
+                    try {
+                        host.internalPrepare(attestationParameters)
+                    } catch (e: Exception) {
+                        discard(host)
+                        throw e
+                    }
+                }
+            }
+        } catch (e: Exception) {
+            failed.incrementAndGet()
+            throw e
+        }
+        val nanos = System.nanoTime() - start
+        created.incrementAndGet()
+        totalCreateNanos.addAndGet(nanos)
+        maxCreateNanos.accumulateAndGet(nanos) { a, b -> maxOf(a, b) }
+        log.debug { "Created enclave ${scanResult.enclaveClassName} in ${nanos / 1_000_000} ms" }
+        return host
+    }
+
+    private fun discard(host: EnclaveHost) {
+        try {
+            host.internalDiscard()
+        } catch (e: Exception) {
+            log.debug("Unable to destroy pooled enclave", e)
+        }
+    }
+}
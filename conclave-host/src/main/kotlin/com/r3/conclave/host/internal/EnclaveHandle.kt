@@ -50,6 +50,11 @@ interface EnclaveHandle {
      */
     fun destroy()
 
+    /**
+     * How long the startup phases of the enclave took, or null if they are not profiled in this mode.
+     */
+    val startupProfile: EnclaveStartupProfile? get() = null
+
     /**
      * Initialises the enclave by instantiating the specified class.
      * This is not currently used in mock mode.
@@ -59,15 +64,32 @@ interface EnclaveHandle {
     }
 
     /**
-     * Starts the enclave, passing the sealed state blob and calling the onStartup hook.
+     * Runs the warm-up hook of the enclave. This must be called after [initializeEnclave] and before [startEnclave].
      */
-    fun startEnclave(sealedState: ByteArray?) {
-        val bufferSize = nullableSize(sealedState) { it.size }
-        val sealedStateBuffer = ByteBuffer.allocate(bufferSize).apply {
-            putNullable(sealedState) { put(it) }
+    fun warmUpEnclave() {
+        enclaveInterface.executeOutgoingCall(EnclaveCallType.WARM_UP)
+    }
+
+    /**
+     * Starts the enclave, passing the sealed state blob and the snapshot of the in-memory filesystem, and calling
+     * the onStartup hook.
+     */
+    fun startEnclave(sealedState: ByteArray?, inMemorySnapshot: ByteArray?) {
+        val bufferSize = nullableSize(sealedState) { it.intLengthPrefixSize } +
+                nullableSize(inMemorySnapshot) { it.intLengthPrefixSize }
+        val startBuffer = ByteBuffer.allocate(bufferSize).apply {
+            putNullable(sealedState) { putIntLengthPrefixBytes(it) }
+            putNullable(inMemorySnapshot) { putIntLengthPrefixBytes(it) }
             rewind()
         }
-        enclaveInterface.executeOutgoingCall(EnclaveCallType.START_ENCLAVE, sealedStateBuffer)
+        enclaveInterface.executeOutgoingCall(EnclaveCallType.START_ENCLAVE, startBuffer)
+    }
+
+    /**
+     * Request a sealed snapshot of the in-memory filesystem from the enclave.
+     */
+    fun snapshotInMemoryFileSystem(): ByteArray? {
+        return enclaveInterface.executeOutgoingCall(EnclaveCallType.SNAPSHOT_IN_MEMORY_FILE_SYSTEM)?.getRemainingBytes()
     }
 
     /**
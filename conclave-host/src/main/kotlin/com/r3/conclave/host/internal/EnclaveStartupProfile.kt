@@ -0,0 +1,32 @@
+package com.r3.conclave.host.internal
+
+import java.time.Duration
+
+/**
+ * How long each phase of the startup of an enclave took, or null for the phases which haven't run.
+ *
+ * @property load Loading the enclave image, which includes adding the enclave heap pages.
+ * @property initialise Exchanging the configuration with the enclave.
+ * @property isolateCreation Creating the isolate of the enclave JVM.
+ * @property firstEntry The first call into the enclave JVM, which creates the isolate unless it already exists.
+ * @property fileSystem Mounting or formatting the in-memory and persistent filesystems.
+ * @property warmUp Running the warm-up hook of the enclave.
+ */
+data class EnclaveStartupProfile(
+    val load: Duration?,
+    val initialise: Duration?,
+    val isolateCreation: Duration?,
+    val firstEntry: Duration?,
+    val fileSystem: Duration?,
+    val warmUp: Duration?
+) {
+    companion object {
+        /**
+         * @param nanos The array returned by [Native.getStartupProfile].
+         */
+        fun fromNative(nanos: LongArray, warmUp: Duration?): EnclaveStartupProfile {
+            fun phase(index: Int): Duration? = nanos.getOrNull(index)?.takeIf { it >= 0 }?.let(Duration::ofNanos)
+            return EnclaveStartupProfile(phase(0), phase(1), phase(2), phase(3), phase(4), warmUp)
+        }
+    }
+}
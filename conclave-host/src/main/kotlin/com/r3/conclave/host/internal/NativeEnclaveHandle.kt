@@ -13,6 +13,7 @@ import java.nio.ByteBuffer
 import java.nio.file.Files
 import java.nio.file.Path
 import java.nio.file.StandardCopyOption.REPLACE_EXISTING
+import java.time.Duration
 import kotlin.io.path.deleteIfExists
 
 class NativeEnclaveHandle(
@@ -24,6 +25,7 @@ class NativeEnclaveHandle(
     private val enclaveId: Long
     override val enclaveInterface: NativeHostEnclaveInterface
     override lateinit var quotingService: EnclaveQuoteService
+    private var warmUpDuration: Duration? = null
 
     /**
      * Handler for servicing requests from the enclave for signed quotes.
@@ -47,6 +49,8 @@ class NativeEnclaveHandle(
         enclaveId = Native.createEnclave(enclaveFile.toString(), enclaveMode != EnclaveMode.RELEASE)
         enclaveInterface = NativeHostEnclaveInterface(enclaveId)
         NativeApi.registerHostEnclaveInterface(enclaveId, enclaveInterface)
+        // Create the isolate now, rather than in the first call into the enclave
+        Native.warmUpEnclave(enclaveId)
 
         enclaveInterface.registerCallHandler(HostCallType.GET_SIGNED_QUOTE, GetSignedQuoteHandler())
     }
@@ -58,6 +62,15 @@ class NativeEnclaveHandle(
         }
     }
 
+    override fun warmUpEnclave() {
+        val start = System.nanoTime()
+        super.warmUpEnclave()
+        warmUpDuration = Duration.ofNanos(System.nanoTime() - start)
+    }
+
+    override val startupProfile: EnclaveStartupProfile
+        get() = EnclaveStartupProfile.fromNative(Native.getStartupProfile(enclaveId), warmUpDuration)
+
     /** Get the appropriate quoting service. */
     private fun getQuotingService(attestationParameters: AttestationParameters?): EnclaveQuoteService {
         /** Ignore the attestation parameters in simulation mode. */
@@ -68,13 +81,18 @@ class NativeEnclaveHandle(
         /** If not in simulation mode, ensure that the attestation parameters are not null. */
         require(attestationParameters != null)
 
-        return when(attestationParameters) {
+        val quoteService = when(attestationParameters) {
             is AttestationParameters.EPID -> EnclaveQuoteServiceEPID(attestationParameters)
             is AttestationParameters.DCAP -> EnclaveQuoteServiceDCAP
         }
+        /** Re-attestations of the enclave reuse its quote rather than going through the quoting enclave each time. */
+        return CachingEnclaveQuoteService(quoteService)
     }
 
     override fun destroy() {
+        if (this::quotingService.isInitialized) {
+            (quotingService as? CachingEnclaveQuoteService)?.close()
+        }
         Native.destroyEnclave(enclaveId)
         try {
             enclaveFile.deleteIfExists()
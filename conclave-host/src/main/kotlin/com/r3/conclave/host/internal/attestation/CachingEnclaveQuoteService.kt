@@ -0,0 +1,114 @@
+package com.r3.conclave.host.internal.attestation
+
+import com.r3.conclave.common.SHA256Hash
+import com.r3.conclave.common.internal.*
+import com.r3.conclave.host.internal.loggerFor
+import java.nio.ByteBuffer
+import java.time.Clock
+import java.time.Duration
+import java.time.Instant
+import java.util.concurrent.Executors
+import java.util.concurrent.ScheduledFuture
+import java.util.concurrent.TimeUnit
+
+/**
+ * [EnclaveQuoteService] which reuses the signed quotes of [delegate] for the same report body, that is the same
+ * enclave, report data and TCB level (CPUSVN). The report data only changes with the enclave keys, so periodic
+ * re-attestations of an enclave don't need the quoting enclave.
+ *
+ * A quote is reused for at most [rotationPeriod]. With [preGenerate], a quote which is still in use is replaced in
+ * the background before it is due for rotation, by quoting its report again. The report remains valid for the
+ * quoting enclave as long as the platform isn't restarted. If that fails, for example because the quoting enclave
+ * has been updated, the quote is dropped and the next request goes to the quoting enclave.
+ *
+ * There is one instance per enclave, which must be closed when the enclave is destroyed.
+ */
+class CachingEnclaveQuoteService(
+    private val delegate: EnclaveQuoteService,
+    private val rotationPeriod: Duration = DEFAULT_ROTATION_PERIOD,
+    private val preGenerate: Boolean = true,
+    private val clock: Clock = Clock.systemUTC()
+) : EnclaveQuoteService(), AutoCloseable {
+    companion object {
+        val DEFAULT_ROTATION_PERIOD: Duration = Duration.ofHours(1)
+
+        /** The quotes are renewed when this fraction of the rotation period is left. */
+        private const val PRE_GENERATION_MARGIN = 0.2
+        private const val MAX_ENTRIES = 4
+
+        private val logger = loggerFor<CachingEnclaveQuoteService>()
+
+        private val scheduler = Executors.newSingleThreadScheduledExecutor { task ->
+            Thread(task, "Conclave quote pre-generation").apply { isDaemon = true }
+        }
+    }
+
+    private class Entry(val report: ByteArray, val quote: ByteArray, val createdAt: Instant) {
+        @Volatile
+        var usedSinceRenewal = true
+        var renewal: ScheduledFuture<*>? = null
+    }
+
+    // Access ordered, so that the least recently used quote is evicted
+    private val entries = object : LinkedHashMap<SHA256Hash, Entry>(MAX_ENTRIES, 0.75f, true) {
+        override fun removeEldestEntry(eldest: MutableMap.MutableEntry<SHA256Hash, Entry>): Boolean {
+            val evict = size > MAX_ENTRIES
+            if (evict) eldest.value.renewal?.cancel(false)
+            return evict
+        }
+    }
+    private var closed = false
+
+    override fun getQuotingEnclaveInfo(): Cursor<SgxTargetInfo, ByteBuffer> = delegate.getQuotingEnclaveInfo()
+
+    override fun retrieveQuote(report: ByteCursor<SgxReport>): ByteCursor<SgxSignedQuote> {
+        val key = SHA256Hash.hash(report[SgxReport.body].bytes)
+        synchronized(entries) {
+            val entry = entries[key]
+            if (entry != null && clock.instant() < entry.createdAt + rotationPeriod) {
+                entry.usedSinceRenewal = true
+                return Cursor.wrap(SgxSignedQuote, entry.quote.copyOf())
+            }
+        }
+
+        val quote = delegate.retrieveQuote(report).bytes
+        store(key, Entry(report.bytes, quote, clock.instant()))
+        return Cursor.wrap(SgxSignedQuote, quote.copyOf())
+    }
+
+    private fun store(key: SHA256Hash, entry: Entry) {
+        synchronized(entries) {
+            if (closed) return
+            entries.put(key, entry)?.renewal?.cancel(false)
+            if (preGenerate) {
+                val delay = rotationPeriod.toMillis() - (rotationPeriod.toMillis() * PRE_GENERATION_MARGIN).toLong()
+                entry.renewal = scheduler.schedule(Runnable { renew(key, entry) }, delay, TimeUnit.MILLISECONDS)
+            }
+        }
+    }
+
+    private fun renew(key: SHA256Hash, entry: Entry) {
+        synchronized(entries) {
+            if (entries[key] !== entry) return
+            // Quotes which nobody asked for during a whole period are left to expire
+            if (!entry.usedSinceRenewal) return
+        }
+        try {
+            val quote = delegate.retrieveQuote(Cursor.wrap(SgxReport, entry.report)).bytes
+            store(key, Entry(entry.report, quote, clock.instant()).apply { usedSinceRenewal = false })
+        } catch (e: Exception) {
+            logger.debug("Unable to pre-generate quote, it will be requested on demand", e)
+            synchronized(entries) {
+                if (entries[key] === entry) entries.remove(key)
+            }
+        }
+    }
+
+    override fun close() {
+        synchronized(entries) {
+            closed = true
+            entries.values.forEach { it.renewal?.cancel(false) }
+            entries.clear()
+        }
+    }
+}
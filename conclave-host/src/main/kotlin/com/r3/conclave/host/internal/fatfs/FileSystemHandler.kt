@@ -1,6 +1,7 @@
 package com.r3.conclave.host.internal.fatfs
 
 import com.r3.conclave.common.EnclaveMode
+import com.r3.conclave.host.internal.loggerFor
 import java.io.RandomAccessFile
 import java.nio.file.Path
 import kotlin.io.path.pathString
@@ -15,6 +16,20 @@ The read/write functions are called by C++ Host JNI code (cpp/fatfs/host/persist
  encrypted and shuffled sectors (i.e. fixed-size chunks) of bytes into the files representing the filesystems.
 The getDriveSize function is also called by the C++ Host JNI code during the initialization of the filesystem in the Enclave,
 this would indicate that a persistentFileSystemSize bigger than 0 has been provided in the Enclave configuration.
+The size of the filesystem sectors is chosen by the Enclave when the file is created and stored in the header
+(version 2), files with a version 1 header have been formatted with 512 bytes sectors. The Enclave reads it back
+with getSectorSize.
+In the same way the Enclave chooses the size in bytes of the groups of consecutive sectors that are shuffled together
+(version 3), so that logically sequential sectors stay contiguous in the file. Files with an older header have been
+written with each sector shuffled on its own, which is represented by a group size of 0 (see getShuffleGroupSize).
+Finally the Enclave chooses the layout of the sectors in the file (version 4): 0 when each sector has a fixed position,
+1 when the sectors are appended to a log. Files with an older header use the first layout (see getLayout).
+
+The files are not opened in synchronous mode: the Enclave keeps a journal at the end of the file and calls sync
+when its records need to be durable, so that many writes share a single flush to the storage device.
+Reads past the end of the file (e.g. of a journal that has never been written) return zeros.
+The sectors freed by the filesystem are trimmed by the Enclave, and their storage is released by punching holes
+in the file (see trim), so that the file only takes space for the sectors in use.
 
 Note that while the creation of these files is directly handled by the Host during the startup of the Enclave,
    the getDriveSize/read/write calls are triggered only by OCalls from the Enclave.
@@ -24,15 +39,31 @@ Host-Enclave configurations are correct, see all the branch conditions in that f
 
 class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val enclaveMode: EnclaveMode) {
 
-    private class FileSystemFile(val file: RandomAccessFile) {
+    private class FileSystemFile(val path: Path, val file: RandomAccessFile) {
         //  This is needed when using read/write functions
         //  as the header bytes are not included in the offset provided as input of those functions
         var headerSize: Int = 0
+        var sectorSize: Int = VERSION_1_SECTOR_SIZE
+        var shuffleGroupSize: Int = VERSION_2_SHUFFLE_GROUP_SIZE
+        var layout: Int = VERSION_3_LAYOUT
+        //  Cleared when the Host filesystem does not support holes, so that the following trims are skipped
+        var holesSupported: Boolean = true
     }
 
     companion object {
+        private val logger = loggerFor<FileSystemHandler>()
+
         //                                Header size      Header version    EnclaveMode       FileSystem size
         const val VERSION_1_HEADER_SIZE = Int.SIZE_BYTES + Byte.SIZE_BYTES + Byte.SIZE_BYTES + Long.SIZE_BYTES
+        //                                Version 1 header        Sector size
+        const val VERSION_2_HEADER_SIZE = VERSION_1_HEADER_SIZE + Int.SIZE_BYTES
+        //                                Version 2 header        Shuffle group size
+        const val VERSION_3_HEADER_SIZE = VERSION_2_HEADER_SIZE + Int.SIZE_BYTES
+        //                                Version 3 header        Layout
+        const val VERSION_4_HEADER_SIZE = VERSION_3_HEADER_SIZE + Int.SIZE_BYTES
+        const val VERSION_1_SECTOR_SIZE = 512
+        const val VERSION_2_SHUFFLE_GROUP_SIZE = 0
+        const val VERSION_3_LAYOUT = 0
     }
 
     private val filesystemFiles: MutableList<FileSystemFile>
@@ -42,12 +73,17 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
     private external fun setup()
     private external fun cleanup()
 
+    //  punchHole() is a native call implemented in the same JNI C++ layer, as the JDK cannot release
+    //  the storage of a range of a file. It returns 0 on success, 1 when the filesystem does not support holes
+    //  and -1 on any other failure.
+    private external fun punchHole(path: String, offset: Long, length: Long): Int
+
     init {
         setup()
         filesystemFiles = mutableListOf()
 
         enclaveFileSystemFilePaths.forEach { path ->
-            filesystemFiles.add(FileSystemFile(RandomAccessFile(path.pathString, "rws")))
+            filesystemFiles.add(FileSystemFile(path, RandomAccessFile(path.pathString, "rw")))
         }
     }
 
@@ -60,7 +96,13 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
 
     @Suppress("unused")
     @Synchronized
-    fun getDriveSize(drive: Int, enclaveFileSystemSizeFromConfig: Long): Long {
+    fun getDriveSize(
+        drive: Int,
+        enclaveFileSystemSizeFromConfig: Long,
+        sectorSizeForNewFile: Int,
+        shuffleGroupSizeForNewFile: Int,
+        layoutForNewFile: Int
+    ): Long {
         //  Calling this function can only happen when persistentFileSystemSize in the Enclave
         //  configuration is bigger than 0, i.e. when the Enclave wants a persisted filesystem
         val filesystemFile: FileSystemFile? = filesystemFiles.getOrNull(drive)
@@ -74,13 +116,19 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
 
         if (filesystemFile.file.length() == 0L) {
             //  The Host has correctly provided a path and hence an empty file was generated in the init.
-            //    We store EnclaveMode and enclaveFileSystemSize in the header and return 0, to tell the Enclave to
-            //    format the filesystem file.
-            filesystemFile.headerSize = VERSION_1_HEADER_SIZE
-            filesystemFile.file.writeInt(VERSION_1_HEADER_SIZE)
-            filesystemFile.file.write(1)
+            //    We store EnclaveMode, enclaveFileSystemSize, the sector size, the shuffle group size and the layout
+            //    in the header and return 0, to tell the Enclave to format the filesystem file.
+            filesystemFile.headerSize = VERSION_4_HEADER_SIZE
+            filesystemFile.sectorSize = sectorSizeForNewFile
+            filesystemFile.shuffleGroupSize = shuffleGroupSizeForNewFile
+            filesystemFile.layout = layoutForNewFile
+            filesystemFile.file.writeInt(VERSION_4_HEADER_SIZE)
+            filesystemFile.file.write(4)
             filesystemFile.file.write(enclaveMode.ordinal)
             filesystemFile.file.writeLong(enclaveFileSystemSizeFromConfig)
+            filesystemFile.file.writeInt(sectorSizeForNewFile)
+            filesystemFile.file.writeInt(shuffleGroupSizeForNewFile)
+            filesystemFile.file.writeInt(layoutForNewFile)
             return 0
         } else {
             //  The Host has correctly provided a path and such file already existed, so it was only opened in the init.
@@ -90,11 +138,14 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
             val headerSize = filesystemFile.file.readInt()
             val version = filesystemFile.file.read()
 
-            check(version == 1) {
+            check(version in 1..4) {
                 "The filesystem file is set with a non valid version"
             }
             val fileEnclaveModeByte = filesystemFile.file.read()
             val fileSystemSizeFromHeader = filesystemFile.file.readLong()
+            filesystemFile.sectorSize = if (version == 1) VERSION_1_SECTOR_SIZE else filesystemFile.file.readInt()
+            filesystemFile.shuffleGroupSize = if (version <= 2) VERSION_2_SHUFFLE_GROUP_SIZE else filesystemFile.file.readInt()
+            filesystemFile.layout = if (version <= 3) VERSION_3_LAYOUT else filesystemFile.file.readInt()
 
             filesystemFile.headerSize = headerSize
             val fileEnclaveMode = EnclaveMode.values()[fileEnclaveModeByte]
@@ -112,6 +163,27 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
     }
 
 
+    @Suppress("unused")
+    @Synchronized
+    fun getSectorSize(drive: Int): Int {
+        return filesystemFiles[drive].sectorSize
+    }
+
+
+    @Suppress("unused")
+    @Synchronized
+    fun getShuffleGroupSize(drive: Int): Int {
+        return filesystemFiles[drive].shuffleGroupSize
+    }
+
+
+    @Suppress("unused")
+    @Synchronized
+    fun getLayout(drive: Int): Int {
+        return filesystemFiles[drive].layout
+    }
+
+
     @Suppress("unused")
     @Synchronized
     fun read(drive: Int, sectorId: Long, numSectors: Int, sectorSize: Int): ByteArray {
@@ -122,8 +194,10 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
         val buffer = ByteArray(readSize)
 
         with(fileSystemFile.file) {
-            seek(position + fileSystemFile.headerSize)
-            readFully(buffer)
+            val filePosition = position + fileSystemFile.headerSize
+            val available = (length() - filePosition).coerceIn(0L, readSize.toLong()).toInt()
+            seek(filePosition)
+            readFully(buffer, 0, available)
         }
         return buffer
     }
@@ -134,11 +208,49 @@ class FileSystemHandler(enclaveFileSystemFilePaths: List<Path>, private val encl
     fun write(drive: Int, inputBuffer: ByteArray, sectorSize: Int, sector: Long): Int {
         val fileSystemFile = filesystemFiles[drive]
 
+        //  The input buffer can contain more than one sector
         with(fileSystemFile.file) {
             val position = sector * sectorSize
             seek(position + fileSystemFile.headerSize)
-            write(inputBuffer, 0, sectorSize)
+            write(inputBuffer)
+        }
+        return inputBuffer.size
+    }
+
+
+    @Suppress("unused")
+    @Synchronized
+    fun sync(drive: Int): Int {
+        filesystemFiles[drive].file.channel.force(false)
+        return 0
+    }
+
+
+    @Suppress("unused")
+    @Synchronized
+    fun trim(drive: Int, sectorId: Long, numSectors: Long, sectorSize: Int): Int {
+        val fileSystemFile = filesystemFiles[drive]
+
+        //  The storage is released only where the file has been written, and the Host filesystem might not
+        //  support holes at all: in that case the sectors are simply left in the file.
+        val position = sectorId * sectorSize + fileSystemFile.headerSize
+        val length = (numSectors * sectorSize).coerceAtMost(fileSystemFile.file.length() - position)
+
+        if (length <= 0 || !fileSystemFile.holesSupported) {
+            return 0
+        }
+        return when (punchHole(fileSystemFile.path.pathString, position, length)) {
+            0 -> 0
+            1 -> {
+                logger.info("The filesystem of ${fileSystemFile.path} does not support holes, " +
+                        "the storage of the sectors freed by the enclave will not be released")
+                fileSystemFile.holesSupported = false
+                0
+            }
+            else -> {
+                logger.warn("Unable to release $length bytes at offset $position of ${fileSystemFile.path}")
+                -1
+            }
         }
-        return sectorSize
     }
 }
@@ -0,0 +1,143 @@
+package com.r3.conclave.host
+
+import com.r3.conclave.common.EnclaveMode
+import com.r3.conclave.enclave.Enclave
+import org.assertj.core.api.Assertions.assertThat
+import org.assertj.core.api.Assertions.assertThatIllegalArgumentException
+import org.assertj.core.api.Assertions.assertThatIllegalStateException
+import org.junit.jupiter.api.AfterEach
+import org.junit.jupiter.api.BeforeEach
+import org.junit.jupiter.api.Test
+import java.time.Duration
+import java.util.concurrent.CountDownLatch
+import java.util.concurrent.atomic.AtomicInteger
+
+class EnclaveHostPoolTest {
+    class PoolEnclave : Enclave() {
+        companion object {
+            /** Holds back the enclaves created by the pool, so that the tests can empty it. */
+            @Volatile
+            var poolGate = CountDownLatch(0)
+            val warmUps = AtomicInteger()
+        }
+
+        init {
+            if (Thread.currentThread().name == "Conclave enclave pool") poolGate.await()
+        }
+
+        override fun onWarmUp() {
+            warmUps.incrementAndGet()
+        }
+
+        override fun receiveFromUntrustedHost(bytes: ByteArray): ByteArray = bytes + 1
+    }
+
+    private val pools = ArrayList<EnclaveHostPool>()
+    private val hosts = ArrayList<EnclaveHost>()
+
+    @BeforeEach
+    fun reset() {
+        PoolEnclave.poolGate = CountDownLatch(0)
+        PoolEnclave.warmUps.set(0)
+    }
+
+    @AfterEach
+    fun cleanUp() {
+        PoolEnclave.poolGate.countDown()
+        hosts.forEach(EnclaveHost::close)
+        pools.forEach(EnclaveHostPool::close)
+    }
+
+    @Test
+    fun `acquire hands out a ready enclave and replenishes the pool`() {
+        val pool = createPool(2)
+        awaitReady(pool, 2)
+        val host = acquire(pool)
+        assertThat(pool.metrics.hits).isEqualTo(1)
+        assertThat(pool.metrics.misses).isEqualTo(0)
+
+        awaitReady(pool, 2)
+        assertThat(pool.metrics.created).isEqualTo(3)
+        assertThat(pool.metrics.failed).isEqualTo(0)
+        assertThat(pool.metrics.maxCreateTime).isGreaterThanOrEqualTo(pool.metrics.averageCreateTime)
+
+        host.start(null, null, null) { }
+        assertThat(host.enclaveMode).isEqualTo(EnclaveMode.MOCK)
+        assertThat(host.callEnclave(byteArrayOf(1))).isEqualTo(byteArrayOf(1, 1))
+    }
+
+    @Test
+    fun `hosts handed out are distinct`() {
+        val pool = createPool(2)
+        awaitReady(pool, 2)
+        val host1 = acquire(pool)
+        val host2 = acquire(pool)
+        assertThat(host1).isNotSameAs(host2)
+        assertThat(host1.mockEnclave).isNotSameAs(host2.mockEnclave)
+    }
+
+    @Test
+    fun `acquire loads the enclave itself when the pool is empty`() {
+        PoolEnclave.poolGate = CountDownLatch(1)
+        val pool = createPool(1)
+        val host = acquire(pool)
+        assertThat(pool.metrics.hits).isEqualTo(0)
+        assertThat(pool.metrics.misses).isEqualTo(1)
+        assertThat(pool.metrics.created).isEqualTo(1)
+        host.start(null, null, null) { }
+        assertThat(host.callEnclave(byteArrayOf(2))).isEqualTo(byteArrayOf(2, 1))
+
+        PoolEnclave.poolGate.countDown()
+        awaitReady(pool, 1)
+        acquire(pool)
+        assertThat(pool.metrics.hits).isEqualTo(1)
+    }
+
+    @Test
+    fun `initialised pool warms the enclaves up`() {
+        val pool = createPool(1, initialise = true)
+        awaitReady(pool, 1)
+        assertThat(PoolEnclave.warmUps.get()).isEqualTo(1)
+
+        val host = acquire(pool)
+        host.start(null, null, null) { }
+        assertThat(PoolEnclave.warmUps.get()).isGreaterThanOrEqualTo(1)
+        assertThat(host.callEnclave(byteArrayOf(3))).isEqualTo(byteArrayOf(3, 1))
+    }
+
+    @Test
+    fun `close destroys the ready enclaves and rejects acquire`() {
+        val pool = createPool(2)
+        awaitReady(pool, 2)
+        val host = acquire(pool)
+        awaitReady(pool, 2)
+        pool.close()
+        assertThat(pool.metrics.ready).isEqualTo(0)
+        assertThatIllegalStateException().isThrownBy { pool.acquire() }.withMessage("The pool has been closed.")
+
+        // The hosts already handed out are not affected
+        host.start(null, null, null) { }
+        assertThat(host.callEnclave(byteArrayOf(4))).isEqualTo(byteArrayOf(4, 1))
+    }
+
+    @Test
+    fun `pool size must be positive`() {
+        assertThatIllegalArgumentException().isThrownBy {
+            EnclaveHostPool.create(PoolEnclave::class.java.name, 0)
+        }.withMessage("The pool size must be positive.")
+    }
+
+    private fun createPool(size: Int, initialise: Boolean = false): EnclaveHostPool {
+        return EnclaveHostPool.create(PoolEnclave::class.java.name, size, initialise, null, null).also { pools += it }
+    }
+
+    private fun acquire(pool: EnclaveHostPool): EnclaveHost = pool.acquire().also { hosts += it }
+
+    private fun awaitReady(pool: EnclaveHostPool, count: Int) {
+        val deadline = System.nanoTime() + Duration.ofSeconds(30).toNanos()
+        while (pool.metrics.ready < count) {
+            check(System.nanoTime() < deadline) { "Timed out waiting for $count ready enclaves" }
+            Thread.sleep(10)
+        }
+    }
+}
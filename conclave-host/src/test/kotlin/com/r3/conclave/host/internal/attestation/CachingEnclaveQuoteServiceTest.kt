@@ -0,0 +1,176 @@
+package com.r3.conclave.host.internal.attestation
+
+import com.r3.conclave.common.internal.*
+import org.assertj.core.api.Assertions.assertThat
+import org.junit.jupiter.api.AfterEach
+import org.junit.jupiter.api.Test
+import java.nio.ByteBuffer
+import java.time.Clock
+import java.time.Duration
+import java.time.Instant
+import java.time.ZoneId
+import java.time.ZoneOffset
+import java.util.concurrent.atomic.AtomicInteger
+import kotlin.random.Random
+
+class CachingEnclaveQuoteServiceTest {
+    private class FakeClock : Clock() {
+        @Volatile
+        var now: Instant = Instant.EPOCH
+
+        fun advance(duration: Duration) {
+            now += duration
+        }
+
+        override fun instant(): Instant = now
+        override fun getZone(): ZoneId = ZoneOffset.UTC
+        override fun withZone(zone: ZoneId): Clock = this
+    }
+
+    /** Numbers its quotes, in the extended EPID group ID, so that the tests can tell which one they are given. */
+    private class FakeQuoteService : EnclaveQuoteService() {
+        val requests = AtomicInteger()
+        @Volatile
+        var failing = false
+
+        override fun getQuotingEnclaveInfo(): Cursor<SgxTargetInfo, ByteBuffer> = Cursor.allocate(SgxTargetInfo)
+
+        override fun retrieveQuote(report: ByteCursor<SgxReport>): ByteCursor<SgxSignedQuote> {
+            val number = requests.incrementAndGet()
+            if (failing) throw IllegalStateException("Quoting enclave unavailable")
+            val signedQuote = Cursor.wrap(SgxSignedQuote, ByteArray(SgxSignedQuote.minSize))
+            signedQuote[SgxSignedQuote.quote][SgxQuote.reportBody] = report[SgxReport.body].read()
+            signedQuote[SgxSignedQuote.quote][SgxQuote.extendedEpidGroupId] = number.toLong()
+            return signedQuote
+        }
+    }
+
+    private val clock = FakeClock()
+    private val delegate = FakeQuoteService()
+    private var service: CachingEnclaveQuoteService? = null
+
+    @AfterEach
+    fun close() {
+        service?.close()
+    }
+
+    @Test
+    fun `quote is reused for the same report body`() {
+        val service = createService()
+        val report = randomReport()
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        // The MAC of the report is not part of the body
+        val sameBody = report.bytes.copyOf()
+        sameBody[sameBody.size - 1] = (sameBody[sameBody.size - 1] + 1).toByte()
+        assertThat(service.quoteNumber(Cursor.wrap(SgxReport, sameBody))).isEqualTo(1)
+        assertThat(delegate.requests.get()).isEqualTo(1)
+
+        val quote = service.retrieveQuote(report)
+        assertThat(quote[SgxSignedQuote.quote][SgxQuote.reportBody]).isEqualTo(report[SgxReport.body])
+    }
+
+    @Test
+    fun `different report bodies have their own quote`() {
+        val service = createService()
+        assertThat(service.quoteNumber(randomReport())).isEqualTo(1)
+        assertThat(service.quoteNumber(randomReport())).isEqualTo(2)
+    }
+
+    @Test
+    fun `quote is rotated after the rotation period`() {
+        val service = createService()
+        val report = randomReport()
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        clock.advance(Duration.ofMinutes(59))
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        clock.advance(Duration.ofMinutes(1))
+        assertThat(service.quoteNumber(report)).isEqualTo(2)
+        assertThat(service.quoteNumber(report)).isEqualTo(2)
+    }
+
+    @Test
+    fun `least recently used quote is evicted`() {
+        val service = createService()
+        val reports = List(5) { randomReport() }
+        for (i in 0..3) {
+            assertThat(service.quoteNumber(reports[i])).isEqualTo(i + 1)
+        }
+        assertThat(service.quoteNumber(reports[0])).isEqualTo(1)
+        assertThat(service.quoteNumber(reports[4])).isEqualTo(5)
+
+        assertThat(service.quoteNumber(reports[0])).isEqualTo(1)
+        assertThat(service.quoteNumber(reports[2])).isEqualTo(3)
+        assertThat(service.quoteNumber(reports[1])).isEqualTo(6)
+    }
+
+    @Test
+    fun `quote in use is pre-generated before its rotation`() {
+        val service = createService(Duration.ofMillis(500), preGenerate = true)
+        val report = randomReport()
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        clock.advance(Duration.ofMillis(450))
+        awaitRequests(2)
+        // The first quote has expired, but not the one generated in the background
+        clock.advance(Duration.ofMillis(100))
+        assertThat(service.quoteNumber(report)).isEqualTo(2)
+        assertThat(delegate.requests.get()).isEqualTo(2)
+    }
+
+    @Test
+    fun `quote which is not used is left to expire`() {
+        val service = createService(Duration.ofMillis(500), preGenerate = true)
+        val report = randomReport()
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        awaitRequests(2)
+        // Nobody asked for the pre-generated quote, so it is not renewed again
+        Thread.sleep(1000)
+        assertThat(delegate.requests.get()).isEqualTo(2)
+    }
+
+    @Test
+    fun `quote which fails to be pre-generated is requested on demand`() {
+        val service = createService(Duration.ofMillis(500), preGenerate = true)
+        val report = randomReport()
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        delegate.failing = true
+        awaitRequests(2)
+        delegate.failing = false
+        // The first quote is still within its rotation period, but it has been dropped
+        assertThat(service.quoteNumber(report)).isEqualTo(3)
+    }
+
+    @Test
+    fun `closed service stops pre-generating and caching quotes`() {
+        val service = createService(Duration.ofMillis(500), preGenerate = true)
+        val report = randomReport()
+        assertThat(service.quoteNumber(report)).isEqualTo(1)
+        service.close()
+        Thread.sleep(1000)
+        assertThat(delegate.requests.get()).isEqualTo(1)
+        assertThat(service.quoteNumber(report)).isEqualTo(2)
+        assertThat(service.quoteNumber(report)).isEqualTo(3)
+    }
+
+    private fun createService(
+        rotationPeriod: Duration = Duration.ofHours(1),
+        preGenerate: Boolean = false
+    ): CachingEnclaveQuoteService {
+        return CachingEnclaveQuoteService(delegate, rotationPeriod, preGenerate, clock).also { service = it }
+    }
+
+    private fun randomReport(): ByteCursor<SgxReport> = Cursor.wrap(SgxReport, Random.nextBytes(SgxReport.size))
+
+    private fun CachingEnclaveQuoteService.quoteNumber(report: ByteCursor<SgxReport>): Int {
+        return retrieveQuote(report)[SgxSignedQuote.quote][SgxQuote.extendedEpidGroupId].read().toInt()
+    }
+
+    private fun awaitRequests(count: Int) {
+        val deadline = System.nanoTime() + Duration.ofSeconds(10).toNanos()
+        while (delegate.requests.get() < count) {
+            check(System.nanoTime() < deadline) { "Timed out waiting for $count quote requests" }
+            Thread.sleep(10)
+        }
+        // Let the background renewal store its quote
+        Thread.sleep(100)
+    }
+}
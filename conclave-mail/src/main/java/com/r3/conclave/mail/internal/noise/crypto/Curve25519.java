@@ -37,6 +37,24 @@ import java.util.Arrays;
  */
 public final class Curve25519 {
 
+    /**
+     * A faster implementation of {@link #eval}, such as the native one inside the enclave.
+     */
+    public interface Implementation {
+        void eval(byte[] result, int offset, byte[] privateKey, byte[] publicKey);
+    }
+
+    private static volatile Implementation implementation = null;
+
+    /**
+     * Replaces the Java implementation of {@link #eval}. It must implement RFC 7748, it is only given public keys
+     * whose top bit is clear, the Java implementation reduces the other ones differently from the RFC.
+     */
+    public static void setImplementation(Implementation implementation)
+    {
+        Curve25519.implementation = implementation;
+    }
+
     // Numbers modulo 2^255 - 19 are broken up into ten 26-bit words.
     private static final int NUM_LIMBS_255BIT = 10;
     private static final int NUM_LIMBS_510BIT = 20;
@@ -508,6 +526,12 @@ public final class Curve25519 {
      */
     public static void eval(byte[] result, int offset, byte[] privateKey, byte[] publicKey)
     {
+        Implementation implementation = Curve25519.implementation;
+        if (implementation != null && (publicKey == null || (publicKey[31] & 0x80) == 0)) {
+            implementation.eval(result, offset, privateKey, publicKey);
+            return;
+        }
+
         Curve25519 state = new Curve25519();
         try {
             // Unpack the public key value.  If null, use 9 as the base point.
@@ -0,0 +1,62 @@
+#ifndef _FATFS_CLUSTER_BITMAP
+#define _FATFS_CLUSTER_BITMAP
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "ff.hpp"
+
+/*
+  In-memory copy of the allocation state of the clusters of a FAT volume.
+
+  FatFs finds free clusters by reading the FAT one entry at a time, which costs
+  many FAT sector reads per allocated cluster on a full or fragmented volume, and
+  counts the free clusters with a full FAT scan. ff.cpp builds this bitmap from
+  whole FAT sectors on the first allocation after the volume is mounted and
+  keeps it in sync in put_fat(), so that free clusters
+  and runs of free clusters can be found with a few word operations and the
+  number of free clusters is always known.
+
+  A second level bitmap tracks which words of the first level have at least one
+  free cluster, so that a full region of the volume is skipped 4096 clusters at
+  a time.
+*/
+
+namespace conclave {
+
+    class FatFsClusterBitmap {
+    public:
+        //  All the clusters are initially marked as in use.
+        explicit FatFsClusterBitmap(DWORD n_fatent);
+
+        void setFree(DWORD clst, bool free);
+
+        bool isFree(DWORD clst) const;
+
+        DWORD freeCount() const;
+
+        //  Returns the first free cluster at or after from, wrapping around
+        //  at the end of the volume, or 0 if the volume is full.
+        DWORD findFree(DWORD from) const;
+
+        //  Returns the first cluster of a run of at least count free clusters,
+        //  searching from the given cluster and wrapping around at the end of
+        //  the volume, or 0 if there is no such run.
+        DWORD findRun(DWORD count, DWORD from) const;
+
+    private:
+        std::vector<uint64_t> free_;
+        std::vector<uint64_t> non_empty_;
+        DWORD n_fatent_;
+        DWORD free_count_;
+
+        DWORD nextFree(DWORD from, DWORD limit) const;
+
+        DWORD nextUsed(DWORD from, DWORD limit) const;
+
+        DWORD findRunIn(DWORD count, DWORD from, DWORD limit) const;
+    };
+}
+
+#endif  //  End of _FATFS_CLUSTER_BITMAP
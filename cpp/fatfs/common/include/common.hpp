@@ -1,8 +1,14 @@
 #ifndef _FATFS_COMMON
 #define _FATFS_COMMON
 
+//  Default size of the sectors of a volume, disks can be created with a bigger
+//    sector size (up to FF_MAX_SS, see FatFsDisk)
 #define SECTOR_SIZE 512
 
+//  Default size of the buffer which collects the small writes to each open file
+//    before they are passed to FatFs (see FatFsFileManager), 0 disables the buffering
+#define FILE_WRITE_BUFFER_SIZE (64 * 1024)
+
 #define FATFS_DEBUG 0
 
 #if FATFS_DEBUG
@@ -0,0 +1,96 @@
+#ifndef _FATFS_DIR_INDEX
+#define _FATFS_DIR_INDEX
+
+#include <stddef.h>
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ff.hpp"
+
+/*
+  In-memory name index for FAT directories.
+
+  FatFs resolves a name by scanning every 32-byte entry of the directory table,
+  reassembling long file names and case folding them one character at a time.
+  This class keeps, for each directory that has been looked up at least once, a
+  hash table from the case folded long name and from the 8.3 name to the position
+  of the short name entry, so that ff.cpp can jump straight to it.
+
+  A directory is identified by the start cluster of its table, which is unique
+  within a volume. Indexes are built lazily by ff.cpp on the first lookup in a
+  directory and kept up to date by the FatFs functions which add or remove
+  entries. FatFs is not re-entrant in our configuration, so access is serialized
+  by the callers (see FatFsFileManager).
+*/
+
+namespace conclave {
+
+    class FatFsDirIndex {
+    public:
+        struct Location {
+            DWORD dptr;      //  Offset of the short name entry in the directory table
+            DWORD blk_ofs;   //  Offset of the first long name entry, 0xFFFFFFFF if there is none
+            BYTE sfn[11];    //  Short name, used to validate the entry before trusting the index
+        };
+
+        //  max_bytes bounds the heap used by the index, see entryCost.
+        explicit FatFsDirIndex(size_t max_bytes);
+
+        bool isIndexed(DWORD sclust) const;
+
+        bool isSkipped(DWORD sclust) const;
+
+        void beginDirectory(DWORD sclust);
+
+        //  Returns false if the entry could not be added, either because the index
+        //  is full or because the name is ambiguous; the caller is expected to drop
+        //  the directory in that case.
+        bool insert(DWORD sclust, const BYTE* sfn, const WCHAR* lfn, DWORD dptr, DWORD blk_ofs);
+
+        const Location* findLfn(DWORD sclust, const WCHAR* lfn) const;
+
+        const Location* findSfn(DWORD sclust, const BYTE* sfn) const;
+
+        void erase(DWORD sclust, DWORD dptr);
+
+        void dropDirectory(DWORD sclust);
+
+        //  Remember that a directory can not be indexed, so that we don't pay for
+        //  a failing build on every lookup.
+        void skipDirectory(DWORD sclust);
+
+        void clear();
+
+        //  Approximate number of bytes of heap used by the indexed entries.
+        size_t usedBytes() const;
+
+    private:
+        struct Entry {
+            Location location;
+            //  Key of the entry in by_lfn, or null if it has no long name. The keys of an
+            //    unordered_map don't move when it is rehashed.
+            const std::u16string* lfn_key;
+        };
+
+        struct Directory {
+            std::unordered_map<std::u16string, DWORD> by_lfn;
+            std::unordered_map<std::string, DWORD> by_sfn;
+            std::unordered_map<DWORD, Entry> by_dptr;
+        };
+
+        std::unordered_map<DWORD, Directory> directories_;
+        std::unordered_set<DWORD> skipped_;
+        size_t used_bytes_;
+        size_t max_bytes_;
+
+        static size_t entryCost(size_t lfn_length);
+
+        static std::u16string foldName(const WCHAR* lfn);
+
+        static std::string sfnKey(const BYTE* sfn);
+    };
+}
+
+#endif  //  End of _FATFS_DIR_INDEX
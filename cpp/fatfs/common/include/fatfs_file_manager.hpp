@@ -10,28 +10,30 @@
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <limits>
 #include <stdexcept>
 #include <fcntl.h>
 
 #include "sgx_tcrypto.h"
+#ifndef UNIT_TEST
 #include "enclave_shared_data.h"
 #include "substrate_jvm.h"
 #include "sys_stat.h"
 #include "graal_isolate.h"
 #include "vm_enclave_layer.h"
 #include "conclave-stat.h"
+#include "conclave-statvfs.h"
+#endif
 
 #include "ff.hpp"
 #include "common.hpp"
 #include "fatfs_result.hpp"
+#include "posix_file_manager.hpp"
 
 
 namespace conclave {
-    typedef uint32_t mode_t;
-    typedef int FileHandle;
-
-    class FatFsFileManager {
+    class FatFsFileManager : public PosixFileManager {
 
     private:
         std::unordered_map<FileHandle, FIL* > files_;
@@ -43,6 +45,21 @@ namespace conclave {
         std::unordered_map<const DIR*, struct dirent* > dirents_;
         std::unordered_map<const DIR*, struct dirent64* > dirents64_;
         std::unordered_map<const DIR*, std::string > inverse_dir_paths_;
+
+        //  Files opened for appending, with the number of bytes that their cluster
+        //    chain has been grown to ahead of the writes (see growAppendExtent)
+        std::unordered_map<FileHandle, FSIZE_t> append_extents_;
+
+        //  Writes which have not been passed to FatFs yet. The data is contiguous and
+        //    starts at "offset", which is where the file pointer of the FIL still is.
+        struct WriteBuffer {
+            FSIZE_t offset;
+            std::vector<BYTE> data;
+        };
+        std::unordered_map<FileHandle, WriteBuffer> write_buffers_;
+
+        //  Writes of this size or more bypass the buffer, 0 disables the buffering
+        const size_t write_buffer_size_;
         
         std::mutex file_mutex_;
 
@@ -75,6 +92,16 @@ namespace conclave {
 
         off_t lseekInternal(int fd, off_t offset, int whence);
 
+        void growAppendExtent(const FileHandle handle, FIL* fil_ptr, size_t count);
+
+        int extendWithZeros(FIL* fil_ptr, FSIZE_t size);
+
+        FRESULT writeInternal(const FileHandle handle, FIL* fil_ptr, const void* buf, size_t count, UINT* written_bytes);
+
+        FRESULT bufferedWrite(const FileHandle handle, FIL* fil_ptr, const void* buf, size_t count, UINT* written_bytes);
+
+        FRESULT flushWriteBuffer(const FileHandle handle, FIL* fil_ptr);
+
         FileHandle getNewHandle();
         
         void insertFileHandle(const FileHandle handle,
@@ -92,21 +119,22 @@ namespace conclave {
                          const int max_handle_id,
                          const unsigned char* encryption_key,
                          const std::string& mount_path,
-                         const std::shared_ptr<FatFsDisk>& disk_handler);
+                         const std::shared_ptr<FatFsDisk>& disk_handler,
+                         const size_t write_buffer_size = FILE_WRITE_BUFFER_SIZE);
 
-        std::string getMountPath();
+        std::string getMountPath() override;
 
         FatFsResult init(const DiskInitialization init_type);
        
         //  These couple of functions uses the file/handle maps above
         //    to determine if the path/handle is managed by this file manager
-        bool isPathOwner(const std::string& path);
+        bool isPathOwner(const std::string& path) override;
 
-        bool isHandleOwner(const int handle);
+        bool isHandleOwner(const int handle) override;
 
         //  This is to determine if the file manager is the owner of the directory
         //    represented by the DIR pointer.
-        bool isDirOwner(const DIR* dir);        
+        bool isDirOwner(const void* dir) override;        
         
         int isDirOpen(const std::string& path);
 
@@ -115,71 +143,77 @@ namespace conclave {
         int isFileInDirOpen(const std::string& path);
         
         //  Posix calls
-        int open(const char* path, int oflag, int& err);
+        int open(const char* path, int oflag, int& err) override;
        
-        off_t lseek(int fd, off_t offset, int whence);
+        off_t lseek(int fd, off_t offset, int whence) override;
   
-        ssize_t read(int fd, void* buf, size_t count);
+        ssize_t read(int fd, void* buf, size_t count) override;
 
         size_t fread(void* ptr, size_t size, size_t nmemb, FILE* stream);
 
-        ssize_t pread(int fd, void* buf, size_t count, off_t offset);
+        ssize_t pread(int fd, void* buf, size_t count, off_t offset) override;
     
         FILE *fdopen(int fd, const char *mode);
 
-        FILE *fopen(const char* path, const char* mode, int& err);
+        FILE *fopen(const char* path, const char* mode, int& err) override;
 
         size_t fwrite(const void* buf, size_t size, size_t count, FILE* fp);
 
-        ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset);
+        ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) override;
         
-        ssize_t write(int fd, const void* buf, size_t count);
+        ssize_t write(int fd, const void* buf, size_t count) override;
         
         int fclose(FILE* fp);    
         
-        int close(int fd);
+        int close(int fd) override;
 
-        int fstat(int ver, int fd, struct stat64* stat_buf, int& err);
+        int fstat(int ver, int fd, struct stat64* stat_buf, int& err) override;
 
-        int stat(int ver, const char* path, struct stat64* stat_buf, int& err);
+        int stat(int ver, const char* path, struct stat64* stat_buf, int& err) override;
 
-        int lstat64(const char* path, struct stat64* stat_buf, int& err);
+        int lstat64(const char* path, struct stat64* stat_buf, int& err) override;
 
-        int lstat(const char* path, struct stat* stat_buf, int& err);
+        int lstat(const char* path, struct stat* stat_buf, int& err) override;
         
-        int mkdir(const char* path, mode_t mode);
+        int mkdir(const char* path, mode_t mode) override;
 
-        int access(const char* path, mode_t mode, int& err);
+        int access(const char* path, mode_t mode, int& err) override;
         
-        int unlink(const char* path, int& res);
+        int unlink(const char* path, int& res) override;
 
-        int rmdir(const char* path, int& res);
+        int rmdir(const char* path, int& res) override;
 
-        int remove(const char* path, int& res);
+        int remove(const char* path, int& res) override;
 
-        int rename(const char* oldpath, const char* newpath, int& err);
+        int rename(const char* oldpath, const char* newpath, int& err) override;
     
         int chdir(const char* path);
 
         char *getcwd(char* buf, size_t size);
 
-        int dup2(int oldfd, int newfd);
+        int dup2(int oldfd, int newfd) override;
 
-        void* opendir(const char* dirname, int& err);
+        void* opendir(const char* dirname, int& err) override;
 
-        struct dirent* readdir(void* dirp, int& err);
+        struct dirent* readdir(void* dirp, int& err) override;
 
-        struct dirent64* readdir64(void* dirp, int& err);
+        struct dirent64* readdir64(void* dirp, int& err) override;
         
-        int closedir(void* dirp, int& err);
+        int closedir(void* dirp, int& err) override;
+
+        int ftruncate(int fd, off_t length, int& err) override;
+
+        int fsync(int fd, int& err) override;
+
+        int fallocate(int fd, int mode, off_t offset, off_t len, int& err) override;
 
-        int ftruncate(int fd, off_t length, int& err);
+        int fchown(int fd, uid_t owner, gid_t group, int& err) override;
 
-        int fchown(int fd, uid_t owner, gid_t group, int& err);
+        int fchmod(int fd, mode_t mode, int& err) override;
 
-        int fchmod(int fd, mode_t mode, int& err);
+        int utimes(const char *filename, const struct timeval times[2], int& err) override;
 
-        int utimes(const char *filename, const struct timeval times[2], int& err);
+        int statvfs(struct statvfs64* buf, int& err) override;
     };
 };
 
@@ -155,6 +155,12 @@ typedef struct {
 	DWORD	cdc_size;		/* b31-b8:Size of containing directory, b7-b0: Chain status */
 	DWORD	cdc_ofs;		/* Offset in the containing directory (invalid when cdir is 0) */
 #endif
+#endif
+#if FF_USE_DIR_INDEX
+	void*	dirindex;		/* Directory name index (conclave::FatFsDirIndex) */
+#endif
+#if FF_USE_CLUSTER_BITMAP
+	void*	clbitmap;		/* Free cluster bitmap (conclave::FatFsClusterBitmap) */
 #endif
 	DWORD	n_fatent;		/* Number of FAT entries (number of clusters + 2) */
 	DWORD	fsize;			/* Size of an FAT [sectors] */
@@ -321,6 +327,8 @@ FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
+FRESULT f_allocate (FIL* fp, FSIZE_t fsz);						/* Allocate clusters beyond the end of the file */
+FRESULT f_shrink (FIL* fp);											/* Release the clusters beyond the end of the file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
@@ -41,8 +41,9 @@
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
-/* This option switches f_expand function. (0:Disable or 1:Enable) */
+#define FF_USE_EXPAND	1
+/* This option switches f_expand function, and the f_allocate and f_shrink
+/  functions added for the POSIX layer. (0:Disable or 1:Enable) */
 
 
 #define FF_USE_CHMOD	0
@@ -59,6 +60,31 @@
 /* This option switches f_forward() function. (0:Disable or 1:Enable) */
 
 
+#define FF_USE_DIR_INDEX	1
+#define FF_DIR_INDEX_MAX_BYTES	(4 * 1024 * 1024)
+/* This option switches the in-memory directory name index (see dir_index.hpp).
+/  When enabled, the entries of a directory are hashed on the first lookup so that
+/  following lookups don't need to scan the directory table. (0:Disable or 1:Enable)
+/  FF_DIR_INDEX_MAX_BYTES bounds the heap used by the index of a volume, about 250
+/  bytes per entry, the directories which don't fit are looked up with a table scan
+/  as usual. */
+
+
+#define FF_USE_CLUSTER_BITMAP	1
+#define FF_CLUSTER_BITMAP_RUN	16
+#define FF_CLUSTER_BITMAP_READ	0x8000
+/* This option switches the in-memory free cluster bitmap (see cluster_bitmap.hpp).
+/  When enabled, the FAT is read once, on the first allocation or free space query
+/  after the mount, and free clusters are then found without reading the FAT, and
+/  the number of free clusters is always known.
+/  (0:Disable or 1:Enable)
+/  FF_CLUSTER_BITMAP_READ is the number of bytes of the FAT read at a time when the
+/  bitmap is built. It must be a multiple of FF_MAX_SS.
+/  FF_CLUSTER_BITMAP_RUN is the number of contiguous free clusters that is looked
+/  for when a new chain is created or a chain can't be stretched in place, so that
+/  files keep growing sequentially. */
+
+
 #define FF_USE_STRFUNC	0
 #define FF_PRINT_LLI	0
 #define FF_PRINT_FLOAT	0
@@ -197,7 +223,7 @@
 
 
 #define FF_MIN_SS		512
-#define FF_MAX_SS		512
+#define FF_MAX_SS		4096
 /* This set of options configures the range of sector size to be supported. (512,
 /  1024, 2048 or 4096) Always set both 512 for most systems, generic memory card and
 /  harddisk, but a larger value may be required for on-board flash memory and some
@@ -216,7 +242,7 @@
 /  f_fdisk function. 0x100000000 max. This option has no effect when FF_LBA64 == 0. */
 
 
-#define FF_USE_TRIM		0
+#define FF_USE_TRIM		1
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable Trim function, also CTRL_TRIM command should be implemented to the
 /  disk_ioctl() function. */
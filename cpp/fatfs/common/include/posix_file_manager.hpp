@@ -0,0 +1,128 @@
+#ifndef _POSIX_FILE_MANAGER
+#define _POSIX_FILE_MANAGER
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#ifndef UNIT_TEST
+#include "sys_stat.h"
+#include "vm_enclave_layer.h"
+#include "conclave-stat.h"
+#include "conclave-statvfs.h"
+#else
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/time.h>
+
+//  The host <dirent.h> declares a DIR type which clashes with the one of FatFs,
+//    the unit tests use the directory entries of the Enclave (vm_enclave_layer.h)
+struct dirent {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+};
+
+struct dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+};
+#endif
+
+namespace conclave {
+    typedef uint32_t mode_t;
+    typedef int FileHandle;
+
+    /*
+      Abstract class of the filesystems mounted in the Enclave. The Posix calls
+      redirected to the filesystems (api.cpp) select the instance that owns a path,
+      a file handle or a directory stream, and forward the call to it.
+      FatFsFileManager implements these calls on top of FatFs for the persistent
+      and in-memory mounts, TmpFsFileManager on top of the Enclave memory for the
+      in-memory mount.
+    */
+    class PosixFileManager {
+
+    public:
+        virtual ~PosixFileManager() {}
+
+        virtual std::string getMountPath() = 0;
+
+        //  These functions determine if the path, the handle or the directory stream
+        //    is managed by this file manager
+        virtual bool isPathOwner(const std::string& path) = 0;
+
+        virtual bool isHandleOwner(const int handle) = 0;
+
+        virtual bool isDirOwner(const void* dir) = 0;
+
+        //  Posix calls
+        virtual int open(const char* path, int oflag, int& err) = 0;
+
+        virtual off_t lseek(int fd, off_t offset, int whence) = 0;
+
+        virtual ssize_t read(int fd, void* buf, size_t count) = 0;
+
+        virtual ssize_t pread(int fd, void* buf, size_t count, off_t offset) = 0;
+
+        virtual FILE *fopen(const char* path, const char* mode, int& err) = 0;
+
+        virtual ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) = 0;
+
+        virtual ssize_t write(int fd, const void* buf, size_t count) = 0;
+
+        virtual int close(int fd) = 0;
+
+        virtual int fstat(int ver, int fd, struct stat64* stat_buf, int& err) = 0;
+
+        virtual int stat(int ver, const char* path, struct stat64* stat_buf, int& err) = 0;
+
+        virtual int lstat64(const char* path, struct stat64* stat_buf, int& err) = 0;
+
+        virtual int lstat(const char* path, struct stat* stat_buf, int& err) = 0;
+
+        virtual int mkdir(const char* path, mode_t mode) = 0;
+
+        virtual int access(const char* path, mode_t mode, int& err) = 0;
+
+        virtual int unlink(const char* path, int& res) = 0;
+
+        virtual int rmdir(const char* path, int& res) = 0;
+
+        virtual int remove(const char* path, int& res) = 0;
+
+        virtual int rename(const char* oldpath, const char* newpath, int& err) = 0;
+
+        virtual int dup2(int oldfd, int newfd) = 0;
+
+        virtual void* opendir(const char* dirname, int& err) = 0;
+
+        virtual struct dirent* readdir(void* dirp, int& err) = 0;
+
+        virtual struct dirent64* readdir64(void* dirp, int& err) = 0;
+
+        virtual int closedir(void* dirp, int& err) = 0;
+
+        virtual int ftruncate(int fd, off_t length, int& err) = 0;
+
+        virtual int fsync(int fd, int& err) = 0;
+
+        virtual int fallocate(int fd, int mode, off_t offset, off_t len, int& err) = 0;
+
+        virtual int fchown(int fd, uid_t owner, gid_t group, int& err) = 0;
+
+        virtual int fchmod(int fd, mode_t mode, int& err) = 0;
+
+        virtual int utimes(const char* path, const struct timeval times[2], int& err) = 0;
+
+        virtual int statvfs(struct statvfs64* buf, int& err) = 0;
+    };
+};
+
+#endif    //  _POSIX_FILE_MANAGER
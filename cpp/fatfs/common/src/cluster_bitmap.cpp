@@ -0,0 +1,149 @@
+#include "cluster_bitmap.hpp"
+
+static const DWORD kBitsPerWord = 64;
+
+namespace conclave {
+
+    FatFsClusterBitmap::FatFsClusterBitmap(DWORD n_fatent)
+        : free_((n_fatent + kBitsPerWord - 1) / kBitsPerWord, 0),
+          non_empty_((free_.size() + kBitsPerWord - 1) / kBitsPerWord, 0),
+          n_fatent_(n_fatent),
+          free_count_(0) {
+    }
+
+    void FatFsClusterBitmap::setFree(DWORD clst, bool free) {
+        if (clst < 2 || clst >= n_fatent_ || isFree(clst) == free) {
+            return;
+        }
+        const DWORD word = clst / kBitsPerWord;
+        const uint64_t bit = 1ULL << (clst % kBitsPerWord);
+
+        if (free) {
+            free_[word] |= bit;
+            free_count_++;
+        } else {
+            free_[word] &= ~bit;
+            free_count_--;
+        }
+        const uint64_t summary_bit = 1ULL << (word % kBitsPerWord);
+
+        if (free_[word] != 0) {
+            non_empty_[word / kBitsPerWord] |= summary_bit;
+        } else {
+            non_empty_[word / kBitsPerWord] &= ~summary_bit;
+        }
+    }
+
+    bool FatFsClusterBitmap::isFree(DWORD clst) const {
+        if (clst >= n_fatent_) {
+            return false;
+        }
+        return (free_[clst / kBitsPerWord] >> (clst % kBitsPerWord)) & 1;
+    }
+
+    DWORD FatFsClusterBitmap::freeCount() const {
+        return free_count_;
+    }
+
+    DWORD FatFsClusterBitmap::findFree(DWORD from) const {
+        if (from < 2 || from >= n_fatent_) {
+            from = 2;
+        }
+        DWORD clst = nextFree(from, n_fatent_);
+
+        if (clst == n_fatent_) {
+            clst = nextFree(2, from);
+            if (clst == from) {
+                return 0;
+            }
+        }
+        return clst;
+    }
+
+    DWORD FatFsClusterBitmap::findRun(DWORD count, DWORD from) const {
+        if (from < 2 || from >= n_fatent_) {
+            from = 2;
+        }
+
+        if (count == 0 || count > free_count_) {
+            return 0;
+        }
+        const DWORD clst = findRunIn(count, from, n_fatent_);
+        return clst != 0 ? clst : findRunIn(count, 2, from);
+    }
+
+    DWORD FatFsClusterBitmap::nextFree(DWORD from, DWORD limit) const {
+        DWORD word = from / kBitsPerWord;
+
+        if (from >= limit) {
+            return limit;
+        }
+        uint64_t bits = free_[word] & (~0ULL << (from % kBitsPerWord));
+
+        while (bits == 0) {
+            //  Use the summary to skip the words without any free cluster
+            word++;
+            DWORD summary = word / kBitsPerWord;
+
+            if (summary >= non_empty_.size()) {
+                return limit;
+            }
+            uint64_t summary_bits = non_empty_[summary] & (~0ULL << (word % kBitsPerWord));
+
+            while (summary_bits == 0) {
+                summary++;
+                if (summary >= non_empty_.size() || summary * kBitsPerWord * kBitsPerWord >= limit) {
+                    return limit;
+                }
+                summary_bits = non_empty_[summary];
+            }
+            word = summary * kBitsPerWord + __builtin_ctzll(summary_bits);
+
+            if (word * kBitsPerWord >= limit) {
+                return limit;
+            }
+            bits = free_[word];
+        }
+        const DWORD clst = word * kBitsPerWord + __builtin_ctzll(bits);
+        return clst < limit ? clst : limit;
+    }
+
+    DWORD FatFsClusterBitmap::nextUsed(DWORD from, DWORD limit) const {
+        DWORD word = from / kBitsPerWord;
+
+        if (from >= limit) {
+            return limit;
+        }
+        uint64_t bits = ~free_[word] & (~0ULL << (from % kBitsPerWord));
+
+        while (bits == 0) {
+            word++;
+            if (word * kBitsPerWord >= limit) {
+                return limit;
+            }
+            bits = ~free_[word];
+        }
+        const DWORD clst = word * kBitsPerWord + __builtin_ctzll(bits);
+        return clst < limit ? clst : limit;
+    }
+
+    DWORD FatFsClusterBitmap::findRunIn(DWORD count, DWORD from, DWORD limit) const {
+        DWORD clst = from;
+
+        while (clst < limit) {
+            const DWORD start = nextFree(clst, limit);
+
+            if (start >= limit || limit - start < count) {
+                return 0;
+            }
+            //  Only look as far as the end of the run that we need
+            const DWORD end = nextUsed(start, start + count);
+
+            if (end - start >= count) {
+                return start;
+            }
+            clst = end;
+        }
+        return 0;
+    }
+}
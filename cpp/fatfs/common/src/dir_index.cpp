@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "dir_index.hpp"
+
+namespace conclave {
+
+    FatFsDirIndex::FatFsDirIndex(size_t max_bytes)
+        : used_bytes_(0), max_bytes_(max_bytes) {
+    }
+
+    bool FatFsDirIndex::isIndexed(DWORD sclust) const {
+        return directories_.find(sclust) != directories_.end();
+    }
+
+    bool FatFsDirIndex::isSkipped(DWORD sclust) const {
+        return skipped_.find(sclust) != skipped_.end();
+    }
+
+    void FatFsDirIndex::beginDirectory(DWORD sclust) {
+        dropDirectory(sclust);
+        directories_[sclust];
+    }
+
+    bool FatFsDirIndex::insert(DWORD sclust,
+                               const BYTE* sfn,
+                               const WCHAR* lfn,
+                               DWORD dptr,
+                               DWORD blk_ofs) {
+        auto dir_it = directories_.find(sclust);
+
+        if (dir_it == directories_.end()) {
+            return true;
+        }
+
+        Directory& dir = dir_it->second;
+        Entry entry;
+        entry.location.dptr = dptr;
+        entry.location.blk_ofs = blk_ofs;
+        memcpy(entry.location.sfn, sfn, sizeof(entry.location.sfn));
+        entry.lfn_key = nullptr;
+
+        //  Two entries which only differ by case can't be told apart by the index,
+        //  in that case the linear scan is the only way to preserve FatFs semantics.
+        const std::string sfn_key = sfnKey(sfn);
+
+        if (dir.by_sfn.find(sfn_key) != dir.by_sfn.end() || dir.by_dptr.find(dptr) != dir.by_dptr.end()) {
+            return false;
+        }
+        std::u16string lfn_key;
+
+        if (lfn != nullptr) {
+            lfn_key = foldName(lfn);
+
+            if (dir.by_lfn.find(lfn_key) != dir.by_lfn.end()) {
+                return false;
+            }
+        }
+        const size_t cost = entryCost(lfn_key.size());
+
+        if (used_bytes_ + cost > max_bytes_) {
+            return false;
+        }
+
+        if (lfn != nullptr) {
+            entry.lfn_key = &dir.by_lfn.emplace(std::move(lfn_key), dptr).first->first;
+        }
+        dir.by_sfn[sfn_key] = dptr;
+        dir.by_dptr[dptr] = entry;
+        used_bytes_ += cost;
+        return true;
+    }
+
+    const FatFsDirIndex::Location* FatFsDirIndex::findLfn(DWORD sclust, const WCHAR* lfn) const {
+        auto dir_it = directories_.find(sclust);
+
+        if (dir_it == directories_.end()) {
+            return nullptr;
+        }
+        const Directory& dir = dir_it->second;
+        auto it = dir.by_lfn.find(foldName(lfn));
+        return it == dir.by_lfn.end() ? nullptr : &dir.by_dptr.at(it->second).location;
+    }
+
+    const FatFsDirIndex::Location* FatFsDirIndex::findSfn(DWORD sclust, const BYTE* sfn) const {
+        auto dir_it = directories_.find(sclust);
+
+        if (dir_it == directories_.end()) {
+            return nullptr;
+        }
+        const Directory& dir = dir_it->second;
+        auto it = dir.by_sfn.find(sfnKey(sfn));
+        return it == dir.by_sfn.end() ? nullptr : &dir.by_dptr.at(it->second).location;
+    }
+
+    void FatFsDirIndex::erase(DWORD sclust, DWORD dptr) {
+        auto dir_it = directories_.find(sclust);
+
+        if (dir_it == directories_.end()) {
+            return;
+        }
+        Directory& dir = dir_it->second;
+        auto it = dir.by_dptr.find(dptr);
+
+        if (it == dir.by_dptr.end()) {
+            return;
+        }
+
+        size_t lfn_length = 0;
+
+        if (it->second.lfn_key != nullptr) {
+            lfn_length = it->second.lfn_key->size();
+            dir.by_lfn.erase(*it->second.lfn_key);
+        }
+        dir.by_sfn.erase(sfnKey(it->second.location.sfn));
+        dir.by_dptr.erase(it);
+        used_bytes_ -= entryCost(lfn_length);
+    }
+
+    void FatFsDirIndex::dropDirectory(DWORD sclust) {
+        auto dir_it = directories_.find(sclust);
+
+        if (dir_it != directories_.end()) {
+            for (const auto& entry : dir_it->second.by_dptr) {
+                used_bytes_ -= entryCost(entry.second.lfn_key != nullptr ? entry.second.lfn_key->size() : 0);
+            }
+            directories_.erase(dir_it);
+        }
+        skipped_.erase(sclust);
+    }
+
+    void FatFsDirIndex::skipDirectory(DWORD sclust) {
+        dropDirectory(sclust);
+        skipped_.insert(sclust);
+    }
+
+    void FatFsDirIndex::clear() {
+        directories_.clear();
+        skipped_.clear();
+        used_bytes_ = 0;
+    }
+
+    size_t FatFsDirIndex::usedBytes() const {
+        return used_bytes_;
+    }
+
+    //  One node in each of the three hash tables, with its bucket, next pointer, cached hash
+    //    and allocator header, plus the heap buffer of the long name key. This overestimates
+    //    short names, which the strings keep inline.
+    size_t FatFsDirIndex::entryCost(size_t lfn_length) {
+        const size_t node_overhead = 3 * sizeof(void*) + 16;
+        return sizeof(std::pair<const std::u16string, DWORD>) +
+            sizeof(std::pair<const std::string, DWORD>) +
+            sizeof(std::pair<const DWORD, Entry>) +
+            3 * node_overhead +
+            (lfn_length + 1) * sizeof(char16_t);
+    }
+
+    std::u16string FatFsDirIndex::foldName(const WCHAR* lfn) {
+        std::u16string key;
+
+        for (; *lfn; lfn++) {
+            WCHAR c = *lfn;
+
+            //  Most names are plain ASCII, avoid the lookup in the conversion tables
+            //  of ffunicode.cpp for them.
+            if (c < 0x80) {
+                if (c >= 'a' && c <= 'z') {
+                    c -= 0x20;
+                }
+            } else {
+                c = (WCHAR)ff_wtoupper(c);
+            }
+            key.push_back((char16_t)c);
+        }
+        return key;
+    }
+
+    std::string FatFsDirIndex::sfnKey(const BYTE* sfn) {
+        return std::string(reinterpret_cast<const char*>(sfn), 11);
+    }
+}
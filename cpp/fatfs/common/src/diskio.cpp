@@ -1,6 +1,8 @@
 #include <vector>
 
+#ifndef UNIT_TEST
 #include "vm_enclave_layer.h"
+#endif
 
 #include "disk.hpp"
 #include "common.hpp"
@@ -9,6 +11,9 @@
 
 static std::vector<std::shared_ptr<conclave::FatFsDisk> > disks(FF_VOLUMES, nullptr);
 
+//  Size of the work area of f_mkfs, the FAT is written in chunks of this size when formatting
+static const unsigned int kFormatWorkSize = 256 * 1024;
+
 
 FatFsResult disk_register(const BYTE drive, const std::shared_ptr<conclave::FatFsDisk>& disk) {
     if (drive >= FF_VOLUMES) {
@@ -25,7 +30,7 @@ FatFsResult disk_unregister(const BYTE drive) {
     if (drive >= FF_VOLUMES) {
         return FatFsResult::WRONG_DRIVE_ID;
     } else {
-        disks.erase(disks.begin() + static_cast<int>(drive));
+        disks[drive] = nullptr;
         return FatFsResult::OK;
     }
 }
@@ -51,7 +56,7 @@ DSTATUS disk_status(BYTE drive) {
 }
 
 
-DRESULT disk_read(BYTE drive, BYTE* buf, LBA_t sector, BYTE num) {
+DRESULT disk_read(BYTE drive, BYTE* buf, LBA_t sector, UINT num) {
 
     if (drive >= FF_VOLUMES) {
         return RES_PARERR;
@@ -61,7 +66,7 @@ DRESULT disk_read(BYTE drive, BYTE* buf, LBA_t sector, BYTE num) {
 }
 
 #if _READONLY == 0
-DRESULT disk_write(BYTE drive, const BYTE* buf, LBA_t sector, BYTE num) {
+DRESULT disk_write(BYTE drive, const BYTE* buf, LBA_t sector, UINT num) {
 
     if (drive >= FF_VOLUMES) {
         return RES_PARERR;
@@ -121,10 +126,12 @@ FatFsResult disk_start(const std::shared_ptr<conclave::FatFsDisk>& disk_handler,
     const char* drive_text = disk_handler->getDriveTextId().c_str();
     
     if (init_type == conclave::DiskInitialization::FORMAT) {
-        BYTE work[FF_MAX_SS * 2];
+        //  f_mkfs writes as many sectors at once as fit in the work area, hence this is
+        //    too big for the stack of the Enclave threads
+        std::vector<BYTE> work(kFormatWorkSize);
         FATFS_DEBUG_PRINT("MKFS drive %s\n", drive_text);
 
-        const FRESULT res_mkfs = f_mkfs(drive_text, &parms, work, sizeof(work));
+        const FRESULT res_mkfs = f_mkfs(drive_text, &parms, work.data(), work.size());
 
         if (res_mkfs != FR_OK) {
             if (res_mkfs == FR_MKFS_ABORTED) {
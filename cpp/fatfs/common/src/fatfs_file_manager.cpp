@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <vector>
 
 #include "diskio_ext.hpp"
 #include "disk.hpp"
@@ -6,6 +7,14 @@
 
 static const std::string kRootPath = "/";
 
+//  Files opened for appending have their cluster chain grown ahead of the writes,
+//    doubling from kMinAppendExtent up to steps of kMaxAppendExtentStep, so that
+//    they are laid out contiguously. The unused clusters are released on close.
+static const FSIZE_t kMinAppendExtent = 256 * 1024;
+static const FSIZE_t kMaxAppendExtentStep = 16 * 1024 * 1024;
+static const FSIZE_t kMaxFileSize = 0xFFFFFFFF;
+static const FSIZE_t kZeroFillChunkSize = 64 * 1024;
+
 namespace conclave {
 
     static std::unordered_map<int, BYTE> createFlagMap() {
@@ -125,7 +134,9 @@ namespace conclave {
                                        const int max_handle,
                                        const unsigned char* encryption_key,
                                        const std::string& mount_path,
-                                       const std::shared_ptr<FatFsDisk>& disk_handler):
+                                       const std::shared_ptr<FatFsDisk>& disk_handler,
+                                       const size_t write_buffer_size):
+        write_buffer_size_(write_buffer_size),
         first_handle_(first_handle),
         next_handle_(first_handle),
         last_handle_(max_handle),
@@ -142,7 +153,7 @@ namespace conclave {
    
 
     FatFsResult FatFsFileManager::init(const DiskInitialization init_type) {
-        disk_handler_->diskStart();
+        disk_handler_->diskStart(init_type);
 
         /*
           diskio.cpp->disk_start is the FatFs related call to register functions, 
@@ -180,8 +191,8 @@ namespace conclave {
     }
 
 
-    bool FatFsFileManager::isDirOwner(const DIR* dir) {
-        return inverse_dir_paths_.find(dir) != inverse_dir_paths_.end();   
+    bool FatFsFileManager::isDirOwner(const void* dir) {
+        return inverse_dir_paths_.find(static_cast<const DIR*>(dir)) != inverse_dir_paths_.end();   
     }
 
 
@@ -198,6 +209,13 @@ namespace conclave {
   
     int FatFsFileManager::closeInternal(FIL* fil_ptr) {
         const FileHandle file_handle = inverse_files_map_.at(fil_ptr);
+        const FRESULT res_flush = flushWriteBuffer(file_handle, fil_ptr);
+        write_buffers_.erase(file_handle);
+
+        if (append_extents_.erase(file_handle) != 0) {
+            //  Give back the clusters reserved ahead of the writes
+            f_shrink(fil_ptr);
+        }
         const FRESULT res = f_close(fil_ptr);
 
         if (res == FR_OK) {
@@ -210,7 +228,8 @@ namespace conclave {
             delete(fil_ptr);
             fil_ptr = nullptr;
             FATFS_DEBUG_PRINT("closeInternal successful, removed handle: %d, path: %s\n", file_handle, path.c_str());
-            return 0;
+            //  The file is closed anyway, but the caller needs to know that some data was lost
+            return res_flush == FR_OK ? 0 : -1;
         } else {
             FATFS_DEBUG_PRINT("closeInternal error %d\n", res);
             return -1;
@@ -389,6 +408,10 @@ namespace conclave {
         }
         FIL* fil_ptr = it->second;
 
+        if (flushWriteBuffer(handle, fil_ptr) != FR_OK) {
+            return -1;
+        }
+
         if (whence == SEEK_CUR) {
             off_t cur = (off_t)f_tell(fil_ptr);
             offset = cur + offset;
@@ -405,6 +428,127 @@ namespace conclave {
             return -1;
         }
     };
+
+
+    void FatFsFileManager::growAppendExtent(const FileHandle handle, FIL* fil_ptr, size_t count) {
+        const auto it = append_extents_.find(handle);
+
+        if (it == append_extents_.end()) {
+            return;
+        }
+        const FSIZE_t needed = std::min<FSIZE_t>(kMaxFileSize, (FSIZE_t)f_tell(fil_ptr) + count);
+
+        if (needed <= it->second) {
+            return;
+        }
+        const FSIZE_t current = it->second;
+        const FSIZE_t step = std::min(std::max(current, kMinAppendExtent), kMaxAppendExtentStep);
+        const FSIZE_t extent = std::max(needed, (FSIZE_t)std::min<uint64_t>(kMaxFileSize, (uint64_t)current + step));
+
+        //  If we are out of space the write itself will fail, or get as far as it can
+        if (f_allocate(fil_ptr, extent) == FR_OK) {
+            FATFS_DEBUG_PRINT("Append extent of handle %d grown to %u\n", handle, (unsigned int)extent);
+            it->second = extent;
+        }
+    }
+
+
+    int FatFsFileManager::extendWithZeros(FIL* fil_ptr, FSIZE_t size) {
+        //  FatFs does not clear the clusters when a file is extended by seeking past its end,
+        //    so we write the zeros ourselves, the clusters have already been allocated.
+        const FSIZE_t position = f_tell(fil_ptr);
+        const std::vector<BYTE> zeros(std::min(size - f_size(fil_ptr), kZeroFillChunkSize), 0);
+        FRESULT res = f_lseek(fil_ptr, f_size(fil_ptr));
+
+        while (res == FR_OK && f_size(fil_ptr) < size) {
+            const UINT chunk = (UINT)std::min<FSIZE_t>(size - f_size(fil_ptr), zeros.size());
+            UINT written_bytes = 0;
+            res = f_write(fil_ptr, zeros.data(), chunk, &written_bytes);
+
+            if (res == FR_OK && written_bytes != chunk) {
+                res = FR_DENIED;
+            }
+        }
+
+        if (res == FR_OK) {
+            res = f_lseek(fil_ptr, position);
+        }
+        return res == FR_OK ? 0 : -1;
+    }
+
+
+    FRESULT FatFsFileManager::writeInternal(const FileHandle handle,
+                                            FIL* fil_ptr,
+                                            const void* buf,
+                                            size_t count,
+                                            UINT* written_bytes) {
+        growAppendExtent(handle, fil_ptr, count);
+        return f_write(fil_ptr, buf, count, written_bytes);
+    }
+
+
+    FRESULT FatFsFileManager::bufferedWrite(const FileHandle handle,
+                                            FIL* fil_ptr,
+                                            const void* buf,
+                                            size_t count,
+                                            UINT* written_bytes) {
+        *written_bytes = 0;
+
+        //  FatFs would refuse the write, do not buffer it
+        if (!(fil_ptr->flag & FA_WRITE)) {
+            return FR_DENIED;
+        }
+        FRESULT res = FR_OK;
+
+        if (count >= write_buffer_size_) {
+            //  Large writes are passed to FatFs in a single call, which transfers the whole
+            //    sectors straight from the caller's buffer.
+            res = flushWriteBuffer(handle, fil_ptr);
+            return res == FR_OK ? writeInternal(handle, fil_ptr, buf, count, written_bytes) : res;
+        }
+        WriteBuffer& buffer = write_buffers_[handle];
+
+        if (buffer.data.size() + count > write_buffer_size_) {
+            res = flushWriteBuffer(handle, fil_ptr);
+
+            if (res != FR_OK) {
+                return res;
+            }
+        }
+
+        if (buffer.data.empty()) {
+            buffer.offset = f_tell(fil_ptr);
+            buffer.data.reserve(write_buffer_size_);
+        }
+        const BYTE* bytes = static_cast<const BYTE*>(buf);
+        buffer.data.insert(buffer.data.end(), bytes, bytes + count);
+        *written_bytes = count;
+        return FR_OK;
+    }
+
+
+    FRESULT FatFsFileManager::flushWriteBuffer(const FileHandle handle, FIL* fil_ptr) {
+        const auto it = write_buffers_.find(handle);
+
+        if (it == write_buffers_.end() || it->second.data.empty()) {
+            return FR_OK;
+        }
+        std::vector<BYTE>& data = it->second.data;
+        UINT written_bytes = 0;
+        FRESULT res = writeInternal(handle, fil_ptr, data.data(), data.size(), &written_bytes);
+
+        if (res == FR_OK && written_bytes != data.size()) {
+            //  The volume is full
+            res = FR_DENIED;
+        }
+
+        if (res != FR_OK) {
+            FATFS_DEBUG_PRINT("Error in flushing %lu bytes to handle %d, result %d\n", data.size(), handle, res);
+        }
+        //  The data is dropped even if the write failed, the error is reported to the caller
+        data.clear();
+        return res;
+    }
     
 
     FileHandle FatFsFileManager::getNewHandle() {
@@ -469,7 +613,11 @@ namespace conclave {
             //  When opening again the same file, we do a f_sync (flush), so that we can read it correctly.   
             const FileHandle old_handle = it->second;
             FIL* old_fil = files_.at(old_handle);
-            const FRESULT res_sync = f_sync(old_fil);
+            FRESULT res_sync = flushWriteBuffer(old_handle, old_fil);
+
+            if (res_sync == FR_OK) {
+                res_sync = f_sync(old_fil);
+            }
             FATFS_DEBUG_PRINT("File %s, handle %d previously opened, synced with result %d\n", path.c_str(), old_handle, res_sync);
             
             if (res_sync != 0) {
@@ -494,6 +642,10 @@ namespace conclave {
             return -1;
         };
         insertFileHandle(file_handle, fil_ptr, path_str);
+
+        if ((fatfs_mode_flag & FA_OPEN_APPEND) == FA_OPEN_APPEND) {
+            append_extents_[file_handle] = 0;
+        }
         return file_handle;
     };
   
@@ -525,6 +677,10 @@ namespace conclave {
         
         FIL* fil_ptr = it->second;    
         UINT read_bytes = 0;
+
+        if (flushWriteBuffer(handle, fil_ptr) != FR_OK) {
+            return -1;
+        }
         const FRESULT res = f_read(fil_ptr, buf, count, &read_bytes);
 
         if (res == FR_OK) {
@@ -544,7 +700,11 @@ namespace conclave {
             return 0;
         };
         FIL* fil_ptr = reinterpret_cast<FIL*>(fp);
+        const auto it = inverse_files_map_.find(fil_ptr);
 
+        if (it != inverse_files_map_.end() && flushWriteBuffer(it->second, fil_ptr) != FR_OK) {
+            return 0;
+        }
         UINT read_bytes = 0;
         const FRESULT res = f_read(fil_ptr, buf, count, &read_bytes);
 
@@ -571,7 +731,11 @@ namespace conclave {
         }
 
         FIL* fil_ptr = it->second;    
-        FRESULT res = f_lseek(fil_ptr, offset);
+        FRESULT res = flushWriteBuffer(handle, fil_ptr);
+
+        if (res == FR_OK) {
+            res = f_lseek(fil_ptr, offset);
+        }
 
         if (res != FR_OK) {
             return 0;
@@ -623,7 +787,11 @@ namespace conclave {
             //  When opening again the same file, we do a f_sync (flush), so that we can read it correctly.    
             FileHandle old_handle = it->second;
             FIL* old_fil = files_.at(old_handle);
-            const FRESULT res_sync = f_sync(old_fil);
+            FRESULT res_sync = flushWriteBuffer(old_handle, old_fil);
+
+            if (res_sync == FR_OK) {
+                res_sync = f_sync(old_fil);
+            }
             FATFS_DEBUG_PRINT("File %s, handle %d previously opened, synced with result %d\n", path.c_str(), old_handle, res_sync);
             
             if (res_sync != 0) {
@@ -647,6 +815,10 @@ namespace conclave {
             return nullptr;
         };
         insertFileHandle(file_handle, fil_ptr, path_str);
+
+        if ((fatfs_mode & FA_OPEN_APPEND) == FA_OPEN_APPEND) {
+            append_extents_[file_handle] = 0;
+        }
         return reinterpret_cast<FILE*>(fil_ptr);
     };
    
@@ -659,9 +831,13 @@ namespace conclave {
             return 0;
         };
         FIL* fil = reinterpret_cast<FIL*>(fp);
+        const auto it = inverse_files_map_.find(fil);
 
+        if (it == inverse_files_map_.end()) {
+            return 0;
+        }
         UINT written_bytes = 0;
-        const FRESULT res = f_write(fil, buf, count, &written_bytes);
+        const FRESULT res = bufferedWrite(it->second, fil, buf, count, &written_bytes);
 
         if (res == 0) {
             return written_bytes;
@@ -687,11 +863,16 @@ namespace conclave {
         FIL* fil_ptr = it->second;    
         UINT written_bytes = 0;
 
-        if (lseekInternal(fd, offset, SEEK_SET) == -1) {
+        //  Consecutive writes can be collected in the buffer without seeking, which would flush it
+        const auto buffer_it = write_buffers_.find(handle);
+        const bool is_sequential = buffer_it != write_buffers_.end() &&
+            !buffer_it->second.data.empty() &&
+            buffer_it->second.offset + buffer_it->second.data.size() == (FSIZE_t)offset;
+
+        if (!is_sequential && lseekInternal(fd, offset, SEEK_SET) == -1) {
             return 0;
         };
-
-        FRESULT res = f_write(fil_ptr, buf, count, &written_bytes);
+        FRESULT res = bufferedWrite(handle, fil_ptr, buf, count, &written_bytes);
 
         if (res == 0) {
             return written_bytes;
@@ -715,8 +896,7 @@ namespace conclave {
 
         FIL* fil_ptr = it->second;
         UINT written_bytes = 0;
-
-        const FRESULT res = f_write(fil_ptr, buf, count, &written_bytes);
+        const FRESULT res = bufferedWrite(handle, fil_ptr, buf, count, &written_bytes);
 
         if (res == 0) {
             return static_cast<size_t>(written_bytes);
@@ -905,13 +1085,26 @@ namespace conclave {
         if (it == inverse_file_paths_.end()) {
             return -1;
         }
+        const auto file_it = files_.find(handle);
+
+        if (file_it != files_.end() && file_it->second != nullptr &&
+            flushWriteBuffer(handle, file_it->second) != FR_OK) {
+            err = EIO;
+            return -1;
+        }
 
         std::string path = it->second;
         //  Here "path" is a FatFs style path (for example "0:/mydir/myfile.txt"),
         //    thus, to reuse the code below we need to remove the drive identifier,
         //    "0:/" inthe example
         path = path.substr(drive_text_id_.length(), path.length());
-        return this->statInternal64(path.c_str(), stat_buf, err);
+        const int res = this->statInternal64(path.c_str(), stat_buf, err);
+
+        if (res == 0 && file_it != files_.end() && file_it->second != nullptr) {
+            //  The directory entry is only updated when the file is synced
+            stat_buf->st_size = f_size(file_it->second);
+        }
+        return res;
     };
 
     
@@ -1247,6 +1440,90 @@ namespace conclave {
             errno = EINVAL;
             return -1;
         };
+        const auto extent_it = append_extents_.find(handle);
+
+        if (extent_it != append_extents_.end()) {
+            //  The clusters reserved beyond the new end of file have been released
+            extent_it->second = 0;
+        }
+        return 0;
+    }
+
+
+    int FatFsFileManager::fsync(int fd, int& err) {
+        FATFS_DEBUG_PRINT("fsync fd %d\n", fd);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        const FileHandle handle = fd;
+        const auto it = files_.find(handle);
+
+        if (it == files_.end() || it->second == nullptr) {
+            err = EBADF;
+            return -1;
+        }
+        FIL* fil_ptr = it->second;
+        FRESULT res = flushWriteBuffer(handle, fil_ptr);
+
+        if (res == FR_OK) {
+            res = f_sync(fil_ptr);
+        }
+
+        if (res != FR_OK) {
+            FATFS_DEBUG_PRINT("Error in syncing handle %d, result %d\n", handle, res);
+            err = EIO;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int FatFsFileManager::fallocate(int fd, int mode, off_t offset, off_t len, int& err) {
+        FATFS_DEBUG_PRINT("fallocate fd %d, mode %d, offset %ld, len %ld\n", fd, mode, offset, len);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        const FileHandle handle = fd;
+        const auto it = files_.find(handle);
+
+        if (it == files_.end() || !(it->second->flag & FA_WRITE)) {
+            err = EBADF;
+            return -1;
+        }
+
+        if (offset < 0 || len <= 0) {
+            err = EINVAL;
+            return -1;
+        }
+
+        //  Only the default mode (allocate and extend the file) and FALLOC_FL_KEEP_SIZE are supported
+        if ((mode & ~FALLOC_FL_KEEP_SIZE) != 0) {
+            err = EOPNOTSUPP;
+            return -1;
+        }
+
+        if ((uint64_t)offset + (uint64_t)len > kMaxFileSize) {
+            err = EFBIG;
+            return -1;
+        }
+        FIL* fil_ptr = it->second;
+        const FSIZE_t end = (FSIZE_t)(offset + len);
+        FRESULT res = flushWriteBuffer(handle, fil_ptr);
+
+        if (res == FR_OK) {
+            res = f_allocate(fil_ptr, end);
+        }
+
+        if (res != FR_OK) {
+            FATFS_DEBUG_PRINT("Error in allocating for handle %d, result %d\n", handle, res);
+            err = (res == FR_DENIED) ? ENOSPC : EIO;
+            return -1;
+        }
+
+        if (!(mode & FALLOC_FL_KEEP_SIZE) && end > f_size(fil_ptr)) {
+            if (extendWithZeros(fil_ptr, end) != 0) {
+                err = EIO;
+                return -1;
+            }
+        }
         return 0;
     }
 
@@ -1317,4 +1594,43 @@ namespace conclave {
             return -1;            
         }
     }
+
+
+    int FatFsFileManager::statvfs(struct statvfs64* buf, int& err) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        //  The number of free clusters is cached by FatFs (and kept exact by the free
+        //    cluster bitmap), so this doesn't scan the FAT.
+        DWORD free_clusters = 0;
+        FATFS* fs = nullptr;
+        const FRESULT res = f_getfree(drive_text_id_.c_str(), &free_clusters, &fs);
+
+        if (res != FR_OK) {
+            err = EIO;
+            return -1;
+        }
+#if FF_MAX_SS != FF_MIN_SS
+        const unsigned long sector_size = fs->ssize;
+#else
+        const unsigned long sector_size = FF_MAX_SS;
+#endif
+        const unsigned long max_files = last_handle_ - first_handle_;
+        const unsigned long open_files = files_.size();
+
+        memset(buf, 0, sizeof(struct statvfs64));
+        buf->f_bsize = fs->csize * sector_size;
+        buf->f_frsize = buf->f_bsize;
+        buf->f_blocks = fs->n_fatent - 2;
+        buf->f_bfree = free_clusters;
+        buf->f_bavail = free_clusters;
+        //  FAT has no limit on the number of files, the only limit is the number
+        //    of handles that we can give out.
+        buf->f_files = max_files;
+        buf->f_ffree = max_files > open_files ? max_files - open_files : 0;
+        buf->f_favail = buf->f_ffree;
+        buf->f_fsid = disk_handler_->getDriveId();
+        buf->f_namemax = FF_MAX_LFN;
+        return 0;
+    }
 };
@@ -22,6 +22,12 @@
 #include <string.h>
 #include "ff.hpp"			/* Declarations of FatFs API */
 #include "diskio.hpp"		/* Declarations of device I/O functions */
+#if FF_USE_DIR_INDEX
+#include "dir_index.hpp"	/* In-memory directory name index */
+#endif
+#if FF_USE_CLUSTER_BITMAP
+#include "cluster_bitmap.hpp"	/* In-memory free cluster bitmap */
+#endif
 
 
 /*--------------------------------------------------------------------------
@@ -34,6 +40,14 @@
 #error Wrong include file (ff.h).
 #endif
 
+#if FF_USE_DIR_INDEX && (!FF_USE_LFN || FF_FS_READONLY)
+#error FF_USE_DIR_INDEX requires LFN and write access
+#endif
+
+#if FF_USE_CLUSTER_BITMAP && (FF_FS_EXFAT || FF_FS_READONLY)
+#error FF_USE_CLUSTER_BITMAP is only supported on writable FAT/FAT32 volumes
+#endif
+
 
 /* Limits and boundaries */
 #define MAX_DIR		0x200000		/* Max size of FAT directory */
@@ -1253,10 +1267,88 @@ static FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			fs->wflag = 1;
 			break;
 		}
+#if FF_USE_CLUSTER_BITMAP
+		if (res == FR_OK && fs->clbitmap) {	/* Keep the free cluster bitmap in sync with the FAT */
+			((conclave::FatFsClusterBitmap*)fs->clbitmap)->setFree(clst, val == 0);
+		}
+#endif
 	}
 	return res;
 }
 
+
+
+#if FF_USE_CLUSTER_BITMAP
+/*-----------------------------------------------------------------------*/
+/* FAT access - Get the free cluster bitmap, building it on first use    */
+/*-----------------------------------------------------------------------*/
+
+static conclave::FatFsClusterBitmap* cluster_bitmap (	/* Returns the bitmap, or null on disk error */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	conclave::FatFsClusterBitmap* bm;
+	BYTE *buf;
+	FFOBJID obj;
+	LBA_t sect, fatend;
+	UINT nsect, n, i;
+	DWORD clst, val;
+
+
+	if (fs->clbitmap) return (conclave::FatFsClusterBitmap*)fs->clbitmap;
+
+	bm = new conclave::FatFsClusterBitmap(fs->n_fatent);
+	if (fs->fs_type == FS_FAT12) {	/* FAT12 entries straddle the sectors but the FAT is 6 KB at most */
+		obj.fs = fs;
+		for (clst = 2; clst < fs->n_fatent; clst++) {
+			val = get_fat(&obj, clst);
+			if (val == 0xFFFFFFFF || val == 1) {
+				delete bm;
+				return 0;
+			}
+			if (val == 0) bm->setFree(clst, true);
+		}
+	} else {	/* FAT16/32: Read the FAT a block of sectors at a time */
+		nsect = FF_CLUSTER_BITMAP_READ / SS(fs);
+		buf = (BYTE*)ff_memalloc(nsect * SS(fs));
+		if (!buf) {
+			delete bm;
+			return 0;
+		}
+		fatend = fs->fatbase + ((LBA_t)fs->n_fatent * (fs->fs_type == FS_FAT16 ? 2 : 4) + SS(fs) - 1) / SS(fs);
+		clst = 0;
+		for (sect = fs->fatbase; sect < fatend; sect += n) {
+			n = (fatend - sect < nsect) ? (UINT)(fatend - sect) : nsect;
+			if (disk_read(fs->pdrv, buf, sect, n) != RES_OK) {
+				ff_memfree(buf);
+				delete bm;
+				return 0;
+			}
+			if (fs->winsect >= sect && fs->winsect < sect + n) {	/* The window may hold a newer copy of a sector */
+				memcpy(buf + (UINT)(fs->winsect - sect) * SS(fs), fs->win, SS(fs));
+			}
+			for (i = 0; i < n * SS(fs) && clst < fs->n_fatent; clst++) {
+				if (fs->fs_type == FS_FAT16) {
+					val = ld_word(buf + i);
+					i += 2;
+				} else {
+					val = ld_dword(buf + i) & 0x0FFFFFFF;
+					i += 4;
+				}
+				if (clst >= 2 && val == 0) bm->setFree(clst, true);
+			}
+		}
+		ff_memfree(buf);
+	}
+	fs->clbitmap = bm;
+	if (fs->free_clst != bm->freeCount()) {	/* Correct the free cluster count from FSInfo */
+		fs->free_clst = bm->freeCount();
+		fs->fsi_flag |= 1;
+	}
+	return bm;
+}
+#endif
+
 #endif /* !FF_FS_READONLY */
 
 
@@ -1539,6 +1631,27 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			}
 		}
 	} else
+#endif
+#if FF_USE_CLUSTER_BITMAP
+	if (cluster_bitmap(fs)) {	/* On the FAT/FAT32 volume with the free cluster bitmap */
+		conclave::FatFsClusterBitmap* bm = (conclave::FatFsClusterBitmap*)fs->clbitmap;
+
+		ncl = 0;
+		if (scl == clst && bm->isFree(clst + 1)) {	/* Stretching an existing chain and the next cluster is free? */
+			ncl = clst + 1;
+		}
+		if (ncl == 0) {	/* Find another fragment, preferably one the chain can keep growing into */
+			cs = fs->last_clst;
+			scl = (cs >= 2 && cs < fs->n_fatent) ? cs + 1 : 2;
+			ncl = bm->findRun(FF_CLUSTER_BITMAP_RUN, scl);
+			if (ncl == 0) ncl = bm->findFree(scl);
+			if (ncl == 0) return 0;				/* No free cluster found? */
+		}
+		res = put_fat(fs, ncl, 0xFFFFFFFF);		/* Mark the new cluster 'EOC' */
+		if (res == FR_OK && clst != 0) {
+			res = put_fat(fs, clst, ncl);		/* Link it from the previous one if needed */
+		}
+	} else
 #endif
 	{	/* On the FAT/FAT32 volume */
 		ncl = 0;
@@ -2346,6 +2459,115 @@ static FRESULT dir_read (
 
 
 
+#if FF_USE_DIR_INDEX
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Name index                                       */
+/*-----------------------------------------------------------------------*/
+
+static conclave::FatFsDirIndex* dir_index (	/* Returns the name index of the volume */
+	FATFS* fs
+)
+{
+	if (!fs->dirindex) fs->dirindex = new conclave::FatFsDirIndex(FF_DIR_INDEX_MAX_BYTES);
+	return (conclave::FatFsDirIndex*)fs->dirindex;
+}
+
+
+static DWORD dir_index_key (	/* Returns the key of a directory in the name index */
+	FATFS* fs,
+	DWORD sclust	/* Start cluster of the directory table (0:root) */
+)
+{
+	return (fs->fs_type >= FS_FAT32 && sclust == fs->dirbase) ? 0 : sclust;	/* The root may be referred by its cluster on FAT32 */
+}
+
+
+static void dir_index_drop (
+	FATFS* fs,
+	DWORD sclust	/* Start cluster of the directory table which is going away */
+)
+{
+	if (fs->dirindex) ((conclave::FatFsDirIndex*)fs->dirindex)->dropDirectory(dir_index_key(fs, sclust));
+}
+
+
+static FRESULT dir_index_build (	/* FR_OK(0):succeeded, FR_DENIED:directory not indexable, !=0:error */
+	DIR* dp,
+	conclave::FatFsDirIndex* index
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD sclust = dir_index_key(fs, dp->obj.sclust);
+	WCHAR *name;
+	int ok = 1;
+
+
+	/* dir_read() captures the names into lfnbuf, which holds the name being looked up */
+	name = (WCHAR*)ff_memalloc((FF_MAX_LFN + 1) * sizeof (WCHAR));
+	if (!name) return FR_NOT_ENOUGH_CORE;
+	memcpy(name, fs->lfnbuf, (FF_MAX_LFN + 1) * sizeof (WCHAR));
+
+	index->beginDirectory(sclust);
+	res = dir_sdi(dp, 0);
+	while (res == FR_OK && (res = DIR_READ_FILE(dp)) == FR_OK) {
+		ok = index->insert(sclust, dp->dir, (dp->blk_ofs != 0xFFFFFFFF) ? fs->lfnbuf : 0, dp->dptr, dp->blk_ofs);
+		if (!ok) break;
+		res = dir_next(dp, 0);
+	}
+	memcpy(fs->lfnbuf, name, (FF_MAX_LFN + 1) * sizeof (WCHAR));
+	ff_memfree(name);
+
+	if (res == FR_NO_FILE) return FR_OK;	/* Reached to end of table */
+	if (!ok) {
+		index->skipDirectory(sclust);
+		return FR_DENIED;
+	}
+	index->dropDirectory(sclust);
+	return res;
+}
+
+
+static int dir_index_find (	/* 1:resolved by the index, 0:the table needs to be scanned */
+	DIR* dp,				/* Pointer to the directory object with the file name */
+	FRESULT* rres			/* Result of the lookup when resolved by the index */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	conclave::FatFsDirIndex* index = dir_index(fs);
+	DWORD sclust = dir_index_key(fs, dp->obj.sclust);
+	const conclave::FatFsDirIndex::Location* loc = 0;
+
+
+	if (dp->fn[NSFLAG] & NS_DOT) return 0;	/* Dot entries are not indexed */
+	if (!index->isIndexed(sclust)) {
+		if (index->isSkipped(sclust)) return 0;
+		res = dir_index_build(dp, index);
+		if (res == FR_DENIED || res == FR_NOT_ENOUGH_CORE) return 0;
+		if (res != FR_OK) { *rres = res; return 1; }
+	}
+	if (!(dp->fn[NSFLAG] & NS_NOLFN)) loc = index->findLfn(sclust, fs->lfnbuf);	/* LFN matched? */
+	if (!loc && !(dp->fn[NSFLAG] & NS_LOSS)) loc = index->findSfn(sclust, dp->fn);	/* SFN matched? */
+	if (!loc) { *rres = FR_NO_FILE; return 1; }
+
+	res = dir_sdi(dp, loc->dptr);
+	if (res == FR_OK) res = move_window(fs, dp->sect);
+	if (res != FR_OK) { *rres = res; return 1; }
+	if (dp->dir[DIR_Name] == DDEM || memcmp(dp->dir, loc->sfn, 11)) {	/* Stale index? */
+		index->dropDirectory(sclust);
+		return 0;
+	}
+	dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+	dp->blk_ofs = loc->blk_ofs;
+	*rres = FR_OK;
+	return 1;
+}
+
+#endif	/* FF_USE_DIR_INDEX */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Find an object in the directory                  */
 /*-----------------------------------------------------------------------*/
@@ -2384,6 +2606,11 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	}
 #endif
 	/* On the FAT/FAT32 volume */
+#if FF_USE_DIR_INDEX
+	if (dir_index_find(dp, &res)) return res;	/* Try the name index first */
+	res = dir_sdi(dp, 0);			/* Rewind directory object */
+	if (res != FR_OK) return res;
+#endif
 #if FF_USE_LFN
 	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
@@ -2492,6 +2719,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 
 	/* Create an SFN with/without LFNs. */
 	n_ent = (sn[NSFLAG] & NS_LFN) ? (len + 12) / 13 + 1 : 1;	/* Number of entries to allocate */
+#if FF_USE_DIR_INDEX
+	n = n_ent - 1;					/* Number of LFN entries */
+#endif
 	res = dir_alloc(dp, n_ent);		/* Allocate entries */
 	if (res == FR_OK && --n_ent) {	/* Set LFN entry if needed */
 		res = dir_sdi(dp, dp->dptr - n_ent * SZDIRE);
@@ -2522,6 +2752,12 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			fs->wflag = 1;
+#if FF_USE_DIR_INDEX
+			if (fs->dirindex && !((conclave::FatFsDirIndex*)fs->dirindex)->insert(	/* Add the new entry to the name index */
+					dir_index_key(fs, dp->obj.sclust), dp->fn, n ? fs->lfnbuf : 0, dp->dptr, n ? dp->dptr - n * SZDIRE : 0xFFFFFFFF)) {
+				dir_index_drop(fs, dp->obj.sclust);
+			}
+#endif
 		}
 	}
 
@@ -2562,6 +2798,9 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		} while (res == FR_OK);
 		if (res == FR_NO_FILE) res = FR_INT_ERR;
 	}
+#if FF_USE_DIR_INDEX
+	if (res == FR_OK && fs->dirindex) ((conclave::FatFsDirIndex*)fs->dirindex)->erase(dir_index_key(fs, dp->obj.sclust), last);
+#endif
 #else			/* Non LFN configuration */
 
 	res = move_window(fs, dp->sect);
@@ -3547,6 +3786,13 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #endif
 #if FF_FS_LOCK != 0			/* Clear file lock semaphores */
 	clear_lock(fs);
+#endif
+#if FF_USE_DIR_INDEX
+	if (fs->dirindex) ((conclave::FatFsDirIndex*)fs->dirindex)->clear();	/* Forget the names of the previous mount */
+#endif
+#if FF_USE_CLUSTER_BITMAP	/* The free cluster bitmap is built again on the first allocation */
+	delete (conclave::FatFsClusterBitmap*)fs->clbitmap;
+	fs->clbitmap = 0;
 #endif
 	return FR_OK;
 }
@@ -3625,6 +3871,14 @@ FRESULT f_mount (
 #endif
 #if FF_FS_REENTRANT						/* Discard sync object of the current volume */
 		if (!ff_del_syncobj(cfs->sobj)) return FR_INT_ERR;
+#endif
+#if FF_USE_DIR_INDEX						/* Discard name index of the current volume */
+		delete (conclave::FatFsDirIndex*)cfs->dirindex;
+		cfs->dirindex = 0;
+#endif
+#if FF_USE_CLUSTER_BITMAP				/* Discard free cluster bitmap of the current volume */
+		delete (conclave::FatFsClusterBitmap*)cfs->clbitmap;
+		cfs->clbitmap = 0;
 #endif
 		cfs->fs_type = 0;				/* Clear old fs object */
 	}
@@ -4768,7 +5022,13 @@ FRESULT f_getfree (
 		/* If free_clst is valid, return it without full FAT scan */
 		if (fs->free_clst <= fs->n_fatent - 2) {
 			*nclst = fs->free_clst;
-		} else {
+		} else
+#if FF_USE_CLUSTER_BITMAP
+		if (cluster_bitmap(fs)) {	/* Building the bitmap counts the free clusters */
+			*nclst = fs->free_clst;
+		} else
+#endif
+		{
 			/* Scan FAT to obtain number of free clusters */
 			nfree = 0;
 			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
@@ -4960,6 +5220,9 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+#if FF_USE_DIR_INDEX
+				if (res == FR_OK && (dj.obj.attr & AM_DIR)) dir_index_drop(fs, dclst);	/* Discard name index of the sub-directory */
+#endif
 				if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
 #if FF_FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
@@ -5011,6 +5274,9 @@ FRESULT f_mkdir (
 			if (dcl == 0) res = FR_DENIED;		/* No space to allocate a new cluster? */
 			if (dcl == 1) res = FR_INT_ERR;		/* Any insanity? */
 			if (dcl == 0xFFFFFFFF) res = FR_DISK_ERR;	/* Disk error? */
+#if FF_USE_DIR_INDEX
+			if (res == FR_OK) dir_index_drop(fs, dcl);	/* The cluster may have held a removed directory */
+#endif
 			tm = GET_FATTIME();
 			if (res == FR_OK) {
 				res = dir_clear(fs, dcl);		/* Clean up the new table */
@@ -5524,6 +5790,23 @@ FRESULT f_expand (
 			}
 		}
 	} else
+#endif
+#if FF_USE_CLUSTER_BITMAP
+	if (cluster_bitmap(fs)) {
+		scl = ((conclave::FatFsClusterBitmap*)fs->clbitmap)->findRun(tcl, stcl);	/* Find a contiguous cluster block */
+		if (scl == 0) res = FR_DENIED;				/* No contiguous cluster block was found */
+		if (res == FR_OK) {	/* A contiguous free area is found */
+			if (opt) {		/* Allocate it now */
+				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
+					res = put_fat(fs, clst, (n == 1) ? 0xFFFFFFFF : clst + 1);
+					if (res != FR_OK) break;
+					lclst = clst;
+				}
+			} else {		/* Set it as suggested point for next allocation */
+				lclst = scl - 1;
+			}
+		}
+	} else
 #endif
 	{
 		scl = clst = stcl; ncl = 0;
@@ -5569,6 +5852,130 @@ FRESULT f_expand (
 	LEAVE_FF(fs, res);
 }
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Allocate Clusters beyond the End of the File                          */
+/*-----------------------------------------------------------------------*/
+/* Unlike f_expand(), this also works on files with data. The cluster chain
+/  is stretched so that it can hold fsz bytes, preferably contiguously, but
+/  the file size is not changed. Writes beyond the end of the file follow the
+/  existing chain (see create_chain()), so the clusters get used as the file
+/  grows. f_shrink() gives the unused clusters back. */
+
+FRESULT f_allocate (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t fsz		/* Number of bytes the cluster chain needs to hold */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, lclst, ncl, tcl;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_WRITE) || (FF_FS_EXFAT && fs->fs_type == FS_EXFAT)) LEAVE_FF(fs, FR_DENIED);
+	n = (DWORD)fs->csize * SS(fs);	/* Cluster size */
+	tcl = (DWORD)(fsz / n) + ((fsz % n) ? 1 : 0);	/* Number of clusters required */
+
+	/* Follow the chain up to its last cluster */
+	clst = fp->obj.sclust; lclst = 0; ncl = 0;
+	while (clst != 0 && ncl < tcl) {
+		lclst = clst; ncl++;
+		clst = get_fat(&fp->obj, clst);
+		if (clst == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+		if (clst < 2) ABORT(fs, FR_INT_ERR);
+		if (clst >= fs->n_fatent) clst = 0;	/* End of the chain */
+	}
+	if (ncl >= tcl) LEAVE_FF(fs, FR_OK);	/* The chain is already long enough */
+
+	while (res == FR_OK && ncl < tcl) {
+		clst = 0;
+#if FF_USE_CLUSTER_BITMAP
+		if (cluster_bitmap(fs)) {	/* Try to allocate the remaining clusters in a single block */
+			DWORD scl = ((conclave::FatFsClusterBitmap*)fs->clbitmap)->findRun(tcl - ncl, lclst ? lclst + 1 : fs->last_clst);
+
+			if (scl != 0) {
+				for (clst = scl; res == FR_OK && ncl < tcl; clst++, ncl++) {	/* Create a cluster chain on the FAT */
+					res = put_fat(fs, clst, (ncl + 1 == tcl) ? 0xFFFFFFFF : clst + 1);
+				}
+				if (res == FR_OK) res = lclst ? put_fat(fs, lclst, scl) : FR_OK;	/* Link it to the file */
+				if (res == FR_OK) {
+					if (lclst == 0) fp->obj.sclust = scl;
+					lclst = clst - 1;
+					fs->last_clst = lclst;
+					if (fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO */
+						fs->free_clst -= lclst - scl + 1;
+					}
+					fs->fsi_flag |= 1;
+				}
+			}
+		}
+#endif
+		if (clst == 0) {	/* Fall back to stretching the chain a cluster at a time */
+			clst = create_chain(&fp->obj, lclst);
+			if (clst == 0) res = FR_DENIED;
+			if (clst == 1) res = FR_INT_ERR;
+			if (clst == 0xFFFFFFFF) res = FR_DISK_ERR;
+			if (res == FR_OK) {
+				if (lclst == 0) fp->obj.sclust = clst;
+				lclst = clst; ncl++;
+			}
+		}
+	}
+	fp->flag |= FA_MODIFIED;
+	if (res == FR_INT_ERR || res == FR_DISK_ERR) ABORT(fs, res);
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Release the Clusters beyond the End of the File                       */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_shrink (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD n, clst, ncl, tcl;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);
+	if (fp->obj.sclust == 0) LEAVE_FF(fs, FR_OK);	/* Nothing allocated */
+
+	if (fp->obj.objsize == 0) {	/* Release the entire chain */
+		res = remove_chain(&fp->obj, fp->obj.sclust, 0);
+		if (res == FR_OK) {
+			fp->obj.sclust = 0;
+			fp->flag |= FA_MODIFIED;
+		}
+	} else {
+		n = (DWORD)fs->csize * SS(fs);	/* Cluster size */
+		tcl = (DWORD)(fp->obj.objsize / n) + ((fp->obj.objsize % n) ? 1 : 0);	/* Number of clusters in use */
+		for (clst = fp->obj.sclust; --tcl; clst = ncl) {	/* Find the last cluster in use */
+			ncl = get_fat(&fp->obj, clst);
+			if (ncl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+			if (ncl < 2 || ncl >= fs->n_fatent) ABORT(fs, FR_INT_ERR);
+		}
+		ncl = get_fat(&fp->obj, clst);
+		if (ncl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
+		if (ncl < 2) ABORT(fs, FR_INT_ERR);
+		if (ncl < fs->n_fatent) {	/* Remove the clusters after it */
+			res = remove_chain(&fp->obj, ncl, clst);
+		}
+	}
+	if (res != FR_OK) ABORT(fs, res);
+	LEAVE_FF(fs, res);
+}
+
 #endif /* FF_USE_EXPAND && !FF_FS_READONLY */
 
 
@@ -4,6 +4,7 @@
 #include <string>
 #include <memory>
 
+#include "common.hpp"
 #include "diskio.hpp"
 
 namespace conclave {
@@ -23,13 +24,17 @@ namespace conclave {
         unsigned long drive_size_;
 
         unsigned long num_sectors_;    
+
+        unsigned int sector_size_;
     
         std::string drive_text_id_;
 
         std::shared_ptr<FATFS> filesystem_;
 
     public:
-        FatFsDisk(const unsigned char drive_id, const unsigned long size);
+        FatFsDisk(const unsigned char drive_id,
+                  const unsigned long size,
+                  const unsigned int sector_size = SECTOR_SIZE);
     
         virtual ~FatFsDisk();
     
@@ -39,26 +44,31 @@ namespace conclave {
 
         unsigned long getNumSectors();
 
+        unsigned int getSectorSize();
+
+        static bool isValidSectorSize(const unsigned int sector_size);
+
         std::string getDriveTextId();
 
         std::shared_ptr<FATFS> getFileSystem();
 
-        virtual void diskStart() = 0;
+        //  FatFs formats the disk after this call when init_type is FORMAT
+        virtual void diskStart(const DiskInitialization init_type) = 0;
     
         virtual void diskStop() = 0;    
 
         // Here are the 5 FatFs calls to register
-        DSTATUS diskInitialize();
+        virtual DSTATUS diskInitialize();
 
-        DSTATUS diskStatus();
+        virtual DSTATUS diskStatus();
     
         virtual DRESULT diskRead(BYTE* input_buffer,
                                  LBA_t sector,
-                                 BYTE num_reads) = 0;
+                                 UINT num_reads) = 0;
 
         virtual DRESULT diskWrite(const BYTE* content_buf,
                                   LBA_t sector,
-                                  BYTE num_writes) = 0;
+                                  UINT num_writes) = 0;
 
         virtual DRESULT diskIoCtl(BYTE cmd, void * buf)  = 0;
     };
@@ -1,6 +1,8 @@
 #ifndef _INMEMORY_DISK
 #define _INMEMORY_DISK
 
+#include <unordered_map>
+
 #include "diskio.hpp"
 
 #include "disk.hpp"
@@ -11,26 +13,40 @@ namespace conclave {
       in the Enclave.
       The member functions of this class are reading/writing streams of
       encrypted bytes representing filesystem "sectors" (FatFs terminology).
-      The actual file storage consists in an unsigned char buffer
-      which is initialized and resident only in the Enclave.
+      The actual file storage consists in chunks of kChunkSize bytes which are
+      resident only in the Enclave. A chunk is allocated the first time non-zero
+      content is written to it and it is released when all its sectors are trimmed,
+      so the memory used follows the data stored rather than the size of the drive.
+      The sectors of a chunk which is not allocated read as zeros.
     */
     class InMemoryDisk : public FatFsDisk {
 
     private:
-        unsigned char* ram_buffer_ = NULL;
-   
+        static const UINT kChunkSize = 64 * 1024;
+
+        const UINT chunk_sectors_;
+
+        std::unordered_map<UINT, unsigned char*> chunks_;
+
+        bool isValidRange(const LBA_t start, const UINT num_sectors);
+
+        void releaseChunks(const LBA_t first_sector, const LBA_t last_sector);
+
     public:
         InMemoryDisk(const BYTE drive_id, const unsigned long size);
 
         virtual ~InMemoryDisk();
 
-        DRESULT diskRead(BYTE* output_buffer, LBA_t sector, BYTE num_reads) override;
+        //  Memory taken by the chunks allocated so far
+        size_t getAllocatedSize() const;
+
+        DRESULT diskRead(BYTE* output_buffer, LBA_t sector, UINT num_reads) override;
 
-        DRESULT diskWrite(const BYTE* content_buf, LBA_t sector, BYTE num_writes) override;
+        DRESULT diskWrite(const BYTE* content_buf, LBA_t sector, UINT num_writes) override;
 
         DRESULT diskIoCtl(BYTE cmd, void * buf) override;
 
-        void diskStart() override;
+        void diskStart(const DiskInitialization init_type) override;
 
         void diskStop() override;    
     };
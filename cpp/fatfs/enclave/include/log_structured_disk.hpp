@@ -0,0 +1,114 @@
+#ifndef _FATFS_LOG_STRUCTURED_DISK
+#define _FATFS_LOG_STRUCTURED_DISK
+
+#include <vector>
+#include <unordered_map>
+
+#include "common.hpp"
+#include "diskio.hpp"
+
+#include "persistent_disk.hpp"
+
+namespace conclave {
+
+    /*
+      This class provides an encrypted persistent FatFs filesystem where the sectors
+      are appended to a log in the Host file instead of having a fixed position
+      (PERSISTENT_LAYOUT_LOG), so that the writes are sequential on the Host.
+      The log is made of segments. The sectors written between two syncs of FatFs are
+      appended to the current segment as a unit: a summary sector with the ids of the
+      sectors, followed by the sectors themselves. A unit is written with a single OCall
+      and made durable with a single flush of the Host file, and it is part of the
+      filesystem only once it is complete, so no journal is needed.
+      A segment is reused once its sectors have been replaced, so the position of a sector
+      in the log is not enough for its IV. Each use of a segment has its own generation,
+      which is recorded in a header at the start of the segment (written with the first
+      unit) and is bound to the IVs of the summaries and sectors of the segment. The IV of
+      the header is its position, as for the superblock of the journal of PersistentDisk.
+      A unit is never written again where writing it failed.
+      The indirection table from the id of a sector to its position in the log is kept
+      in the Enclave. It is persisted, encrypted, in the summaries and it is rebuilt from
+      them when the filesystem is opened: the most recent unit with a sector wins.
+      Overwritten sectors leave dead space in the log. When only a few segments are free,
+      the live sectors of the segment with the fewest of them are appended again to the
+      log and the segment is freed (cleaning). The cleaner runs a step at a time when
+      FatFs syncs, as the Enclave has no thread of its own to run it in the background.
+      The log is bigger than the disk to leave room to the cleaner. The table needs 4 bytes
+      for each sector of the disk and 4 bytes for each position of the log.
+      Trimmed sectors are removed from the table at the following sync, which makes their
+      segments cheaper to clean. The storage of the free segments is released on the Host.
+    */
+    class LogStructuredDisk : public PersistentDisk {
+
+    private:
+        //  Size of a segment in sectors and number of segments in the log
+        const UINT segment_sectors_;
+        const UINT num_segments_;
+
+        //  Maximum number of sectors in a unit, besides its summary
+        UINT unit_sectors_ = 0;
+
+        //  Position in the log of each sector, and sector at each position of the log
+        std::vector<uint32_t> table_;
+        std::vector<uint32_t> owners_;
+
+        //  Number of sectors in each segment that are still referenced by the table
+        std::vector<UINT> live_sectors_;
+
+        //  Generation of each segment, 0 when the segment is free. It is a value of the
+        //    sequence number taken when the segment is opened, hence it is unique.
+        std::vector<uint64_t> generations_;
+
+        std::vector<UINT> free_segments_;
+
+        //  Segment where the units are appended, and position of the next unit in it
+        UINT current_segment_;
+        UINT current_position_ = 0;
+
+        uint64_t unit_seq_ = 1;
+
+        bool cleaning_ = false;
+
+        //  Sectors written since the last unit
+        std::unordered_map<LBA_t, UINT> pending_slots_;
+        std::vector<LBA_t> pending_sectors_;
+        std::vector<BYTE> pending_data_;
+
+        //  IV of the sector at a position of the log, in the current use of its segment
+        unsigned long ivId(const uint32_t position) const;
+
+        void scanLog();
+
+        DRESULT addPending(const BYTE* input_buf, const LBA_t sector);
+
+        DRESULT appendUnit();
+
+        DRESULT openSegment();
+
+        void releaseSegments();
+
+        bool cleanSegment();
+
+    protected:
+        DRESULT readRun(BYTE* output_buf, const LBA_t sector, const UINT num_sectors) override;
+
+        DRESULT writeSectors(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors) override;
+
+        DRESULT syncSectors() override;
+
+        DRESULT discardSectors(const LBA_t sector, const UINT num_sectors) override;
+
+    public:
+        LogStructuredDisk(const BYTE drive,
+                          const unsigned long size,
+                          const unsigned int sector_size,
+                          const unsigned char* encryption_key);
+
+        virtual ~LogStructuredDisk();
+
+        void diskStart(const DiskInitialization init_type) override;
+
+        void diskStop() override;
+    };
+}
+#endif  //  End of _FATFS_LOG_STRUCTURED_DISK
@@ -1,8 +1,10 @@
 #ifndef _FATFS_PERSISTENT_DISK
 #define _FATFS_PERSISTENT_DISK
 
+#include <memory>
 #include <vector>
 #include <string>
+#include <unordered_map>
 
 #include "sgx_tcrypto.h"
 
@@ -10,15 +12,21 @@
 #include "diskio.hpp"
 
 #include "disk.hpp"
+#include "sector_crypto.hpp"
 
 #define ENCRYPTION 1
 #define SECTOR_SHUFFLING 1
+//  The journal relies on the MACs to find where the committed records end
+#define JOURNAL ENCRYPTION
+
+//  Layouts of the sectors in the Host file, see PersistentDisk and LogStructuredDisk
+#define PERSISTENT_LAYOUT_IN_PLACE 0
+#define PERSISTENT_LAYOUT_LOG 1
 
 #if ENCRYPTION
-#define SECTOR_SIZE_AND_MAC (SECTOR_SIZE + SGX_AESGCM_MAC_SIZE)
-#define IV_SIZE 12
+#define SECTOR_MAC_SIZE SGX_AESGCM_MAC_SIZE
 #else
-#define SECTOR_SIZE_AND_MAC SECTOR_SIZE
+#define SECTOR_MAC_SIZE 0
 #endif
 
 
@@ -32,6 +40,37 @@ namespace conclave {
       The Host writes such bytes into a a single file according to a path established
       when the Enclave is loaded by the Host itself.
       Encryption and sector shuffling provide further obfuscation.
+      Sectors are shuffled in groups of consecutive sectors (e.g. 64K), each group is
+      moved as a whole to a random position in the file and keeps its sectors in order.
+      This way the sequential reads and writes of FatFs are sequential on the Host too.
+      Filesystems created before the group size was recorded in the header have a group
+      size of 0, which means that each sector is shuffled on its own.
+      Sequential reads are detected per stream of consecutive sectors: once a stream is
+      read sequentially, the following sectors are read ahead with the same OCalls and
+      decryption, in a window that doubles at each sequential read. Tracking a few streams
+      means that files read at the same time, and the FAT, do not reset each other.
+      Writes are made crash consistent by a redo journal stored after the sectors of the
+      filesystem in the Host file. The sectors written between two syncs of FatFs are
+      appended to the journal as one or more records, the last of which commits them, and
+      a single flush of the Host file makes all the records durable. The sectors are written to their home location lazily, when the
+      journal is half full (checkpoint). Records that have not been checkpointed are
+      replayed when the filesystem is opened again.
+      The sectors freed by FatFs are trimmed: a bitmap of the sectors that might hold data
+      lets the trimmed sectors, and those never written since the filesystem was formatted,
+      be read as zeros without going to the Host. Once the sync that frees them in the FAT is
+      durable, the Host is asked to release their storage, so the file stays as small as the
+      data in it. The bitmap is stored after the journal and it is written through the journal,
+      so that it changes together with the sectors it describes. Zeros written to sectors
+      without data, e.g. most of the FAT when formatting, are not written at all.
+      The sector size is chosen when the filesystem is formatted and is recorded by
+      the Host in the header of the file. Bigger sectors mean fewer encryptions, MACs
+      and OCalls for the same amount of data.
+      The header of the file is not authenticated, so the sector size, the shuffle group
+      size and the layout are bound to the encryption key: with any other geometry the
+      sectors do not authenticate, and the filesystem is not started (FatFs then fails
+      to mount it) rather than read with the sectors in the wrong places. Filesystems
+      created before the geometry was recorded have the key of the default geometry
+      (512 bytes sectors shuffled one by one, in place).
     */
     class PersistentDisk : public FatFsDisk {
 
@@ -39,46 +78,196 @@ namespace conclave {
         std::vector<LBA_t> sectors_table_1_;
         std::vector<LBA_t> sectors_table_2_;
 
+        //  Number of sectors in a shuffle group, 0 when sectors are shuffled one by one
+        const unsigned int shuffle_group_sectors_;
+
         sgx_aes_gcm_128bit_key_t encryption_key_ = {0};
 
-        unsigned char buffer_encryption_[SECTOR_SIZE_AND_MAC] = {0};
+        //  Size of an encrypted sector on the Host, i.e. sector and MAC
+        const unsigned int sector_size_and_mac_;
+
+        std::unique_ptr<SectorCrypto> crypto_;
+
+        //  Encrypted sectors of the run being read or written, and their ids on the Host
+        std::vector<unsigned char> buffer_encryption_;
+
+        std::vector<unsigned long> sector_ids_;
+
+        struct ReadStream {
+            //  Sector expected by the next sequential read
+            LBA_t next_sector = 0;
+
+            //  Number of sectors to read ahead at the next sequential read, 0 until the
+            //    stream has been read sequentially
+            UINT window = 0;
+
+            //  Decrypted sectors of the last read of the stream, including those read ahead
+            LBA_t cache_start = 0;
+            UINT cache_count = 0;
+            std::vector<BYTE> cache;
+
+            unsigned long last_use = 0;
+        };
+
+        std::vector<ReadStream> read_streams_;
+
+        unsigned long read_counter_ = 0;
+
+        //  Host id of the journal superblock, the records follow it
+        LBA_t journal_start_ = 0;
+
+        //  Size of the journal in sectors, including the superblock
+        UINT journal_sectors_ = 0;
+
+        //  Maximum number of sectors in a record, besides its header
+        UINT journal_record_sectors_ = 0;
 
-        unsigned char buffer_writes_[SECTOR_SIZE_AND_MAC] = {0};
+        //  Position of the next record and its sequence number
+        UINT journal_head_ = 0;
+        unsigned long journal_seq_ = 0;
 
-        unsigned long buffer_index_ = 0;
+        //  Sectors written since the last checkpoint, their home location on the Host is stale.
+        //    Each sector has a slot in dirty_data_, pending_slots_ are those not yet in a record
+        //    and open_slots_ those in the records of the sync in progress, which is not committed.
+        std::unordered_map<LBA_t, UINT> dirty_slots_;
+        std::vector<LBA_t> dirty_sectors_;
+        std::vector<BYTE> dirty_data_;
+        std::vector<bool> dirty_pending_;
+        std::vector<bool> dirty_open_;
+        std::vector<UINT> pending_slots_;
+        std::vector<UINT> open_slots_;
 
-        int encrypt(const unsigned long sector_id,
-                    const BYTE* input_buffer,
-                    BYTE* output_buffer);
+        //  One bit for each sector, cleared when the sector is trimmed and set when it is written
+        std::vector<uint64_t> written_sectors_;
 
-        int decrypt(const unsigned long sector_id,
-                    const BYTE* input_buffer,
-                    BYTE* output_buffer);
+        //  First and last sector of the ranges trimmed since the last sync
+        std::vector<std::pair<LBA_t, LBA_t>> trimmed_ranges_;
+
+        //  Host id of the bitmap and its size in sectors, 0 when it is not persisted.
+        //    In the journal the sectors of the bitmap follow those of the filesystem.
+        LBA_t bitmap_start_ = 0;
+        UINT bitmap_sectors_ = 0;
+        std::vector<bool> bitmap_dirty_;
+
+        //  Whether the bitmap has been there since the filesystem was formatted
+        bool bitmap_from_format_ = false;
 
         void prepareSectorTables();
 
         unsigned long mapSectorId(const unsigned long sector_id);
 
-        DRESULT flush();
+        void prepareGroupTable();
+
+        void prepareRun(const LBA_t sector, const UINT num_sectors);
+
+        DRESULT writeRun(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors);
+
+        bool startJournal(const DiskInitialization init_type);
+
+        DRESULT writeJournalSuperblock();
+
+        DRESULT writeJournal(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors);
+
+        DRESULT writeJournalRecord(const UINT* slots, const UINT num_sectors, const bool commit);
+
+        DRESULT appendJournalRecord(const bool commit);
+
+        DRESULT syncJournal();
+
+        DRESULT checkpointJournal();
+
+        const BYTE* getDirtySector(const LBA_t sector);
+
+        ReadStream& getReadStream(const LBA_t sector, bool& sequential);
+
+        void updateReadStreams(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors);
+
+        void trimSectors(const LBA_t first_sector, const LBA_t last_sector);
+
+        void startBitmap(const DiskInitialization init_type);
+
+        DRESULT writeBitmap();
+
+    protected:
+        //  Whether the sectors that have not been written are still zeros when the filesystem
+        //    is opened again, so that writing zeros to them can be skipped
+        bool unwritten_sectors_persist_ = false;
+
+        //  Cleared when the filesystem does not authenticate with the key and the geometry
+        //    it is opened with, nothing is written to the Host then
+        bool started_ = false;
+
+        PersistentDisk(const BYTE drive,
+                       const unsigned long size,
+                       const unsigned int sector_size,
+                       const unsigned int shuffle_group_size,
+                       const unsigned int layout,
+                       const unsigned char* encryption_key);
+
+        DRESULT readHostSectors(BYTE* output_buf,
+                                const unsigned long* host_ids,
+                                const unsigned long* iv_ids,
+                                const UINT num_sectors);
+
+        DRESULT writeHostSectors(const BYTE* input_buf,
+                                 const unsigned long* host_ids,
+                                 const unsigned long* iv_ids,
+                                 const UINT num_sectors);
+
+        DRESULT syncHost();
+
+        DRESULT trimHostSectors(const unsigned long host_id, const unsigned long num_sectors);
+
+        void clearReadStreams();
+
+        bool isWrittenSector(const LBA_t sector) const;
+
+        void markWrittenSectors(const LBA_t sector, const UINT num_sectors);
+
+        void resetWrittenSectors(const bool written);
+
+        //  Discards the sectors trimmed since the last sync and not written again, to be called
+        //    once the sync is durable
+        DRESULT discardTrimmedSectors();
+
+        //  Where the sectors are stored on the Host, in place (with the journal) in this class.
+        //    diskRead, diskWrite and CTRL_SYNC go through these, together with the read-ahead.
+        virtual DRESULT readRun(BYTE* output_buf, const LBA_t sector, const UINT num_sectors);
+
+        virtual DRESULT writeSectors(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors);
+
+        virtual DRESULT syncSectors();
+
+        virtual DRESULT discardSectors(const LBA_t sector, const UINT num_sectors);
 
     public:
         PersistentDisk(const BYTE drive,
                        const unsigned long size,
+                       const unsigned int sector_size,
+                       const unsigned int shuffle_group_size,
                        const unsigned char* encryption_key);
 
         virtual ~PersistentDisk();
 
+        //  The shuffle group size is in bytes, 0 or a multiple of the sector size
+        static bool isValidShuffleGroupSize(const unsigned int shuffle_group_size,
+                                            const unsigned int sector_size);
+
         DRESULT diskRead(BYTE* output_buf,
                          LBA_t sector,
-                         BYTE num_reads) override;
+                         UINT num_reads) override;
 
         DRESULT diskWrite(const BYTE* input_buf,
                           LBA_t sector,
-                          BYTE num_writes) override;
+                          UINT num_writes) override;
 
         DRESULT diskIoCtl(BYTE cmd, void* buf) override;
 
-        void diskStart() override;
+        DSTATUS diskInitialize() override;
+
+        DSTATUS diskStatus() override;
+
+        void diskStart(const DiskInitialization init_type) override;
 
         void diskStop() override;
     };
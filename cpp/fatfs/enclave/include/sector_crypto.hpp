@@ -0,0 +1,66 @@
+#ifndef _FATFS_SECTOR_CRYPTO
+#define _FATFS_SECTOR_CRYPTO
+
+#include <stddef.h>
+
+#include "sgx_tcrypto.h"
+
+#include "diskio.hpp"
+
+#define SECTOR_IV_SIZE 12
+
+namespace conclave {
+
+    /*
+      AES-128-GCM encryption of runs of sectors of the persistent filesystem.
+
+      Each sector is encrypted on its own, with a 12 bytes IV made of the id of the
+      sector on the Host, and is followed by its 16 bytes MAC. This is the same format
+      produced by sgx_rijndael128GCM_encrypt, so filesystems written before this class
+      was introduced can still be read.
+
+      sgx_rijndael128GCM_encrypt expands the key and sets up the GHASH tables on every
+      call, and processes one sector at a time. Here the key schedule and the hash key
+      are computed once, and the sectors of a run are processed in groups of kLanes:
+      the AES rounds and the GHASH multiplications of the sectors in a group are
+      interleaved, so that the AES-NI and PCLMULQDQ units are kept busy instead of
+      waiting for the result of the previous block of the same sector.
+    */
+    class SectorCrypto {
+    public:
+        static const size_t kLanes = 8;
+
+        explicit SectorCrypto(const sgx_aes_gcm_128bit_key_t& key);
+
+        ~SectorCrypto();
+
+        SectorCrypto(const SectorCrypto&) = delete;
+
+        SectorCrypto& operator=(const SectorCrypto&) = delete;
+
+        //  Encrypts num_sectors consecutive sectors of sector_size bytes from input_buf.
+        //    For each sector, output_buf receives the ciphertext followed by the MAC.
+        //  sector_ids contains the id of each sector, used as IV.
+        int encrypt(const unsigned long* sector_ids,
+                    const BYTE* input_buf,
+                    BYTE* output_buf,
+                    size_t num_sectors,
+                    unsigned int sector_size);
+
+        //  Inverse of encrypt. If any MAC does not match, -1 is returned and output_buf
+        //    is cleared, so that no unauthenticated data is handed to FatFs.
+        int decrypt(const unsigned long* sector_ids,
+                    const BYTE* input_buf,
+                    BYTE* output_buf,
+                    size_t num_sectors,
+                    unsigned int sector_size);
+
+    private:
+        //  AES-128 key schedule and powers H, H^2, H^3, H^4 of the GHASH key (byte reflected)
+        alignas(16) unsigned char round_keys_[11 * 16];
+
+        alignas(16) unsigned char hash_powers_[4 * 16];
+    };
+}
+
+#endif  //  End of _FATFS_SECTOR_CRYPTO
@@ -0,0 +1,201 @@
+#ifndef _TMPFS_FILE_MANAGER
+#define _TMPFS_FILE_MANAGER
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+#include "posix_file_manager.hpp"
+
+namespace conclave {
+
+    /*
+      This class provides an in-memory volatile filesystem which lives directly in the
+      Enclave memory, without FatFs and a disk underneath (IN_MEMORY_BACKEND_TMPFS).
+      The namespace is a tree of nodes, each directory keeps its entries in a hash table.
+      The content of a file is stored in extents of whole pages: the first extent is one
+      page and each following extent doubles in size, up to kMaxExtentSize, so that the
+      extent holding an offset is computed rather than searched and sequential reads and
+      writes are a memcpy per extent. An extent is allocated when it is first written,
+      the ones which have not been written read as zeros.
+      The memory used by the extents is limited by the size of the filesystem, and so
+      is the size of a file.
+      An unlinked file keeps its content until the last handle opened on it is closed.
+      The whole tree can be serialised with snapshot and loaded back with restore, so that
+      the content of the filesystem survives a restart of the Enclave (sealed by the caller).
+    */
+    class TmpFsFileManager : public PosixFileManager {
+
+    private:
+        struct Node {
+            bool is_dir;
+
+            uint64_t size = 0;
+
+            //  Extents of a file, nullptr where nothing has been written
+            std::vector<unsigned char*> extents;
+
+            //  Entries of a directory
+            std::unordered_map<std::string, std::shared_ptr<Node> > children;
+
+            //  Bytes allocated in the filesystem, released with the extents
+            uint64_t* used_bytes;
+
+            Node(const bool is_dir, uint64_t* used_bytes);
+
+            ~Node();
+        };
+
+        struct OpenFile {
+            std::shared_ptr<Node> node;
+            uint64_t position;
+            bool readable;
+            bool writable;
+            bool append;
+        };
+
+        struct DirStream {
+            std::vector<std::pair<std::string, bool> > entries;
+            size_t next;
+            struct dirent entry;
+            struct dirent64 entry64;
+        };
+
+        std::unordered_map<FileHandle, std::unique_ptr<OpenFile> > files_;
+
+        std::unordered_map<const void*, std::unique_ptr<DirStream> > dirs_;
+
+        std::mutex file_mutex_;
+
+        FileHandle first_handle_;
+        FileHandle next_handle_;
+        FileHandle last_handle_;
+
+        std::string mount_path_;
+
+        unsigned char drive_id_;
+
+        std::shared_ptr<Node> root_;
+
+        const uint64_t capacity_;
+        uint64_t used_bytes_ = 0;
+
+        static bool splitPath(const char* path, std::vector<std::string>& components);
+
+        std::shared_ptr<Node> lookup(const std::vector<std::string>& components);
+
+        Node* lookupParent(const std::vector<std::string>& components, int& err);
+
+        OpenFile* getOpenFile(const int fd);
+
+        FileHandle getNewHandle();
+
+        int openInternal(const char* path, int oflag, int& err);
+
+        bool allocateExtent(Node& node, const size_t index, const uint64_t size);
+
+        size_t readData(const Node& node, uint64_t position, void* buf, size_t count);
+
+        size_t writeData(Node& node, uint64_t position, const void* buf, size_t count);
+
+        void truncateData(Node& node, const uint64_t length);
+
+        int removeInternal(const char* path, const bool allow_file, const bool allow_dir, int& err);
+
+        int statInternal(const char* path, struct stat64* stat_buf, int& err);
+
+        void snapshotNode(const Node& node, const std::string& path, std::vector<uint8_t>& out);
+
+        bool restoreFile(const std::string& path, const uint8_t*& data, const uint8_t* end);
+
+    public:
+        TmpFsFileManager() = delete;
+
+        TmpFsFileManager(const unsigned char drive_id,
+                         const int first_handle_id,
+                         const int max_handle_id,
+                         const std::string& mount_path,
+                         const unsigned long size);
+
+        virtual ~TmpFsFileManager();
+
+        std::string getMountPath() override;
+
+        bool isPathOwner(const std::string& path) override;
+
+        bool isHandleOwner(const int handle) override;
+
+        bool isDirOwner(const void* dir) override;
+
+        //  Posix calls
+        int open(const char* path, int oflag, int& err) override;
+
+        off_t lseek(int fd, off_t offset, int whence) override;
+
+        ssize_t read(int fd, void* buf, size_t count) override;
+
+        ssize_t pread(int fd, void* buf, size_t count, off_t offset) override;
+
+        FILE *fopen(const char* path, const char* mode, int& err) override;
+
+        ssize_t pwrite(int fd, const void* buf, size_t count, off_t offset) override;
+
+        ssize_t write(int fd, const void* buf, size_t count) override;
+
+        int close(int fd) override;
+
+        int fstat(int ver, int fd, struct stat64* stat_buf, int& err) override;
+
+        int stat(int ver, const char* path, struct stat64* stat_buf, int& err) override;
+
+        int lstat64(const char* path, struct stat64* stat_buf, int& err) override;
+
+        int lstat(const char* path, struct stat* stat_buf, int& err) override;
+
+        int mkdir(const char* path, mode_t mode) override;
+
+        int access(const char* path, mode_t mode, int& err) override;
+
+        int unlink(const char* path, int& res) override;
+
+        int rmdir(const char* path, int& res) override;
+
+        int remove(const char* path, int& res) override;
+
+        int rename(const char* oldpath, const char* newpath, int& err) override;
+
+        int dup2(int oldfd, int newfd) override;
+
+        void* opendir(const char* dirname, int& err) override;
+
+        struct dirent* readdir(void* dirp, int& err) override;
+
+        struct dirent64* readdir64(void* dirp, int& err) override;
+
+        int closedir(void* dirp, int& err) override;
+
+        int ftruncate(int fd, off_t length, int& err) override;
+
+        int fsync(int fd, int& err) override;
+
+        int fallocate(int fd, int mode, off_t offset, off_t len, int& err) override;
+
+        int fchown(int fd, uid_t owner, gid_t group, int& err) override;
+
+        int fchmod(int fd, mode_t mode, int& err) override;
+
+        int utimes(const char* path, const struct timeval times[2], int& err) override;
+
+        int statvfs(struct statvfs64* buf, int& err) override;
+
+        //  Serialises the directories and the written extents of the files
+        void snapshot(std::vector<uint8_t>& out);
+
+        //  Loads a snapshot into the filesystem, false if it is malformed or does not fit
+        bool restore(const uint8_t* data, const size_t size);
+    };
+}
+#endif  //  End of _TMPFS_FILE_MANAGER
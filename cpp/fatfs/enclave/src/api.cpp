@@ -12,17 +12,23 @@
 #include "graal_isolate.h"
 #include "vm_enclave_layer.h"
 #include "conclave-stat.h"
+#include "conclave-statvfs.h"
 #include "unistd.h"
 #include "sgx_tcrypto.h"
+#include "sgx_tseal.h"
+#include "zlib.h"
 
 #include <jni.h>
 #include <jvm_t.h>
 #include <dlsym_symbols.h>
+#include <startup_phase_guard.h>
 
 #include "disk.hpp"
 #include "inmemory_disk.hpp"
 #include "persistent_disk.hpp"
+#include "log_structured_disk.hpp"
 #include "fatfs_file_manager.hpp"
+#include "tmpfs_file_manager.hpp"
 #include "fatfs_result.hpp"
 
 static const int kMaxNumFiles = 500000;
@@ -33,11 +39,34 @@ static const int kMaxNumFiles = 500000;
 static const unsigned long kMaxInMemorySize = ((unsigned long)UINT_MAX * SECTOR_SIZE);
 static const unsigned long kMaxPersistentSize = ((unsigned long)UINT_MAX * SECTOR_SIZE);
 
+//  Sector size used when formatting a new persistent filesystem. Each sector is encrypted
+//    and written to the Host separately, so bigger sectors mean less overhead.
+//  Small filesystems keep the default size, as FatFs needs a minimum number of sectors
+//    and 4K clusters would waste most of their space.
+static const unsigned int kLargePersistentSectorSize = 4096;
+static const unsigned long kMinLargeSectorPersistentSize = 8 * 1024 * 1024;
+
+//  Size of the groups of consecutive sectors that are shuffled together in a new persistent filesystem,
+//    see PersistentDisk. FatFs reads and writes files in runs of consecutive sectors, keeping them
+//    together lets the Host serve a run with sequential I/O.
+static const unsigned int kPersistentShuffleGroupSize = 64 * 1024;
+
+//  Backend of the in-memory filesystem, configured in the Enclave (inMemoryFileSystemBackend).
+//  IN_MEMORY_BACKEND_TMPFS keeps the files directly in the Enclave memory (see TmpFsFileManager),
+//    IN_MEMORY_BACKEND_FATFS formats a FatFs volume on an InMemoryDisk.
+//  The values match the ids of InMemoryFileSystemBackend.
+enum InMemoryBackend { IN_MEMORY_BACKEND_FATFS = 0, IN_MEMORY_BACKEND_TMPFS = 1 };
+
+//  Authenticated data of the sealed snapshots of the in-memory filesystem, so that
+//    a blob sealed for another purpose by the same Enclave is not restored as a snapshot.
+static const std::string kSnapshotAuthenticatedData = "conclave-tmpfs-snapshot-1";
+
 static int currentFirstAvailableHandle  = 100000;
 static int currentDummyHandle = currentFirstAvailableHandle;
 static std::unordered_set<int> dummyHandles;
 static std::mutex dummyHandleMutex;
-static std::vector<std::shared_ptr<conclave::FatFsFileManager> > filesystems;
+static std::vector<std::shared_ptr<conclave::PosixFileManager> > filesystems;
+static std::shared_ptr<conclave::TmpFsFileManager> inMemoryTmpFs;
 
 static std::string currentPath = "/";
 static JavaVM *jvm = NULL;
@@ -47,9 +76,21 @@ enum FileSystemType { IN_MEMORY, PERSISTENT };
 std::unique_ptr<conclave::FatFsDisk> createDiskHandler(const FileSystemType type,
                                                        const BYTE drive_id,
                                                        const unsigned long size,
+                                                       const unsigned int sector_size,
+                                                       const unsigned int shuffle_group_size,
+                                                       const unsigned int layout,
                                                        const unsigned char* encryption_key) {
-    if (type == FileSystemType::PERSISTENT) {
-        return std::unique_ptr<conclave::FatFsDisk>(new conclave::PersistentDisk(drive_id, size, encryption_key));
+    if (type == FileSystemType::PERSISTENT && layout == PERSISTENT_LAYOUT_LOG) {
+        return std::unique_ptr<conclave::FatFsDisk>(new conclave::LogStructuredDisk(drive_id,
+                                                                                    size,
+                                                                                    sector_size,
+                                                                                    encryption_key));
+    } else if (type == FileSystemType::PERSISTENT) {
+        return std::unique_ptr<conclave::FatFsDisk>(new conclave::PersistentDisk(drive_id,
+                                                                                 size,
+                                                                                 sector_size,
+                                                                                 shuffle_group_size,
+                                                                                 encryption_key));
     } else if (type == FileSystemType::IN_MEMORY) {
         return std::unique_ptr<conclave::FatFsDisk>(new conclave::InMemoryDisk(drive_id, size));
     } else {
@@ -59,24 +100,45 @@ std::unique_ptr<conclave::FatFsDisk> createDiskHandler(const FileSystemType type
 }
 
 
+//  Each filesystem gives out the handles of its own range, so that a handle identifies its filesystem
+static void reserveHandles(int& first_handle, int& max_handle) {
+    first_handle = currentFirstAvailableHandle;
+    max_handle = currentFirstAvailableHandle + kMaxNumFiles -1;
+    currentFirstAvailableHandle += kMaxNumFiles;
+    currentDummyHandle = currentFirstAvailableHandle;
+}
+
+
 static std::shared_ptr<conclave::FatFsFileManager> createFileSystem(const FileSystemType type,
                                                                     const BYTE drive,
                                                                     const unsigned long size,
+                                                                    const unsigned int sector_size,
+                                                                    const unsigned int shuffle_group_size,
+                                                                    const unsigned int layout,
                                                                     const unsigned char* encryption_key,
                                                                     const std::string& mount_path) {
-    const int first_handle = currentFirstAvailableHandle;
-    const int max_handle = currentFirstAvailableHandle + kMaxNumFiles -1;
-    auto disk_handler = createDiskHandler(type, drive, size, encryption_key);
+    int first_handle;
+    int max_handle;
+    reserveHandles(first_handle, max_handle);
+    auto disk_handler = createDiskHandler(type, drive, size, sector_size, shuffle_group_size, layout, encryption_key);
     auto filesystem = std::make_shared<conclave::FatFsFileManager>(first_handle,
                                                                    max_handle,
                                                                    encryption_key,
                                                                    mount_path,
                                                                    std::move(disk_handler));
-    currentFirstAvailableHandle += kMaxNumFiles;
-    currentDummyHandle = currentFirstAvailableHandle;
     return filesystem;
 }
 
+
+static std::shared_ptr<conclave::TmpFsFileManager> createTmpFileSystem(const BYTE drive,
+                                                                       const unsigned long size,
+                                                                       const std::string& mount_path) {
+    int first_handle;
+    int max_handle;
+    reserveHandles(first_handle, max_handle);
+    return std::make_shared<conclave::TmpFsFileManager>(drive, first_handle, max_handle, mount_path, size);
+}
+
 // Convert a path from JNI and convert it to a string
 static std::string getJniMountPath(JNIEnv* env, jstring& path_in) {
     jboolean is_copy;
@@ -115,13 +177,72 @@ static bool getJniEncryptionKey(JNIEnv* env,
     return true;
 }
 
+//  A snapshot is sealed as: size of the serialised filesystem (8 bytes) followed by
+//    the serialised filesystem compressed with zlib.
+static bool restoreInMemorySnapshot(JNIEnv* env,
+                                    const jbyteArray& snapshot_in,
+                                    conclave::TmpFsFileManager& filesystem) {
+    const jsize sealed_size = env->GetArrayLength(snapshot_in);
+
+    if ((size_t)sealed_size < sizeof(sgx_sealed_data_t)) {
+        return false;
+    }
+    jbyte* sealed = env->GetByteArrayElements(snapshot_in, nullptr);
+
+    if (sealed == nullptr) {
+        return false;
+    }
+    const sgx_sealed_data_t* sealed_data = reinterpret_cast<const sgx_sealed_data_t*>(sealed);
+    uint32_t compressed_size = sgx_get_encrypt_txt_len(sealed_data);
+    uint32_t authenticated_size = sgx_get_add_mac_txt_len(sealed_data);
+    bool restored = false;
+
+    if (compressed_size != UINT32_MAX && compressed_size > sizeof(uint64_t) &&
+        authenticated_size == kSnapshotAuthenticatedData.size() &&
+        sgx_calc_sealed_data_size(authenticated_size, compressed_size) == (uint32_t)sealed_size) {
+        std::vector<uint8_t> compressed(compressed_size);
+        std::vector<uint8_t> authenticated(authenticated_size);
+        const sgx_status_t res = sgx_unseal_data(sealed_data,
+                                                 authenticated.data(),
+                                                 &authenticated_size,
+                                                 compressed.data(),
+                                                 &compressed_size);
+
+        if (res != SGX_SUCCESS) {
+            FATFS_DEBUG_PRINT("Could not unseal the snapshot, error %d\n", res);
+        } else if (memcmp(authenticated.data(), kSnapshotAuthenticatedData.data(), authenticated_size) == 0) {
+            uint64_t raw_size;
+            memcpy(&raw_size, compressed.data(), sizeof(raw_size));
+            std::vector<uint8_t> raw(raw_size);
+            uLongf uncompressed_size = raw_size;
+
+            if (uncompress(raw.data(), &uncompressed_size,
+                           compressed.data() + sizeof(raw_size), compressed_size - sizeof(raw_size)) == Z_OK &&
+                uncompressed_size == raw_size) {
+                restored = filesystem.restore(raw.data(), raw.size());
+            }
+        }
+    }
+    env->ReleaseByteArrayElements(snapshot_in, sealed, JNI_ABORT);
+    return restored;
+}
+
+
 //  The initialization of the persistent disk depends on the present of the
 //    file/filesystem path on the host.
 //  When loading the enclave, we do an OCall and we check the presence of the file on the host.
-static conclave::DiskInitialization getInitializationType(JNIEnv* env, const unsigned char drive, const unsigned long persistent_size) {
+//  The sector size, the shuffle group size and the layout are inputs when the file is created (the Host
+//    records them in the file header), and outputs when the file already exists.
+static conclave::DiskInitialization getInitializationType(JNIEnv* env,
+                                                          const unsigned char drive,
+                                                          const unsigned long persistent_size,
+                                                          unsigned int& sector_size,
+                                                          unsigned int& shuffle_group_size,
+                                                          unsigned int& layout) {
     long host_file_size = -1;
-    host_disk_get_size_ocall(&host_file_size, drive, persistent_size);
-    FATFS_DEBUG_PRINT("Host disk size %ld\n", host_file_size);
+    host_disk_get_size_ocall(&host_file_size, drive, persistent_size, &sector_size, &shuffle_group_size, &layout);
+    FATFS_DEBUG_PRINT("Host disk size %ld, sector size %u, shuffle group size %u, layout %u\n",
+                      host_file_size, sector_size, shuffle_group_size, layout);
 
     const bool host_has_thrown_exception = (host_file_size == -1);
 
@@ -129,6 +250,21 @@ static conclave::DiskInitialization getInitializationType(JNIEnv* env, const uns
         FATFS_DEBUG_PRINT("Disk not initialized, the host has thrown an exception, drive %d\n", drive);
         return conclave::DiskInitialization::ERROR;
     }
+
+    if (!conclave::FatFsDisk::isValidSectorSize(sector_size)) {
+        FATFS_DEBUG_PRINT("Disk not initialized, wrong sector size %u for drive %d\n", sector_size, drive);
+        return conclave::DiskInitialization::ERROR;
+    }
+
+    if (!conclave::PersistentDisk::isValidShuffleGroupSize(shuffle_group_size, sector_size)) {
+        FATFS_DEBUG_PRINT("Disk not initialized, wrong shuffle group size %u for drive %d\n", shuffle_group_size, drive);
+        return conclave::DiskInitialization::ERROR;
+    }
+
+    if (layout != PERSISTENT_LAYOUT_IN_PLACE && layout != PERSISTENT_LAYOUT_LOG) {
+        FATFS_DEBUG_PRINT("Disk not initialized, wrong layout %u for drive %d\n", layout, drive);
+        return conclave::DiskInitialization::ERROR;
+    }
     const bool host_file_present = (host_file_size != 0);
     conclave::DiskInitialization initialization;
         
@@ -183,10 +319,14 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_setupFileSys
                                                                                      jobject,
                                                                                      jlong in_memory_size,
                                                                                      jlong persistent_size,
+                                                                                     jint persistent_layout,
+                                                                                     jint in_memory_backend,
                                                                                      jstring in_memory_mount_path_in,
                                                                                      jstring persistent_mount_path_in,
-                                                                                     jbyteArray encryption_key_in) {
+                                                                                     jbyteArray encryption_key_in,
+                                                                                     jbyteArray in_memory_snapshot_in) {
     FATFS_DEBUG_PRINT("Sizes: %lu, %lu\n", in_memory_size, persistent_size);
+    r3::conclave::StartupPhaseGuard phase(r3::conclave::StartupPhase::FILESYSTEM);
 
     if (encryption_key_in == nullptr) {
         raiseException(env, "Filesystems not initialized, key not passed in");
@@ -229,7 +369,19 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_setupFileSys
     */
     
     if (persistent_size > 0) {
-        conclave::DiskInitialization initialization = getInitializationType(env, drive, persistent_size);
+        unsigned int sector_size = (unsigned long)persistent_size >= kMinLargeSectorPersistentSize ?
+            kLargePersistentSectorSize : SECTOR_SIZE;
+        unsigned int shuffle_group_size = kPersistentShuffleGroupSize;
+        //  The layout of a new filesystem is configured in the Enclave (persistentFileSystemLayout).
+        //    PERSISTENT_LAYOUT_LOG turns the writes into sequential appends to the Host file,
+        //    at the cost of an indirection table in the Enclave (see LogStructuredDisk).
+        unsigned int layout = persistent_layout;
+        conclave::DiskInitialization initialization = getInitializationType(env,
+                                                                            drive,
+                                                                            persistent_size,
+                                                                            sector_size,
+                                                                            shuffle_group_size,
+                                                                            layout);
         
         if (initialization == conclave::DiskInitialization::ERROR) {
             //  The Host has thrown an exception as well
@@ -239,6 +391,9 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_setupFileSys
         auto filesystem = createFileSystem(FileSystemType::PERSISTENT,
                                            drive++,
                                            persistent_size,
+                                           sector_size,
+                                           shuffle_group_size,
+                                           layout,
                                            encryption_key,
                                            persistent_mount_path);
         FatFsResult initResult = filesystem->init(initialization);
@@ -250,10 +405,31 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_setupFileSys
         filesystems.push_back(filesystem);
     }
     
-    if (in_memory_size > 0) {
+    if (in_memory_size > 0 && in_memory_backend == IN_MEMORY_BACKEND_TMPFS) {
+        inMemoryTmpFs = createTmpFileSystem(drive++, in_memory_size, in_memory_mount_path);
+
+        //  The whole snapshot is restored here, in the same ECall which creates the filesystem
+        if (in_memory_snapshot_in != nullptr && !restoreInMemorySnapshot(env, in_memory_snapshot_in, *inMemoryTmpFs)) {
+            inMemoryTmpFs.reset();
+            raiseException(env, "Unable to restore the snapshot of the enclave's in-memory filesystem",
+                           "java/io/IOException");
+            return;
+        }
+        filesystems.push_back(inMemoryTmpFs);
+    } else if (in_memory_size > 0) {
+        //  Only the TmpFs backend can be snapshotted, see snapshotInMemoryFileSystem
+        if (in_memory_snapshot_in != nullptr) {
+            raiseException(env, "A snapshot of the enclave's in-memory filesystem can only be restored with the "
+                                "tmpfs backend (inMemoryFileSystemBackend)",
+                           "java/io/IOException");
+            return;
+        }
         auto filesystem = createFileSystem(FileSystemType::IN_MEMORY,
                                            drive++,
                                            in_memory_size,
+                                           SECTOR_SIZE,
+                                           0,
+                                           PERSISTENT_LAYOUT_IN_PLACE,
                                            encryption_key,
                                            in_memory_mount_path);
         FatFsResult initResult = filesystem->init(conclave::DiskInitialization::FORMAT);
@@ -279,6 +455,63 @@ DLSYM_STATIC {
 };
 
 
+//  Seals the content of the in-memory filesystem so that the Host can store it and pass it
+//    back to setupFileSystems when the Enclave is restarted.
+//  Returns null when the in-memory filesystem is not a TmpFsFileManager (or there is none).
+JNIEXPORT jbyteArray JNICALL Java_com_r3_conclave_enclave_internal_Native_snapshotInMemoryFileSystem(JNIEnv* env,
+                                                                                                   jobject) {
+    if (inMemoryTmpFs == nullptr) {
+        return nullptr;
+    }
+    std::vector<uint8_t> raw;
+    inMemoryTmpFs->snapshot(raw);
+
+    const uint64_t raw_size = raw.size();
+    uLongf compressed_size = compressBound(raw.size());
+    std::vector<uint8_t> compressed(sizeof(raw_size) + compressed_size);
+    memcpy(compressed.data(), &raw_size, sizeof(raw_size));
+
+    //  The content is mostly restored once per start, speed matters more than the ratio
+    if (compress2(compressed.data() + sizeof(raw_size), &compressed_size, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK) {
+        raiseException(env, "Unable to compress the snapshot of the enclave's in-memory filesystem");
+        return nullptr;
+    }
+    raw.clear();
+    raw.shrink_to_fit();
+    compressed.resize(sizeof(raw_size) + compressed_size);
+
+    const uint32_t sealed_size = compressed.size() > UINT32_MAX ? UINT32_MAX :
+        sgx_calc_sealed_data_size(kSnapshotAuthenticatedData.size(), compressed.size());
+
+    if (sealed_size == UINT32_MAX || sealed_size > (uint32_t)std::numeric_limits<jsize>::max()) {
+        raiseException(env, "The snapshot of the enclave's in-memory filesystem is too big to be sealed");
+        return nullptr;
+    }
+    std::vector<uint8_t> sealed(sealed_size);
+    const sgx_status_t res = sgx_seal_data(kSnapshotAuthenticatedData.size(),
+                                           reinterpret_cast<const uint8_t*>(kSnapshotAuthenticatedData.data()),
+                                           compressed.size(),
+                                           compressed.data(),
+                                           sealed_size,
+                                           reinterpret_cast<sgx_sealed_data_t*>(sealed.data()));
+
+    if (res != SGX_SUCCESS) {
+        const std::string msg("Unable to seal the snapshot of the enclave's in-memory filesystem, error " + std::to_string(res));
+        raiseException(env, msg.c_str());
+        return nullptr;
+    }
+    jbyteArray snapshot = env->NewByteArray(sealed_size);
+
+    if (snapshot != nullptr) {
+        env->SetByteArrayRegion(snapshot, 0, sealed_size, reinterpret_cast<const jbyte*>(sealed.data()));
+    }
+    return snapshot;
+}
+DLSYM_STATIC {
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_snapshotInMemoryFileSystem);
+};
+
+
 static std::string normalizePath(const std::string& path_in) {
     std::string path(path_in);
 
@@ -288,7 +521,7 @@ static std::string normalizePath(const std::string& path_in) {
     return path;
 }
 
-/*  The next couple of functions are needed to retrieve the correct instance of FatFsFileManager that
+/*  The next couple of functions are needed to retrieve the correct instance of PosixFileManager that
     we are going to use when one of the Posix calls below is executed.
     Based on the file path that the user is handling and given the mount points (getFatFsInstanceFromPath) or
     based on the handle number (getFatFsInstanceFromHandle) which have been previously created and
@@ -298,7 +531,7 @@ static std::string normalizePath(const std::string& path_in) {
     filesystem, a file like "/tmp/test.txt" will be handled by the in-memory filesystem and
     a file like "/tmptest.txt" will be handled by the persistent one.
 */
-static std::shared_ptr<conclave::FatFsFileManager> getFatFsInstanceFromPath(const char* path_in) {
+static std::shared_ptr<conclave::PosixFileManager> getFatFsInstanceFromPath(const char* path_in) {
 
     if (path_in == nullptr || std::string(path_in).empty()) {
         FATFS_DEBUG_PRINT("Error, empty string provided: %d\n", 1);
@@ -306,7 +539,7 @@ static std::shared_ptr<conclave::FatFsFileManager> getFatFsInstanceFromPath(cons
     }
 
     const std::string path = normalizePath(std::string(path_in));
-    std::vector<std::shared_ptr<conclave::FatFsFileManager> > found_instances;
+    std::vector<std::shared_ptr<conclave::PosixFileManager> > found_instances;
     
     for (auto& it : filesystems) {
 
@@ -338,7 +571,7 @@ static std::shared_ptr<conclave::FatFsFileManager> getFatFsInstanceFromPath(cons
 };
 
 
-static std::shared_ptr<conclave::FatFsFileManager> getFatFsInstanceFromHandle(const int fd) {
+static std::shared_ptr<conclave::PosixFileManager> getFatFsInstanceFromHandle(const int fd) {
     FATFS_DEBUG_PRINT("Handle %d\n", fd);
 
     if (fd == -1) {
@@ -356,12 +589,12 @@ static std::shared_ptr<conclave::FatFsFileManager> getFatFsInstanceFromHandle(co
 };
 
 
-static std::shared_ptr<conclave::FatFsFileManager> getFatFsInstanceFromDir(void* dir) {
-    std::vector<std::shared_ptr<conclave::FatFsFileManager> > found_instances;
+static std::shared_ptr<conclave::PosixFileManager> getFatFsInstanceFromDir(void* dir) {
+    std::vector<std::shared_ptr<conclave::PosixFileManager> > found_instances;
   
     for (auto& it : filesystems) {
 
-        if (it->isDirOwner(static_cast<DIR*>(dir))) {
+        if (it->isDirOwner(dir)) {
             found_instances.push_back(it);
         }
     }
@@ -686,6 +919,17 @@ int ftruncate_impl(int fd, off_t offset, int& err) {
 }
 
 
+int fsync_impl(int fd, int& err) {
+    auto file_manager = getFatFsInstanceFromHandle(fd);
+
+    if (file_manager == nullptr) {
+        //  Nothing to do for the descriptors which are not backed by a filesystem
+        return 0;
+    }
+    return file_manager->fsync(fd, err);
+}
+
+
 int fchown_impl(int fd, uid_t owner, gid_t group, int& err) {
     auto file_manager = getFatFsInstanceFromHandle(fd);
 
@@ -717,3 +961,36 @@ int utimes_impl(const char *filename, const struct timeval times[2], int& err) {
     }
     return file_manager->utimes(filename, times, err);
 }
+
+
+int statvfs64_impl(const char* path, struct statvfs64* buf, int& err) {
+    auto file_manager = getFatFsInstanceFromPath(path);
+
+    if (file_manager == nullptr) {
+        err = ENOENT;
+        return -1;
+    }
+    return file_manager->statvfs(buf, err);
+}
+
+
+int fallocate_impl(int fd, int mode, off_t offset, off_t len, int& err) {
+    auto file_manager = getFatFsInstanceFromHandle(fd);
+
+    if (file_manager == nullptr) {
+        err = EBADF;
+        return -1;
+    }
+    return file_manager->fallocate(fd, mode, offset, len, err);
+}
+
+
+int fstatvfs64_impl(int fd, struct statvfs64* buf, int& err) {
+    auto file_manager = getFatFsInstanceFromHandle(fd);
+
+    if (file_manager == nullptr) {
+        err = EBADF;
+        return -1;
+    }
+    return file_manager->statvfs(buf, err);
+}
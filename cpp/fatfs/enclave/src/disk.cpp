@@ -4,9 +4,12 @@
 
 namespace conclave {
 
-    FatFsDisk::FatFsDisk(const unsigned char drive, const unsigned long size) :
+    FatFsDisk::FatFsDisk(const unsigned char drive,
+                         const unsigned long size,
+                         const unsigned int sector_size) :
         drive_size_(size),
-        num_sectors_(size / SECTOR_SIZE) {
+        num_sectors_(isValidSectorSize(sector_size) ? size / sector_size : 0),
+        sector_size_(sector_size) {
     
         if (drive >= FF_VOLUMES) {
             const std::string message = "Error, wrong drive id provided";
@@ -15,6 +18,11 @@ namespace conclave {
         } else {
             drive_id_ = drive;
         }
+
+        if (!isValidSectorSize(sector_size)) {
+            const std::string message = "Error, wrong sector size provided";
+            throw std::runtime_error(message);
+        }
         filesystem_ = std::make_shared<FATFS>();
     }
 
@@ -38,6 +46,17 @@ namespace conclave {
     }
 
 
+    unsigned int FatFsDisk::getSectorSize() {
+        return sector_size_;
+    }
+
+
+    bool FatFsDisk::isValidSectorSize(const unsigned int sector_size) {
+        //  FatFs supports powers of two between FF_MIN_SS and FF_MAX_SS
+        return sector_size >= FF_MIN_SS && sector_size <= FF_MAX_SS && (sector_size & (sector_size - 1)) == 0;
+    }
+
+
     std::string FatFsDisk::getDriveTextId() {
         return std::to_string(drive_id_) + ":";
     }
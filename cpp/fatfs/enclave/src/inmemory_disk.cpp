@@ -1,4 +1,8 @@
+#include <algorithm>
+
+#ifndef UNIT_TEST
 #include "vm_enclave_layer.h"
+#endif
 #include "common.hpp"
 
 #include "inmemory_disk.hpp"
@@ -6,7 +10,8 @@
 namespace conclave {
 
     InMemoryDisk::InMemoryDisk(const BYTE drive_id, const unsigned long size) :
-        FatFsDisk(drive_id, size) {
+        FatFsDisk(drive_id, size),
+        chunk_sectors_(kChunkSize / getSectorSize()) {
     }
 
 
@@ -15,36 +20,99 @@ namespace conclave {
     }
 
 
-    DRESULT InMemoryDisk::diskRead(BYTE* output_buf, LBA_t start, BYTE num_reads) {
-        FATFS_DEBUG_PRINT("Read - Start %d num_reads %hhu \n", start, num_reads);               
-        const unsigned char* ram_first_ptr = ram_buffer_;
-        const unsigned char* read_from_ptr = ram_first_ptr + start * SECTOR_SIZE;
-        const unsigned long read_size = num_reads * SECTOR_SIZE;
+    size_t InMemoryDisk::getAllocatedSize() const {
+        return chunks_.size() * (size_t)kChunkSize;
+    }
+
+
+    bool InMemoryDisk::isValidRange(const LBA_t start, const UINT num_sectors) {
+        return (unsigned long)start + num_sectors <= getNumSectors();
+    }
+
+
+    DRESULT InMemoryDisk::diskRead(BYTE* output_buf, LBA_t start, UINT num_reads) {
+        FATFS_DEBUG_PRINT("Read - Start %d num_reads %u \n", start, num_reads);               
 
-        if ((uintptr_t)read_from_ptr >= (uintptr_t)ram_first_ptr &&
-            (uintptr_t)read_from_ptr + (uintptr_t)read_size < (uintptr_t)ram_first_ptr + (uintptr_t)getDriveSize()) { 
-            memcpy(output_buf, read_from_ptr, read_size);
-            return RES_OK;
-        } else {
+        if (!isValidRange(start, num_reads)) {
             return RES_PARERR;
         }
+        const UINT sector_size = getSectorSize();
+
+        while (num_reads > 0) {
+            const UINT chunk = start / chunk_sectors_;
+            const UINT offset = start % chunk_sectors_;
+            const UINT count = std::min(num_reads, chunk_sectors_ - offset);
+            const size_t size = (size_t)count * sector_size;
+            const auto it = chunks_.find(chunk);
+
+            if (it == chunks_.end()) {
+                memset(output_buf, 0, size);
+            } else {
+                memcpy(output_buf, it->second + (size_t)offset * sector_size, size);
+            }
+            output_buf += size;
+            start += count;
+            num_reads -= count;
+        }
+        return RES_OK;
     }
 
 
-    DRESULT InMemoryDisk::diskWrite(const BYTE* input_buf, LBA_t start, BYTE num) {
-        FATFS_DEBUG_PRINT("Write - Start %d num writes %hhu \n", start, num);               
-        unsigned char* ram_first_ptr = ram_buffer_;
-        unsigned char* write_to_ptr = ram_first_ptr + (uintptr_t)start * (uintptr_t)SECTOR_SIZE;
-        const unsigned long write_size = num * SECTOR_SIZE;
-    
-        if ((uintptr_t)write_to_ptr >= (uintptr_t)ram_first_ptr &&
+    DRESULT InMemoryDisk::diskWrite(const BYTE* input_buf, LBA_t start, UINT num) {
+        FATFS_DEBUG_PRINT("Write - Start %d num writes %u \n", start, num);               
 
-            (uintptr_t)write_to_ptr + (uintptr_t)write_size < (uintptr_t)ram_first_ptr + (uintptr_t)getDriveSize()) { 
-            memcpy(write_to_ptr, input_buf, write_size);
-            return RES_OK;
-        } else {
+        if (!isValidRange(start, num)) {
             return RES_PARERR;
         }
+        const UINT sector_size = getSectorSize();
+
+        while (num > 0) {
+            const UINT chunk = start / chunk_sectors_;
+            const UINT offset = start % chunk_sectors_;
+            const UINT count = std::min(num, chunk_sectors_ - offset);
+            const size_t size = (size_t)count * sector_size;
+            auto it = chunks_.find(chunk);
+
+            if (it == chunks_.end()) {
+                //  Zeros written to a chunk which is not allocated (e.g. the FAT written
+                //    by f_mkfs) do not need any memory
+                if (input_buf[0] == 0 && memcmp(input_buf, input_buf + 1, size - 1) == 0) {
+                    input_buf += size;
+                    start += count;
+                    num -= count;
+                    continue;
+                }
+                unsigned char* chunk_buffer = (unsigned char*)calloc(kChunkSize, sizeof(unsigned char));
+
+                if (chunk_buffer == NULL) {
+                    FATFS_DEBUG_PRINT("Could not allocate memory for the RAM disk chunk %u\n", chunk);
+                    return RES_ERROR;
+                }
+                it = chunks_.emplace(chunk, chunk_buffer).first;
+            }
+            memcpy(it->second + (size_t)offset * sector_size, input_buf, size);
+            input_buf += size;
+            start += count;
+            num -= count;
+        }
+        return RES_OK;
+    }
+
+
+    void InMemoryDisk::releaseChunks(const LBA_t first_sector, const LBA_t last_sector) {
+        //  Only the chunks entirely within the range are released, the content
+        //    of trimmed sectors is undefined for FatFs
+        const unsigned long first_chunk = ((unsigned long)first_sector + chunk_sectors_ - 1) / chunk_sectors_;
+        const unsigned long end_chunk = ((unsigned long)last_sector + 1) / chunk_sectors_;
+
+        for (unsigned long chunk = first_chunk; chunk < end_chunk; chunk++) {
+            const auto it = chunks_.find(chunk);
+
+            if (it != chunks_.end()) {
+                free(it->second);
+                chunks_.erase(it);
+            }
+        }
     }
 
 
@@ -61,7 +129,7 @@ namespace conclave {
             break;
 
         case GET_SECTOR_SIZE:
-            *(WORD*)buf = SECTOR_SIZE;
+            *(WORD*)buf = getSectorSize();
             result = RES_OK;
             break;
 
@@ -70,6 +138,19 @@ namespace conclave {
             result = RES_OK;
             break;
 
+        case CTRL_TRIM: {
+            const LBA_t first_sector = ((LBA_t*)buf)[0];
+            const LBA_t last_sector = ((LBA_t*)buf)[1];
+
+            if (first_sector > last_sector || !isValidRange(first_sector, last_sector - first_sector + 1)) {
+                result = RES_PARERR;
+            } else {
+                releaseChunks(first_sector, last_sector);
+                result = RES_OK;
+            }
+            break;
+        }
+
         default:
             result = RES_ERROR;
             break;
@@ -78,24 +159,19 @@ namespace conclave {
     }
 
 
-    void InMemoryDisk::diskStart() {
+    void InMemoryDisk::diskStart(const DiskInitialization) {
         DEBUG_PRINT_FUNCTION;
 
-        ram_buffer_ = (unsigned char*)calloc(getDriveSize(), sizeof(unsigned char));
-    
-        if (ram_buffer_ == NULL) {
-            const std::string message("Could not allocate memory for the RAM disk in the Enclave");
-            throw std::runtime_error(message);
-        }
+        //  The chunks are allocated on the first write
     }
 
 
     void InMemoryDisk::diskStop() {
         DEBUG_PRINT_FUNCTION;
 
-        if (ram_buffer_ != NULL) {
-            free(ram_buffer_);
-            ram_buffer_ = NULL;
+        for (auto& chunk : chunks_) {
+            free(chunk.second);
         }
+        chunks_.clear();
     }
 }
@@ -0,0 +1,485 @@
+#include <climits>
+#include <vector>
+#include <algorithm>
+
+#ifndef UNIT_TEST
+#include "vm_enclave_layer.h"
+#endif
+#include "common.hpp"
+
+#include "log_structured_disk.hpp"
+
+namespace conclave {
+
+    static const unsigned int kLogSegmentSize = 256 * 1024;
+
+    //  Free segments kept for the cleaner, and spare segments of the log (a fraction of the disk)
+    static const unsigned int kMinFreeSegments = 2;
+    static const unsigned int kMinSpareSegments = 4;
+    static const unsigned int kSpareFraction = 8;
+
+    static const uint32_t kUnmapped = UINT32_MAX;
+    static const UINT kNoSegment = UINT_MAX;
+
+    //  Layout of a summary: magic, number of sectors, sequence number, generation, sector ids
+    static const uint32_t kUnitMagic = 0x55534c43;
+    static const unsigned int kUnitHeaderSize = 24;
+
+    //  Layout of the header of a segment: magic, generation.
+    //    The header is the first sector of the segment, the units follow it.
+    static const uint32_t kSegmentMagic = 0x53534c43;
+    static const UINT kSegmentHeaderSectors = 1;
+
+
+    LogStructuredDisk::LogStructuredDisk(const BYTE drive,
+                                         const unsigned long size,
+                                         const unsigned int sector_size,
+                                         const unsigned char* encryption_key) :
+        PersistentDisk(drive, size, sector_size, 0, PERSISTENT_LAYOUT_LOG, encryption_key),
+        segment_sectors_(std::max(kLogSegmentSize / sector_size, 16u)),
+        num_segments_((getNumSectors() + segment_sectors_ - 1) / segment_sectors_ +
+                      std::max(getNumSectors() / segment_sectors_ / kSpareFraction, (unsigned long)kMinSpareSegments)),
+        current_segment_(kNoSegment) {
+
+        //  A sector that is not in the table is zeros
+        unwritten_sectors_persist_ = true;
+
+        unit_sectors_ = std::min((sector_size - kUnitHeaderSize) / (UINT)sizeof(uint32_t),
+                                 segment_sectors_ - kSegmentHeaderSectors - 1);
+    }
+
+
+    LogStructuredDisk::~LogStructuredDisk() {
+    }
+
+
+    //  The generation is in the high half of the id, the position in the low half.
+    //    The headers of the segments use their position alone, as generations start from 1.
+    unsigned long LogStructuredDisk::ivId(const uint32_t position) const {
+        return (unsigned long)(generations_[position / segment_sectors_] << 32) | position;
+    }
+
+
+    //  Rebuilds the table from the summaries of the units in the log.
+    //  Each unit is followed by a flush of the Host file, hence only the most recent unit
+    //    can be incomplete after a crash: its sectors are checked before it is used.
+    //  A segment whose header is not valid, e.g. it has been released, is free.
+    void LogStructuredDisk::scanLog() {
+        struct Unit {
+            uint64_t seq;
+            uint32_t position;
+            std::vector<uint32_t> sectors;
+        };
+        const UINT sector_size = getSectorSize();
+        std::vector<Unit> units;
+        std::vector<BYTE> summary(sector_size, 0);
+        uint64_t max_seq = 0;
+
+        table_.assign(getNumSectors(), kUnmapped);
+        owners_.assign((size_t)num_segments_ * segment_sectors_, kUnmapped);
+        live_sectors_.assign(num_segments_, 0);
+        generations_.assign(num_segments_, 0);
+        free_segments_.clear();
+        current_segment_ = kNoSegment;
+
+        for (UINT segment = 0; segment < num_segments_; ++segment) {
+            const unsigned long header_id = (unsigned long)segment * segment_sectors_;
+
+            if (readHostSectors(summary.data(), &header_id, &header_id, 1) != RES_OK) {
+                continue;
+            }
+            uint32_t magic = 0;
+            uint64_t generation = 0;
+            memcpy(&magic, summary.data(), sizeof(uint32_t));
+            memcpy(&generation, summary.data() + 8, sizeof(uint64_t));
+
+            if (magic != kSegmentMagic || generation == 0 || generation > UINT32_MAX) {
+                continue;
+            }
+            //  The generation is not used again, even if the segment has no complete unit
+            max_seq = std::max(max_seq, generation);
+            generations_[segment] = generation;
+            UINT position = kSegmentHeaderSectors;
+
+            while (position < segment_sectors_) {
+                const unsigned long host_id = header_id + position;
+                const unsigned long iv_id = ivId(host_id);
+
+                if (readHostSectors(summary.data(), &host_id, &iv_id, 1) != RES_OK) {
+                    break;
+                }
+                uint32_t num_sectors = 0;
+                uint64_t seq = 0;
+                uint64_t unit_generation = 0;
+                memcpy(&magic, summary.data(), sizeof(uint32_t));
+                memcpy(&num_sectors, summary.data() + 4, sizeof(uint32_t));
+                memcpy(&seq, summary.data() + 8, sizeof(uint64_t));
+                memcpy(&unit_generation, summary.data() + 16, sizeof(uint64_t));
+
+                if (magic != kUnitMagic || num_sectors == 0 || num_sectors > unit_sectors_ ||
+                    position + 1 + num_sectors > segment_sectors_ || unit_generation != generation ||
+                    seq <= generation) {
+                    break;
+                }
+                Unit unit;
+                unit.seq = seq;
+                unit.position = host_id;
+                unit.sectors.resize(num_sectors);
+                memcpy(unit.sectors.data(), summary.data() + kUnitHeaderSize, num_sectors * sizeof(uint32_t));
+                units.push_back(std::move(unit));
+                position += 1 + num_sectors;
+            }
+
+            if (position == kSegmentHeaderSectors) {
+                generations_[segment] = 0;
+            }
+        }
+        std::sort(units.begin(), units.end(), [](const Unit& a, const Unit& b) { return a.seq < b.seq; });
+
+        if (!units.empty()) {
+            const Unit& last = units.back();
+            std::vector<unsigned long> host_ids(last.sectors.size());
+            std::vector<unsigned long> iv_ids(last.sectors.size());
+            std::vector<BYTE> data(last.sectors.size() * sector_size);
+
+            for (size_t i = 0; i < host_ids.size(); ++i) {
+                host_ids[i] = last.position + 1 + i;
+                iv_ids[i] = ivId(host_ids[i]);
+            }
+            max_seq = std::max(max_seq, last.seq);
+
+            if (readHostSectors(data.data(), host_ids.data(), iv_ids.data(), host_ids.size()) != RES_OK) {
+                FATFS_DEBUG_PRINT("Discarding incomplete unit %lu\n", (unsigned long)last.seq);
+
+                if (last.position % segment_sectors_ == kSegmentHeaderSectors) {
+                    generations_[last.position / segment_sectors_] = 0;
+                }
+                units.pop_back();
+            }
+        }
+        unit_seq_ = max_seq + 1;
+
+        for (const Unit& unit : units) {
+            for (size_t i = 0; i < unit.sectors.size(); ++i) {
+                if (unit.sectors[i] < table_.size()) {
+                    table_[unit.sectors[i]] = unit.position + 1 + i;
+                }
+            }
+        }
+
+        for (LBA_t sector = 0; sector < table_.size(); ++sector) {
+            if (table_[sector] != kUnmapped) {
+                owners_[table_[sector]] = sector;
+                live_sectors_[table_[sector] / segment_sectors_]++;
+            }
+        }
+        releaseSegments();
+
+        for (UINT segment = 0; segment < num_segments_; ++segment) {
+            if (generations_[segment] == 0) {
+                free_segments_.push_back(segment);
+            }
+        }
+        FATFS_DEBUG_PRINT("Log with %lu units, %lu free segments\n", units.size(), free_segments_.size());
+    }
+
+
+    DRESULT LogStructuredDisk::addPending(const BYTE* input_buf, const LBA_t sector) {
+        const UINT sector_size = getSectorSize();
+        auto it = pending_slots_.find(sector);
+
+        if (it == pending_slots_.end()) {
+            //  A summary can only list so many sectors, and the current segment only has so much
+            //    room left (which would be wasted otherwise): the following sectors go in the next unit
+            UINT max_sectors = unit_sectors_;
+
+            if (current_segment_ != kNoSegment && current_position_ + 1 < segment_sectors_) {
+                max_sectors = std::min(max_sectors, segment_sectors_ - current_position_ - 1);
+            }
+
+            if (pending_sectors_.size() >= max_sectors && appendUnit() != RES_OK) {
+                return RES_ERROR;
+            }
+            it = pending_slots_.emplace(sector, pending_sectors_.size()).first;
+            pending_sectors_.push_back(sector);
+            pending_data_.resize(pending_data_.size() + sector_size);
+        }
+        memcpy(pending_data_.data() + (size_t)it->second * sector_size, input_buf, sector_size);
+        return RES_OK;
+    }
+
+
+    DRESULT LogStructuredDisk::openSegment() {
+        if (free_segments_.empty()) {
+            FATFS_DEBUG_PRINT("No free segments in the log of drive %d\n", getDriveId());
+            return RES_ERROR;
+        }
+        if (unit_seq_ > UINT32_MAX) {
+            FATFS_DEBUG_PRINT("No generations left in the log of drive %d\n", getDriveId());
+            return RES_ERROR;
+        }
+        current_segment_ = free_segments_.back();
+        free_segments_.pop_back();
+        //  The header is written with the first unit
+        current_position_ = 0;
+        generations_[current_segment_] = unit_seq_++;
+        return RES_OK;
+    }
+
+
+    DRESULT LogStructuredDisk::appendUnit() {
+        if (pending_sectors_.empty()) {
+            return RES_OK;
+        }
+        const UINT sector_size = getSectorSize();
+        const UINT num_sectors = pending_sectors_.size();
+
+        if (current_segment_ == kNoSegment || current_position_ + 1 + num_sectors > segment_sectors_) {
+            if (openSegment() != RES_OK) {
+                return RES_ERROR;
+            }
+        }
+        const UINT num_header = current_position_ == 0 ? kSegmentHeaderSectors : 0;
+        const uint32_t start = current_segment_ * segment_sectors_ + current_position_;
+        const uint32_t position = start + num_header;
+        const UINT num_written = num_header + 1 + num_sectors;
+        std::vector<BYTE> unit((size_t)num_written * sector_size, 0);
+        std::vector<unsigned long> host_ids(num_written);
+        std::vector<unsigned long> iv_ids(num_written);
+
+        const uint64_t generation = generations_[current_segment_];
+
+        if (num_header != 0) {
+            memcpy(unit.data(), &kSegmentMagic, sizeof(uint32_t));
+            memcpy(unit.data() + 8, &generation, sizeof(uint64_t));
+        }
+        BYTE* const summary = unit.data() + (size_t)num_header * sector_size;
+        const uint32_t num = num_sectors;
+        memcpy(summary, &kUnitMagic, sizeof(uint32_t));
+        memcpy(summary + 4, &num, sizeof(uint32_t));
+        memcpy(summary + 8, &unit_seq_, sizeof(uint64_t));
+        memcpy(summary + 16, &generation, sizeof(uint64_t));
+
+        for (UINT i = 0; i < num_sectors; ++i) {
+            const uint32_t sector = pending_sectors_[i];
+            memcpy(summary + kUnitHeaderSize + i * sizeof(uint32_t), &sector, sizeof(uint32_t));
+        }
+        memcpy(summary + sector_size, pending_data_.data(), (size_t)num_sectors * sector_size);
+
+        for (UINT i = 0; i < num_written; ++i) {
+            host_ids[i] = start + i;
+            iv_ids[i] = i < num_header ? host_ids[i] : ivId(host_ids[i]);
+        }
+
+        if (writeHostSectors(unit.data(), host_ids.data(), iv_ids.data(), num_written) != RES_OK ||
+            syncHost() != RES_OK) {
+            //  The positions might have been written, they are not written again with the same IVs
+            current_segment_ = kNoSegment;
+            return RES_ERROR;
+        }
+
+        for (UINT i = 0; i < num_sectors; ++i) {
+            const LBA_t sector = pending_sectors_[i];
+
+            if (table_[sector] != kUnmapped) {
+                live_sectors_[table_[sector] / segment_sectors_]--;
+            }
+            table_[sector] = position + 1 + i;
+            owners_[position + 1 + i] = sector;
+            live_sectors_[current_segment_]++;
+        }
+        current_position_ += num_written;
+        unit_seq_++;
+        pending_slots_.clear();
+        pending_sectors_.clear();
+        pending_data_.clear();
+
+        releaseSegments();
+
+        if (!cleaning_) {
+            cleaning_ = true;
+
+            //  A step that frees no segment, e.g. when the log is almost full, is not repeated
+            while (free_segments_.size() < kMinFreeSegments) {
+                const size_t num_free = free_segments_.size();
+
+                if (!cleanSegment() || free_segments_.size() <= num_free) {
+                    break;
+                }
+            }
+            cleaning_ = false;
+        }
+        return RES_OK;
+    }
+
+
+    //  A segment with no live sectors can be reused, as the units that replaced its
+    //    sectors are durable. Its storage is released on the Host until then.
+    void LogStructuredDisk::releaseSegments() {
+        for (UINT segment = 0; segment < num_segments_; ++segment) {
+            if (generations_[segment] != 0 && segment != current_segment_ && live_sectors_[segment] == 0) {
+                generations_[segment] = 0;
+                free_segments_.push_back(segment);
+                trimHostSectors((unsigned long)segment * segment_sectors_, segment_sectors_);
+            }
+        }
+    }
+
+
+    bool LogStructuredDisk::cleanSegment() {
+        UINT victim = kNoSegment;
+
+        for (UINT segment = 0; segment < num_segments_; ++segment) {
+            if (generations_[segment] != 0 && segment != current_segment_ &&
+                (victim == kNoSegment || live_sectors_[segment] < live_sectors_[victim])) {
+                victim = segment;
+            }
+        }
+
+        //  Moving the sectors must free more space than it takes, summaries included
+        if (victim == kNoSegment ||
+            live_sectors_[victim] + live_sectors_[victim] / unit_sectors_ + 1 + kSegmentHeaderSectors >= segment_sectors_) {
+            return false;
+        }
+        std::vector<unsigned long> host_ids;
+        std::vector<unsigned long> iv_ids;
+        std::vector<LBA_t> sectors;
+
+        for (UINT i = 0; i < segment_sectors_; ++i) {
+            const uint32_t position = victim * segment_sectors_ + i;
+            const uint32_t sector = owners_[position];
+
+            //  Sectors that are pending are about to be replaced anyway
+            if (sector != kUnmapped && table_[sector] == position && pending_slots_.count(sector) == 0) {
+                host_ids.push_back(position);
+                iv_ids.push_back(ivId(position));
+                sectors.push_back(sector);
+            }
+        }
+        const UINT sector_size = getSectorSize();
+        std::vector<BYTE> data(sectors.size() * sector_size);
+
+        if (readHostSectors(data.data(), host_ids.data(), iv_ids.data(), host_ids.size()) != RES_OK) {
+            return false;
+        }
+
+        for (size_t i = 0; i < sectors.size(); ++i) {
+            if (addPending(data.data() + i * sector_size, sectors[i]) != RES_OK) {
+                return false;
+            }
+        }
+        return appendUnit() == RES_OK;
+    }
+
+
+    DRESULT LogStructuredDisk::readRun(BYTE* output_buf, const LBA_t sector, const UINT num_sectors) {
+        const UINT sector_size = getSectorSize();
+        std::vector<unsigned long> host_ids;
+        std::vector<unsigned long> iv_ids;
+        std::vector<UINT> indexes;
+
+        for (UINT i = 0; i < num_sectors; ++i) {
+            const auto it = pending_slots_.find(sector + i);
+
+            if (it != pending_slots_.end()) {
+                memcpy(output_buf + (size_t)i * sector_size,
+                       pending_data_.data() + (size_t)it->second * sector_size,
+                       sector_size);
+            } else if (table_[sector + i] == kUnmapped || !isWrittenSector(sector + i)) {
+                //  The sector has never been written, or it has been trimmed
+                memset(output_buf + (size_t)i * sector_size, 0, sector_size);
+            } else {
+                host_ids.push_back(table_[sector + i]);
+                iv_ids.push_back(ivId(table_[sector + i]));
+                indexes.push_back(i);
+            }
+        }
+
+        if (host_ids.empty()) {
+            return RES_OK;
+        }
+        std::vector<BYTE> data(host_ids.size() * sector_size);
+
+        if (readHostSectors(data.data(), host_ids.data(), iv_ids.data(), host_ids.size()) != RES_OK) {
+            return RES_ERROR;
+        }
+
+        for (size_t i = 0; i < indexes.size(); ++i) {
+            memcpy(output_buf + (size_t)indexes[i] * sector_size, data.data() + i * sector_size, sector_size);
+        }
+        return RES_OK;
+    }
+
+
+    DRESULT LogStructuredDisk::writeSectors(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors) {
+        for (UINT i = 0; i < num_sectors; ++i) {
+            if (addPending(input_buf + (size_t)i * getSectorSize(), sector + i) != RES_OK) {
+                return RES_ERROR;
+            }
+        }
+        return RES_OK;
+    }
+
+
+    //  Each unit is flushed when it is written, so the sectors are durable once they are in a unit
+    DRESULT LogStructuredDisk::syncSectors() {
+        if (appendUnit() != RES_OK || discardTrimmedSectors() != RES_OK) {
+            return RES_ERROR;
+        }
+        releaseSegments();
+        return RES_OK;
+    }
+
+
+    //  The trimmed sectors are removed from the table, so that the cleaner does not move them
+    //    and their segments are released sooner.
+    //    The summaries still list them, they are found again (as garbage in free clusters) when
+    //    the filesystem is opened, until they are written again.
+    DRESULT LogStructuredDisk::discardSectors(const LBA_t sector, const UINT num_sectors) {
+        for (LBA_t i = sector; i < sector + num_sectors; ++i) {
+            if (table_[i] != kUnmapped) {
+                live_sectors_[table_[i] / segment_sectors_]--;
+                table_[i] = kUnmapped;
+            }
+        }
+        return RES_OK;
+    }
+
+
+    void LogStructuredDisk::diskStart(const DiskInitialization init_type) {
+        DEBUG_PRINT_FUNCTION;
+        scanLog();
+        resetWrittenSectors(false);
+        started_ = true;
+
+        if (init_type != DiskInitialization::FORMAT) {
+            bool mapped = false;
+
+            for (LBA_t sector = 0; sector < table_.size(); ++sector) {
+                if (table_[sector] != kUnmapped) {
+                    markWrittenSectors(sector, 1);
+                    mapped = true;
+                }
+            }
+            //  Formatting writes a unit, an existing log without any does not authenticate
+            started_ = mapped;
+        }
+    }
+
+
+    void LogStructuredDisk::diskStop() {
+        DEBUG_PRINT_FUNCTION;
+
+        if (started_ && appendUnit() != RES_OK) {
+            FATFS_DEBUG_PRINT("Log not flushed for drive %d\n", getDriveId());
+        }
+        started_ = false;
+        table_.clear();
+        owners_.clear();
+        live_sectors_.clear();
+        generations_.clear();
+        free_segments_.clear();
+        clearReadStreams();
+        resetWrittenSectors(true);
+    }
+}
@@ -1,15 +1,57 @@
 #include <cmath>
+#include <climits>
 #include <random>
 #include <vector>
 #include <algorithm>
 
+#ifndef UNIT_TEST
 #include "vm_enclave_layer.h"
+#endif
 #include "common.hpp"
 
 #include "persistent_disk.hpp"
 
 namespace conclave {
 
+    static const unsigned int kMaxShuffleGroupSize = 16 * 1024 * 1024;
+
+    //  Read-ahead, see ReadStream
+    static const unsigned int kNumReadStreams = 4;
+    static const unsigned int kMinReadAheadSize = 16 * 1024;
+    static const unsigned int kMaxReadAheadSize = 128 * 1024;
+
+    //  Journal, the size is a fraction of the filesystem, within the limits below
+    static const unsigned int kJournalFraction = 16;
+    static const unsigned int kMinJournalSectors = 16;
+    static const unsigned int kMaxJournalSize = 4 * 1024 * 1024;
+
+    //  Layout of the superblock:    magic, version, sequence number of the first valid record.
+    //  Layout of a record header:   magic, number of sectors, sequence number, sector ids.
+    //  The sectors of a record are encrypted with the sequence number in the IV, so that the
+    //    records left by previous checkpoints do not authenticate.
+    //  A sync can take several records, the number of sectors of the last one has the commit
+    //    flag. In version 1 of the journal each record was committed on its own.
+    static const uint32_t kJournalSuperblockMagic = 0x42534a43;
+    static const uint32_t kJournalRecordMagic = 0x52534a43;
+    static const uint32_t kJournalVersion = 2;
+    static const uint32_t kJournalVersionRecordCommit = 1;
+    static const uint32_t kJournalRecordCommit = 0x80000000;
+    static const unsigned int kJournalRecordHeaderSize = 16;
+
+    //  Set in the superblock when the filesystem has been formatted with the bitmap of the written sectors
+    static const uint32_t kJournalBitmapFromFormat = 1;
+
+
+    static bool isZeroSector(const BYTE* sector_buf, const UINT sector_size) {
+        for (UINT i = 0; i < sector_size; ++i) {
+            if (sector_buf[i] != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
     void getHashFromKey(const char* derivation_text,
                         const unsigned char* key,
                         const unsigned int key_size,
@@ -31,15 +73,55 @@ namespace conclave {
     
     PersistentDisk::PersistentDisk(const BYTE drive,
                                    const unsigned long size,
+                                   const unsigned int sector_size,
+                                   const unsigned int shuffle_group_size,
                                    const unsigned char* encryption_key) :
-        FatFsDisk(drive, size) {
+        PersistentDisk(drive, size, sector_size, shuffle_group_size, PERSISTENT_LAYOUT_IN_PLACE, encryption_key) {
+    }
+
+
+    PersistentDisk::PersistentDisk(const BYTE drive,
+                                   const unsigned long size,
+                                   const unsigned int sector_size,
+                                   const unsigned int shuffle_group_size,
+                                   const unsigned int layout,
+                                   const unsigned char* encryption_key) :
+        FatFsDisk(drive, size, sector_size),
+        shuffle_group_sectors_(shuffle_group_size / sector_size),
+        sector_size_and_mac_(sector_size + SECTOR_MAC_SIZE),
+        read_streams_(kNumReadStreams) {
 
         sgx_sha256_hash_t hash_encryption_key;
-        getHashFromKey("R3 persistent filesystem I",
-                       encryption_key,
-                       sizeof(sgx_aes_gcm_128bit_key_t),
-                       &hash_encryption_key);
+
+        if (sector_size == SECTOR_SIZE && shuffle_group_size == 0 && layout == PERSISTENT_LAYOUT_IN_PLACE) {
+            //  The default geometry keeps the key of the filesystems created before it was recorded
+            getHashFromKey("R3 persistent filesystem I",
+                           encryption_key,
+                           sizeof(sgx_aes_gcm_128bit_key_t),
+                           &hash_encryption_key);
+        } else {
+            //  The geometry comes from the header of the Host file, which is not authenticated
+            const uint32_t geometry[3] = {sector_size, shuffle_group_size, layout};
+            std::vector<unsigned char> key_and_geometry(encryption_key, encryption_key + sizeof(sgx_aes_gcm_128bit_key_t));
+            key_and_geometry.insert(key_and_geometry.end(),
+                                    (const unsigned char*)geometry,
+                                    (const unsigned char*)geometry + sizeof(geometry));
+            getHashFromKey("R3 persistent filesystem I",
+                           key_and_geometry.data(),
+                           key_and_geometry.size(),
+                           &hash_encryption_key);
+            memset(key_and_geometry.data(), 0, key_and_geometry.size());
+        }
         memcpy(&encryption_key_, &hash_encryption_key, sizeof(sgx_aes_gcm_128bit_key_t));
+        crypto_.reset(new SectorCrypto(encryption_key_));
+
+        journal_sectors_ = std::min<unsigned long>(getNumSectors() / kJournalFraction, kMaxJournalSize / sector_size);
+        journal_sectors_ = std::max(journal_sectors_, kMinJournalSectors);
+        journal_record_sectors_ = std::min<UINT>((sector_size - kJournalRecordHeaderSize) / sizeof(uint32_t),
+                                                 (journal_sectors_ - 1) / 2 - 1);
+
+        //  Until the bitmap is loaded, all the sectors might hold data
+        resetWrittenSectors(true);
     };
 
 
@@ -47,53 +129,12 @@ namespace conclave {
     }
 
 
-#if ENCRYPTION
-    int PersistentDisk::encrypt(const unsigned long sector_id,
-                                const BYTE* input_buf,
-                                BYTE* output_buf) {
-        //  Here we assume that IV_SIZE is bigger than the size of sector_id
-        uint8_t iv[IV_SIZE] = {0};
-        memcpy(iv, &sector_id, sizeof(unsigned long));
-        const sgx_status_t res = sgx_rijndael128GCM_encrypt(&encryption_key_,
-                                                            input_buf,
-                                                            SECTOR_SIZE,
-                                                            output_buf,
-                                                            iv,
-                                                            IV_SIZE,
-                                                            NULL,
-                                                            0,
-                                                            (sgx_aes_gcm_128bit_tag_t*) (output_buf + SECTOR_SIZE));
-        if (res != SGX_SUCCESS) {
-            FATFS_DEBUG_PRINT("Error: could not encrypt to the filesystem, error code: %d\n", res);
-            return -1;
-        }
-        return 0;
-    }
-
-
-    int PersistentDisk::decrypt(const unsigned long sector_id,
-                                const BYTE* input_buf,
-                                BYTE* output_buf) {
-        //  Here we assume that IV_SIZE is bigger than the size of sector_id
-        uint8_t iv[IV_SIZE] = {0};
-        memcpy(iv, &sector_id, sizeof(unsigned long));
-        const sgx_status_t res = sgx_rijndael128GCM_decrypt(&encryption_key_,
-                                                            input_buf,
-                                                            SECTOR_SIZE,
-                                                            output_buf,
-                                                            iv,
-                                                            IV_SIZE,
-                                                            NULL,
-                                                            0,
-                                                            (sgx_aes_gcm_128bit_tag_t*) (input_buf + SECTOR_SIZE));
-        if (res != SGX_SUCCESS) {
-            FATFS_DEBUG_PRINT("Error: could not decrypt from the filesystem, error code: %d\n", res);
-            return -1;
-        }
-        return 0;
-    }
-
-#endif  //  End of ENCRYPTION
+    bool PersistentDisk::isValidShuffleGroupSize(const unsigned int shuffle_group_size,
+                                                 const unsigned int sector_size) {
+        return shuffle_group_size <= kMaxShuffleGroupSize && (shuffle_group_size % sector_size) == 0;
+    }
+
+
 
 #if SECTOR_SHUFFLING
     void PersistentDisk::prepareSectorTables() {
@@ -103,6 +144,8 @@ namespace conclave {
         //  The number of sectors can't be bigger than 2^32 - 1 (see GET_SECTOR_COUNT in diskIoCtl below)
         //  Hence the sector tables can just be of LBA_t type (currently "unsigned int").
         //  This is to save memory when the tables are big.
+        //  Note that the rounding below uses SECTOR_SIZE whatever the sector size of the disk,
+        //    the layout of existing filesystems depends on it.
         const LBA_t size_table_1 = square_root - (square_root % SECTOR_SIZE) + SECTOR_SIZE;
         //  We do not want this value to be zero in case the number of sectors is very small
         const LBA_t size_table_2 = std::max(num_sectors / size_table_1, 1ul);
@@ -130,7 +173,39 @@ namespace conclave {
     }
 
 
+    //  The groups are shuffled with a single table, which is small as there is one entry
+    //    every shuffle_group_sectors_ sectors.
+    //  Only the groups that are full are shuffled, the sectors at the end of the disk that
+    //    do not make a full group keep their position so that the size of the file is unchanged.
+    void PersistentDisk::prepareGroupTable() {
+        const LBA_t num_groups = getNumSectors() / shuffle_group_sectors_;
+        sectors_table_1_.reserve(num_groups);
+
+        unsigned long seed = 0;
+        sgx_sha256_hash_t hash_seed;
+
+        getHashFromKey("R3 persistent filesystem II",
+                       encryption_key_,
+                       sizeof(sgx_aes_gcm_128bit_key_t),
+                       &hash_seed);
+        memcpy(&seed, &hash_seed, sizeof(unsigned long));
+
+        for (LBA_t i = 0; i < num_groups; ++i) {
+            sectors_table_1_.push_back(i);
+        }
+        std::shuffle(sectors_table_1_.begin(), sectors_table_1_.end(), std::default_random_engine(seed));
+    }
+
+
     unsigned long PersistentDisk::mapSectorId(const unsigned long sector_id) {
+        if (shuffle_group_sectors_ != 0) {
+            const unsigned long group_id = sector_id / shuffle_group_sectors_;
+
+            if (group_id >= sectors_table_1_.size()) {
+                return sector_id;
+            }
+            return sectors_table_1_[group_id] * shuffle_group_sectors_ + sector_id % shuffle_group_sectors_;
+        }
         const unsigned long size_table_2 = sectors_table_2_.size();
         const unsigned long bucket_id = sector_id / size_table_2;
         const unsigned long offset_id = sector_id % size_table_2;
@@ -140,116 +215,881 @@ namespace conclave {
 #endif  //  End of SECTOR_SHUFFLING
                                
 
-    DRESULT PersistentDisk::flush() {
-        int res = -1;
-        const unsigned int sector_size = SECTOR_SIZE_AND_MAC;
-        host_encrypted_write_ocall(&res,
-                                   getDriveId(),
-                                   buffer_writes_,
-                                   sector_size,
-                                   buffer_index_);
-        if (res < 0) {
-            return RES_ERROR;
+    void PersistentDisk::prepareRun(const LBA_t sector, const UINT num_sectors) {
+        sector_ids_.resize(num_sectors);
+
+        for (UINT i = 0; i < num_sectors; ++i) {
+            if (sector + i >= getNumSectors()) {
+                //  Sectors of the bitmap
+                sector_ids_[i] = bitmap_start_ + (sector + i - getNumSectors());
+                continue;
+            }
+#if SECTOR_SHUFFLING
+            sector_ids_[i] = mapSectorId(sector + i);
+#else
+            sector_ids_[i] = sector + i;
+#endif
         }
-        return RES_OK;
     }
 
 
-    DRESULT PersistentDisk::diskRead(BYTE* output_buf,
-                                     LBA_t sector,
-                                     BYTE num_reads) {
-        DRESULT res_flush = flush();
+    //  The sectors are read from the Host first and then decrypted together, see SectorCrypto.
+    //  iv_ids are the ids used in the IV of each sector, these are the same as host_ids
+    //    apart from the journal records.
+    DRESULT PersistentDisk::readHostSectors(BYTE* output_buf,
+                                            const unsigned long* host_ids,
+                                            const unsigned long* iv_ids,
+                                            const UINT num_sectors) {
+        const size_t run_size = (size_t)num_sectors * sector_size_and_mac_;
 
-        if (res_flush != RES_OK) {
-            return RES_ERROR;
+        if (buffer_encryption_.size() < run_size) {
+            buffer_encryption_.resize(run_size);
         }
         int res = 0;
-    
-        BYTE* p_output_buf = output_buf;
-        int i = 0;
-    
-        while (i < num_reads) {
-#if SECTOR_SHUFFLING
-            const unsigned long sector_id = mapSectorId(sector + i);
-#else
-            const unsigned long sector_id = sector + i;
-#endif
 
-#if ENCRYPTION
+        UINT i = 0;
+
+        while (i < num_sectors) {
+            //  Sectors that are contiguous on the Host are read with a single OCall
+            UINT num_contiguous = 1;
+
+            while (i + num_contiguous < num_sectors &&
+                   num_contiguous < UCHAR_MAX &&
+                   host_ids[i + num_contiguous] == host_ids[i] + num_contiguous) {
+                num_contiguous++;
+            }
+            const unsigned int read_size = num_contiguous * sector_size_and_mac_;
             host_encrypted_read_ocall(&res,
                                       getDriveId(),
-                                      sector_id,
-                                      1,
-                                      SECTOR_SIZE_AND_MAC,
-                                      buffer_encryption_,
-                                      SECTOR_SIZE_AND_MAC);
+                                      host_ids[i],
+                                      num_contiguous,
+                                      sector_size_and_mac_,
+                                      buffer_encryption_.data() + (size_t)i * sector_size_and_mac_,
+                                      read_size);
             if (res < 0) {
                 FATFS_DEBUG_PRINT("Read failed, result: %d\n", res);
                 return RES_ERROR;
             }
-            const int res_decrypt = decrypt(sector_id, buffer_encryption_, p_output_buf);
+            i += num_contiguous;
+        }
 
-            if (res_decrypt != 0) {
-                return RES_ERROR;
-            }
+#if ENCRYPTION
+        if (crypto_->decrypt(iv_ids, buffer_encryption_.data(), output_buf, num_sectors, getSectorSize()) != 0) {
+            return RES_ERROR;
+        }
 #else
-            host_encrypted_read_ocall(&res,
-                                      getDriveId(),
-                                      sector_id,
-                                      1,
-                                      SECTOR_SIZE_AND_MAC,
-                                      p_output_buf,
-                                      SECTOR_SIZE_AND_MAC);
+        for (UINT i = 0; i < num_sectors; ++i) {
+            memcpy(output_buf + (size_t)i * getSectorSize(),
+                   buffer_encryption_.data() + (size_t)i * sector_size_and_mac_,
+                   getSectorSize());
+        }
+#endif
+        return RES_OK;
+    }
+
+
+    DRESULT PersistentDisk::writeHostSectors(const BYTE* input_buf,
+                                             const unsigned long* host_ids,
+                                             const unsigned long* iv_ids,
+                                             const UINT num_sectors) {
+        const size_t run_size = (size_t)num_sectors * sector_size_and_mac_;
+
+        if (buffer_encryption_.size() < run_size) {
+            buffer_encryption_.resize(run_size);
+        }
+
+#if ENCRYPTION
+        if (crypto_->encrypt(iv_ids, input_buf, buffer_encryption_.data(), num_sectors, getSectorSize()) != 0) {
+            return RES_ERROR;
+        }
+#else
+        for (UINT i = 0; i < num_sectors; ++i) {
+            memcpy(buffer_encryption_.data() + (size_t)i * sector_size_and_mac_,
+                   input_buf + (size_t)i * getSectorSize(),
+                   getSectorSize());
+        }
+#endif
+
+        UINT i = 0;
+
+        while (i < num_sectors) {
+            //  Sectors that are contiguous on the Host are written with a single OCall
+            UINT num_contiguous = 1;
+
+            while (i + num_contiguous < num_sectors &&
+                   num_contiguous < UCHAR_MAX &&
+                   host_ids[i + num_contiguous] == host_ids[i] + num_contiguous) {
+                num_contiguous++;
+            }
+            int res = -1;
+            host_encrypted_write_ocall(&res,
+                                       getDriveId(),
+                                       buffer_encryption_.data() + (size_t)i * sector_size_and_mac_,
+                                       num_contiguous * sector_size_and_mac_,
+                                       sector_size_and_mac_,
+                                       host_ids[i]);
             if (res < 0) {
-                FATFS_DEBUG_PRINT("Read failed, result: %d\n", res);
                 return RES_ERROR;
             }
-#endif
-
-            p_output_buf += SECTOR_SIZE;
-            i++;
+            i += num_contiguous;
         }
-        if (res == -1) {
+        return RES_OK;
+    }
+
+
+    //  The storage of the sectors is released on the Host, they are read as zeros afterwards
+    DRESULT PersistentDisk::trimHostSectors(const unsigned long host_id, const unsigned long num_sectors) {
+        int res = -1;
+        host_disk_trim_ocall(&res, getDriveId(), host_id, num_sectors, sector_size_and_mac_);
+
+        if (res < 0) {
+            FATFS_DEBUG_PRINT("Trim failed, result: %d\n", res);
             return RES_ERROR;
+        }
+        return RES_OK;
+    }
+
+
+    //  The Host file is not opened in synchronous mode, the writes are durable only after this call
+    DRESULT PersistentDisk::syncHost() {
+        int res = -1;
+        host_disk_sync_ocall(&res, getDriveId());
+        return (res < 0) ? RES_ERROR : RES_OK;
+    }
+
+
+    //  The sectors in the journal are read from memory, as their home location is stale
+    //    (or has never been written) until the next checkpoint.
+    //  The sectors that do not hold data are zeros, with no need to read them from the Host.
+    DRESULT PersistentDisk::readRun(BYTE* output_buf, const LBA_t sector, const UINT num_sectors) {
+        const UINT sector_size = getSectorSize();
+        UINT i = 0;
+
+        while (i < num_sectors) {
+            if (!isWrittenSector(sector + i)) {
+                memset(output_buf + (size_t)i * sector_size, 0, sector_size);
+                i++;
+                continue;
+            }
+            const BYTE* dirty_sector = getDirtySector(sector + i);
+
+            if (dirty_sector != nullptr) {
+                memcpy(output_buf + (size_t)i * sector_size, dirty_sector, sector_size);
+                i++;
+                continue;
+            }
+            UINT num_run = 1;
+
+            while (i + num_run < num_sectors &&
+                   isWrittenSector(sector + i + num_run) &&
+                   getDirtySector(sector + i + num_run) == nullptr) {
+                num_run++;
+            }
+            prepareRun(sector + i, num_run);
+
+            if (readHostSectors(output_buf + (size_t)i * sector_size, sector_ids_.data(), sector_ids_.data(), num_run) != RES_OK) {
+                return RES_ERROR;
+            }
+            i += num_run;
+        }
+        return RES_OK;
+    }
+
+
+    DRESULT PersistentDisk::writeRun(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors) {
+        prepareRun(sector, num_sectors);
+        return writeHostSectors(input_buf, sector_ids_.data(), sector_ids_.data(), num_sectors);
+    }
+
+
+    const BYTE* PersistentDisk::getDirtySector(const LBA_t sector) {
+        if (dirty_slots_.empty()) {
+            return nullptr;
+        }
+        const auto it = dirty_slots_.find(sector);
+        return (it == dirty_slots_.end()) ? nullptr : dirty_data_.data() + (size_t)it->second * getSectorSize();
+    }
+
+
+    //  Reads the superblock and replays the committed records that follow it, if any.
+    //  When the superblock is not valid, e.g. the filesystem is new or was created before
+    //    the journal was introduced, the journal is empty and we just write a new superblock.
+    //  Returns false, before anything is written, when an existing filesystem does not
+    //    authenticate: the superblock is always there unless the filesystem was created
+    //    before the journal, with the default geometry, and then its first sector must be valid.
+    bool PersistentDisk::startJournal(const DiskInitialization init_type) {
+        const UINT sector_size = getSectorSize();
+        std::vector<BYTE> header(sector_size, 0);
+        unsigned long host_id = journal_start_;
+        bool valid = readHostSectors(header.data(), &host_id, &host_id, 1) == RES_OK;
+        uint32_t magic = 0;
+        uint32_t version = 0;
+        memcpy(&magic, header.data(), sizeof(uint32_t));
+        memcpy(&version, header.data() + 4, sizeof(uint32_t));
+        memcpy(&journal_seq_, header.data() + 8, sizeof(uint64_t));
+
+        if (valid && magic == kJournalSuperblockMagic) {
+            uint32_t flags = 0;
+            memcpy(&flags, header.data() + 16, sizeof(uint32_t));
+            bitmap_from_format_ = bitmap_from_format_ || (flags & kJournalBitmapFromFormat) != 0;
+        }
+
+        if (!valid || magic != kJournalSuperblockMagic ||
+            (version != kJournalVersion && version != kJournalVersionRecordCommit)) {
+
+            if (init_type == DiskInitialization::OPEN) {
+                const bool default_geometry = sector_size == SECTOR_SIZE && shuffle_group_sectors_ == 0;
+
+                if (!default_geometry || readRun(header.data(), 0, 1) != RES_OK) {
+                    FATFS_DEBUG_PRINT("Filesystem of drive %d does not authenticate\n", getDriveId());
+                    return false;
+                }
+            }
+            //  We start from a random sequence number so that the IVs of the new records
+            //    do not repeat those of any record left in the file
+            uint32_t seed = 0;
+
+            if (sgx_read_rand((unsigned char*)&seed, sizeof(seed)) != SGX_SUCCESS) {
+                seed = 0;
+            }
+            journal_seq_ = (seed >> 1) + 1;
         } else {
+            UINT position = 1;
+            unsigned long num_replayed = 0;
+            //  Sectors of the records read since the last commit
+            std::vector<LBA_t> sectors;
+            std::vector<BYTE> sectors_data;
+
+            while (position < journal_sectors_) {
+                host_id = journal_start_ + position;
+                unsigned long iv_id = (journal_seq_ << 32) | position;
+
+                if (readHostSectors(header.data(), &host_id, &iv_id, 1) != RES_OK) {
+                    break;
+                }
+                uint32_t num_sectors = 0;
+                memcpy(&magic, header.data(), sizeof(uint32_t));
+                memcpy(&num_sectors, header.data() + 4, sizeof(uint32_t));
+                const bool commit = version == kJournalVersionRecordCommit || (num_sectors & kJournalRecordCommit) != 0;
+                num_sectors &= ~kJournalRecordCommit;
+
+                if (magic != kJournalRecordMagic ||
+                    num_sectors > journal_record_sectors_ ||
+                    position + 1 + num_sectors > journal_sectors_) {
+                    break;
+                }
+                std::vector<unsigned long> host_ids(num_sectors);
+                std::vector<unsigned long> iv_ids(num_sectors);
+
+                for (uint32_t i = 0; i < num_sectors; ++i) {
+                    host_ids[i] = journal_start_ + position + 1 + i;
+                    iv_ids[i] = (journal_seq_ << 32) | (position + 1 + i);
+                }
+                const size_t data_offset = sectors_data.size();
+                sectors_data.resize(data_offset + (size_t)num_sectors * sector_size);
+
+                if (readHostSectors(sectors_data.data() + data_offset, host_ids.data(), iv_ids.data(), num_sectors) != RES_OK) {
+                    //  The record was not completely written
+                    break;
+                }
+
+                for (uint32_t i = 0; i < num_sectors; ++i) {
+                    uint32_t sector = 0;
+                    memcpy(&sector, header.data() + kJournalRecordHeaderSize + i * sizeof(uint32_t), sizeof(uint32_t));
+                    sectors.push_back(sector);
+                }
+                position += 1 + num_sectors;
+                journal_seq_++;
+
+                if (!commit) {
+                    continue;
+                }
+
+                for (size_t i = 0; i < sectors.size(); ++i) {
+                    if (sectors[i] >= getNumSectors() + bitmap_sectors_ ||
+                        writeRun(sectors_data.data() + i * sector_size, sectors[i], 1) != RES_OK) {
+                        FATFS_DEBUG_PRINT("Journal replay failed at sector %lu\n", (unsigned long)sectors[i]);
+                        return true;
+                    }
+                }
+                sectors.clear();
+                sectors_data.clear();
+                num_replayed++;
+            }
+            FATFS_DEBUG_PRINT("Journal replayed %lu syncs\n", num_replayed);
+
+            //  The records after the last one that authenticated, and those of a sync that was not
+            //    committed, might have been written with the following sequence numbers. There can't
+            //    be more records than sectors in the journal, so we skip that many numbers so that
+            //    the IVs of the new records are not used again.
+            journal_seq_ += journal_sectors_;
+
+            if (num_replayed != 0 && syncHost() != RES_OK) {
+                return true;
+            }
+        }
+
+        if (writeJournalSuperblock() != RES_OK || syncHost() != RES_OK) {
+            FATFS_DEBUG_PRINT("Journal superblock not written for drive %d\n", getDriveId());
+        }
+        return true;
+    }
+
+
+    DRESULT PersistentDisk::writeJournalSuperblock() {
+        std::vector<BYTE> superblock(getSectorSize(), 0);
+        const uint64_t seq = journal_seq_;
+        const uint32_t flags = bitmap_from_format_ ? kJournalBitmapFromFormat : 0;
+        memcpy(superblock.data(), &kJournalSuperblockMagic, sizeof(uint32_t));
+        memcpy(superblock.data() + 4, &kJournalVersion, sizeof(uint32_t));
+        memcpy(superblock.data() + 8, &seq, sizeof(uint64_t));
+        memcpy(superblock.data() + 16, &flags, sizeof(uint32_t));
+        const unsigned long host_id = journal_start_;
+        journal_head_ = 1;
+        return writeHostSectors(superblock.data(), &host_id, &host_id, 1);
+    }
+
+
+    DRESULT PersistentDisk::writeJournal(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors) {
+        const UINT sector_size = getSectorSize();
+
+        for (UINT i = 0; i < num_sectors; ++i) {
+            auto it = dirty_slots_.find(sector + i);
+
+            if ((it == dirty_slots_.end() || !dirty_pending_[it->second]) &&
+                pending_slots_.size() == journal_record_sectors_) {
+                //  A record can only contain so many sectors, the following ones go in the next record
+                if (appendJournalRecord(false) != RES_OK) {
+                    return RES_ERROR;
+                }
+                //  appendJournalRecord might have checkpointed and moved the slots
+                it = dirty_slots_.find(sector + i);
+            }
+            UINT slot = 0;
+
+            if (it == dirty_slots_.end()) {
+                slot = dirty_sectors_.size();
+                dirty_slots_[sector + i] = slot;
+                dirty_sectors_.push_back(sector + i);
+                dirty_pending_.push_back(false);
+                dirty_open_.push_back(false);
+                dirty_data_.resize(dirty_data_.size() + sector_size);
+            } else {
+                slot = it->second;
+            }
+
+            if (!dirty_pending_[slot]) {
+                dirty_pending_[slot] = true;
+                pending_slots_.push_back(slot);
+            }
+            memcpy(dirty_data_.data() + (size_t)slot * sector_size, input_buf + (size_t)i * sector_size, sector_size);
+        }
+        return RES_OK;
+    }
+
+
+    //  Writes a record with the sectors of the given slots at the head of the journal
+    DRESULT PersistentDisk::writeJournalRecord(const UINT* slots, const UINT num_sectors, const bool commit) {
+        const UINT sector_size = getSectorSize();
+        std::vector<BYTE> record((size_t)(num_sectors + 1) * sector_size, 0);
+        std::vector<unsigned long> host_ids(num_sectors + 1);
+        std::vector<unsigned long> iv_ids(num_sectors + 1);
+
+        const uint64_t seq = journal_seq_;
+        const uint32_t num = num_sectors | (commit ? kJournalRecordCommit : 0);
+        memcpy(record.data(), &kJournalRecordMagic, sizeof(uint32_t));
+        memcpy(record.data() + 4, &num, sizeof(uint32_t));
+        memcpy(record.data() + 8, &seq, sizeof(uint64_t));
+
+        for (UINT i = 0; i <= num_sectors; ++i) {
+            host_ids[i] = journal_start_ + journal_head_ + i;
+            iv_ids[i] = (journal_seq_ << 32) | (journal_head_ + i);
+        }
+
+        for (UINT i = 0; i < num_sectors; ++i) {
+            const uint32_t sector = dirty_sectors_[slots[i]];
+            memcpy(record.data() + kJournalRecordHeaderSize + i * sizeof(uint32_t), &sector, sizeof(uint32_t));
+            memcpy(record.data() + (size_t)(i + 1) * sector_size, dirty_data_.data() + (size_t)slots[i] * sector_size, sector_size);
+        }
+
+        if (writeHostSectors(record.data(), host_ids.data(), iv_ids.data(), num_sectors + 1) != RES_OK) {
+            return RES_ERROR;
+        }
+        journal_head_ += num_sectors + 1;
+        journal_seq_++;
+        return RES_OK;
+    }
+
+
+    //  The pending sectors are written to the journal, this does not make them durable (see syncJournal).
+    //    The records of a sync are only replayed once its last record, which has the commit flag, is written.
+    DRESULT PersistentDisk::appendJournalRecord(const bool commit) {
+        if (pending_slots_.empty() && (!commit || open_slots_.empty())) {
+            return RES_OK;
+        }
+
+        if (journal_head_ + 1 + pending_slots_.size() > journal_sectors_ && checkpointJournal() != RES_OK) {
+            return RES_ERROR;
+        }
+
+        if (writeJournalRecord(pending_slots_.data(), pending_slots_.size(), commit) != RES_OK) {
+            return RES_ERROR;
+        }
+
+        for (const UINT slot : pending_slots_) {
+            dirty_pending_[slot] = false;
+
+            if (!commit && !dirty_open_[slot]) {
+                dirty_open_[slot] = true;
+                open_slots_.push_back(slot);
+            }
+        }
+        pending_slots_.clear();
+
+        if (commit) {
+            for (const UINT slot : open_slots_) {
+                dirty_open_[slot] = false;
+            }
+            open_slots_.clear();
+        }
+        return RES_OK;
+    }
+
+
+    //  All the sectors written since the last sync are committed with a single flush of the Host file
+    DRESULT PersistentDisk::syncJournal() {
+        if (appendJournalRecord(true) != RES_OK || syncHost() != RES_OK) {
+            return RES_ERROR;
+        }
+
+        if (journal_head_ > journal_sectors_ / 2) {
+            return checkpointJournal();
+        }
+        return RES_OK;
+    }
+
+
+    //  The committed sectors in the journal are written to their home location, and a new superblock
+    //    invalidates the records. The sectors of the sync in progress are not committed yet: those
+    //    already in records are written again to the new journal, and the pending ones are kept.
+    DRESULT PersistentDisk::checkpointJournal() {
+        if (syncHost() != RES_OK) {
+            return RES_ERROR;
+        }
+        //  The records of the sync in progress and the pending sectors must leave room for a record
+        //    in the new journal. Otherwise the sync is bigger than the journal and can't be atomic,
+        //    and its sectors are written to their home location as well.
+        size_t open_sectors = 0;
+
+        for (size_t i = 0; i < open_slots_.size(); i += journal_record_sectors_) {
+            open_sectors += 1 + std::min<size_t>(open_slots_.size() - i, journal_record_sectors_);
+        }
+
+        if (1 + open_sectors + 1 + journal_record_sectors_ > journal_sectors_) {
+            FATFS_DEBUG_PRINT("Sync of %lu sectors does not fit in the journal\n", (unsigned long)open_slots_.size());
+
+            for (const UINT slot : open_slots_) {
+                dirty_open_[slot] = false;
+            }
+            open_slots_.clear();
+        }
+        std::vector<UINT> slots;
+
+        for (UINT slot = 0; slot < dirty_sectors_.size(); ++slot) {
+            if (!dirty_pending_[slot] && !dirty_open_[slot]) {
+                slots.push_back(slot);
+            }
+        }
+        std::sort(slots.begin(), slots.end(), [this](UINT a, UINT b) {
+            return dirty_sectors_[a] < dirty_sectors_[b];
+        });
+        const UINT sector_size = getSectorSize();
+        std::vector<BYTE> run_data;
+        size_t i = 0;
+
+        while (i < slots.size()) {
+            //  Consecutive sectors are written together, so that they are encrypted in one go
+            size_t num_run = 1;
+
+            while (i + num_run < slots.size() && dirty_sectors_[slots[i + num_run]] == dirty_sectors_[slots[i]] + num_run) {
+                num_run++;
+            }
+            run_data.resize(num_run * sector_size);
+
+            for (size_t j = 0; j < num_run; ++j) {
+                memcpy(run_data.data() + j * sector_size, dirty_data_.data() + (size_t)slots[i + j] * sector_size, sector_size);
+            }
+
+            if (writeRun(run_data.data(), dirty_sectors_[slots[i]], num_run) != RES_OK) {
+                return RES_ERROR;
+            }
+            i += num_run;
+        }
+
+        if (syncHost() != RES_OK || writeJournalSuperblock() != RES_OK || syncHost() != RES_OK) {
+            return RES_ERROR;
+        }
+        //  Only the sectors of the sync in progress are kept
+        std::unordered_map<LBA_t, UINT> dirty_slots;
+        std::vector<LBA_t> dirty_sectors;
+        std::vector<BYTE> dirty_data;
+        std::vector<bool> dirty_pending;
+        std::vector<bool> dirty_open;
+        std::vector<UINT> new_slots(dirty_sectors_.size());
+
+        for (UINT slot = 0; slot < dirty_sectors_.size(); ++slot) {
+            if (!dirty_pending_[slot] && !dirty_open_[slot]) {
+                continue;
+            }
+            new_slots[slot] = dirty_sectors.size();
+            dirty_slots[dirty_sectors_[slot]] = new_slots[slot];
+            dirty_sectors.push_back(dirty_sectors_[slot]);
+            dirty_pending.push_back(dirty_pending_[slot]);
+            dirty_open.push_back(dirty_open_[slot]);
+            dirty_data.insert(dirty_data.end(),
+                              dirty_data_.begin() + (size_t)slot * sector_size,
+                              dirty_data_.begin() + (size_t)(slot + 1) * sector_size);
+        }
+
+        for (UINT& slot : pending_slots_) {
+            slot = new_slots[slot];
+        }
+
+        for (UINT& slot : open_slots_) {
+            slot = new_slots[slot];
+        }
+        dirty_slots_.swap(dirty_slots);
+        dirty_sectors_.swap(dirty_sectors);
+        dirty_data_.swap(dirty_data);
+        dirty_pending_.swap(dirty_pending);
+        dirty_open_.swap(dirty_open);
+
+        for (size_t i = 0; i < open_slots_.size(); i += journal_record_sectors_) {
+            const UINT num_sectors = std::min<size_t>(open_slots_.size() - i, journal_record_sectors_);
+
+            if (writeJournalRecord(open_slots_.data() + i, num_sectors, false) != RES_OK) {
+                return RES_ERROR;
+            }
+        }
+        return RES_OK;
+    }
+
+
+    //  Returns the stream that the read of sector belongs to, i.e. the one that has the sector
+    //    in its cache or expects it as next sector. If there is none, the least recently used
+    //    stream is reset and returned.
+    PersistentDisk::ReadStream& PersistentDisk::getReadStream(const LBA_t sector, bool& sequential) {
+        ReadStream* lru_stream = &read_streams_[0];
+
+        for (auto& stream : read_streams_) {
+            const bool cached = sector >= stream.cache_start && sector - stream.cache_start < stream.cache_count;
+
+            if (stream.last_use != 0 && (cached || sector == stream.next_sector)) {
+                sequential = true;
+                return stream;
+            }
+
+            if (stream.last_use < lru_stream->last_use) {
+                lru_stream = &stream;
+            }
+        }
+        sequential = false;
+        lru_stream->window = 0;
+        lru_stream->cache_count = 0;
+        return *lru_stream;
+    }
+
+
+    //  Writes go through to the Host, the copies of the sectors in the read-ahead caches
+    //    are updated so that they are never stale.
+    void PersistentDisk::updateReadStreams(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors) {
+        const UINT sector_size = getSectorSize();
+
+        for (auto& stream : read_streams_) {
+            const LBA_t start = std::max(sector, stream.cache_start);
+            const LBA_t end = std::min(sector + num_sectors, stream.cache_start + stream.cache_count);
+
+            if (start < end) {
+                memcpy(stream.cache.data() + (size_t)(start - stream.cache_start) * sector_size,
+                       input_buf + (size_t)(start - sector) * sector_size,
+                       (size_t)(end - start) * sector_size);
+            }
+        }
+    }
+
+
+    DRESULT PersistentDisk::diskRead(BYTE* output_buf,
+                                     LBA_t sector,
+                                     UINT num_reads) {
+        const UINT sector_size = getSectorSize();
+        bool sequential = false;
+        ReadStream& stream = getReadStream(sector, sequential);
+        stream.last_use = ++read_counter_;
+        UINT num_left = num_reads;
+
+        if (sector >= stream.cache_start && sector - stream.cache_start < stream.cache_count) {
+            const UINT index = sector - stream.cache_start;
+            const UINT num_cached = std::min(num_left, stream.cache_count - index);
+            memcpy(output_buf, stream.cache.data() + (size_t)index * sector_size, (size_t)num_cached * sector_size);
+            output_buf += (size_t)num_cached * sector_size;
+            sector += num_cached;
+            num_left -= num_cached;
+        }
+        stream.next_sector = sector + num_left;
+
+        if (num_left == 0) {
             return RES_OK;
         }
+        const UINT max_window = std::max(kMaxReadAheadSize / sector_size, 1u);
+
+        if (sequential) {
+            stream.window = (stream.window == 0) ? std::max(kMinReadAheadSize / sector_size, 1u) : stream.window * 2;
+            stream.window = std::min(stream.window, max_window);
+        }
+        const LBA_t num_sectors = getNumSectors();
+        const UINT num_ahead = (stream.next_sector >= num_sectors) ?
+            0 : std::min<LBA_t>(stream.window, num_sectors - stream.next_sector);
+        stream.cache_count = 0;
+
+        if (num_ahead > 0) {
+            const UINT num_run = num_left + num_ahead;
+            stream.cache.resize((size_t)num_run * sector_size);
+
+            if (readRun(stream.cache.data(), sector, num_run) == RES_OK) {
+                memcpy(output_buf, stream.cache.data(), (size_t)num_left * sector_size);
+                stream.cache_start = sector;
+                stream.cache_count = num_run;
+                return RES_OK;
+            }
+            //  The sectors read ahead might have never been written (the bitmap does not know
+            //    about them when the filesystem has been opened), hence they do not have a valid MAC.
+            //  We read again only what FatFs asked for.
+            stream.window = 0;
+        }
+        return readRun(output_buf, sector, num_left);
     }
 
-#if _READONLY == 0
-    DRESULT PersistentDisk::diskWrite(const BYTE* input_buf,
-                                      LBA_t sector,
-                                      BYTE num_writes) {
-        const BYTE* p_input_buf = input_buf;
-        unsigned int i_num = 0;
+    DRESULT PersistentDisk::writeSectors(const BYTE* input_buf, const LBA_t sector, const UINT num_sectors) {
+#if JOURNAL
+        return writeJournal(input_buf, sector, num_sectors);
+#else
+        return writeRun(input_buf, sector, num_sectors);
+#endif
+    }
 
-        unsigned char* p_output_buf = buffer_writes_;
 
-        while (i_num < num_writes) {
-#if SECTOR_SHUFFLING
-            const unsigned long sector_id = mapSectorId(sector + i_num);
+    DRESULT PersistentDisk::syncSectors() {
+#if JOURNAL
+        const DRESULT res = (writeBitmap() == RES_OK) ? syncJournal() : RES_ERROR;
 #else
-            const unsigned long sector_id = sector + i_num;
+        const DRESULT res = syncHost();
 #endif
-            buffer_index_ = sector_id;
-            
-#if ENCRYPTION
-            const int res_encrypt = encrypt(sector_id, p_input_buf, p_output_buf);
+        return (res == RES_OK) ? discardTrimmedSectors() : res;
+    }
+
+
+    //  The hole left on the Host is read as zeros, which is not a valid encrypted sector,
+    //    but the bitmap prevents any read of it.
+    DRESULT PersistentDisk::discardSectors(const LBA_t sector, const UINT num_sectors) {
+        prepareRun(sector, num_sectors);
+        UINT i = 0;
 
-            if (res_encrypt == -1) {
+        while (i < num_sectors) {
+            //  Shuffled sectors are contiguous on the Host only within a group
+            UINT num_contiguous = 1;
+
+            while (i + num_contiguous < num_sectors && sector_ids_[i + num_contiguous] == sector_ids_[i] + num_contiguous) {
+                num_contiguous++;
+            }
+            if (trimHostSectors(sector_ids_[i], num_contiguous) != RES_OK) {
                 return RES_ERROR;
             }
-#else
-            memcpy(p_output_buf, p_input_buf, SECTOR_SIZE);
-#endif
-            p_input_buf += SECTOR_SIZE;
-        
-            DRESULT res = flush();
-    
-            if (res != RES_OK) {
+            i += num_contiguous;
+        }
+        return RES_OK;
+    }
+
+
+    bool PersistentDisk::isWrittenSector(const LBA_t sector) const {
+        return (written_sectors_[sector / 64] >> (sector % 64)) & 1;
+    }
+
+
+    void PersistentDisk::markWrittenSectors(const LBA_t sector, const UINT num_sectors) {
+        for (LBA_t i = sector; i < sector + num_sectors; ++i) {
+            if (!isWrittenSector(i)) {
+                written_sectors_[i / 64] |= 1ULL << (i % 64);
+
+                if (bitmap_sectors_ != 0) {
+                    bitmap_dirty_[i / 8 / getSectorSize()] = true;
+                }
+            }
+        }
+    }
+
+
+    //  The sectors are read as zeros straight away, but they are discarded only at the next sync:
+    //    FatFs trims them before the FAT that frees them is written, and a crash in between
+    //    must not lose the data of a file that is still allocated.
+    void PersistentDisk::trimSectors(const LBA_t first_sector, const LBA_t last_sector) {
+        const LBA_t last = std::min<LBA_t>(last_sector, getNumSectors() - 1);
+        LBA_t i = first_sector;
+
+        while (i <= last) {
+            //  Only the sectors that might hold data need to be discarded
+            if (!isWrittenSector(i)) {
+                i++;
+                continue;
+            }
+            const LBA_t first = i;
+
+            while (i <= last && isWrittenSector(i)) {
+                written_sectors_[i / 64] &= ~(1ULL << (i % 64));
+
+                if (bitmap_sectors_ != 0) {
+                    bitmap_dirty_[i / 8 / getSectorSize()] = true;
+                }
+                i++;
+            }
+            trimmed_ranges_.emplace_back(first, i - 1);
+        }
+        clearReadStreams();
+    }
+
+
+    //  The trims that have not been followed by a sync are dropped, their sectors are simply
+    //    not released on the Host
+    void PersistentDisk::resetWrittenSectors(const bool written) {
+        written_sectors_.assign((getNumSectors() + 63) / 64, written ? ~0ULL : 0);
+        trimmed_ranges_.clear();
+    }
+
+
+    //  A new filesystem has no data, and its whole bitmap is written with the first sync (the one at the
+    //    end of the format), which is recorded in the journal superblock.
+    //  Each sector of the bitmap that cannot be read then leaves all the sectors it describes as holding
+    //    data, so that their reads are authenticated as well rather than returning zeros; this is also
+    //    the case of a filesystem created before the bitmap was introduced.
+    void PersistentDisk::startBitmap(const DiskInitialization init_type) {
+        const UINT sector_size = getSectorSize();
+        const size_t bitmap_size = written_sectors_.size() * sizeof(uint64_t);
+
+        if (bitmap_sectors_ == 0) {
+            return;
+        }
+
+        if (init_type == DiskInitialization::FORMAT) {
+            resetWrittenSectors(false);
+            bitmap_dirty_.assign(bitmap_sectors_, true);
+            return;
+        }
+        bitmap_dirty_.assign(bitmap_sectors_, false);
+        std::vector<BYTE> data((size_t)bitmap_sectors_ * sector_size);
+        std::vector<unsigned long> host_ids(bitmap_sectors_);
+
+        for (UINT i = 0; i < bitmap_sectors_; ++i) {
+            host_ids[i] = bitmap_start_ + i;
+        }
+
+        if (readHostSectors(data.data(), host_ids.data(), host_ids.data(), bitmap_sectors_) == RES_OK) {
+            memcpy(written_sectors_.data(), data.data(), bitmap_size);
+            return;
+        }
+        resetWrittenSectors(true);
+
+        for (UINT i = 0; i < bitmap_sectors_; ++i) {
+            if (readHostSectors(data.data(), &host_ids[i], &host_ids[i], 1) == RES_OK) {
+                const size_t offset = (size_t)i * sector_size;
+                memcpy((BYTE*)written_sectors_.data() + offset, data.data(), std::min<size_t>(sector_size, bitmap_size - offset));
+            } else if (bitmap_from_format_) {
+                FATFS_DEBUG_PRINT("Bitmap sector %u of drive %d not authenticated\n", i, getDriveId());
+            }
+        }
+    }
+
+
+    //  The sectors of the bitmap that have changed are added to the journal, in the same
+    //    record as the last sectors written
+    DRESULT PersistentDisk::writeBitmap() {
+        const UINT sector_size = getSectorSize();
+        const size_t bitmap_size = written_sectors_.size() * sizeof(uint64_t);
+        std::vector<BYTE> data(sector_size);
+
+        for (UINT i = 0; i < bitmap_sectors_; ++i) {
+            if (!bitmap_dirty_[i]) {
+                continue;
+            }
+            const size_t offset = (size_t)i * sector_size;
+            std::fill(data.begin(), data.end(), 0);
+            memcpy(data.data(), (const BYTE*)written_sectors_.data() + offset, std::min<size_t>(sector_size, bitmap_size - offset));
+
+            if (writeJournal(data.data(), getNumSectors() + i, 1) != RES_OK) {
+                return RES_ERROR;
+            }
+            bitmap_dirty_[i] = false;
+        }
+        return RES_OK;
+    }
+
+
+    DRESULT PersistentDisk::discardTrimmedSectors() {
+        std::vector<std::pair<LBA_t, LBA_t>> trimmed_ranges;
+        trimmed_ranges.swap(trimmed_ranges_);
+
+        for (const auto& range : trimmed_ranges) {
+            LBA_t i = range.first;
+
+            while (i <= range.second) {
+                //  Sectors written again since they were trimmed are kept
+                if (isWrittenSector(i)) {
+                    i++;
+                    continue;
+                }
+                LBA_t num_run = 1;
+
+                while (i + num_run <= range.second && num_run < UINT_MAX && !isWrittenSector(i + num_run)) {
+                    num_run++;
+                }
+
+                if (discardSectors(i, num_run) != RES_OK) {
+                    return RES_ERROR;
+                }
+                i += num_run;
+            }
+        }
+        return RES_OK;
+    }
+
+#if _READONLY == 0
+    DRESULT PersistentDisk::diskWrite(const BYTE* input_buf,
+                                      LBA_t sector,
+                                      UINT num_writes) {
+        const UINT sector_size = getSectorSize();
+        UINT i = 0;
+
+        while (i < num_writes) {
+            //  Zeros written to a sector without data are there already (e.g. the FAT when formatting)
+            if (unwritten_sectors_persist_ &&
+                !isWrittenSector(sector + i) &&
+                isZeroSector(input_buf + (size_t)i * sector_size, sector_size)) {
+                i++;
+                continue;
+            }
+            UINT num_run = 1;
+
+            while (i + num_run < num_writes &&
+                   (!unwritten_sectors_persist_ ||
+                    isWrittenSector(sector + i + num_run) ||
+                    !isZeroSector(input_buf + (size_t)(i + num_run) * sector_size, sector_size))) {
+                num_run++;
+            }
+            markWrittenSectors(sector + i, num_run);
+
+            if (writeSectors(input_buf + (size_t)i * sector_size, sector + i, num_run) != RES_OK) {
                 return RES_ERROR;
             }
-            i_num ++;
+            updateReadStreams(input_buf + (size_t)i * sector_size, sector + i, num_run);
+            i += num_run;
         }
         return RES_OK;
     }
@@ -261,7 +1101,12 @@ namespace conclave {
 
         switch (cmd) {
         case CTRL_SYNC:
-            result = flush();
+            result = syncSectors();
+            break;
+
+        case CTRL_TRIM:
+            trimSectors(((LBA_t*)buf)[0], ((LBA_t*)buf)[1]);
+            result = RES_OK;
             break;
             
         case GET_BLOCK_SIZE:
@@ -269,7 +1114,7 @@ namespace conclave {
             break;
 
         case GET_SECTOR_SIZE:
-            *((WORD*)buf) = SECTOR_SIZE;
+            *((WORD*)buf) = getSectorSize();
             result = RES_OK;
             break;
 
@@ -290,11 +1135,40 @@ namespace conclave {
     }
 
 
-    void PersistentDisk::diskStart() {
+    void PersistentDisk::diskStart(const DiskInitialization init_type) {
         DEBUG_PRINT_FUNCTION;
     
+        journal_start_ = getNumSectors();
+
 #if SECTOR_SHUFFLING
-        prepareSectorTables();
+        if (shuffle_group_sectors_ != 0) {
+            prepareGroupTable();
+        } else {
+            prepareSectorTables();
+            //  The sector tables can map sectors past the end of the disk when it is small
+            journal_start_ = std::max<unsigned long>(journal_start_, sectors_table_1_.size() * sectors_table_2_.size());
+        }
+#endif
+
+#if JOURNAL
+        //  The bitmap is replayed from the journal as any other sector, so its size must be known first.
+        //    Its sectors need an id in the journal records.
+        const size_t bitmap_size = written_sectors_.size() * sizeof(uint64_t);
+        const UINT bitmap_sectors = (bitmap_size + getSectorSize() - 1) / getSectorSize();
+
+        if (getNumSectors() + bitmap_sectors <= UINT32_MAX) {
+            bitmap_start_ = journal_start_ + journal_sectors_;
+            bitmap_sectors_ = bitmap_sectors;
+            unwritten_sectors_persist_ = true;
+            bitmap_from_format_ = (init_type == DiskInitialization::FORMAT);
+        }
+        started_ = startJournal(init_type);
+
+        if (started_) {
+            startBitmap(init_type);
+        }
+#else
+        started_ = true;
 #endif
     }
 
@@ -302,9 +1176,51 @@ namespace conclave {
     void PersistentDisk::diskStop() {
         DEBUG_PRINT_FUNCTION;
 
+#if JOURNAL
+        //  The trims that are not followed by a sync must not be persisted in the bitmap
+        for (const auto& range : trimmed_ranges_) {
+            markWrittenSectors(range.first, range.second - range.first + 1);
+        }
+
+        if (!started_) {
+            FATFS_DEBUG_PRINT("Drive %d not started, nothing to write\n", getDriveId());
+        } else if (writeBitmap() != RES_OK ||
+            syncJournal() != RES_OK ||
+            (journal_head_ > 1 && checkpointJournal() != RES_OK)) {
+            FATFS_DEBUG_PRINT("Journal not checkpointed for drive %d\n", getDriveId());
+        }
+        dirty_slots_.clear();
+        dirty_sectors_.clear();
+        dirty_data_.clear();
+        dirty_pending_.clear();
+        dirty_open_.clear();
+        pending_slots_.clear();
+        open_slots_.clear();
+#endif
+
 #if SECTOR_SHUFFLING
         sectors_table_1_.clear();
         sectors_table_2_.clear();
 #endif
+        clearReadStreams();
+        resetWrittenSectors(true);
+        started_ = false;
+    }
+
+
+    DSTATUS PersistentDisk::diskInitialize() {
+        return started_ ? RES_OK : STA_NOINIT;
+    }
+
+
+    DSTATUS PersistentDisk::diskStatus() {
+        return started_ ? RES_OK : STA_NOINIT;
+    }
+
+
+    void PersistentDisk::clearReadStreams() {
+        for (auto& stream : read_streams_) {
+            stream = ReadStream();
+        }
     }
 }
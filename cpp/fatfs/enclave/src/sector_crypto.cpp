@@ -0,0 +1,319 @@
+#include <string.h>
+
+#include "common.hpp"
+
+#include "sector_crypto.hpp"
+
+#if !defined(__AES__) || !defined(__PCLMUL__) || !defined(__SSSE3__)
+#error sector_crypto.cpp must be compiled with -maes -mpclmul -mssse3
+#endif
+
+namespace conclave {
+
+    /*
+      The Enclave is built with -nostdinc, which hides the compiler's intrinsics headers,
+      so we use the GCC builtins behind them directly.
+    */
+    typedef long long Block __attribute__((vector_size(16), aligned(16)));
+    typedef int Words __attribute__((vector_size(16)));
+    typedef char Bytes __attribute__((vector_size(16)));
+
+    //  Number of blocks hashed before each GHASH reduction, see processSectors
+    static const size_t kHashBlocks = 4;
+
+    static inline Block loadBlock(const void* p) {
+        Block b;
+        memcpy(&b, p, sizeof(b));
+        return b;
+    }
+
+    static inline void storeBlock(void* p, const Block b) {
+        memcpy(p, &b, sizeof(b));
+    }
+
+    //  Reverses the bytes of a block, GHASH works on big endian values
+    static inline Block byteSwap(const Block b) {
+        const Bytes mask = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0};
+        return (Block)__builtin_ia32_pshufb128((Bytes)b, mask);
+    }
+
+    //  The byte shifts only take an immediate count, which must be known without optimisations
+    template <int N>
+    static inline Block shiftLeftBytes(const Block b) {
+        return __builtin_ia32_pslldqi128(b, N * 8);
+    }
+
+    template <int N>
+    static inline Block shiftRightBytes(const Block b) {
+        return __builtin_ia32_psrldqi128(b, N * 8);
+    }
+
+    static inline Block shiftLeftWords(const Block b, const int n) {
+        return (Block)__builtin_ia32_pslldi128((Words)b, n);
+    }
+
+    static inline Block shiftRightWords(const Block b, const int n) {
+        return (Block)__builtin_ia32_psrldi128((Words)b, n);
+    }
+
+    //  Carry-less multiplication of two byte-reflected blocks, the 256 bits product is
+    //    accumulated in lo/hi so that the reduction can be done once for several products.
+    static inline void clMulAccumulate(const Block a, const Block b, Block& lo, Block& hi) {
+        lo ^= __builtin_ia32_pclmulqdq128(a, b, 0x00);
+        hi ^= __builtin_ia32_pclmulqdq128(a, b, 0x11);
+        const Block mid = __builtin_ia32_pclmulqdq128(a, b, 0x10) ^ __builtin_ia32_pclmulqdq128(a, b, 0x01);
+        lo ^= shiftLeftBytes<8>(mid);
+        hi ^= shiftRightBytes<8>(mid);
+    }
+
+    //  Reduction of a 256 bits product modulo x^128 + x^7 + x^2 + x + 1 (Intel's "Carry-Less
+    //    Multiplication Instruction and its Usage for Computing the GCM Mode", algorithm 5).
+    static inline Block gfReduce(Block lo, Block hi) {
+        //  Shift the 256 bits product left by one, as the operands are bit reflected
+        Block carry_lo = shiftRightWords(lo, 31);
+        Block carry_hi = shiftRightWords(hi, 31);
+        lo = shiftLeftWords(lo, 1);
+        hi = shiftLeftWords(hi, 1);
+        const Block carry_across = shiftRightBytes<12>(carry_lo);
+        carry_hi = shiftLeftBytes<4>(carry_hi);
+        carry_lo = shiftLeftBytes<4>(carry_lo);
+        lo |= carry_lo;
+        hi |= carry_hi | carry_across;
+
+        //  Reduction
+        Block t = shiftLeftWords(lo, 31) ^ shiftLeftWords(lo, 30) ^ shiftLeftWords(lo, 25);
+        const Block t_hi = shiftRightBytes<4>(t);
+        lo ^= shiftLeftBytes<12>(t);
+        Block r = shiftRightWords(lo, 1) ^ shiftRightWords(lo, 2) ^ shiftRightWords(lo, 7) ^ t_hi;
+        return hi ^ lo ^ r;
+    }
+
+    static inline Block gfMul(const Block a, const Block b) {
+        Block lo = {0, 0};
+        Block hi = {0, 0};
+        clMulAccumulate(a, b, lo, hi);
+        return gfReduce(lo, hi);
+    }
+
+    template <size_t N>
+    static inline void aesEncrypt(Block* blocks, const Block* round_keys) {
+        for (size_t i = 0; i < N; ++i) {
+            blocks[i] ^= round_keys[0];
+        }
+        for (int r = 1; r < 10; ++r) {
+            for (size_t i = 0; i < N; ++i) {
+                blocks[i] = __builtin_ia32_aesenc128(blocks[i], round_keys[r]);
+            }
+        }
+        for (size_t i = 0; i < N; ++i) {
+            blocks[i] = __builtin_ia32_aesenclast128(blocks[i], round_keys[10]);
+        }
+    }
+
+    template <int RCON>
+    static inline Block expandKeyStep(Block key) {
+        Block t = __builtin_ia32_aeskeygenassist128(key, RCON);
+        t = (Block)__builtin_ia32_pshufd((Words)t, 0xff);
+        key ^= shiftLeftBytes<4>(key);
+        key ^= shiftLeftBytes<4>(key);
+        key ^= shiftLeftBytes<4>(key);
+        return key ^ t;
+    }
+
+    static void expandKey(const unsigned char* key, Block* round_keys) {
+        round_keys[0] = loadBlock(key);
+        round_keys[1] = expandKeyStep<0x01>(round_keys[0]);
+        round_keys[2] = expandKeyStep<0x02>(round_keys[1]);
+        round_keys[3] = expandKeyStep<0x04>(round_keys[2]);
+        round_keys[4] = expandKeyStep<0x08>(round_keys[3]);
+        round_keys[5] = expandKeyStep<0x10>(round_keys[4]);
+        round_keys[6] = expandKeyStep<0x20>(round_keys[5]);
+        round_keys[7] = expandKeyStep<0x40>(round_keys[6]);
+        round_keys[8] = expandKeyStep<0x80>(round_keys[7]);
+        round_keys[9] = expandKeyStep<0x1b>(round_keys[8]);
+        round_keys[10] = expandKeyStep<0x36>(round_keys[9]);
+    }
+
+    //  Encrypts (or decrypts) N sectors at the same time, see the description in sector_crypto.hpp.
+    //  Counters are kept byte swapped, so that the 32 bits big endian counter of GCM is the
+    //    lowest word and can be incremented with a vector addition.
+    template <size_t N, bool ENCRYPT>
+    static int processSectors(const Block* round_keys,
+                              const Block* hash_powers,
+                              const unsigned long* sector_ids,
+                              const BYTE* input_buf,
+                              BYTE* output_buf,
+                              const unsigned int sector_size) {
+        const size_t input_stride = ENCRYPT ? sector_size : sector_size + SGX_AESGCM_MAC_SIZE;
+        const size_t output_stride = ENCRYPT ? sector_size + SGX_AESGCM_MAC_SIZE : sector_size;
+        const Block one = {1, 0};
+
+        Block counters[N];
+        Block tag_masks[N];
+        Block hashes[N];
+        Block blocks[N];
+
+        for (size_t i = 0; i < N; ++i) {
+            unsigned char iv_block[16] = {0};
+            memcpy(iv_block, &sector_ids[i], sizeof(unsigned long));
+            iv_block[15] = 1;
+            tag_masks[i] = loadBlock(iv_block);
+            counters[i] = byteSwap(tag_masks[i]) + one;
+            hashes[i] = Block{0, 0};
+        }
+        //  E(K, J0) is xored to the hash to obtain the MAC
+        aesEncrypt<N>(tag_masks, round_keys);
+
+        //  The hash of each sector is updated kHashBlocks blocks at a time:
+        //    X = (X + C1) * H^4 + C2 * H^3 + C3 * H^2 + C4 * H, with a single reduction.
+        for (unsigned int offset = 0; offset < sector_size; offset += kHashBlocks * 16) {
+            Block lo[N];
+            Block hi[N];
+
+            for (size_t i = 0; i < N; ++i) {
+                lo[i] = Block{0, 0};
+                hi[i] = Block{0, 0};
+            }
+
+            for (size_t b = 0; b < kHashBlocks; ++b) {
+                const unsigned int block_offset = offset + b * 16;
+
+                for (size_t i = 0; i < N; ++i) {
+                    blocks[i] = byteSwap(counters[i]);
+                    counters[i] += one;
+                }
+                aesEncrypt<N>(blocks, round_keys);
+
+                for (size_t i = 0; i < N; ++i) {
+                    const Block input = loadBlock(input_buf + i * input_stride + block_offset);
+                    const Block output = input ^ blocks[i];
+                    storeBlock(output_buf + i * output_stride + block_offset, output);
+
+                    Block cipher = byteSwap(ENCRYPT ? output : input);
+
+                    if (b == 0) {
+                        cipher ^= hashes[i];
+                    }
+                    clMulAccumulate(cipher, hash_powers[kHashBlocks - 1 - b], lo[i], hi[i]);
+                }
+            }
+
+            for (size_t i = 0; i < N; ++i) {
+                hashes[i] = gfReduce(lo[i], hi[i]);
+            }
+        }
+        //  Lengths block: no additional data, sector_size bytes of ciphertext
+        const Block lengths = {(long long)sector_size * 8, 0};
+        int res = 0;
+
+        for (size_t i = 0; i < N; ++i) {
+            hashes[i] = gfMul(hashes[i] ^ lengths, hash_powers[0]);
+            const Block tag = byteSwap(hashes[i]) ^ tag_masks[i];
+
+            if (ENCRYPT) {
+                storeBlock(output_buf + i * output_stride + sector_size, tag);
+            } else {
+                //  Constant time comparison
+                const Block diff = tag ^ loadBlock(input_buf + i * input_stride + sector_size);
+                res |= (diff[0] | diff[1]) != 0;
+            }
+        }
+        return res == 0 ? 0 : -1;
+    }
+
+    template <bool ENCRYPT>
+    static int processRun(const Block* round_keys,
+                          const Block* hash_powers,
+                          const unsigned long* sector_ids,
+                          const BYTE* input_buf,
+                          BYTE* output_buf,
+                          size_t num_sectors,
+                          const unsigned int sector_size) {
+        const size_t input_stride = ENCRYPT ? sector_size : sector_size + SGX_AESGCM_MAC_SIZE;
+        const size_t output_stride = ENCRYPT ? sector_size + SGX_AESGCM_MAC_SIZE : sector_size;
+        int res = 0;
+
+        while (num_sectors > 0) {
+            size_t n;
+
+            if (num_sectors >= SectorCrypto::kLanes) {
+                n = SectorCrypto::kLanes;
+                res |= processSectors<SectorCrypto::kLanes, ENCRYPT>(round_keys, hash_powers, sector_ids, input_buf, output_buf, sector_size);
+            } else if (num_sectors >= 4) {
+                n = 4;
+                res |= processSectors<4, ENCRYPT>(round_keys, hash_powers, sector_ids, input_buf, output_buf, sector_size);
+            } else if (num_sectors >= 2) {
+                n = 2;
+                res |= processSectors<2, ENCRYPT>(round_keys, hash_powers, sector_ids, input_buf, output_buf, sector_size);
+            } else {
+                n = 1;
+                res |= processSectors<1, ENCRYPT>(round_keys, hash_powers, sector_ids, input_buf, output_buf, sector_size);
+            }
+            sector_ids += n;
+            input_buf += n * input_stride;
+            output_buf += n * output_stride;
+            num_sectors -= n;
+        }
+        return res;
+    }
+
+
+    SectorCrypto::SectorCrypto(const sgx_aes_gcm_128bit_key_t& key) {
+        Block* round_keys = reinterpret_cast<Block*>(round_keys_);
+        Block* hash_powers = reinterpret_cast<Block*>(hash_powers_);
+        expandKey(key, round_keys);
+        //  H = E(K, 0^128), followed by H^2, H^3 and H^4
+        Block hash_key = {0, 0};
+        aesEncrypt<1>(&hash_key, round_keys);
+        hash_powers[0] = byteSwap(hash_key);
+
+        for (size_t i = 1; i < kHashBlocks; ++i) {
+            hash_powers[i] = gfMul(hash_powers[i - 1], hash_powers[0]);
+        }
+    }
+
+
+    SectorCrypto::~SectorCrypto() {
+        //  Do not leave key material around in the Enclave heap
+        volatile unsigned char* p = round_keys_;
+        for (size_t i = 0; i < sizeof(round_keys_); ++i) p[i] = 0;
+        p = hash_powers_;
+        for (size_t i = 0; i < sizeof(hash_powers_); ++i) p[i] = 0;
+    }
+
+
+    int SectorCrypto::encrypt(const unsigned long* sector_ids,
+                              const BYTE* input_buf,
+                              BYTE* output_buf,
+                              size_t num_sectors,
+                              unsigned int sector_size) {
+        return processRun<true>(reinterpret_cast<const Block*>(round_keys_),
+                                reinterpret_cast<const Block*>(hash_powers_),
+                                sector_ids,
+                                input_buf,
+                                output_buf,
+                                num_sectors,
+                                sector_size);
+    }
+
+
+    int SectorCrypto::decrypt(const unsigned long* sector_ids,
+                              const BYTE* input_buf,
+                              BYTE* output_buf,
+                              size_t num_sectors,
+                              unsigned int sector_size) {
+        const int res = processRun<false>(reinterpret_cast<const Block*>(round_keys_),
+                                          reinterpret_cast<const Block*>(hash_powers_),
+                                          sector_ids,
+                                          input_buf,
+                                          output_buf,
+                                          num_sectors,
+                                          sector_size);
+        if (res != 0) {
+            FATFS_DEBUG_PRINT("Error: could not decrypt from the filesystem, MAC mismatch %d\n", res);
+            memset(output_buf, 0, num_sectors * sector_size);
+            return -1;
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,1219 @@
+#include <algorithm>
+#include <fcntl.h>
+
+#include "tmpfs_file_manager.hpp"
+
+static const std::string kRootPath = "/";
+
+//  The extents of a file are kPageSize, 2 * kPageSize, 4 * kPageSize... bytes long,
+//    up to kMaxExtentSize, and then kMaxExtentSize bytes long.
+//  As in FatFs, a file cannot be larger than the filesystem (EFBIG), which also bounds
+//    the number of extents of a file.
+static const uint64_t kPageSize = 4096;
+static const unsigned int kMaxExtentShift = 8;
+static const uint64_t kMaxExtentSize = kPageSize << kMaxExtentShift;
+static const uint64_t kDoublingExtentsSize = kPageSize * ((1 << kMaxExtentShift) - 1);
+static const size_t kMaxNameLength = 255;
+
+//  Snapshot of the tree: header, then a record for each directory and file in
+//    depth-first order (type, path length, path relative to the root), then kRecordEnd.
+//    A file record carries the size of the file and the extents which have been written.
+//    The path length is 4 bytes long, it was 2 bytes long in version 1 of the snapshots.
+static const uint32_t kSnapshotMagic = 0x53465443;  //  "CTFS"
+static const uint32_t kSnapshotVersion = 2;
+static const uint32_t kSnapshotVersionShortPaths = 1;
+static const uint8_t kRecordDir = 0;
+static const uint8_t kRecordFile = 1;
+static const uint8_t kRecordEnd = 0xFF;
+
+#ifndef DT_DIR
+#define DT_DIR  0040000 /* Directory.  */
+#define DT_REG  0100000 /* Regular file.  */
+#endif
+
+namespace conclave {
+
+    //  Index, first byte and size of the extent which holds a byte of a file
+    static void locateExtent(const uint64_t offset, size_t& index, uint64_t& start, uint64_t& size) {
+        if (offset < kDoublingExtentsSize) {
+            index = 63 - __builtin_clzll(offset / kPageSize + 1);
+            start = kPageSize * ((1ULL << index) - 1);
+            size = kPageSize << index;
+        } else {
+            const uint64_t fixed_extents = (offset - kDoublingExtentsSize) / kMaxExtentSize;
+            index = kMaxExtentShift + fixed_extents;
+            start = kDoublingExtentsSize + fixed_extents * kMaxExtentSize;
+            size = kMaxExtentSize;
+        }
+    }
+
+
+    static uint64_t extentSize(const size_t index) {
+        return index < kMaxExtentShift ? kPageSize << index : kMaxExtentSize;
+    }
+
+
+    static uint64_t extentStart(const size_t index) {
+        return index < kMaxExtentShift ?
+            kPageSize * ((1ULL << index) - 1) :
+            kDoublingExtentsSize + (index - kMaxExtentShift) * kMaxExtentSize;
+    }
+
+
+    static void appendBytes(std::vector<uint8_t>& out, const void* data, const size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+
+    static bool takeBytes(const uint8_t*& data, const uint8_t* end, void* out, const size_t size) {
+        if ((size_t)(end - data) < size) {
+            return false;
+        }
+        memcpy(out, data, size);
+        data += size;
+        return true;
+    }
+
+
+    static int convertModeFlag(const char* mode) {
+        //  Legacy letters such as "b" are ignored, as on all POSIX systems
+        const std::string mode_str(mode);
+        const bool update = mode_str.find('+') != std::string::npos;
+        int oflag = 0;
+
+        switch (mode_str.empty() ? 0 : mode_str[0]) {
+        case 'r':
+            oflag = update ? O_RDWR : O_RDONLY;
+            break;
+        case 'w':
+            oflag = (update ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+            break;
+        case 'a':
+            oflag = (update ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+            break;
+        default:
+            return -1;
+        }
+
+        if (mode_str.find('x') != std::string::npos) {
+            oflag |= O_EXCL;
+        }
+        return oflag;
+    }
+
+
+    TmpFsFileManager::Node::Node(const bool is_dir, uint64_t* used_bytes) :
+        is_dir(is_dir),
+        used_bytes(used_bytes) {
+    }
+
+
+    TmpFsFileManager::Node::~Node() {
+        for (size_t i = 0; i < extents.size(); i++) {
+            if (extents[i] != nullptr) {
+                *used_bytes -= extentSize(i);
+                free(extents[i]);
+            }
+        }
+    }
+
+
+    TmpFsFileManager::TmpFsFileManager(const unsigned char drive_id,
+                                       const int first_handle,
+                                       const int max_handle,
+                                       const std::string& mount_path,
+                                       const unsigned long size) :
+        first_handle_(first_handle),
+        next_handle_(first_handle),
+        last_handle_(max_handle),
+        mount_path_(mount_path),
+        drive_id_(drive_id),
+        root_(std::make_shared<Node>(true, &used_bytes_)),
+        capacity_(size) {
+
+        if (mount_path_ != kRootPath) {
+            mkdir(mount_path_.c_str(), 0);
+        }
+    }
+
+
+    TmpFsFileManager::~TmpFsFileManager() {
+        DEBUG_PRINT_FUNCTION;
+        files_.clear();
+        dirs_.clear();
+        root_.reset();
+    }
+
+
+    std::string TmpFsFileManager::getMountPath() {
+        return mount_path_;
+    }
+
+
+    bool TmpFsFileManager::isPathOwner(const std::string& path) {
+        return path.length() > 0 &&
+            (path.find(mount_path_, 0) == 0 ||  //  Path starts with mount_path
+             path == mount_path_.substr(0, mount_path_.size() - 1));  // Path is the mount_path (without / at the end)
+    }
+
+
+    bool TmpFsFileManager::isHandleOwner(const int handle) {
+        return handle != -1 && handle >= first_handle_ && handle <= last_handle_;
+    }
+
+
+    bool TmpFsFileManager::isDirOwner(const void* dir) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return dirs_.find(dir) != dirs_.end();
+    }
+
+
+    bool TmpFsFileManager::splitPath(const char* path, std::vector<std::string>& components) {
+        if (path == nullptr || path[0] == '\0') {
+            return false;
+        }
+        const char* begin = path;
+
+        while (*begin != '\0') {
+            const char* end = begin;
+
+            while (*end != '\0' && *end != '/') {
+                end++;
+            }
+            const std::string name(begin, end);
+
+            if (name == "..") {
+                if (!components.empty()) {
+                    components.pop_back();
+                }
+            } else if (!name.empty() && name != ".") {
+                components.push_back(name);
+            }
+            begin = (*end == '/') ? end + 1 : end;
+        }
+        return true;
+    }
+
+
+    std::shared_ptr<TmpFsFileManager::Node> TmpFsFileManager::lookup(const std::vector<std::string>& components) {
+        std::shared_ptr<Node> node = root_;
+
+        for (const auto& name : components) {
+            if (!node->is_dir) {
+                return nullptr;
+            }
+            const auto it = node->children.find(name);
+
+            if (it == node->children.end()) {
+                return nullptr;
+            }
+            node = it->second;
+        }
+        return node;
+    }
+
+
+    TmpFsFileManager::Node* TmpFsFileManager::lookupParent(const std::vector<std::string>& components, int& err) {
+        if (components.empty()) {
+            //  The root directory has no parent
+            err = EBUSY;
+            return nullptr;
+        }
+
+        if (components.back().length() > kMaxNameLength) {
+            err = ENAMETOOLONG;
+            return nullptr;
+        }
+        const std::vector<std::string> parent_components(components.begin(), components.end() - 1);
+        const auto parent = lookup(parent_components);
+
+        if (parent == nullptr) {
+            err = ENOENT;
+            return nullptr;
+        }
+
+        if (!parent->is_dir) {
+            err = ENOTDIR;
+            return nullptr;
+        }
+        return parent.get();
+    }
+
+
+    TmpFsFileManager::OpenFile* TmpFsFileManager::getOpenFile(const int fd) {
+        const auto it = files_.find(fd);
+
+        if (it == files_.end()) {
+            FATFS_DEBUG_PRINT("Error: handle not found: %d\n", fd);
+            return nullptr;
+        }
+        return it->second.get();
+    }
+
+
+    FileHandle TmpFsFileManager::getNewHandle() {
+        const int num_handles = last_handle_ - first_handle_ + 1;
+
+        for (int i = 0; i < num_handles; i++) {
+            const FileHandle handle = next_handle_;
+            next_handle_ = (next_handle_ == last_handle_) ? first_handle_ : next_handle_ + 1;
+
+            if (files_.find(handle) == files_.end()) {
+                return handle;
+            }
+        }
+        FATFS_DEBUG_PRINT("No handles available, returning %d\n", -1);
+        return -1;
+    }
+
+
+    bool TmpFsFileManager::allocateExtent(Node& node, const size_t index, const uint64_t size) {
+        if (index < node.extents.size() && node.extents[index] != nullptr) {
+            return true;
+        }
+
+        if (extentStart(index) >= capacity_ || used_bytes_ + size > capacity_) {
+            return false;
+        }
+        unsigned char* extent = (unsigned char*)calloc(size, sizeof(unsigned char));
+
+        if (extent == nullptr) {
+            FATFS_DEBUG_PRINT("Could not allocate an extent of %lu bytes\n", size);
+            return false;
+        }
+
+        if (index >= node.extents.size()) {
+            node.extents.resize(index + 1, nullptr);
+        }
+        node.extents[index] = extent;
+        used_bytes_ += size;
+        return true;
+    }
+
+
+    size_t TmpFsFileManager::readData(const Node& node, uint64_t position, void* buf, size_t count) {
+        if (position >= node.size) {
+            return 0;
+        }
+        count = (size_t)std::min<uint64_t>(count, node.size - position);
+        unsigned char* output = static_cast<unsigned char*>(buf);
+        size_t remaining = count;
+
+        while (remaining > 0) {
+            size_t index;
+            uint64_t start, size;
+            locateExtent(position, index, start, size);
+            const size_t chunk = (size_t)std::min<uint64_t>(remaining, start + size - position);
+
+            if (index < node.extents.size() && node.extents[index] != nullptr) {
+                memcpy(output, node.extents[index] + (position - start), chunk);
+            } else {
+                memset(output, 0, chunk);
+            }
+            output += chunk;
+            position += chunk;
+            remaining -= chunk;
+        }
+        return count;
+    }
+
+
+    size_t TmpFsFileManager::writeData(Node& node, uint64_t position, const void* buf, size_t count) {
+        const unsigned char* input = static_cast<const unsigned char*>(buf);
+        size_t written = 0;
+
+        if (position >= capacity_) {
+            return 0;
+        }
+        count = (size_t)std::min<uint64_t>(count, capacity_ - position);
+
+        while (written < count) {
+            size_t index;
+            uint64_t start, size;
+            locateExtent(position, index, start, size);
+
+            if (!allocateExtent(node, index, size)) {
+                //  The filesystem is full, the write gets as far as it can
+                break;
+            }
+            const size_t chunk = (size_t)std::min<uint64_t>(count - written, start + size - position);
+            memcpy(node.extents[index] + (position - start), input + written, chunk);
+            position += chunk;
+            written += chunk;
+        }
+        node.size = std::max(node.size, position);
+        return written;
+    }
+
+
+    void TmpFsFileManager::truncateData(Node& node, const uint64_t length) {
+        if (length < node.size && !node.extents.empty()) {
+            size_t index;
+            uint64_t start, size;
+            locateExtent(length, index, start, size);
+
+            //  The tail of the extent holding the new end of file is cleared,
+            //    so that the file reads as zeros if it is extended again
+            if (length > start && index < node.extents.size() && node.extents[index] != nullptr) {
+                memset(node.extents[index] + (length - start), 0, size - (length - start));
+                index++;
+            }
+
+            for (size_t i = index; i < node.extents.size(); i++) {
+                if (node.extents[i] != nullptr) {
+                    free(node.extents[i]);
+                    used_bytes_ -= extentSize(i);
+                }
+            }
+            node.extents.resize(std::min(index, node.extents.size()));
+        }
+        node.size = length;
+    }
+
+
+    int TmpFsFileManager::openInternal(const char* path, int oflag, int& err) {
+        std::vector<std::string> components;
+
+        if (!splitPath(path, components)) {
+            err = ENOENT;
+            return -1;
+        }
+        const int access_mode = oflag & O_ACCMODE;
+        const bool writable = access_mode != O_RDONLY;
+        std::shared_ptr<Node> node = lookup(components);
+
+        if (node == nullptr) {
+            if (!(oflag & O_CREAT)) {
+                err = ENOENT;
+                return -1;
+            }
+            Node* parent = lookupParent(components, err);
+
+            if (parent == nullptr) {
+                return -1;
+            }
+            node = std::make_shared<Node>(false, &used_bytes_);
+            parent->children[components.back()] = node;
+        } else if ((oflag & O_CREAT) && (oflag & O_EXCL)) {
+            err = EEXIST;
+            return -1;
+        } else if (node->is_dir && writable) {
+            err = EISDIR;
+            return -1;
+        }
+        const FileHandle handle = getNewHandle();
+
+        if (handle == -1) {
+            err = EMFILE;
+            return -1;
+        }
+
+        if ((oflag & O_TRUNC) && writable && !node->is_dir) {
+            truncateData(*node, 0);
+        }
+        std::unique_ptr<OpenFile> open_file(new OpenFile());
+        open_file->node = node;
+        open_file->position = 0;
+        open_file->readable = access_mode != O_WRONLY;
+        open_file->writable = writable;
+        open_file->append = (oflag & O_APPEND) != 0;
+        files_[handle] = std::move(open_file);
+        FATFS_DEBUG_PRINT("Created handle %d for file %s\n", handle, path);
+        return handle;
+    }
+
+
+    int TmpFsFileManager::open(const char* path, int oflag, int& err) {
+        FATFS_DEBUG_PRINT("Opening file: %s\n", path);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return openInternal(path, oflag, err);
+    }
+
+
+    FILE* TmpFsFileManager::fopen(const char* path, const char* mode, int& err) {
+        FATFS_DEBUG_PRINT("Fopen file: %s\n", path);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        if (mode == nullptr) {
+            err = EINVAL;
+            return nullptr;
+        }
+        const int oflag = convertModeFlag(mode);
+
+        if (oflag == -1) {
+            err = EINVAL;
+            return nullptr;
+        }
+        const FileHandle handle = openInternal(path, oflag, err);
+
+        if (handle == -1) {
+            return nullptr;
+        }
+        return reinterpret_cast<FILE*>(files_.at(handle).get());
+    }
+
+
+    off_t TmpFsFileManager::lseek(int fd, off_t offset, int whence) {
+        FATFS_DEBUG_PRINT("lseek fd %d, offset %ld, command %d\n", fd, offset, whence);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr) {
+            errno = EBADF;
+            return -1;
+        }
+        off_t position;
+
+        if (whence == SEEK_SET) {
+            position = offset;
+        } else if (whence == SEEK_CUR) {
+            position = (off_t)file->position + offset;
+        } else if (whence == SEEK_END) {
+            position = (off_t)file->node->size + offset;
+        } else {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (position < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        file->position = position;
+        return position;
+    }
+
+
+    ssize_t TmpFsFileManager::read(int fd, void* buf, size_t count) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr || !file->readable) {
+            errno = EBADF;
+            return -1;
+        }
+
+        if (file->node->is_dir) {
+            errno = EISDIR;
+            return -1;
+        }
+
+        if (buf == nullptr || count == 0) {
+            return 0;
+        }
+        const size_t read_bytes = readData(*file->node, file->position, buf, count);
+        file->position += read_bytes;
+        return read_bytes;
+    }
+
+
+    ssize_t TmpFsFileManager::pread(int fd, void* buf, size_t count, off_t offset) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr || !file->readable) {
+            errno = EBADF;
+            return -1;
+        }
+
+        if (file->node->is_dir) {
+            errno = EISDIR;
+            return -1;
+        }
+
+        if (offset < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (buf == nullptr || count == 0) {
+            return 0;
+        }
+        return readData(*file->node, offset, buf, count);
+    }
+
+
+    ssize_t TmpFsFileManager::write(int fd, const void* buf, size_t count) {
+        FATFS_DEBUG_PRINT("TmpFs write %d %lu\n", fd, count);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr || !file->writable) {
+            errno = EBADF;
+            return -1;
+        }
+
+        if (buf == nullptr || count == 0) {
+            return 0;
+        }
+
+        if (file->append) {
+            file->position = file->node->size;
+        }
+
+        if (file->position >= capacity_) {
+            errno = EFBIG;
+            return -1;
+        }
+        const size_t written_bytes = writeData(*file->node, file->position, buf, count);
+        file->position += written_bytes;
+
+        if (written_bytes == 0) {
+            errno = ENOSPC;
+            return -1;
+        }
+        return written_bytes;
+    }
+
+
+    ssize_t TmpFsFileManager::pwrite(int fd, const void* buf, size_t count, off_t offset) {
+        FATFS_DEBUG_PRINT("TmpFs pwrite %d %lu %lu \n", fd, count, offset);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr || !file->writable) {
+            errno = EBADF;
+            return -1;
+        }
+
+        if (offset < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (buf == nullptr || count == 0) {
+            return 0;
+        }
+
+        if ((uint64_t)offset >= capacity_) {
+            errno = EFBIG;
+            return -1;
+        }
+        const size_t written_bytes = writeData(*file->node, offset, buf, count);
+
+        if (written_bytes == 0) {
+            errno = ENOSPC;
+            return -1;
+        }
+        return written_bytes;
+    }
+
+
+    int TmpFsFileManager::close(int fd) {
+        FATFS_DEBUG_PRINT("Closing file handle %d\n", fd);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        //  As in FatFsFileManager, closing a handle which is not open is not an error
+        files_.erase(fd);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::dup2(int oldfd, int newfd) {
+        FATFS_DEBUG_PRINT("dup2 from fd %d to %d\n", oldfd, newfd);
+        //  See FatFsFileManager::dup2, the target descriptor is closed and the copy skipped
+        return close(newfd);
+    }
+
+
+    template <typename T>
+    static void fillStat(const bool is_dir, const uint64_t size, T* stat_buf) {
+        memset(stat_buf, 0, sizeof(T));
+        stat_buf->st_size = size;
+        stat_buf->st_mode = is_dir ? S_IFDIR : S_IFREG;
+    }
+
+
+    int TmpFsFileManager::statInternal(const char* path, struct stat64* stat_buf, int& err) {
+        std::vector<std::string> components;
+        const auto node = splitPath(path, components) ? lookup(components) : nullptr;
+
+        if (node == nullptr) {
+            err = ENOENT;
+            return -1;
+        }
+        fillStat(node->is_dir, node->size, stat_buf);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::fstat(int ver, int fd, struct stat64* stat_buf, int& err) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr) {
+            err = EBADF;
+            return -1;
+        }
+        fillStat(file->node->is_dir, file->node->size, stat_buf);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::stat(int ver, const char* path, struct stat64* stat_buf, int& err) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return statInternal(path, stat_buf, err);
+    }
+
+
+    int TmpFsFileManager::lstat64(const char* path, struct stat64* stat_buf, int& err) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return statInternal(path, stat_buf, err);
+    }
+
+
+    int TmpFsFileManager::lstat(const char* path, struct stat* stat_buf, int& err) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::vector<std::string> components;
+        const auto node = splitPath(path, components) ? lookup(components) : nullptr;
+
+        if (node == nullptr) {
+            err = ENOENT;
+            return -1;
+        }
+        fillStat(node->is_dir, node->size, stat_buf);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::mkdir(const char* path, mode_t mode) {
+        FATFS_DEBUG_PRINT("Mkdir %s with mode %d\n", path, mode);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::vector<std::string> components;
+
+        if (!splitPath(path, components)) {
+            return -1;
+        }
+
+        if (components.empty()) {
+            //  As in FatFsFileManager, creating the root directory succeeds
+            return 0;
+        }
+        int err = 0;
+        Node* parent = lookupParent(components, err);
+
+        if (parent == nullptr || parent->children.count(components.back()) != 0) {
+            FATFS_DEBUG_PRINT("Mkdir %s failed with error %d\n", path, err);
+            return -1;
+        }
+        parent->children[components.back()] = std::make_shared<Node>(true, &used_bytes_);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::access(const char* path, mode_t mode, int& err) {
+        FATFS_DEBUG_PRINT("Accessing path %s with mode %d\n", path, mode);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::vector<std::string> components;
+
+        //  We always give access to files or directories if they exist, no
+        //    specific user permissions needed.
+        if (!splitPath(path, components) || lookup(components) == nullptr) {
+            err = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::removeInternal(const char* path, const bool allow_file, const bool allow_dir, int& err) {
+        std::vector<std::string> components;
+
+        if (!splitPath(path, components)) {
+            err = ENOENT;
+            return -1;
+        }
+        Node* parent = lookupParent(components, err);
+
+        if (parent == nullptr) {
+            return -1;
+        }
+        const auto it = parent->children.find(components.back());
+
+        if (it == parent->children.end()) {
+            err = ENOENT;
+            return -1;
+        }
+        const Node& node = *it->second;
+
+        if (node.is_dir && !allow_dir) {
+            err = EISDIR;
+            return -1;
+        } else if (!node.is_dir && !allow_file) {
+            err = ENOTDIR;
+            return -1;
+        } else if (node.is_dir && !node.children.empty()) {
+            err = ENOTEMPTY;
+            return -1;
+        }
+        //  The content of a file is released with the last handle opened on it
+        parent->children.erase(it);
+        FATFS_DEBUG_PRINT("Path %s unlinked/removed successfully\n", path);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::unlink(const char* path, int& err) {
+        FATFS_DEBUG_PRINT("unlink path %s\n", path);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return removeInternal(path, true, false, err);
+    }
+
+
+    int TmpFsFileManager::rmdir(const char* path, int& err) {
+        FATFS_DEBUG_PRINT("rmdir path %s\n", path);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return removeInternal(path, false, true, err);
+    }
+
+
+    int TmpFsFileManager::remove(const char* path, int& err) {
+        FATFS_DEBUG_PRINT("remove path %s\n", path);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        return removeInternal(path, true, true, err);
+    }
+
+
+    int TmpFsFileManager::rename(const char* oldpath, const char* newpath, int& err) {
+        FATFS_DEBUG_PRINT("Renaming from %s to %s\n", oldpath, newpath);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::vector<std::string> old_components;
+        std::vector<std::string> new_components;
+
+        if (!splitPath(oldpath, old_components) || !splitPath(newpath, new_components)) {
+            err = ENOENT;
+            return -1;
+        }
+        Node* old_parent = lookupParent(old_components, err);
+        Node* new_parent = old_parent == nullptr ? nullptr : lookupParent(new_components, err);
+
+        if (new_parent == nullptr) {
+            return -1;
+        }
+        const auto old_it = old_parent->children.find(old_components.back());
+
+        if (old_it == old_parent->children.end()) {
+            err = ENOENT;
+            return -1;
+        }
+        const std::shared_ptr<Node> node = old_it->second;
+
+        if (node->is_dir && new_components.size() > old_components.size() &&
+            std::equal(old_components.begin(), old_components.end(), new_components.begin())) {
+            //  A directory cannot be moved inside itself
+            err = EINVAL;
+            return -1;
+        }
+        const auto new_it = new_parent->children.find(new_components.back());
+
+        if (new_it != new_parent->children.end()) {
+            const Node& target = *new_it->second;
+
+            if (new_it->second == node) {
+                return 0;
+            } else if (node->is_dir && !target.is_dir) {
+                err = ENOTDIR;
+                return -1;
+            } else if (!node->is_dir && target.is_dir) {
+                err = EISDIR;
+                return -1;
+            } else if (target.is_dir && !target.children.empty()) {
+                err = ENOTEMPTY;
+                return -1;
+            }
+        }
+        old_parent->children.erase(old_it);
+        new_parent->children[new_components.back()] = node;
+        return 0;
+    }
+
+
+    void* TmpFsFileManager::opendir(const char* path, int& err) {
+        FATFS_DEBUG_PRINT("Opening dir: %s\n", path);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::vector<std::string> components;
+        const auto node = splitPath(path, components) ? lookup(components) : nullptr;
+
+        if (node == nullptr) {
+            err = ENOENT;
+            return nullptr;
+        }
+
+        if (!node->is_dir) {
+            err = ENOTDIR;
+            return nullptr;
+        }
+        //  The entries are listed when the directory is opened, so that the stream
+        //    is not affected by the files created or removed while reading it
+        std::unique_ptr<DirStream> dir(new DirStream());
+        dir->next = 0;
+        dir->entries.reserve(node->children.size());
+
+        for (const auto& child : node->children) {
+            dir->entries.emplace_back(child.first, child.second->is_dir);
+        }
+        void* dir_ptr = dir.get();
+        dirs_[dir_ptr] = std::move(dir);
+        return dir_ptr;
+    }
+
+
+    struct dirent64* TmpFsFileManager::readdir64(void* dirp, int& err) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        const auto it = dirs_.find(dirp);
+
+        if (it == dirs_.end()) {
+            err = EBADF;
+            return nullptr;
+        }
+        DirStream& dir = *it->second;
+
+        if (dir.next == dir.entries.size()) {
+            //  End of the directory, this is not an error as per "readdir" man page
+            return nullptr;
+        }
+        const auto& entry = dir.entries[dir.next++];
+        memset(&dir.entry64, 0, sizeof(struct dirent64));
+        dir.entry64.d_reclen = entry.first.length();
+        dir.entry64.d_type = entry.second ? DT_DIR : DT_REG;
+        strncpy(dir.entry64.d_name, entry.first.c_str(), sizeof(dir.entry64.d_name) - 1);
+        return &dir.entry64;
+    }
+
+
+    struct dirent* TmpFsFileManager::readdir(void* dirp, int& err) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        const auto it = dirs_.find(dirp);
+
+        if (it == dirs_.end()) {
+            err = EBADF;
+            return nullptr;
+        }
+        DirStream& dir = *it->second;
+
+        if (dir.next == dir.entries.size()) {
+            //  End of the directory, this is not an error as per "readdir" man page
+            return nullptr;
+        }
+        const auto& entry = dir.entries[dir.next++];
+        memset(&dir.entry, 0, sizeof(struct dirent));
+        dir.entry.d_reclen = entry.first.length();
+        dir.entry.d_type = entry.second ? DT_DIR : DT_REG;
+        strncpy(dir.entry.d_name, entry.first.c_str(), sizeof(dir.entry.d_name) - 1);
+        return &dir.entry;
+    }
+
+
+    int TmpFsFileManager::closedir(void* dirp, int& err) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        if (dirs_.erase(dirp) == 0) {
+            err = EBADF;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::ftruncate(int fd, off_t length, int& err) {
+        FATFS_DEBUG_PRINT("ftruncate (fd: %d, offs: %lu\n", fd, length);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr) {
+            err = EBADF;
+            return -1;
+        }
+
+        if (!file->writable || file->node->is_dir || length < 0) {
+            err = EINVAL;
+            return -1;
+        }
+
+        if ((uint64_t)length > capacity_) {
+            err = EFBIG;
+            return -1;
+        }
+        truncateData(*file->node, length);
+        return 0;
+    }
+
+
+    int TmpFsFileManager::fsync(int fd, int& err) {
+        FATFS_DEBUG_PRINT("fsync fd %d\n", fd);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        //  Nothing to flush, the data is already in the Enclave memory
+        if (getOpenFile(fd) == nullptr) {
+            err = EBADF;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::fallocate(int fd, int mode, off_t offset, off_t len, int& err) {
+        FATFS_DEBUG_PRINT("fallocate fd %d, mode %d, offset %ld, len %ld\n", fd, mode, offset, len);
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        OpenFile* file = getOpenFile(fd);
+
+        if (file == nullptr || !file->writable) {
+            err = EBADF;
+            return -1;
+        }
+
+        if (offset < 0 || len <= 0) {
+            err = EINVAL;
+            return -1;
+        }
+
+        //  Only the default mode (allocate and extend the file) and FALLOC_FL_KEEP_SIZE are supported
+        if ((mode & ~FALLOC_FL_KEEP_SIZE) != 0) {
+            err = EOPNOTSUPP;
+            return -1;
+        }
+        const uint64_t end = (uint64_t)offset + (uint64_t)len;
+        uint64_t position = offset;
+
+        if (end > capacity_) {
+            err = EFBIG;
+            return -1;
+        }
+
+        while (position < end) {
+            size_t index;
+            uint64_t start, size;
+            locateExtent(position, index, start, size);
+
+            if (!allocateExtent(*file->node, index, size)) {
+                err = ENOSPC;
+                return -1;
+            }
+            position = start + size;
+        }
+
+        if (!(mode & FALLOC_FL_KEEP_SIZE) && end > file->node->size) {
+            file->node->size = end;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::fchown(int fd, uid_t owner, gid_t group, int& err) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        //  As in FatFsFileManager, there is a single user: if the file is open we always succeed
+        if (getOpenFile(fd) == nullptr) {
+            err = EBADF;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::fchmod(int fd, mode_t mode, int& err) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        //  As in FatFsFileManager, there is a single user: if the file is open we always succeed
+        if (getOpenFile(fd) == nullptr) {
+            err = EBADF;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::utimes(const char* path, const struct timeval times[2], int& err) {
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        std::vector<std::string> components;
+
+        //  Times are not recorded, we just check that the file exists
+        if (!splitPath(path, components) || lookup(components) == nullptr) {
+            err = ENOENT;
+            return -1;
+        }
+        return 0;
+    }
+
+
+    int TmpFsFileManager::statvfs(struct statvfs64* buf, int& err) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+
+        const unsigned long max_files = last_handle_ - first_handle_;
+        const unsigned long open_files = files_.size();
+        const uint64_t free_bytes = capacity_ > used_bytes_ ? capacity_ - used_bytes_ : 0;
+
+        memset(buf, 0, sizeof(struct statvfs64));
+        buf->f_bsize = kPageSize;
+        buf->f_frsize = kPageSize;
+        buf->f_blocks = capacity_ / kPageSize;
+        buf->f_bfree = free_bytes / kPageSize;
+        buf->f_bavail = buf->f_bfree;
+        //  The only limit on the number of files is the number of handles that we can give out
+        buf->f_files = max_files;
+        buf->f_ffree = max_files > open_files ? max_files - open_files : 0;
+        buf->f_favail = buf->f_ffree;
+        buf->f_fsid = drive_id_;
+        buf->f_namemax = kMaxNameLength;
+        return 0;
+    }
+
+
+    void TmpFsFileManager::snapshotNode(const Node& node, const std::string& path, std::vector<uint8_t>& out) {
+        if (!path.empty()) {
+            const uint8_t type = node.is_dir ? kRecordDir : kRecordFile;
+            //  The depth of the tree is not limited, so neither is the length of a path
+            const uint32_t path_length = path.length();
+            appendBytes(out, &type, sizeof(type));
+            appendBytes(out, &path_length, sizeof(path_length));
+            appendBytes(out, path.data(), path_length);
+        }
+
+        if (node.is_dir) {
+            for (const auto& child : node.children) {
+                snapshotNode(*child.second, path.empty() ? child.first : path + "/" + child.first, out);
+            }
+            return;
+        }
+        //  Only the bytes up to the end of the file are saved, the extents allocated
+        //    past it by fallocate are not
+        std::vector<uint32_t> indexes;
+
+        for (size_t i = 0; i < node.extents.size(); i++) {
+            if (node.extents[i] != nullptr && extentStart(i) < node.size) {
+                indexes.push_back(i);
+            }
+        }
+        const uint32_t num_extents = indexes.size();
+        appendBytes(out, &node.size, sizeof(node.size));
+        appendBytes(out, &num_extents, sizeof(num_extents));
+
+        for (const uint32_t index : indexes) {
+            const uint64_t start = extentStart(index);
+            appendBytes(out, &index, sizeof(index));
+            appendBytes(out, node.extents[index], std::min(extentSize(index), node.size - start));
+        }
+    }
+
+
+    void TmpFsFileManager::snapshot(std::vector<uint8_t>& out) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        out.clear();
+        out.reserve(used_bytes_ + kPageSize);
+        appendBytes(out, &kSnapshotMagic, sizeof(kSnapshotMagic));
+        appendBytes(out, &kSnapshotVersion, sizeof(kSnapshotVersion));
+        snapshotNode(*root_, "", out);
+        appendBytes(out, &kRecordEnd, sizeof(kRecordEnd));
+        FATFS_DEBUG_PRINT("Snapshot of %lu bytes\n", out.size());
+    }
+
+
+    bool TmpFsFileManager::restoreFile(const std::string& path, const uint8_t*& data, const uint8_t* end) {
+        uint64_t size;
+        uint32_t num_extents;
+
+        if (!takeBytes(data, end, &size, sizeof(size)) ||
+            !takeBytes(data, end, &num_extents, sizeof(num_extents))) {
+            return false;
+        }
+        std::vector<std::string> components;
+        int err = 0;
+        Node* parent = splitPath(path.c_str(), components) ? lookupParent(components, err) : nullptr;
+
+        if (parent == nullptr || size > capacity_) {
+            return false;
+        }
+        const auto it = parent->children.find(components.back());
+
+        if (it != parent->children.end() && it->second->is_dir) {
+            return false;
+        }
+        //  An existing file is replaced, the handles still open on it keep the old content
+        auto node = std::make_shared<Node>(false, &used_bytes_);
+        node->size = size;
+
+        for (uint32_t i = 0; i < num_extents; i++) {
+            uint32_t index;
+
+            if (!takeBytes(data, end, &index, sizeof(index)) || extentStart(index) >= size) {
+                return false;
+            }
+            const uint64_t extent_size = extentSize(index);
+
+            if (!allocateExtent(*node, index, extent_size) ||
+                !takeBytes(data, end, node->extents[index], std::min(extent_size, size - extentStart(index)))) {
+                return false;
+            }
+        }
+        parent->children[components.back()] = node;
+        return true;
+    }
+
+
+    bool TmpFsFileManager::restore(const uint8_t* data, const size_t size) {
+        DEBUG_PRINT_FUNCTION;
+        std::lock_guard<std::mutex> lock(file_mutex_);
+        const uint8_t* end = data + size;
+        uint32_t magic, version;
+
+        if (!takeBytes(data, end, &magic, sizeof(magic)) ||
+            !takeBytes(data, end, &version, sizeof(version)) ||
+            magic != kSnapshotMagic || (version != kSnapshotVersion && version != kSnapshotVersionShortPaths)) {
+            FATFS_DEBUG_PRINT("Invalid snapshot header %u %u\n", magic, version);
+            return false;
+        }
+        uint8_t type = 0;
+
+        while (takeBytes(data, end, &type, sizeof(type)) && type != kRecordEnd) {
+            uint32_t path_length = 0;
+            uint16_t short_path_length = 0;
+            const bool has_length = (version == kSnapshotVersionShortPaths) ?
+                takeBytes(data, end, &short_path_length, sizeof(short_path_length)) :
+                takeBytes(data, end, &path_length, sizeof(path_length));
+
+            if (version == kSnapshotVersionShortPaths) {
+                path_length = short_path_length;
+            }
+
+            if (!has_length || (size_t)(end - data) < path_length) {
+                return false;
+            }
+            const std::string path(reinterpret_cast<const char*>(data), path_length);
+            data += path_length;
+
+            if (type == kRecordFile) {
+                if (!restoreFile(path, data, end)) {
+                    FATFS_DEBUG_PRINT("Could not restore file %s\n", path.c_str());
+                    return false;
+                }
+            } else if (type == kRecordDir) {
+                std::vector<std::string> components;
+                int err = 0;
+                Node* parent = splitPath(path.c_str(), components) ? lookupParent(components, err) : nullptr;
+
+                if (parent == nullptr) {
+                    return false;
+                }
+                auto& child = parent->children[components.back()];
+
+                if (child == nullptr) {
+                    child = std::make_shared<Node>(true, &used_bytes_);
+                } else if (!child->is_dir) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+        return type == kRecordEnd && data == end;
+    }
+};
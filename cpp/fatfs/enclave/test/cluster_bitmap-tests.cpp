@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Include the modules under test, FatFs runs on the memory disk below.
+#include <ff.cpp>
+#include <ffunicode.cpp>
+#include <ffsystem.cpp>
+#include <dir_index.cpp>
+#include <cluster_bitmap.cpp>
+
+using namespace std;
+using namespace conclave;
+
+static const UINT kSectorSize = 512;
+static vector<BYTE> disk;
+
+DSTATUS disk_status(BYTE) {
+    return 0;
+}
+
+DSTATUS disk_initialize(BYTE) {
+    return 0;
+}
+
+DRESULT disk_read(BYTE, BYTE* buf, LBA_t sector, UINT num) {
+    memcpy(buf, &disk[sector * kSectorSize], num * kSectorSize);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE, const BYTE* buf, LBA_t sector, UINT num) {
+    memcpy(&disk[sector * kSectorSize], buf, num * kSectorSize);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE, BYTE cmd, void* buf) {
+    switch (cmd) {
+    case GET_SECTOR_COUNT:
+        *(LBA_t*)buf = disk.size() / kSectorSize;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD*)buf = kSectorSize;
+        return RES_OK;
+    case CTRL_SYNC:
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void) {
+    return 0;
+}
+
+struct Volume {
+    BYTE format;
+    size_t size;
+    BYTE fs_type;
+};
+
+class free_cluster_bitmap : public testing::TestWithParam<Volume> {
+protected:
+    FATFS fs;
+
+    void SetUp() override {
+        disk.assign(GetParam().size, 0);
+        vector<BYTE> work(FF_MAX_SS);
+        MKFS_PARM parameters = {GetParam().format, 0, 0, 0, kSectorSize};
+        ASSERT_EQ(f_mkfs("0:", &parameters, work.data(), work.size()), FR_OK);
+        mount();
+        ASSERT_EQ(fs.fs_type, GetParam().fs_type);
+    }
+
+    void TearDown() override {
+        f_mount(nullptr, "0:", 0);
+    }
+
+    void mount() {
+        ASSERT_EQ(f_mount(&fs, "0:", 1), FR_OK);
+    }
+
+    FatFsClusterBitmap* bitmap() {
+        return static_cast<FatFsClusterBitmap*>(fs.clbitmap);
+    }
+
+    //  Checks the bitmap against the FAT, read one entry at a time.
+    void expectMatchesFat() {
+        ASSERT_NE(bitmap(), nullptr);
+        FFOBJID obj;
+        obj.fs = &fs;
+        DWORD free = 0;
+        for (DWORD clst = 2; clst < fs.n_fatent; clst++) {
+            const DWORD stat = get_fat(&obj, clst);
+            ASSERT_NE(stat, 1u);
+            ASSERT_NE(stat, 0xFFFFFFFFu);
+            ASSERT_EQ(bitmap()->isFree(clst), stat == 0) << clst;
+            if (stat == 0) free++;
+        }
+        EXPECT_EQ(bitmap()->freeCount(), free);
+        EXPECT_EQ(fs.free_clst, free);
+    }
+
+    static void write(const string& path, size_t size, BYTE fill) {
+        FIL file;
+        ASSERT_EQ(f_open(&file, path.c_str(), FA_CREATE_ALWAYS | FA_WRITE), FR_OK) << path;
+        vector<BYTE> data(size, fill);
+        UINT written;
+        ASSERT_EQ(f_write(&file, data.data(), data.size(), &written), FR_OK) << path;
+        ASSERT_EQ(written, data.size());
+        ASSERT_EQ(f_close(&file), FR_OK);
+    }
+
+    static void expectContent(const string& path, size_t size, BYTE fill) {
+        FIL file;
+        ASSERT_EQ(f_open(&file, path.c_str(), FA_READ), FR_OK) << path;
+        vector<BYTE> data(size + 1);
+        UINT read;
+        ASSERT_EQ(f_read(&file, data.data(), data.size(), &read), FR_OK) << path;
+        ASSERT_EQ(read, size) << path;
+        data.resize(size);
+        EXPECT_EQ(data, vector<BYTE>(size, fill)) << path;
+        f_close(&file);
+    }
+};
+
+TEST_P(free_cluster_bitmap, is_not_built_by_the_mount) {
+    write("a.bin", 20000, 1);
+    mount();
+    EXPECT_EQ(bitmap(), nullptr);
+
+    expectContent("a.bin", 20000, 1);
+    EXPECT_EQ(bitmap(), nullptr);
+}
+
+TEST_P(free_cluster_bitmap, is_built_by_the_first_allocation) {
+    write("a.bin", 20000, 1);
+    write("b.bin", 3000, 2);
+    mount();
+
+    write("c.bin", 7000, 3);
+    expectMatchesFat();
+    expectContent("a.bin", 20000, 1);
+    expectContent("b.bin", 3000, 2);
+    expectContent("c.bin", 7000, 3);
+}
+
+TEST_P(free_cluster_bitmap, is_built_by_a_free_space_query) {
+    write("a.bin", 20000, 1);
+    mount();
+    fs.free_clst = 0xFFFFFFFF;  // As if the FSInfo sector was missing
+
+    DWORD free;
+    FATFS* volume;
+    ASSERT_EQ(f_getfree("0:", &free, &volume), FR_OK);
+    expectMatchesFat();
+    EXPECT_EQ(free, fs.free_clst);
+}
+
+TEST_P(free_cluster_bitmap, sees_the_fat_changes_made_before_it_is_built) {
+    write("a.bin", 20000, 1);
+    write("b.bin", 30000, 2);
+    mount();
+
+    ASSERT_EQ(f_unlink("a.bin"), FR_OK);
+    EXPECT_EQ(bitmap(), nullptr);
+    write("c.bin", 40000, 3);
+    expectMatchesFat();
+    expectContent("b.bin", 30000, 2);
+    expectContent("c.bin", 40000, 3);
+}
+
+TEST_P(free_cluster_bitmap, corrects_a_wrong_free_cluster_count) {
+    write("a.bin", 20000, 1);
+    mount();
+    fs.free_clst = 1;
+
+    write("b.bin", 1000, 2);
+    expectMatchesFat();
+}
+
+TEST_P(free_cluster_bitmap, is_built_again_after_a_remount) {
+    write("a.bin", 20000, 1);
+    write("b.bin", 5000, 2);
+    expectMatchesFat();
+    mount();
+    EXPECT_EQ(bitmap(), nullptr);
+
+    ASSERT_EQ(f_unlink("b.bin"), FR_OK);
+    write("c.bin", 9000, 3);
+    expectMatchesFat();
+}
+
+INSTANTIATE_TEST_SUITE_P(
+        volumes,
+        free_cluster_bitmap,
+        testing::Values(
+                Volume{FM_FAT, 1024 * 1024, FS_FAT12},
+                Volume{FM_FAT, 16 * 1024 * 1024, FS_FAT16},
+                Volume{FM_FAT32, 48 * 1024 * 1024, FS_FAT32}),
+        [](const testing::TestParamInfo<Volume>& info) {
+            switch (info.param.fs_type) {
+            case FS_FAT12: return "fat12";
+            case FS_FAT16: return "fat16";
+            default: return "fat32";
+            }
+        });
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,293 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Include the modules under test, FatFs runs on the memory disk below.
+#include <ff.cpp>
+#include <ffunicode.cpp>
+#include <ffsystem.cpp>
+#include <dir_index.cpp>
+#include <cluster_bitmap.cpp>
+
+using namespace std;
+using namespace conclave;
+
+static const UINT kSectorSize = 512;
+static vector<BYTE> disk;
+
+DSTATUS disk_status(BYTE) {
+    return 0;
+}
+
+DSTATUS disk_initialize(BYTE) {
+    return 0;
+}
+
+DRESULT disk_read(BYTE, BYTE* buf, LBA_t sector, UINT num) {
+    memcpy(buf, &disk[sector * kSectorSize], num * kSectorSize);
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE, const BYTE* buf, LBA_t sector, UINT num) {
+    memcpy(&disk[sector * kSectorSize], buf, num * kSectorSize);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE, BYTE cmd, void* buf) {
+    switch (cmd) {
+    case GET_SECTOR_COUNT:
+        *(LBA_t*)buf = disk.size() / kSectorSize;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD*)buf = kSectorSize;
+        return RES_OK;
+    case CTRL_SYNC:
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void) {
+    return 0;
+}
+
+class dir_index : public testing::Test {
+protected:
+    FATFS fs;
+
+    void SetUp() override {
+        disk.assign(16 * 1024 * 1024, 0);
+        vector<BYTE> work(FF_MAX_SS);
+        MKFS_PARM parameters = {FM_ANY, 0, 0, 0, 0};
+        ASSERT_EQ(f_mkfs("0:", &parameters, work.data(), work.size()), FR_OK);
+        ASSERT_EQ(f_mount(&fs, "0:", 1), FR_OK);
+    }
+
+    void TearDown() override {
+        f_mount(nullptr, "0:", 0);
+    }
+
+    FatFsDirIndex* index() {
+        return static_cast<FatFsDirIndex*>(fs.dirindex);
+    }
+
+    static void create(const string& path) {
+        FIL file;
+        ASSERT_EQ(f_open(&file, path.c_str(), FA_CREATE_NEW | FA_WRITE), FR_OK) << path;
+        ASSERT_EQ(f_close(&file), FR_OK);
+    }
+
+    static DWORD startCluster(const string& path) {
+        DIR dir;
+        EXPECT_EQ(f_opendir(&dir, path.c_str()), FR_OK);
+        const DWORD sclust = dir.obj.sclust;
+        f_closedir(&dir);
+        return sclust;
+    }
+
+    //  Looks up the path with the index and with a scan of the directory table, which
+    //    must agree, and returns the short name of the entry which was found.
+    string lookup(const string& dir_path, const string& name, FRESULT expected = FR_OK) {
+        const string path = dir_path + "/" + name;
+        FILINFO indexed;
+        EXPECT_EQ(f_stat(path.c_str(), &indexed), expected) << path;
+        EXPECT_TRUE(index()->isIndexed(startCluster(dir_path))) << path;
+
+        index()->skipDirectory(startCluster(dir_path));
+        FILINFO scanned;
+        EXPECT_EQ(f_stat(path.c_str(), &scanned), expected) << path;
+        index()->dropDirectory(startCluster(dir_path));
+
+        if (expected != FR_OK) {
+            return "";
+        }
+        EXPECT_STREQ(indexed.fname, scanned.fname) << path;
+        EXPECT_STREQ(indexed.altname, scanned.altname) << path;
+        return indexed.altname;
+    }
+};
+
+TEST_F(dir_index, lookup) {
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+
+    for (int i = 0; i < 1000; i++) {
+        create("0:/d/record_" + to_string(i) + ".json");
+    }
+    EXPECT_EQ(lookup("0:/d", "record_17.json"), lookup("0:/d", "RECORD_17.JSON"));
+    EXPECT_NE(lookup("0:/d", "record_999.json"), lookup("0:/d", "record_998.json"));
+    lookup("0:/d", "record_1000.json", FR_NO_FILE);
+    EXPECT_GT(index()->usedBytes(), 0u);
+}
+
+TEST_F(dir_index, create) {
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+    create("0:/d/first.txt");
+    lookup("0:/d", "second.txt", FR_NO_FILE);
+
+    //  The directory is indexed now, new entries are added to its index
+    FILINFO info;
+    ASSERT_EQ(f_stat("0:/d/first.txt", &info), FR_OK);
+    create("0:/d/second.txt");
+    EXPECT_EQ(lookup("0:/d", "second.txt"), "SECOND.TXT");
+
+    FIL file;
+    ASSERT_EQ(f_stat("0:/d/first.txt", &info), FR_OK);
+    EXPECT_EQ(f_open(&file, "0:/d/FIRST.TXT", FA_CREATE_NEW | FA_WRITE), FR_EXIST);
+}
+
+TEST_F(dir_index, unlink) {
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+
+    for (int i = 0; i < 100; i++) {
+        create("0:/d/file_" + to_string(i));
+    }
+    FILINFO info;
+    ASSERT_EQ(f_stat("0:/d/file_0", &info), FR_OK);
+    const size_t used_bytes = index()->usedBytes();
+
+    ASSERT_EQ(f_unlink("0:/d/file_50"), FR_OK);
+    EXPECT_LT(index()->usedBytes(), used_bytes);
+    lookup("0:/d", "file_50", FR_NO_FILE);
+    EXPECT_EQ(lookup("0:/d", "file_51"), "FILE_51");
+
+    ASSERT_EQ(f_stat("0:/d/file_0", &info), FR_OK);
+    create("0:/d/file_50");
+    EXPECT_EQ(lookup("0:/d", "file_50"), "FILE_50");
+}
+
+TEST_F(dir_index, rename) {
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+    ASSERT_EQ(f_mkdir("0:/e"), FR_OK);
+
+    for (int i = 0; i < 100; i++) {
+        create("0:/d/file_" + to_string(i) + ".txt");
+    }
+    FILINFO info;
+    ASSERT_EQ(f_stat("0:/d/file_0.txt", &info), FR_OK);
+    ASSERT_EQ(f_stat("0:/e/none", &info), FR_NO_FILE);
+
+    ASSERT_EQ(f_rename("0:/d/file_5.txt", "0:/d/moved.txt"), FR_OK);
+    lookup("0:/d", "file_5.txt", FR_NO_FILE);
+    EXPECT_EQ(lookup("0:/d", "moved.txt"), "MOVED.TXT");
+
+    //  Only the case changes, the entry is replaced by a new one
+    ASSERT_EQ(f_stat("0:/d/moved.txt", &info), FR_OK);
+    ASSERT_EQ(f_rename("0:/d/moved.txt", "0:/d/MOVED.txt"), FR_OK);
+    EXPECT_EQ(lookup("0:/d", "moved.txt"), "MOVED.TXT");
+
+    //  Across directories
+    ASSERT_EQ(f_stat("0:/d/file_6.txt", &info), FR_OK);
+    ASSERT_EQ(f_rename("0:/d/file_6.txt", "0:/e/file_6.txt"), FR_OK);
+    lookup("0:/d", "file_6.txt", FR_NO_FILE);
+    EXPECT_EQ(lookup("0:/e", "file_6.txt"), "FILE_6.TXT");
+}
+
+TEST_F(dir_index, mkdir) {
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+    ASSERT_EQ(f_mkdir("0:/d/sub"), FR_OK);
+    create("0:/d/sub/x");
+    EXPECT_EQ(lookup("0:/d/sub", "x"), "X");
+    EXPECT_EQ(lookup("0:/d", "sub"), "SUB");
+
+    //  The index of a removed directory must not be used for a new one
+    FILINFO info;
+    ASSERT_EQ(f_stat("0:/d/sub/x", &info), FR_OK);
+    ASSERT_EQ(f_unlink("0:/d/sub/x"), FR_OK);
+    ASSERT_EQ(f_unlink("0:/d/sub"), FR_OK);
+    ASSERT_EQ(f_mkdir("0:/d/sub2"), FR_OK);
+    lookup("0:/d/sub2", "x", FR_NO_FILE);
+    lookup("0:/d", "sub", FR_NO_FILE);
+}
+
+TEST_F(dir_index, lfn_and_sfn) {
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+    //  A long name and its generated short name
+    create("0:/d/longfilename.txt");
+    //  A 8.3 name in lower case, which is only stored as a short name
+    create("0:/d/b.txt");
+    //  A 8.3 name in mixed case, which gets a long name too
+    create("0:/d/Mixed.Txt");
+
+    //  The long name is matched first, then the short name
+    EXPECT_EQ(lookup("0:/d", "longfilename.txt"), "LONGFI~1.TXT");
+    EXPECT_EQ(lookup("0:/d", "LONGFILENAME.TXT"), "LONGFI~1.TXT");
+    EXPECT_EQ(lookup("0:/d", "LONGFI~1.TXT"), "LONGFI~1.TXT");
+    EXPECT_EQ(lookup("0:/d", "longfi~1.txt"), "LONGFI~1.TXT");
+    EXPECT_EQ(lookup("0:/d", "B.TXT"), "B.TXT");
+    EXPECT_EQ(lookup("0:/d", "mixed.txt"), "MIXED.TXT");
+    lookup("0:/d", "LONGFI~2.TXT", FR_NO_FILE);
+
+    //  The short name of a new long name must not collide with the existing one
+    create("0:/d/longfilename.json");
+    EXPECT_EQ(lookup("0:/d", "LONGFI~1.TXT"), "LONGFI~1.TXT");
+    EXPECT_EQ(lookup("0:/d", "longfilename.json"), "LONGFI~1.JSO");
+
+    FILINFO info;
+    ASSERT_EQ(f_stat("0:/d/B.TXT", &info), FR_OK);
+    EXPECT_STREQ(info.fname, "b.txt");
+}
+
+TEST_F(dir_index, directories_over_the_budget_are_scanned) {
+    delete index();
+    fs.dirindex = new FatFsDirIndex(4096);
+    ASSERT_EQ(f_mkdir("0:/d"), FR_OK);
+
+    for (int i = 0; i < 100; i++) {
+        create("0:/d/record_" + to_string(i) + ".json");
+    }
+    FILINFO info;
+    EXPECT_EQ(f_stat("0:/d/record_42.json", &info), FR_OK);
+    EXPECT_STREQ(info.fname, "record_42.json");
+    EXPECT_EQ(f_stat("0:/d/record_100.json", &info), FR_NO_FILE);
+    EXPECT_FALSE(index()->isIndexed(startCluster("0:/d")));
+    EXPECT_TRUE(index()->isSkipped(startCluster("0:/d")));
+    EXPECT_LE(index()->usedBytes(), 4096u);
+}
+
+TEST(dir_index_budget, entries_are_accounted) {
+    FatFsDirIndex index(8192);
+    index.beginDirectory(2);
+    BYTE sfn[11];
+    WCHAR lfn[32];
+    size_t inserted = 0;
+
+    for (;; inserted++) {
+        const string name = "NAME" + to_string(inserted);
+        memset(sfn, ' ', sizeof(sfn));
+        memcpy(sfn, name.data(), name.size());
+
+        for (size_t i = 0; i <= name.size(); i++) {
+            lfn[i] = (WCHAR)name.c_str()[i];
+        }
+
+        if (!index.insert(2, sfn, lfn, inserted * 32, 0xFFFFFFFF)) {
+            break;
+        }
+        EXPECT_LE(index.usedBytes(), 8192u);
+    }
+    EXPECT_GT(inserted, 0u);
+
+    index.erase(2, 0);
+    EXPECT_EQ(index.findSfn(2, (const BYTE*)"NAME0      "), nullptr);
+    EXPECT_NE(index.findSfn(2, (const BYTE*)"NAME1      "), nullptr);
+
+    index.dropDirectory(2);
+    EXPECT_EQ(index.usedBytes(), 0u);
+}
+
+TEST(dir_index_budget, names_which_only_differ_by_case_are_rejected) {
+    FatFsDirIndex index(8192);
+    index.beginDirectory(2);
+    const WCHAR lower[] = {'a', 'b', 'c', 0};
+    const WCHAR upper[] = {'A', 'B', 'C', 0};
+
+    EXPECT_TRUE(index.insert(2, (const BYTE*)"ABC~1      ", lower, 32, 0));
+    EXPECT_FALSE(index.insert(2, (const BYTE*)"ABC~2      ", upper, 96, 64));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
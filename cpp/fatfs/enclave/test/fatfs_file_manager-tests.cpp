@@ -0,0 +1,413 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define UNIT_TEST
+
+// Include the modules under test, the file manager runs FatFs on an in-memory disk
+#include <ff.cpp>
+#include <ffunicode.cpp>
+#include <ffsystem.cpp>
+#include <dir_index.cpp>
+#include <cluster_bitmap.cpp>
+#include <diskio.cpp>
+#include <disk.cpp>
+#include <inmemory_disk.cpp>
+#include <fatfs_file_manager.cpp>
+
+using namespace std;
+using namespace conclave;
+
+static const unsigned long kDiskSize = 8 * 1024 * 1024;
+
+class fatfs_file_manager : public ::testing::Test {
+protected:
+    shared_ptr<InMemoryDisk> disk;
+    unique_ptr<FatFsFileManager> manager;
+
+    void SetUp() override {
+        format(FILE_WRITE_BUFFER_SIZE);
+    }
+
+    void format(size_t write_buffer_size) {
+        manager.reset();
+        disk = make_shared<InMemoryDisk>(0, kDiskSize);
+        manager.reset(new FatFsFileManager(3, 100, nullptr, "/", disk, write_buffer_size));
+        ASSERT_EQ(FatFsResult::OK, manager->init(FORMAT));
+    }
+
+    void TearDown() override {
+        manager.reset();
+    }
+
+    int open(const char* path, int flags) {
+        int err = 0;
+        const int fd = manager->open(path, flags, err);
+        EXPECT_GE(fd, 0);
+        return fd;
+    }
+
+    FIL* file(int fd) {
+        return reinterpret_cast<FIL*>(manager->fdopen(fd, "r"));
+    }
+
+    DWORD freeClusters() {
+        DWORD clusters = 0;
+        FATFS* fs = nullptr;
+        EXPECT_EQ(FR_OK, f_getfree("0:", &clusters, &fs));
+        return clusters;
+    }
+
+    DWORD clusterSize() {
+        return (DWORD)disk->getFileSystem()->csize * SS(disk->getFileSystem().get());
+    }
+
+    //  Number of clusters in the chain of the file, zero if the chain is not contiguous
+    DWORD contiguousClusters(int fd) {
+        FIL* fil = file(fd);
+        DWORD count = 0;
+
+        for (DWORD clst = fil->obj.sclust; clst != 0; ) {
+            const DWORD next = get_fat(&fil->obj, clst);
+            count++;
+
+            if (next >= fil->obj.fs->n_fatent) {
+                break;
+            }
+            if (next != clst + 1) {
+                return 0;
+            }
+            clst = next;
+        }
+        return count;
+    }
+
+    off_t fileSize(int fd) {
+        return f_size(file(fd));
+    }
+
+    off_t pathSize(const char* path) {
+        struct stat64 st;
+        int err = 0;
+        EXPECT_EQ(0, manager->stat(0, path, &st, err));
+        return st.st_size;
+    }
+};
+
+TEST_F(fatfs_file_manager, fallocate_allocates_a_contiguous_chain) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const off_t len = 1024 * 1024;
+    int err = 0;
+
+    //  Fragment the free space with a small file first
+    const int other = open("/other", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+    EXPECT_EQ(data.size(), manager->write(other, data.data(), data.size()));
+    EXPECT_EQ(0, manager->close(other));
+
+    EXPECT_EQ(0, manager->fallocate(fd, 0, 0, len, err));
+    EXPECT_EQ(len / clusterSize(), contiguousClusters(fd));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, fallocate_extends_the_file_with_zeros) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(10, 'x');
+    int err = 0;
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->fallocate(fd, 0, 0, 100000, err));
+    EXPECT_EQ(100000, fileSize(fd));
+
+    //  The file pointer has not moved, the original content is followed by zeros
+    vector<char> read_back(100000, 'y');
+    EXPECT_EQ(0, manager->lseek(fd, 0, SEEK_SET));
+    EXPECT_EQ(read_back.size(), manager->read(fd, read_back.data(), read_back.size()));
+    EXPECT_EQ(0, memcmp(read_back.data(), data.data(), data.size()));
+    EXPECT_EQ(read_back.size() - data.size(), count(read_back.begin() + data.size(), read_back.end(), 0));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, fallocate_keep_size_only_reserves_the_clusters) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const DWORD free_before = freeClusters();
+    int err = 0;
+
+    EXPECT_EQ(0, manager->fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 512 * 1024, err));
+    EXPECT_EQ(0, fileSize(fd));
+    EXPECT_EQ(free_before - 512 * 1024 / clusterSize(), freeClusters());
+
+    //  A range within the reserved clusters does not allocate any more
+    EXPECT_EQ(0, manager->fallocate(fd, FALLOC_FL_KEEP_SIZE, 4096, 4096, err));
+    EXPECT_EQ(free_before - 512 * 1024 / clusterSize(), freeClusters());
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, fallocate_rejects_other_modes) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const int modes[] = { FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, FALLOC_FL_ZERO_RANGE, FALLOC_FL_COLLAPSE_RANGE };
+
+    for (const int mode : modes) {
+        int err = 0;
+        EXPECT_EQ(-1, manager->fallocate(fd, mode, 0, 4096, err));
+        EXPECT_EQ(EOPNOTSUPP, err);
+    }
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, fallocate_rejects_bad_arguments) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    int err = 0;
+
+    EXPECT_EQ(-1, manager->fallocate(fd, 0, -1, 4096, err));
+    EXPECT_EQ(EINVAL, err);
+    EXPECT_EQ(-1, manager->fallocate(fd, 0, 0, 0, err));
+    EXPECT_EQ(EINVAL, err);
+    EXPECT_EQ(-1, manager->fallocate(fd + 1, 0, 0, 4096, err));
+    EXPECT_EQ(EBADF, err);
+    EXPECT_EQ(0, manager->close(fd));
+
+    const int read_only = open("/file", O_RDONLY);
+    EXPECT_EQ(-1, manager->fallocate(read_only, 0, 0, 4096, err));
+    EXPECT_EQ(EBADF, err);
+    EXPECT_EQ(0, manager->close(read_only));
+}
+
+TEST_F(fatfs_file_manager, fallocate_fails_when_the_volume_is_full) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    int err = 0;
+
+    EXPECT_EQ(-1, manager->fallocate(fd, 0, 0, 2 * kDiskSize, err));
+    EXPECT_EQ(ENOSPC, err);
+    EXPECT_EQ(0, fileSize(fd));
+
+    EXPECT_EQ(-1, manager->fallocate(fd, 0, 0xFFFFFFFF, 1, err));
+    EXPECT_EQ(EFBIG, err);
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, append_extent_is_contiguous_and_shrinks_on_close) {
+    const DWORD free_before = freeClusters();
+    const int fd = open("/log", O_WRONLY | O_CREAT | O_APPEND);
+    const vector<char> data(4096, 'a');
+    int err = 0;
+
+    //  The first write reserves kMinAppendExtent ahead of the file
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->fsync(fd, err));
+    EXPECT_EQ(kMinAppendExtent / clusterSize(), contiguousClusters(fd));
+    EXPECT_EQ(free_before - kMinAppendExtent / clusterSize(), freeClusters());
+
+    //  Going past it doubles the extent, still in one run
+    for (size_t written = data.size(); written <= kMinAppendExtent; written += data.size()) {
+        EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    }
+    EXPECT_EQ(0, manager->fsync(fd, err));
+    EXPECT_EQ(2 * kMinAppendExtent / clusterSize(), contiguousClusters(fd));
+
+    //  Closing releases the clusters beyond the end of the file
+    const off_t size = fileSize(fd);
+    EXPECT_EQ(0, manager->close(fd));
+    EXPECT_EQ(size, pathSize("/log"));
+    EXPECT_EQ(free_before - (size + clusterSize() - 1) / clusterSize(), freeClusters());
+}
+
+TEST_F(fatfs_file_manager, append_extent_is_reset_by_ftruncate) {
+    const DWORD free_before = freeClusters();
+    const int fd = open("/log", O_WRONLY | O_CREAT | O_APPEND);
+    const vector<char> data(4096, 'a');
+    int err = 0;
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->ftruncate(fd, 0, err));
+    EXPECT_EQ(free_before, freeClusters());
+
+    //  The next write reserves a new extent
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->fsync(fd, err));
+    EXPECT_EQ(free_before - kMinAppendExtent / clusterSize(), freeClusters());
+    EXPECT_EQ(0, manager->close(fd));
+    EXPECT_EQ(free_before - (data.size() + clusterSize() - 1) / clusterSize(), freeClusters());
+}
+
+TEST_F(fatfs_file_manager, append_extent_is_limited_by_the_free_space) {
+    const int fd = open("/log", O_WRONLY | O_CREAT | O_APPEND);
+    const vector<char> data(1024 * 1024, 'a');
+    int err = 0;
+
+    //  Fill the volume, the last writes get as far as they can once no extent fits
+    size_t total = 0;
+
+    for (ssize_t written = data.size(); written == (ssize_t)data.size(); total += written) {
+        written = manager->write(fd, data.data(), data.size());
+    }
+    EXPECT_LT(total, kDiskSize);
+    EXPECT_EQ(0, manager->close(fd));
+    EXPECT_EQ(total, pathSize("/log"));
+}
+
+TEST_F(fatfs_file_manager, small_writes_are_buffered) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, fileSize(fd));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_close) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->close(fd));
+    EXPECT_EQ(data.size(), pathSize("/file"));
+
+    const int read_fd = open("/file", O_RDONLY);
+    vector<char> read_back(data.size());
+    EXPECT_EQ(data.size(), manager->read(read_fd, read_back.data(), read_back.size()));
+    EXPECT_EQ(data, read_back);
+    EXPECT_EQ(0, manager->close(read_fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_fsync) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+    int err = 0;
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->fsync(fd, err));
+    EXPECT_EQ(data.size(), fileSize(fd));
+    EXPECT_EQ(data.size(), pathSize("/file"));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_lseek) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->lseek(fd, 10, SEEK_SET));
+    EXPECT_EQ(data.size(), fileSize(fd));
+
+    //  The next write starts at the new position
+    EXPECT_EQ(1, manager->write(fd, "y", 1));
+    EXPECT_EQ(0, manager->lseek(fd, 0, SEEK_SET));
+
+    vector<char> read_back(data.size());
+    EXPECT_EQ(data.size(), manager->read(fd, read_back.data(), read_back.size()));
+    EXPECT_EQ('x', read_back[9]);
+    EXPECT_EQ('y', read_back[10]);
+    EXPECT_EQ('x', read_back[11]);
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_ftruncate) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+    int err = 0;
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->ftruncate(fd, 40, err));
+    EXPECT_EQ(40, fileSize(fd));
+
+    vector<char> read_back(data.size());
+    EXPECT_EQ(0, manager->lseek(fd, 0, SEEK_SET));
+    EXPECT_EQ(40, manager->read(fd, read_back.data(), read_back.size()));
+    EXPECT_EQ(40, count(read_back.begin(), read_back.begin() + 40, 'x'));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_fstat) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+    struct stat64 st;
+    int err = 0;
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->fstat(0, fd, &st, err));
+    EXPECT_EQ(data.size(), st.st_size);
+    EXPECT_EQ(data.size(), fileSize(fd));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_read) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    vector<char> data(200);
+    char byte = 0;
+
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (char)i;
+    }
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, manager->lseek(fd, 150, SEEK_SET));
+    EXPECT_EQ(1, manager->write(fd, "y", 1));
+
+    //  The read goes on from the end of the buffered write, which it can see
+    EXPECT_EQ(1, manager->read(fd, &byte, 1));
+    EXPECT_EQ(data[151], byte);
+    EXPECT_EQ(0, manager->lseek(fd, 150, SEEK_SET));
+    EXPECT_EQ(1, manager->read(fd, &byte, 1));
+    EXPECT_EQ('y', byte);
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_on_reopen) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+
+    const int read_fd = open("/file", O_RDONLY);
+    vector<char> read_back(data.size());
+    EXPECT_EQ(data.size(), manager->read(read_fd, read_back.data(), read_back.size()));
+    EXPECT_EQ(data, read_back);
+    EXPECT_EQ(0, manager->close(read_fd));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, write_buffer_is_flushed_when_full) {
+    format(1024);
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(600, 'x');
+
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(0, fileSize(fd));
+    EXPECT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    EXPECT_EQ(data.size(), fileSize(fd));
+
+    //  Writes of the size of the buffer are passed straight to FatFs, after the pending data
+    const vector<char> large(1024, 'y');
+    EXPECT_EQ(large.size(), manager->write(fd, large.data(), large.size()));
+    EXPECT_EQ(2 * data.size() + large.size(), fileSize(fd));
+    EXPECT_EQ(0, manager->close(fd));
+}
+
+TEST_F(fatfs_file_manager, sequential_pwrites_are_buffered) {
+    const int fd = open("/file", O_RDWR | O_CREAT | O_TRUNC);
+    const vector<char> data(100, 'x');
+
+    EXPECT_EQ(data.size(), manager->pwrite(fd, data.data(), data.size(), 0));
+    EXPECT_EQ(data.size(), manager->pwrite(fd, data.data(), data.size(), 100));
+    EXPECT_EQ(0, fileSize(fd));
+
+    //  A write elsewhere flushes the buffer first
+    EXPECT_EQ(1, manager->pwrite(fd, "y", 1, 50));
+    EXPECT_EQ(2 * data.size(), fileSize(fd));
+    EXPECT_EQ(0, manager->close(fd));
+
+    const int read_fd = open("/file", O_RDONLY);
+    vector<char> read_back(2 * data.size());
+    EXPECT_EQ(read_back.size(), manager->read(read_fd, read_back.data(), read_back.size()));
+    EXPECT_EQ('y', read_back[50]);
+    EXPECT_EQ(read_back.size() - 1, count(read_back.begin(), read_back.end(), 'x'));
+    EXPECT_EQ(0, manager->close(read_fd));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <vector>
+
+#define UNIT_TEST
+
+using namespace std;
+
+// Include the modules under test
+#include <disk.cpp>
+#include <inmemory_disk.cpp>
+
+using namespace conclave;
+
+static const unsigned long kDiskSize = 4 * 1024 * 1024;
+static const UINT kChunkSectors = 64 * 1024 / SECTOR_SIZE;
+
+class inmemory_disk : public testing::Test {
+protected:
+    InMemoryDisk disk{0, kDiskSize};
+
+    void SetUp() override {
+        disk.diskStart(DiskInitialization::FORMAT);
+    }
+
+    void write(const LBA_t sector, const UINT num_sectors, const BYTE value) {
+        const vector<BYTE> data((size_t)num_sectors * SECTOR_SIZE, value);
+        ASSERT_EQ(RES_OK, disk.diskWrite(data.data(), sector, num_sectors));
+    }
+
+    bool hasValue(const LBA_t sector, const UINT num_sectors, const BYTE value) {
+        vector<BYTE> data((size_t)num_sectors * SECTOR_SIZE, value + 1);
+        return disk.diskRead(data.data(), sector, num_sectors) == RES_OK &&
+            data == vector<BYTE>((size_t)num_sectors * SECTOR_SIZE, value);
+    }
+
+    DRESULT trim(const LBA_t first_sector, const LBA_t last_sector) {
+        LBA_t range[2] = {first_sector, last_sector};
+        return disk.diskIoCtl(CTRL_TRIM, range);
+    }
+
+    size_t chunks() const {
+        return disk.getAllocatedSize() / (kChunkSectors * SECTOR_SIZE);
+    }
+};
+
+TEST_F(inmemory_disk, reads_zeros_from_chunks_never_written) {
+    EXPECT_TRUE(hasValue(0, 1, 0));
+    EXPECT_TRUE(hasValue(kDiskSize / SECTOR_SIZE - 3 * kChunkSectors, 3 * kChunkSectors, 0));
+    EXPECT_EQ(0, chunks());
+}
+
+TEST_F(inmemory_disk, reads_and_writes_across_chunks) {
+    write(kChunkSectors - 2, kChunkSectors + 4, 7);
+    EXPECT_EQ(3, chunks());
+
+    EXPECT_TRUE(hasValue(kChunkSectors - 2, kChunkSectors + 4, 7));
+    EXPECT_TRUE(hasValue(kChunkSectors - 3, 1, 0));
+    EXPECT_TRUE(hasValue(2 * kChunkSectors + 2, 1, 0));
+}
+
+TEST_F(inmemory_disk, does_not_allocate_a_chunk_for_zeros) {
+    write(0, 3 * kChunkSectors, 0);
+    EXPECT_EQ(0, chunks());
+    EXPECT_TRUE(hasValue(0, 3 * kChunkSectors, 0));
+
+    //  Only the chunks with a non-zero byte are allocated
+    vector<BYTE> data(2 * kChunkSectors * SECTOR_SIZE, 0);
+    data.back() = 1;
+    ASSERT_EQ(RES_OK, disk.diskWrite(data.data(), 0, 2 * kChunkSectors));
+    EXPECT_EQ(1, chunks());
+    EXPECT_TRUE(hasValue(0, kChunkSectors, 0));
+    EXPECT_TRUE(hasValue(kChunkSectors, kChunkSectors - 1, 0));
+    ASSERT_EQ(RES_OK, disk.diskRead(data.data(), 0, 2 * kChunkSectors));
+    EXPECT_EQ(1, data.back());
+}
+
+TEST_F(inmemory_disk, writes_zeros_over_data) {
+    write(10, 1, 5);
+    write(10, 1, 0);
+    EXPECT_TRUE(hasValue(10, 1, 0));
+    EXPECT_EQ(1, chunks());
+}
+
+TEST_F(inmemory_disk, releases_the_chunks_entirely_trimmed) {
+    write(0, 4 * kChunkSectors, 3);
+    ASSERT_EQ(4, chunks());
+
+    //  The range covers the second and the third chunks, and part of the other two
+    ASSERT_EQ(RES_OK, trim(kChunkSectors - 1, 3 * kChunkSectors));
+    EXPECT_EQ(2, chunks());
+    EXPECT_TRUE(hasValue(kChunkSectors, 2 * kChunkSectors, 0));
+
+    //  The sectors trimmed in the chunks still allocated keep their data
+    EXPECT_TRUE(hasValue(0, kChunkSectors, 3));
+    EXPECT_TRUE(hasValue(3 * kChunkSectors, kChunkSectors, 3));
+}
+
+TEST_F(inmemory_disk, does_not_release_a_chunk_partially_trimmed) {
+    write(0, kChunkSectors, 3);
+
+    for (const auto& range : {make_pair(0u, kChunkSectors - 2), make_pair(1u, kChunkSectors - 1), make_pair(5u, 5u)}) {
+        ASSERT_EQ(RES_OK, trim(range.first, range.second));
+        EXPECT_EQ(1, chunks()) << range.first << " " << range.second;
+        EXPECT_TRUE(hasValue(0, kChunkSectors, 3)) << range.first << " " << range.second;
+    }
+    ASSERT_EQ(RES_OK, trim(0, kChunkSectors - 1));
+    EXPECT_EQ(0, chunks());
+
+    //  A chunk released is allocated again by the next write
+    write(1, 1, 4);
+    EXPECT_EQ(1, chunks());
+    EXPECT_TRUE(hasValue(0, 1, 0));
+    EXPECT_TRUE(hasValue(1, 1, 4));
+}
+
+TEST_F(inmemory_disk, rejects_a_range_out_of_the_disk) {
+    const LBA_t num_sectors = kDiskSize / SECTOR_SIZE;
+    vector<BYTE> data(2 * SECTOR_SIZE);
+
+    EXPECT_EQ(RES_PARERR, disk.diskRead(data.data(), num_sectors - 1, 2));
+    EXPECT_EQ(RES_PARERR, disk.diskWrite(data.data(), num_sectors, 1));
+    EXPECT_EQ(RES_PARERR, trim(num_sectors - 1, num_sectors));
+    EXPECT_EQ(RES_PARERR, trim(2, 1));
+    EXPECT_EQ(RES_OK, trim(0, num_sectors - 1));
+}
+
+TEST_F(inmemory_disk, releases_the_chunks_when_stopped) {
+    write(0, 2 * kChunkSectors, 3);
+    disk.diskStop();
+    EXPECT_EQ(0, chunks());
+    EXPECT_TRUE(hasValue(0, 2 * kChunkSectors, 0));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
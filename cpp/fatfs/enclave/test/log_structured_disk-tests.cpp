@@ -0,0 +1,314 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#define UNIT_TEST
+
+#include <sgx_tcrypto.h>
+#include <sgx_trts.h>
+
+using namespace std;
+
+//  SGX SDK mock functions, the key derivation only needs to be deterministic here
+sgx_status_t sgx_sha256_init(sgx_sha_state_handle_t* p_sha_handle) {
+    *p_sha_handle = new vector<uint8_t>();
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_sha256_update(const uint8_t* p_src, uint32_t src_len, sgx_sha_state_handle_t sha_handle) {
+    auto* data = static_cast<vector<uint8_t>*>(sha_handle);
+    data->insert(data->end(), p_src, p_src + src_len);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_sha256_get_hash(sgx_sha_state_handle_t sha_handle, sgx_sha256_hash_t* p_hash) {
+    const auto* data = static_cast<vector<uint8_t>*>(sha_handle);
+    memset(*p_hash, 0, sizeof(sgx_sha256_hash_t));
+
+    for (size_t i = 0; i < data->size(); ++i) {
+        (*p_hash)[i % sizeof(sgx_sha256_hash_t)] = (*p_hash)[i % sizeof(sgx_sha256_hash_t)] * 31 + (*data)[i];
+    }
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_sha256_close(sgx_sha_state_handle_t sha_handle) {
+    delete static_cast<vector<uint8_t>*>(sha_handle);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_read_rand(unsigned char* rand, size_t length_in_bytes) {
+    static mt19937 generator(7);
+
+    for (size_t i = 0; i < length_in_bytes; ++i) {
+        rand[i] = generator();
+    }
+    return SGX_SUCCESS;
+}
+
+//  Host file of the disk, and its content at the last flush
+static vector<unsigned char> host;
+static vector<unsigned char> durable;
+
+//  Host ids written by each OCall, and whether the writes fail
+struct HostWrite {
+    unsigned long first;
+    unsigned long count;
+};
+static vector<HostWrite> host_writes;
+static bool fail_writes = false;
+
+void host_encrypted_read_ocall(int* res,
+                               unsigned char drive,
+                               unsigned long sector_id,
+                               unsigned char num_sectors,
+                               unsigned int sector_size,
+                               unsigned char* buf,
+                               unsigned int buf_size) {
+    const size_t offset = sector_id * sector_size;
+
+    if (host.size() < offset + buf_size) {
+        host.resize(offset + buf_size);
+    }
+    memcpy(buf, host.data() + offset, buf_size);
+    *res = buf_size;
+}
+
+void host_encrypted_write_ocall(int* res,
+                                unsigned char drive,
+                                const unsigned char* buf,
+                                unsigned int buf_size,
+                                unsigned int sector_size,
+                                unsigned long sector) {
+    if (fail_writes) {
+        host_writes.push_back({sector, buf_size / sector_size});
+        *res = -1;
+        return;
+    }
+    const size_t offset = sector * sector_size;
+
+    if (host.size() < offset + buf_size) {
+        host.resize(offset + buf_size);
+    }
+    memcpy(host.data() + offset, buf, buf_size);
+    host_writes.push_back({sector, buf_size / sector_size});
+    *res = buf_size;
+}
+
+void host_disk_sync_ocall(int* res, unsigned char drive) {
+    durable = host;
+    *res = 0;
+}
+
+void host_disk_trim_ocall(int* res,
+                          unsigned char drive,
+                          unsigned long sector,
+                          unsigned long num_sectors,
+                          unsigned int sector_size) {
+    for (auto* file : {&host, &durable}) {
+        const size_t start = min(file->size(), sector * sector_size);
+        const size_t end = min(file->size(), (sector + num_sectors) * sector_size);
+        memset(file->data() + start, 0, end - start);
+    }
+    *res = 0;
+}
+
+// Include the modules under test
+#include <disk.cpp>
+#include <sector_crypto.cpp>
+#include <persistent_disk.cpp>
+#include <log_structured_disk.cpp>
+
+using namespace conclave;
+
+static const unsigned long kDiskSize = 4 * 1024 * 1024;
+static const unsigned char kKey[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+class log_structured_disk : public testing::TestWithParam<unsigned int> {
+protected:
+    unique_ptr<LogStructuredDisk> disk;
+
+    void SetUp() override {
+        host.clear();
+        durable.clear();
+        host_writes.clear();
+        fail_writes = false;
+        open(DiskInitialization::FORMAT);
+    }
+
+    void TearDown() override {
+        disk.reset();
+    }
+
+    unsigned int sectorSize() const {
+        return GetParam();
+    }
+
+    unsigned long numSectors() const {
+        return kDiskSize / sectorSize();
+    }
+
+    void open(const DiskInitialization init_type) {
+        disk.reset(new LogStructuredDisk(0, kDiskSize, sectorSize(), kKey));
+        disk->diskStart(init_type);
+    }
+
+    void remount() {
+        disk->diskStop();
+        open(DiskInitialization::OPEN);
+    }
+
+    //  Drops what is not durable, as if the Enclave and the Host had crashed
+    void crash() {
+        disk.reset();
+        host = durable;
+        open(DiskInitialization::OPEN);
+    }
+
+    DRESULT write(const LBA_t sector, const UINT num_sectors, const BYTE fill) {
+        const vector<BYTE> data((size_t)num_sectors * sectorSize(), fill);
+        return disk->diskWrite(data.data(), sector, num_sectors);
+    }
+
+    DRESULT sync() {
+        return disk->diskIoCtl(CTRL_SYNC, nullptr);
+    }
+
+    void expectSectors(const LBA_t sector, const UINT num_sectors, const BYTE fill) {
+        vector<BYTE> data((size_t)num_sectors * sectorSize());
+        ASSERT_EQ(disk->diskRead(data.data(), sector, num_sectors), RES_OK) << sector;
+        EXPECT_EQ(data, vector<BYTE>(data.size(), fill)) << sector;
+    }
+
+    //  Host id of the last sector written by the last OCall
+    unsigned long lastWrittenId() const {
+        return host_writes.back().first + host_writes.back().count - 1;
+    }
+};
+
+TEST_P(log_structured_disk, keeps_the_sectors_across_a_remount) {
+    ASSERT_EQ(write(0, 40, 1), RES_OK);
+    ASSERT_EQ(write(100, 3, 2), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+    ASSERT_EQ(write(20, 10, 3), RES_OK);
+    remount();
+
+    expectSectors(0, 20, 1);
+    expectSectors(20, 10, 3);
+    expectSectors(30, 10, 1);
+    expectSectors(100, 3, 2);
+    expectSectors(200, 8, 0);
+}
+
+TEST_P(log_structured_disk, drops_the_writes_which_are_not_synced) {
+    ASSERT_EQ(write(0, 8, 1), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+    ASSERT_EQ(write(4, 8, 2), RES_OK);
+    crash();
+
+    expectSectors(0, 8, 1);
+    expectSectors(8, 4, 0);
+}
+
+TEST_P(log_structured_disk, keeps_the_sectors_while_cleaning_the_log) {
+    //  Each round writes the whole disk in a shuffled order, which leaves the live sectors
+    //    spread over the segments and makes the cleaner move them
+    const UINT batch = 16;
+    vector<LBA_t> batches;
+
+    for (LBA_t sector = 0; sector < numSectors(); sector += batch) {
+        batches.push_back(sector);
+    }
+    mt19937 generator(1);
+
+    for (BYTE round = 1; round <= 3; ++round) {
+        shuffle(batches.begin(), batches.end(), generator);
+
+        for (const LBA_t sector : batches) {
+            ASSERT_EQ(write(sector, batch, round * 16 + sector / batch % 16), RES_OK);
+            ASSERT_EQ(sync(), RES_OK);
+        }
+    }
+    remount();
+
+    for (LBA_t sector = 0; sector < numSectors(); sector += batch) {
+        expectSectors(sector, batch, 3 * 16 + sector / batch % 16);
+    }
+}
+
+TEST_P(log_structured_disk, rejects_a_sector_from_a_previous_use_of_its_segment) {
+    const size_t host_sector_size = sectorSize() + SECTOR_MAC_SIZE;
+    ASSERT_EQ(write(5, 1, 1), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+    const unsigned long position = lastWrittenId();
+    const vector<unsigned char> stale(host.begin() + position * host_sector_size,
+                                      host.begin() + (position + 1) * host_sector_size);
+
+    //  The segments are released and reused as the sector is written again,
+    //    until it is written at the same position
+    bool reused = false;
+
+    for (int i = 0; i < 100000 && !reused; ++i) {
+        ASSERT_EQ(write(5, 1, 2 + i % 200), RES_OK);
+        ASSERT_EQ(sync(), RES_OK);
+        reused = lastWrittenId() == position;
+    }
+    ASSERT_TRUE(reused);
+    //  The last unit is checked when the log is scanned, and dropped if it is not complete
+    ASSERT_EQ(write(6, 1, 1), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+    crash();
+    vector<BYTE> data(sectorSize());
+    ASSERT_EQ(disk->diskRead(data.data(), 5, 1), RES_OK);
+
+    memcpy(host.data() + position * host_sector_size, stale.data(), stale.size());
+    durable = host;
+    crash();
+    EXPECT_EQ(disk->diskRead(data.data(), 5, 1), RES_ERROR);
+}
+
+TEST_P(log_structured_disk, does_not_write_again_where_a_unit_failed) {
+    ASSERT_EQ(write(0, 4, 1), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+
+    fail_writes = true;
+    ASSERT_EQ(write(4, 4, 2), RES_OK);
+    ASSERT_EQ(sync(), RES_ERROR);
+    const HostWrite failed = host_writes.back();
+
+    fail_writes = false;
+    ASSERT_EQ(sync(), RES_OK);
+    const HostWrite retried = host_writes.back();
+    EXPECT_TRUE(retried.first >= failed.first + failed.count || retried.first + retried.count <= failed.first);
+
+    crash();
+    expectSectors(0, 4, 1);
+    expectSectors(4, 4, 2);
+}
+
+TEST_P(log_structured_disk, reads_zeros_from_trimmed_sectors) {
+    ASSERT_EQ(write(0, 32, 1), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+    LBA_t range[2] = {8, 15};
+    ASSERT_EQ(disk->diskIoCtl(CTRL_TRIM, range), RES_OK);
+    ASSERT_EQ(sync(), RES_OK);
+
+    expectSectors(0, 8, 1);
+    expectSectors(8, 8, 0);
+    expectSectors(16, 16, 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+        sector_sizes,
+        log_structured_disk,
+        testing::Values(512u, 4096u),
+        [](const testing::TestParamInfo<unsigned int>& info) {
+            return "sector_size_" + to_string(info.param);
+        });
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
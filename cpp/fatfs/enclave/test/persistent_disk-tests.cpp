@@ -0,0 +1,751 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#define UNIT_TEST
+
+#include <sgx_tcrypto.h>
+#include <sgx_trts.h>
+
+using namespace std;
+
+//  SGX SDK mock functions, the key derivation only needs to be deterministic here
+sgx_status_t sgx_sha256_init(sgx_sha_state_handle_t* p_sha_handle) {
+    *p_sha_handle = new vector<uint8_t>();
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_sha256_update(const uint8_t* p_src, uint32_t src_len, sgx_sha_state_handle_t sha_handle) {
+    auto* data = static_cast<vector<uint8_t>*>(sha_handle);
+    data->insert(data->end(), p_src, p_src + src_len);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_sha256_get_hash(sgx_sha_state_handle_t sha_handle, sgx_sha256_hash_t* p_hash) {
+    const auto* data = static_cast<vector<uint8_t>*>(sha_handle);
+    memset(*p_hash, 0, sizeof(sgx_sha256_hash_t));
+
+    //  Each byte of the input changes all the bytes of the hash, the key is only the first half of it
+    for (size_t i = 0; i < data->size(); ++i) {
+        for (size_t j = 0; j < sizeof(sgx_sha256_hash_t); ++j) {
+            (*p_hash)[j] = (*p_hash)[j] * 31 + ((*data)[i] ^ j);
+        }
+    }
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_sha256_close(sgx_sha_state_handle_t sha_handle) {
+    delete static_cast<vector<uint8_t>*>(sha_handle);
+    return SGX_SUCCESS;
+}
+
+sgx_status_t sgx_read_rand(unsigned char* rand, size_t length_in_bytes) {
+    static mt19937 generator(7);
+
+    for (size_t i = 0; i < length_in_bytes; ++i) {
+        rand[i] = generator();
+    }
+    return SGX_SUCCESS;
+}
+
+//  Host file of the disk, and its content at the last flush
+static vector<unsigned char> host;
+static vector<unsigned char> durable;
+
+//  Number of sectors read from the Host file
+static unsigned long host_sectors_read = 0;
+
+//  Number of flushes of the Host file, and how many more reach the durable copy (-1 for all of them).
+//    The Enclave crashes at some point after the last one that does.
+static unsigned long host_syncs = 0;
+static long durable_syncs_left = -1;
+
+void host_encrypted_read_ocall(int* res,
+                               unsigned char drive,
+                               unsigned long sector_id,
+                               unsigned char num_sectors,
+                               unsigned int sector_size,
+                               unsigned char* buf,
+                               unsigned int buf_size) {
+    const size_t offset = sector_id * sector_size;
+    host_sectors_read += num_sectors;
+
+    if (host.size() < offset + buf_size) {
+        host.resize(offset + buf_size);
+    }
+    memcpy(buf, host.data() + offset, buf_size);
+    *res = buf_size;
+}
+
+void host_encrypted_write_ocall(int* res,
+                                unsigned char drive,
+                                const unsigned char* buf,
+                                unsigned int buf_size,
+                                unsigned int sector_size,
+                                unsigned long sector) {
+    const size_t offset = sector * sector_size;
+
+    if (host.size() < offset + buf_size) {
+        host.resize(offset + buf_size);
+    }
+    memcpy(host.data() + offset, buf, buf_size);
+    *res = buf_size;
+}
+
+void host_disk_sync_ocall(int* res, unsigned char drive) {
+    host_syncs++;
+
+    if (durable_syncs_left != 0) {
+        durable = host;
+        durable_syncs_left -= (durable_syncs_left > 0) ? 1 : 0;
+    }
+    *res = 0;
+}
+
+void host_disk_trim_ocall(int* res,
+                          unsigned char drive,
+                          unsigned long sector,
+                          unsigned long num_sectors,
+                          unsigned int sector_size) {
+    for (auto* file : {&host, &durable}) {
+        const size_t start = min(file->size(), sector * sector_size);
+        const size_t end = min(file->size(), (sector + num_sectors) * sector_size);
+        memset(file->data() + start, 0, end - start);
+    }
+    *res = 0;
+}
+
+// Include the modules under test, FatFs runs on top of the disk in some of the tests
+#include <ff.cpp>
+#include <ffunicode.cpp>
+#include <ffsystem.cpp>
+#include <dir_index.cpp>
+#include <cluster_bitmap.cpp>
+#include <diskio.cpp>
+#include <disk.cpp>
+#include <sector_crypto.cpp>
+#include <persistent_disk.cpp>
+#include <log_structured_disk.cpp>
+
+using namespace conclave;
+
+static const unsigned long kDiskSize = 4 * 1024 * 1024;
+static const unsigned int kSectorSize = 512;
+static const unsigned char kKey[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+class persistent_disk_bitmap : public testing::Test {
+protected:
+    unique_ptr<PersistentDisk> disk;
+
+    void SetUp() override {
+        host.clear();
+        durable.clear();
+        open(DiskInitialization::FORMAT);
+        const vector<BYTE> data(kSectorSize, 1);
+        ASSERT_EQ(disk->diskWrite(data.data(), 0, 1), RES_OK);
+        ASSERT_EQ(disk->diskIoCtl(CTRL_SYNC, nullptr), RES_OK);
+        disk->diskStop();
+    }
+
+    void TearDown() override {
+        disk.reset();
+    }
+
+    void open(const DiskInitialization init_type) {
+        disk.reset(new PersistentDisk(0, kDiskSize, kSectorSize, 0, kKey));
+        disk->diskStart(init_type);
+    }
+
+    LBA_t lastSector() const {
+        return kDiskSize / kSectorSize - 1;
+    }
+};
+
+TEST_F(persistent_disk_bitmap, reads_zeros_from_sectors_never_written) {
+    open(DiskInitialization::OPEN);
+    vector<BYTE> data(kSectorSize, 1);
+
+    ASSERT_EQ(disk->diskRead(data.data(), lastSector(), 1), RES_OK);
+    EXPECT_EQ(data, vector<BYTE>(kSectorSize, 0));
+}
+
+TEST_F(persistent_disk_bitmap, authenticates_the_sectors_of_a_tampered_bitmap_sector) {
+    //  The last sector of the file is the last sector of the bitmap, which describes the end of the disk
+    const size_t host_sector_size = kSectorSize + SECTOR_MAC_SIZE;
+    ASSERT_GE(host.size(), host_sector_size);
+    host[host.size() - host_sector_size] ^= 1;
+    durable = host;
+    open(DiskInitialization::OPEN);
+    vector<BYTE> data(kSectorSize);
+
+    EXPECT_EQ(disk->diskRead(data.data(), lastSector(), 1), RES_ERROR);
+    ASSERT_EQ(disk->diskRead(data.data(), 0, 1), RES_OK);
+    EXPECT_EQ(data, vector<BYTE>(kSectorSize, 1));
+}
+
+//  FatFs formatted and mounted on a PersistentDisk, as FatFsFileManager does
+class persistent_disk_filesystem : public testing::Test {
+protected:
+    shared_ptr<PersistentDisk> disk;
+
+    void SetUp() override {
+        host.clear();
+        durable.clear();
+    }
+
+    void TearDown() override {
+        if (disk != nullptr) {
+            stop();
+        }
+    }
+
+    FatFsResult start(const DiskInitialization init_type,
+                      const unsigned int sector_size,
+                      const unsigned int shuffle_group_size,
+                      const unsigned int layout = PERSISTENT_LAYOUT_IN_PLACE) {
+        if (layout == PERSISTENT_LAYOUT_LOG) {
+            disk = make_shared<LogStructuredDisk>(0, kDiskSize, sector_size, kKey);
+        } else {
+            disk = make_shared<PersistentDisk>(0, kDiskSize, sector_size, shuffle_group_size, kKey);
+        }
+        disk->diskStart(init_type);
+        return disk_start(disk, init_type);
+    }
+
+    void stop() {
+        disk->diskStop();
+        disk_stop(0, "0:");
+        disk.reset();
+    }
+
+    //  The reads past the end of the Host file extend it with zeros, which is not a change
+    static bool isUnchanged(const vector<unsigned char>& before) {
+        return host.size() >= before.size() &&
+            equal(before.begin(), before.end(), host.begin()) &&
+            all_of(host.begin() + before.size(), host.end(), [](unsigned char byte) { return byte == 0; });
+    }
+
+    static vector<char> content(const size_t size) {
+        vector<char> data(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = (char)(i * 7 + i / 4096);
+        }
+        return data;
+    }
+
+    static void writeFile(const char* path, const vector<char>& data) {
+        FIL fil;
+        UINT written = 0;
+        ASSERT_EQ(FR_OK, f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE));
+        ASSERT_EQ(FR_OK, f_write(&fil, data.data(), data.size(), &written));
+        EXPECT_EQ(data.size(), written);
+        ASSERT_EQ(FR_OK, f_close(&fil));
+    }
+
+    static vector<char> readFile(const char* path) {
+        FIL fil;
+        UINT read = 0;
+        vector<char> data;
+
+        if (f_open(&fil, path, FA_READ) == FR_OK) {
+            data.resize(f_size(&fil));
+            EXPECT_EQ(FR_OK, f_read(&fil, data.data(), data.size(), &read));
+            EXPECT_EQ(data.size(), read);
+            EXPECT_EQ(FR_OK, f_close(&fil));
+        }
+        return data;
+    }
+};
+
+TEST_F(persistent_disk_filesystem, formats_and_reopens_with_4096_byte_sectors) {
+    const vector<char> data = content(300 * 1024);
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::FORMAT, 4096, 64 * 1024));
+    EXPECT_EQ(4096, disk->getFileSystem()->ssize);
+    writeFile("0:/file", data);
+    stop();
+
+    //  Each sector is stored with its MAC on the Host
+    EXPECT_EQ(0, host.size() % (4096 + SECTOR_MAC_SIZE));
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::OPEN, 4096, 64 * 1024));
+    EXPECT_EQ(data, readFile("0:/file"));
+}
+
+TEST_F(persistent_disk_filesystem, opens_a_filesystem_with_the_version_1_geometry) {
+    //  Files with a version 1 header have 512 bytes sectors, each shuffled on its own
+    const vector<char> data = content(100 * 1024);
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::FORMAT, SECTOR_SIZE, 0));
+    EXPECT_EQ(SECTOR_SIZE, disk->getFileSystem()->ssize);
+    writeFile("0:/file", data);
+    stop();
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::OPEN, SECTOR_SIZE, 0));
+    EXPECT_EQ(data, readFile("0:/file"));
+}
+
+TEST_F(persistent_disk_filesystem, rejects_an_invalid_sector_size) {
+    for (const unsigned int sector_size : {0u, 256u, 1000u, 3072u, 8192u}) {
+        EXPECT_FALSE(FatFsDisk::isValidSectorSize(sector_size)) << sector_size;
+        EXPECT_THROW(PersistentDisk(0, kDiskSize, sector_size, 0, kKey), runtime_error) << sector_size;
+    }
+
+    for (const unsigned int sector_size : {512u, 1024u, 2048u, 4096u}) {
+        EXPECT_TRUE(FatFsDisk::isValidSectorSize(sector_size)) << sector_size;
+    }
+}
+
+TEST_F(persistent_disk_filesystem, rejects_an_invalid_shuffle_group_size) {
+    EXPECT_TRUE(PersistentDisk::isValidShuffleGroupSize(0, 4096));
+    EXPECT_TRUE(PersistentDisk::isValidShuffleGroupSize(64 * 1024, 4096));
+    EXPECT_FALSE(PersistentDisk::isValidShuffleGroupSize(6 * 1024, 4096));
+}
+
+TEST_F(persistent_disk_filesystem, refuses_to_open_with_a_tampered_geometry) {
+    const vector<char> data = content(100 * 1024);
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::FORMAT, 4096, 64 * 1024));
+    writeFile("0:/file", data);
+    stop();
+    const vector<unsigned char> formatted = host;
+
+    //  The Host rewrites the shuffle group size, the sector size or the layout in the header of the file
+    const struct { unsigned int sector_size, shuffle_group_size, layout; } geometries[] = {
+        {4096, 0, PERSISTENT_LAYOUT_IN_PLACE},
+        {4096, 4096, PERSISTENT_LAYOUT_IN_PLACE},
+        {4096, 128 * 1024, PERSISTENT_LAYOUT_IN_PLACE},
+        {2048, 64 * 1024, PERSISTENT_LAYOUT_IN_PLACE},
+        {SECTOR_SIZE, 0, PERSISTENT_LAYOUT_IN_PLACE},
+        {4096, 0, PERSISTENT_LAYOUT_LOG}};
+
+    for (const auto& geometry : geometries) {
+        EXPECT_EQ(FatFsResult::MOUNT_FAILED,
+                  start(DiskInitialization::OPEN, geometry.sector_size, geometry.shuffle_group_size, geometry.layout))
+            << geometry.sector_size << " " << geometry.shuffle_group_size << " " << geometry.layout;
+        EXPECT_EQ(STA_NOINIT, disk->diskStatus()) << geometry.sector_size << " " << geometry.shuffle_group_size;
+        stop();
+        EXPECT_TRUE(isUnchanged(formatted)) << geometry.sector_size << " " << geometry.shuffle_group_size;
+    }
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::OPEN, 4096, 64 * 1024));
+    EXPECT_EQ(data, readFile("0:/file"));
+}
+
+TEST_F(persistent_disk_filesystem, refuses_to_open_a_default_geometry_with_another_one) {
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::FORMAT, SECTOR_SIZE, 0));
+    writeFile("0:/file", content(1000));
+    stop();
+    const vector<unsigned char> formatted = host;
+
+    EXPECT_EQ(FatFsResult::MOUNT_FAILED, start(DiskInitialization::OPEN, SECTOR_SIZE, 64 * 1024));
+    stop();
+    EXPECT_EQ(FatFsResult::MOUNT_FAILED, start(DiskInitialization::OPEN, SECTOR_SIZE, 0, PERSISTENT_LAYOUT_LOG));
+    stop();
+    EXPECT_TRUE(isUnchanged(formatted));
+}
+
+TEST_F(persistent_disk_filesystem, opens_a_default_geometry_created_before_the_journal) {
+    const vector<char> data = content(1000);
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::FORMAT, SECTOR_SIZE, 0));
+    writeFile("0:/file", data);
+    stop();
+
+    //  The journal follows the sectors mapped by the shuffle tables, 512 x 16 of them for this size
+    const size_t superblock = 512 * 16 * (SECTOR_SIZE + SECTOR_MAC_SIZE);
+    ASSERT_GT(host.size(), superblock);
+    memset(host.data() + superblock, 0, SECTOR_SIZE + SECTOR_MAC_SIZE);
+    durable = host;
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::OPEN, SECTOR_SIZE, 0));
+    EXPECT_EQ(data, readFile("0:/file"));
+}
+
+TEST_F(persistent_disk_filesystem, refuses_to_open_a_log_with_another_layout) {
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::FORMAT, 4096, 0, PERSISTENT_LAYOUT_LOG));
+    writeFile("0:/file", content(1000));
+    stop();
+    const vector<unsigned char> formatted = host;
+
+    EXPECT_EQ(FatFsResult::MOUNT_FAILED, start(DiskInitialization::OPEN, 4096, 0));
+    stop();
+    EXPECT_EQ(FatFsResult::MOUNT_FAILED, start(DiskInitialization::OPEN, 2048, 0, PERSISTENT_LAYOUT_LOG));
+    stop();
+    EXPECT_TRUE(isUnchanged(formatted));
+
+    ASSERT_EQ(FatFsResult::OK, start(DiskInitialization::OPEN, 4096, 0, PERSISTENT_LAYOUT_LOG));
+    EXPECT_EQ(content(1000), readFile("0:/file"));
+}
+
+//  The read-ahead on a disk of 512 bytes sectors in groups of 64K, so that runs are contiguous on the Host
+class persistent_disk_read_ahead : public testing::Test {
+protected:
+    static const UINT kWrittenSectors = 4096;
+
+    unique_ptr<PersistentDisk> disk;
+
+    void SetUp() override {
+        host.clear();
+        durable.clear();
+        disk.reset(new PersistentDisk(0, kDiskSize, kSectorSize, 64 * 1024, kKey));
+        disk->diskStart(DiskInitialization::FORMAT);
+
+        for (LBA_t sector = 0; sector < kWrittenSectors; sector += 64) {
+            vector<BYTE> data;
+
+            for (LBA_t i = sector; i < sector + 64; ++i) {
+                data.insert(data.end(), kSectorSize, fill(i));
+            }
+            ASSERT_EQ(RES_OK, disk->diskWrite(data.data(), sector, 64));
+            ASSERT_EQ(RES_OK, disk->diskIoCtl(CTRL_SYNC, nullptr));
+        }
+        //  The sectors are read from their home location once the journal is checkpointed
+        disk->diskStop();
+        disk.reset(new PersistentDisk(0, kDiskSize, kSectorSize, 64 * 1024, kKey));
+        disk->diskStart(DiskInitialization::OPEN);
+    }
+
+    void TearDown() override {
+        disk.reset();
+    }
+
+    static BYTE fill(const LBA_t sector) {
+        return (BYTE)(sector % 251 + 1);
+    }
+
+    //  Reads a sector, checks its content and returns the number of sectors read from the Host
+    unsigned long read(const LBA_t sector, const BYTE expected) {
+        vector<BYTE> data(kSectorSize);
+        const unsigned long before = host_sectors_read;
+        EXPECT_EQ(RES_OK, disk->diskRead(data.data(), sector, 1));
+        EXPECT_EQ(vector<BYTE>(kSectorSize, expected), data) << sector;
+        return host_sectors_read - before;
+    }
+
+    unsigned long read(const LBA_t sector) {
+        return read(sector, fill(sector));
+    }
+};
+
+TEST_F(persistent_disk_read_ahead, reads_ahead_once_a_stream_is_sequential) {
+    const UINT min_window = 16 * 1024 / kSectorSize;
+
+    //  A random read is not read ahead
+    EXPECT_EQ(1, read(1000));
+    EXPECT_EQ(1, read(2000));
+
+    //  The second read of a stream is, and the sectors read ahead do not go to the Host
+    EXPECT_EQ(1 + min_window, read(2001));
+
+    for (LBA_t sector = 2002; sector <= 2001 + min_window; ++sector) {
+        EXPECT_EQ(0, read(sector));
+    }
+}
+
+TEST_F(persistent_disk_read_ahead, doubles_the_window_up_to_128k) {
+    LBA_t sector = 100;
+    EXPECT_EQ(1, read(sector++));
+
+    for (const UINT window : {16, 32, 64, 128, 128, 128}) {
+        const UINT window_sectors = window * 1024 / kSectorSize;
+        EXPECT_EQ(1 + window_sectors, read(sector++)) << window;
+
+        for (UINT i = 0; i < window_sectors; ++i) {
+            EXPECT_EQ(0, read(sector++));
+        }
+    }
+}
+
+TEST_F(persistent_disk_read_ahead, keeps_interleaved_streams_apart) {
+    const LBA_t starts[] = {0, 800, 1600, 2400, 3200};
+    const UINT min_window = 16 * 1024 / kSectorSize;
+
+    //  Four streams, one for each entry, are read ahead in turns
+    for (int i = 0; i < 4; ++i) {
+        EXPECT_EQ(1, read(starts[i]));
+        EXPECT_EQ(1 + min_window, read(starts[i] + 1));
+    }
+
+    for (LBA_t offset = 2; offset <= 1 + min_window; ++offset) {
+        for (int i = 0; i < 4; ++i) {
+            EXPECT_EQ(0, read(starts[i] + offset));
+        }
+    }
+
+    //  A fifth stream evicts the least recently used, whose next read is random again
+    EXPECT_EQ(1, read(starts[4]));
+    EXPECT_EQ(1, read(starts[0] + 2 + min_window));
+    EXPECT_EQ(1 + min_window, read(starts[0] + 3 + min_window));
+
+    //  That one evicted the next least recently used stream, the fifth one is still there
+    EXPECT_EQ(1 + min_window, read(starts[4] + 1));
+    EXPECT_EQ(1, read(starts[1] + 2 + min_window));
+}
+
+TEST_F(persistent_disk_read_ahead, does_not_return_a_stale_read_ahead_sector) {
+    EXPECT_EQ(1, read(500));
+    EXPECT_EQ(1 + 16 * 1024 / kSectorSize, read(501));
+
+    //  A sector read ahead is written before it is consumed
+    const vector<BYTE> data(2 * kSectorSize, 0xEE);
+    ASSERT_EQ(RES_OK, disk->diskWrite(data.data(), 510, 2));
+
+    for (LBA_t sector = 502; sector < 510; ++sector) {
+        EXPECT_EQ(0, read(sector));
+    }
+    EXPECT_EQ(0, read(510, 0xEE));
+    EXPECT_EQ(0, read(511, 0xEE));
+    EXPECT_EQ(0, read(512));
+
+    //  And after the sync too
+    ASSERT_EQ(RES_OK, disk->diskIoCtl(CTRL_SYNC, nullptr));
+    read(510, 0xEE);
+}
+
+//  The journal of a disk of 8192 sectors is at the end of them, and has 512 sectors
+static const LBA_t kJournalStart = kDiskSize / kSectorSize;
+static const UINT kJournalSectors = 512;
+static const size_t kHostSectorSize = kSectorSize + SECTOR_MAC_SIZE;
+
+class persistent_disk_journal : public testing::Test {
+protected:
+    unique_ptr<PersistentDisk> disk;
+
+    void SetUp() override {
+        format();
+    }
+
+    void TearDown() override {
+        disk.reset();
+        durable_syncs_left = -1;
+    }
+
+    void format() {
+        host.clear();
+        durable.clear();
+        durable_syncs_left = -1;
+        open(DiskInitialization::FORMAT);
+        disk->diskStop();
+        open(DiskInitialization::OPEN);
+    }
+
+    void open(const DiskInitialization init_type) {
+        disk.reset(new PersistentDisk(0, kDiskSize, kSectorSize, 64 * 1024, kKey));
+        disk->diskStart(init_type);
+    }
+
+    //  The Enclave stops without stopping the disk, the Host file is what was flushed last
+    void crash() {
+        disk.reset();
+        host = durable;
+        durable_syncs_left = -1;
+        open(DiskInitialization::OPEN);
+    }
+
+    static BYTE fill(const LBA_t sector) {
+        return (BYTE)(sector % 251 + 1);
+    }
+
+    void write(const LBA_t sector, const BYTE value) {
+        const vector<BYTE> data(kSectorSize, value);
+        ASSERT_EQ(RES_OK, disk->diskWrite(data.data(), sector, 1));
+    }
+
+    //  Returns the number of flushes of the Host file
+    unsigned long sync() {
+        const unsigned long before = host_syncs;
+        EXPECT_EQ(RES_OK, disk->diskIoCtl(CTRL_SYNC, nullptr));
+        return host_syncs - before;
+    }
+
+    bool hasValue(const LBA_t sector, const BYTE value) {
+        vector<BYTE> data(kSectorSize);
+        return disk->diskRead(data.data(), sector, 1) == RES_OK && data == vector<BYTE>(kSectorSize, value);
+    }
+
+    static vector<unsigned char> journal() {
+        return vector<unsigned char>(host.begin() + kJournalStart * kHostSectorSize,
+                                     host.begin() + (kJournalStart + kJournalSectors) * kHostSectorSize);
+    }
+
+    //  The Host file apart from the journal: the sectors of the disk and the bitmap
+    static vector<unsigned char> home() {
+        vector<unsigned char> data(host);
+        data.erase(data.begin() + kJournalStart * kHostSectorSize,
+                   data.begin() + (kJournalStart + kJournalSectors) * kHostSectorSize);
+        return data;
+    }
+
+    //  Positions of the sectors of the journal which differ
+    static vector<UINT> changed(const vector<unsigned char>& before, const vector<unsigned char>& after) {
+        vector<UINT> positions;
+
+        for (UINT i = 0; i < kJournalSectors; ++i) {
+            if (!equal(before.begin() + i * kHostSectorSize, before.begin() + (i + 1) * kHostSectorSize,
+                       after.begin() + i * kHostSectorSize)) {
+                positions.push_back(i);
+            }
+        }
+        return positions;
+    }
+};
+
+TEST_F(persistent_disk_journal, replays_the_committed_records_after_a_crash) {
+    const vector<unsigned char> home_before = home();
+    write(10, 1);
+    sync();
+    write(20, 2);
+    write(21, 2);
+    sync();
+
+    //  Only the journal was written
+    EXPECT_EQ(home_before, home());
+
+    crash();
+    EXPECT_TRUE(hasValue(10, 1));
+    EXPECT_TRUE(hasValue(20, 2));
+    EXPECT_TRUE(hasValue(21, 2));
+    EXPECT_TRUE(hasValue(22, 0));
+    EXPECT_NE(home_before, home());
+}
+
+TEST_F(persistent_disk_journal, drops_the_records_of_a_sync_without_commit) {
+    //  The sectors are already written, so the bitmap does not hide those replayed by mistake
+    for (LBA_t sector = 100; sector < 400; ++sector) {
+        write(sector, 2);
+    }
+    sync();
+    const vector<unsigned char> synced = journal();
+
+    //  More sectors than fit in a record, the full records are written before the sync
+    for (LBA_t sector = 100; sector < 400; ++sector) {
+        write(sector, 3);
+    }
+    EXPECT_FALSE(changed(synced, journal()).empty());
+
+    //  Those records reach the Host file, but not the one with the commit flag
+    durable = host;
+    crash();
+
+    for (LBA_t sector = 100; sector < 400; ++sector) {
+        EXPECT_TRUE(hasValue(sector, 2)) << sector;
+    }
+}
+
+TEST_F(persistent_disk_journal, checkpoints_when_the_journal_is_half_full) {
+    const vector<unsigned char> initial = journal();
+    const vector<unsigned char> home_before = home();
+    size_t used = 0;
+    LBA_t sector = 0;
+
+    //  Each sync writes a record with a new sector, the checkpoint flushes the Host file again
+    for (;; ++sector) {
+        write(sector, fill(sector));
+
+        if (sync() > 1) {
+            break;
+        }
+        ASSERT_LT(sector, kJournalSectors);
+        EXPECT_EQ(home_before, home()) << sector;
+        used = changed(initial, journal()).size();
+    }
+    ASSERT_GT(sector, 0);
+    const size_t record_size = used / sector;
+
+    //  The superblock and the records before the last sync filled at most half of the journal
+    EXPECT_LE(1 + used, kJournalSectors / 2);
+    EXPECT_GT(1 + used + record_size, kJournalSectors / 2);
+    EXPECT_NE(home_before, home());
+
+    crash();
+
+    for (LBA_t i = 0; i <= sector; ++i) {
+        EXPECT_TRUE(hasValue(i, fill(i))) << i;
+    }
+}
+
+TEST_F(persistent_disk_journal, skips_the_sequence_numbers_of_the_records_after_a_replay) {
+    vector<vector<UINT> > records;
+
+    for (const LBA_t sector : {10, 20, 30}) {
+        const vector<unsigned char> before = journal();
+        write(sector, fill(sector));
+        sync();
+        records.push_back(changed(before, journal()));
+        ASSERT_FALSE(records.back().empty());
+    }
+
+    //  The header of the second record did not reach the Host file, the third one did
+    host[(kJournalStart + records[1][0]) * kHostSectorSize] ^= 1;
+    durable = host;
+    crash();
+    EXPECT_TRUE(hasValue(10, fill(10)));
+    EXPECT_TRUE(hasValue(20, 0));
+    EXPECT_TRUE(hasValue(30, 0));
+
+    //  A record as long as the first two ends where the third one starts. Its sequence number
+    //    would follow the one of the new record if the numbers were not skipped after the replay.
+    const vector<unsigned char> before = journal();
+    const UINT num_sectors = records[0].size() + records[1].size() - 2;
+
+    for (LBA_t sector = 40; sector < 40 + num_sectors; ++sector) {
+        write(sector, fill(sector));
+    }
+    sync();
+    const vector<UINT> record = changed(before, journal());
+    ASSERT_FALSE(record.empty());
+    ASSERT_EQ(records[2][0], record.back() + 1);
+
+    crash();
+    EXPECT_TRUE(hasValue(30, 0));
+
+    for (LBA_t sector = 40; sector < 40 + num_sectors; ++sector) {
+        EXPECT_TRUE(hasValue(sector, fill(sector))) << sector;
+    }
+}
+
+TEST_F(persistent_disk_journal, recovers_from_a_crash_during_the_checkpoint) {
+    //  Finds the sync which checkpoints the journal, and how many flushes come before and with it
+    unsigned long syncs_before = 0;
+    unsigned long checkpoint_syncs = 0;
+    LBA_t last = 0;
+
+    for (;; ++last) {
+        write(last, fill(last));
+        const unsigned long syncs = sync();
+
+        if (syncs > 1) {
+            checkpoint_syncs = syncs;
+            break;
+        }
+        syncs_before += syncs;
+        ASSERT_LT(last, kJournalSectors);
+    }
+
+    //  The first flush of that sync commits its record, the following ones write the home
+    //    locations and then the new superblock
+    for (unsigned long durable_syncs = 0; durable_syncs <= checkpoint_syncs; ++durable_syncs) {
+        format();
+        durable_syncs_left = syncs_before + durable_syncs;
+
+        for (LBA_t sector = 0; sector <= last; ++sector) {
+            write(sector, fill(sector));
+            sync();
+        }
+        crash();
+
+        for (LBA_t sector = 0; sector < last; ++sector) {
+            EXPECT_TRUE(hasValue(sector, fill(sector))) << sector << " " << durable_syncs;
+        }
+        EXPECT_TRUE(hasValue(last, durable_syncs == 0 ? 0 : fill(last))) << durable_syncs;
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,308 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+// Include the module under test
+#include <sector_crypto.cpp>
+
+using namespace std;
+using namespace conclave;
+
+/*
+  Straightforward AES-128-GCM, as specified in FIPS-197 and NIST SP 800-38D, with the
+  interface of sgx_rijndael128GCM_encrypt which was used to encrypt the sectors before
+  SectorCrypto. The SGX trusted crypto library can't be linked in a host test, so the
+  sectors produced by SectorCrypto are compared with this implementation instead, which
+  is itself checked against the test vectors of the GCM specification.
+*/
+namespace reference {
+    static const uint8_t kSBox[256] = {
+        0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+        0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+        0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+        0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+        0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+        0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+        0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+        0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+        0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+        0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+        0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+        0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+        0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+        0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+        0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+        0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+    };
+
+    static uint8_t xtime(const uint8_t b) {
+        return (uint8_t)((b << 1) ^ ((b & 0x80) ? 0x1b : 0));
+    }
+
+    static void aesEncrypt(const uint8_t* key, const uint8_t* in, uint8_t* out) {
+        uint8_t round_keys[11 * 16];
+        memcpy(round_keys, key, 16);
+        uint8_t rcon = 1;
+        for (int i = 16; i < 11 * 16; i += 4) {
+            uint8_t t[4];
+            memcpy(t, &round_keys[i - 4], 4);
+            if (i % 16 == 0) {
+                const uint8_t first = t[0];
+                t[0] = kSBox[t[1]] ^ rcon;
+                t[1] = kSBox[t[2]];
+                t[2] = kSBox[t[3]];
+                t[3] = kSBox[first];
+                rcon = xtime(rcon);
+            }
+            for (int j = 0; j < 4; j++) {
+                round_keys[i + j] = round_keys[i - 16 + j] ^ t[j];
+            }
+        }
+
+        uint8_t s[16];
+        for (int i = 0; i < 16; i++) s[i] = in[i] ^ round_keys[i];
+        for (int round = 1; round <= 10; round++) {
+            uint8_t t[16];
+            for (int i = 0; i < 16; i++) {  // SubBytes and ShiftRows
+                t[i] = kSBox[s[(i + 4 * (i % 4)) % 16]];
+            }
+            for (int c = 0; c < 4 && round < 10; c++) {  // MixColumns
+                uint8_t* col = &t[4 * c];
+                const uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+                const uint8_t first = col[0];
+                col[0] ^= all ^ xtime(col[0] ^ col[1]);
+                col[1] ^= all ^ xtime(col[1] ^ col[2]);
+                col[2] ^= all ^ xtime(col[2] ^ col[3]);
+                col[3] ^= all ^ xtime(col[3] ^ first);
+            }
+            for (int i = 0; i < 16; i++) s[i] = t[i] ^ round_keys[round * 16 + i];
+        }
+        memcpy(out, s, 16);
+    }
+
+    //  x = x * y in GF(2^128), with the bit order of GCM
+    static void gfMul(uint8_t* x, const uint8_t* y) {
+        uint8_t z[16] = {0};
+        uint8_t v[16];
+        memcpy(v, y, 16);
+        for (int i = 0; i < 128; i++) {
+            if (x[i / 8] & (0x80 >> (i % 8))) {
+                for (int j = 0; j < 16; j++) z[j] ^= v[j];
+            }
+            const bool lsb = v[15] & 1;
+            for (int j = 15; j > 0; j--) v[j] = (uint8_t)((v[j] >> 1) | (v[j - 1] << 7));
+            v[0] >>= 1;
+            if (lsb) v[0] ^= 0xe1;
+        }
+        memcpy(x, z, 16);
+    }
+
+    static void encrypt(const uint8_t* key, const uint8_t* src, size_t len, uint8_t* dst, const uint8_t* iv, uint8_t* tag) {
+        uint8_t hash_key[16] = {0};
+        aesEncrypt(key, hash_key, hash_key);
+        uint8_t counter[16] = {0};
+        memcpy(counter, iv, 12);
+        counter[15] = 1;
+        uint8_t tag_mask[16];
+        aesEncrypt(key, counter, tag_mask);
+
+        uint8_t hash[16] = {0};
+        for (size_t offset = 0; offset < len; offset += 16) {
+            for (int j = 15; j >= 12 && ++counter[j] == 0; j--) {}
+            uint8_t stream[16];
+            aesEncrypt(key, counter, stream);
+            const size_t n = len - offset < 16 ? len - offset : 16;
+            for (size_t j = 0; j < n; j++) {
+                dst[offset + j] = src[offset + j] ^ stream[j];
+                hash[j] ^= dst[offset + j];
+            }
+            gfMul(hash, hash_key);
+        }
+        const uint64_t bits = (uint64_t)len * 8;
+        for (int j = 0; j < 8; j++) hash[15 - j] ^= (uint8_t)(bits >> (8 * j));
+        gfMul(hash, hash_key);
+        for (int j = 0; j < 16; j++) tag[j] = hash[j] ^ tag_mask[j];
+    }
+}
+
+static vector<uint8_t> fromHex(const char* hex) {
+    vector<uint8_t> bytes;
+    for (; hex[0] && hex[1]; hex += 2) {
+        char byte[3] = {hex[0], hex[1], 0};
+        bytes.push_back((uint8_t)strtoul(byte, nullptr, 16));
+    }
+    return bytes;
+}
+
+//  Encrypts each sector with the reference implementation, in the layout produced by SectorCrypto::encrypt
+static vector<BYTE> referenceSectors(const sgx_aes_gcm_128bit_key_t& key,
+                                     const vector<unsigned long>& ids,
+                                     const vector<BYTE>& plaintext,
+                                     unsigned int sector_size) {
+    vector<BYTE> sectors(ids.size() * (sector_size + SGX_AESGCM_MAC_SIZE));
+    for (size_t i = 0; i < ids.size(); i++) {
+        uint8_t iv[SECTOR_IV_SIZE] = {0};
+        memcpy(iv, &ids[i], sizeof(unsigned long));
+        BYTE* output = &sectors[i * (sector_size + SGX_AESGCM_MAC_SIZE)];
+        reference::encrypt(key, &plaintext[i * sector_size], sector_size, output, iv, output + sector_size);
+    }
+    return sectors;
+}
+
+TEST(sector_crypto, reference_matches_the_gcm_test_vectors) {
+    //  Test case 3 of "The Galois/Counter Mode of Operation (GCM)", McGrew and Viega
+    const vector<uint8_t> key = fromHex("feffe9928665731c6d6a8f9467308308");
+    const vector<uint8_t> iv = fromHex("cafebabefacedbaddecaf888");
+    const vector<uint8_t> plaintext = fromHex(
+            "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+            "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255");
+    const vector<uint8_t> ciphertext = fromHex(
+            "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+            "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985");
+    const vector<uint8_t> tag = fromHex("4d5c2af327cd64a62cf35abd2ba6fab4");
+
+    vector<uint8_t> output(plaintext.size());
+    uint8_t output_tag[16];
+    reference::encrypt(key.data(), plaintext.data(), plaintext.size(), output.data(), iv.data(), output_tag);
+    EXPECT_EQ(output, ciphertext);
+    EXPECT_EQ(vector<uint8_t>(output_tag, output_tag + 16), tag);
+}
+
+struct KnownAnswer {
+    unsigned int sector_size;
+    unsigned long sector_id;
+    uint8_t first[16];
+    uint8_t last[16];
+    uint8_t tag[16];
+};
+
+//  Computed with OpenSSL's AES-128-GCM, key 000102..0f, sector byte i = i * 7 + 3
+static const KnownAnswer kKnownAnswers[] = {
+    {512, 0,
+     {0x4a, 0xdc, 0x96, 0x4b, 0x86, 0xbd, 0x8b, 0xb8, 0xd8, 0xcb, 0x33, 0x38, 0x37, 0xdf, 0xd5, 0xf1},
+     {0xcb, 0xa9, 0x36, 0xb9, 0x0c, 0xbb, 0xd0, 0x04, 0x8e, 0x9b, 0x83, 0xcb, 0x0d, 0x91, 0xf4, 0xe6},
+     {0xca, 0xb2, 0xc4, 0x52, 0xe4, 0xa7, 0x26, 0x95, 0x20, 0x00, 0xec, 0x5b, 0xf2, 0xbe, 0x61, 0x9d}},
+    {512, 0x0123456789abcdef,
+     {0x49, 0xce, 0x1c, 0xb0, 0x18, 0xe6, 0xcc, 0x26, 0x5b, 0xcf, 0x01, 0xc2, 0xf5, 0x03, 0xba, 0xbb},
+     {0xe4, 0x55, 0xd6, 0x3a, 0x3c, 0x97, 0xdb, 0x18, 0x62, 0x7a, 0xd1, 0xa5, 0x89, 0xfb, 0x21, 0xc2},
+     {0x87, 0xcf, 0x48, 0xe6, 0xda, 0x8c, 0x20, 0x90, 0x9f, 0x33, 0x66, 0x4f, 0x18, 0x7d, 0x43, 0xe6}},
+    {4096, 1,
+     {0x4f, 0xb7, 0xc8, 0x1d, 0x82, 0x90, 0xbf, 0x5a, 0x23, 0xe6, 0x71, 0x8b, 0x22, 0xb4, 0xb3, 0xe6},
+     {0x3b, 0x8a, 0x81, 0xd7, 0xfd, 0xeb, 0x5c, 0x22, 0x34, 0xf6, 0xbd, 0x69, 0x7a, 0x63, 0x86, 0x16},
+     {0x64, 0xc2, 0x8b, 0xef, 0x2b, 0xd3, 0x8e, 0x93, 0x59, 0x1b, 0xa4, 0x3f, 0x18, 0xea, 0xb0, 0x75}},
+    {4096, 0x0123456789abcdef,
+     {0x49, 0xce, 0x1c, 0xb0, 0x18, 0xe6, 0xcc, 0x26, 0x5b, 0xcf, 0x01, 0xc2, 0xf5, 0x03, 0xba, 0xbb},
+     {0x83, 0xc4, 0xb0, 0x14, 0x7f, 0xe8, 0x4f, 0x60, 0x2d, 0x73, 0xd2, 0x1f, 0x97, 0xcd, 0xee, 0xf7},
+     {0x12, 0x42, 0xf0, 0x34, 0xc4, 0xe0, 0x0f, 0xaf, 0xd8, 0x6a, 0x53, 0xd7, 0xde, 0x56, 0xf8, 0x60}},
+};
+
+TEST(sector_crypto, known_answers) {
+    sgx_aes_gcm_128bit_key_t key;
+    for (int i = 0; i < 16; i++) key[i] = i;
+    SectorCrypto crypto(key);
+
+    for (const KnownAnswer& answer : kKnownAnswers) {
+        const unsigned int size = answer.sector_size;
+        vector<BYTE> plaintext(size);
+        for (unsigned int i = 0; i < size; i++) plaintext[i] = (BYTE)(i * 7 + 3);
+        vector<BYTE> sector(size + SGX_AESGCM_MAC_SIZE);
+
+        ASSERT_EQ(crypto.encrypt(&answer.sector_id, plaintext.data(), sector.data(), 1, size), 0);
+        EXPECT_EQ(vector<BYTE>(&sector[0], &sector[16]), vector<BYTE>(answer.first, answer.first + 16)) << size;
+        EXPECT_EQ(vector<BYTE>(&sector[size - 16], &sector[size]), vector<BYTE>(answer.last, answer.last + 16)) << size;
+        EXPECT_EQ(vector<BYTE>(&sector[size], &sector[size + 16]), vector<BYTE>(answer.tag, answer.tag + 16)) << size;
+        EXPECT_EQ(sector, referenceSectors(key, {answer.sector_id}, plaintext, size)) << size;
+    }
+}
+
+class sector_crypto_run : public testing::TestWithParam<tuple<unsigned int, size_t>> {
+protected:
+    mt19937_64 random;
+    sgx_aes_gcm_128bit_key_t key;
+    unsigned int sector_size = get<0>(GetParam());
+    size_t num_sectors = get<1>(GetParam());
+    vector<unsigned long> ids;
+    vector<BYTE> plaintext;
+
+    void SetUp() override {
+        random.seed(sector_size * 100 + num_sectors);
+        for (auto& k : key) k = (uint8_t)random();
+        for (size_t i = 0; i < num_sectors; i++) ids.push_back(random() % 1000000);
+        plaintext.resize(num_sectors * sector_size);
+        for (auto& b : plaintext) b = (BYTE)random();
+    }
+
+    size_t encryptedSize() const {
+        return num_sectors * (sector_size + SGX_AESGCM_MAC_SIZE);
+    }
+};
+
+TEST_P(sector_crypto_run, matches_the_reference) {
+    SectorCrypto crypto(key);
+    vector<BYTE> encrypted(encryptedSize());
+    ASSERT_EQ(crypto.encrypt(ids.data(), plaintext.data(), encrypted.data(), num_sectors, sector_size), 0);
+    EXPECT_EQ(encrypted, referenceSectors(key, ids, plaintext, sector_size));
+}
+
+TEST_P(sector_crypto_run, round_trip) {
+    SectorCrypto crypto(key);
+    vector<BYTE> encrypted(encryptedSize());
+    vector<BYTE> decrypted(plaintext.size());
+    ASSERT_EQ(crypto.encrypt(ids.data(), plaintext.data(), encrypted.data(), num_sectors, sector_size), 0);
+    ASSERT_EQ(crypto.decrypt(ids.data(), encrypted.data(), decrypted.data(), num_sectors, sector_size), 0);
+    EXPECT_EQ(decrypted, plaintext);
+}
+
+TEST_P(sector_crypto_run, tampered_sectors_are_rejected) {
+    SectorCrypto crypto(key);
+    vector<BYTE> encrypted(encryptedSize());
+    ASSERT_EQ(crypto.encrypt(ids.data(), plaintext.data(), encrypted.data(), num_sectors, sector_size), 0);
+
+    //  A flipped bit in the ciphertext or in the MAC of any sector of the run
+    for (size_t offset : {(size_t)0, encryptedSize() / 2, encryptedSize() - SGX_AESGCM_MAC_SIZE - 1, encryptedSize() - 1}) {
+        vector<BYTE> tampered = encrypted;
+        tampered[offset] ^= 0x10;
+        vector<BYTE> decrypted(plaintext.size(), 0xaa);
+        EXPECT_EQ(crypto.decrypt(ids.data(), tampered.data(), decrypted.data(), num_sectors, sector_size), -1) << offset;
+        EXPECT_EQ(decrypted, vector<BYTE>(plaintext.size(), 0)) << offset;
+    }
+}
+
+TEST_P(sector_crypto_run, sectors_moved_to_another_id_are_rejected) {
+    SectorCrypto crypto(key);
+    vector<BYTE> encrypted(encryptedSize());
+    ASSERT_EQ(crypto.encrypt(ids.data(), plaintext.data(), encrypted.data(), num_sectors, sector_size), 0);
+
+    vector<unsigned long> moved = ids;
+    moved.back() += 1;
+    vector<BYTE> decrypted(plaintext.size());
+    EXPECT_EQ(crypto.decrypt(moved.data(), encrypted.data(), decrypted.data(), num_sectors, sector_size), -1);
+}
+
+TEST_P(sector_crypto_run, sectors_encrypted_with_another_key_are_rejected) {
+    SectorCrypto crypto(key);
+    vector<BYTE> encrypted(encryptedSize());
+    ASSERT_EQ(crypto.encrypt(ids.data(), plaintext.data(), encrypted.data(), num_sectors, sector_size), 0);
+
+    sgx_aes_gcm_128bit_key_t other_key;
+    memcpy(other_key, key, sizeof(key));
+    other_key[0] ^= 1;
+    SectorCrypto other(other_key);
+    vector<BYTE> decrypted(plaintext.size());
+    EXPECT_EQ(other.decrypt(ids.data(), encrypted.data(), decrypted.data(), num_sectors, sector_size), -1);
+}
+
+//  Runs of 1, 2, 4 and 8 sectors use a single group of lanes, the others a mix of them
+INSTANTIATE_TEST_SUITE_P(
+        lanes,
+        sector_crypto_run,
+        testing::Combine(testing::Values(512u, 4096u), testing::Values(1, 2, 3, 4, 7, 8, 13, 17)),
+        [](const testing::TestParamInfo<tuple<unsigned int, size_t>>& info) {
+            return to_string(get<0>(info.param)) + "_bytes_" + to_string(get<1>(info.param)) + "_sectors";
+        });
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,550 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#define UNIT_TEST
+
+// Include the module under test
+#include <tmpfs_file_manager.cpp>
+
+using namespace std;
+using namespace conclave;
+
+static const unsigned long kFileSystemSize = 8 * 1024 * 1024;
+
+//  Size of the extents which double in size, the following ones are all 1 MiB
+static const uint64_t kDoublingSize = 4096 * 255;
+static const uint64_t kFixedExtentSize = 1024 * 1024;
+
+class tmpfs_file_manager : public ::testing::Test {
+protected:
+    unique_ptr<TmpFsFileManager> manager;
+
+    void SetUp() override {
+        create(kFileSystemSize);
+    }
+
+    void TearDown() override {
+        manager.reset();
+    }
+
+    void create(const unsigned long size) {
+        manager.reset(new TmpFsFileManager(0, 3, 100, "/", size));
+    }
+
+    int open(const char* path, int flags) {
+        int err = 0;
+        const int fd = manager->open(path, flags, err);
+        EXPECT_GE(fd, 0) << path << " " << err;
+        return fd;
+    }
+
+    //  Bytes taken by the extents allocated in the filesystem
+    uint64_t usedBytes() {
+        struct statvfs64 buf;
+        int err = 0;
+        EXPECT_EQ(0, manager->statvfs(&buf, err));
+        return (buf.f_blocks - buf.f_bfree) * buf.f_frsize;
+    }
+
+    uint64_t size(int fd) {
+        struct stat64 buf;
+        int err = 0;
+        EXPECT_EQ(0, manager->fstat(0, fd, &buf, err));
+        return buf.st_size;
+    }
+
+    vector<char> pread(int fd, size_t count, off_t offset) {
+        vector<char> data(count, 'x');
+        const ssize_t read_bytes = manager->pread(fd, data.data(), count, offset);
+        EXPECT_GE(read_bytes, 0);
+        data.resize(max<ssize_t>(read_bytes, 0));
+        return data;
+    }
+
+    static vector<char> content(const size_t size, const uint64_t offset) {
+        vector<char> data(size);
+
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = (char)((offset + i) * 7 + (offset + i) / 4096 + 1);
+        }
+        return data;
+    }
+
+    set<string> list(const char* path) {
+        int err = 0;
+        void* dir = manager->opendir(path, err);
+        EXPECT_NE(nullptr, dir) << path;
+        set<string> names;
+
+        for (struct dirent* entry = manager->readdir(dir, err); entry != nullptr; entry = manager->readdir(dir, err)) {
+            names.insert(string(entry->d_name) + (isDir(string(path) + "/" + entry->d_name) ? "/" : ""));
+        }
+        EXPECT_EQ(0, manager->closedir(dir, err));
+        return names;
+    }
+
+    bool isDir(const string& path) {
+        struct stat64 buf;
+        int err = 0;
+        return manager->stat(0, path.c_str(), &buf, err) == 0 && S_ISDIR(buf.st_mode);
+    }
+
+    bool exists(const char* path) {
+        int err = 0;
+        return manager->access(path, 0, err) == 0;
+    }
+};
+
+TEST_F(tmpfs_file_manager, reads_back_writes_across_the_extents) {
+    const int fd = open("/file", O_RDWR | O_CREAT);
+
+    //  The write starts in the last doubling extent and ends in the third fixed one
+    const uint64_t offset = kDoublingSize - 5000;
+    const vector<char> data = content(2 * kFixedExtentSize + 10000, offset);
+    ASSERT_EQ(data.size(), manager->pwrite(fd, data.data(), data.size(), offset));
+    EXPECT_EQ(offset + data.size(), size(fd));
+    EXPECT_EQ(data, pread(fd, data.size(), offset));
+
+    //  Reads which start or end on the boundary between the extents
+    EXPECT_EQ(content(100, kDoublingSize - 50), pread(fd, 100, kDoublingSize - 50));
+    EXPECT_EQ(content(100, kDoublingSize + kFixedExtentSize - 50), pread(fd, 100, kDoublingSize + kFixedExtentSize - 50));
+
+    //  Only the extents written are allocated: the last doubling one and three fixed ones
+    EXPECT_EQ(4096 * 128 + 3 * kFixedExtentSize, usedBytes());
+
+    //  The extents before the data were not written and read as zeros
+    EXPECT_EQ(vector<char>(10000, 0), pread(fd, 10000, 0));
+    EXPECT_EQ(vector<char>(100, 0), pread(fd, 100, offset - 100));
+}
+
+TEST_F(tmpfs_file_manager, reads_and_writes_sequentially_across_the_extents) {
+    const int fd = open("/file", O_RDWR | O_CREAT);
+    const vector<char> data = content(kDoublingSize + kFixedExtentSize + 3, 0);
+
+    //  Writes of an odd size, so that most of them straddle two extents
+    for (size_t written = 0; written < data.size(); written += 4099) {
+        const size_t count = min<size_t>(4099, data.size() - written);
+        ASSERT_EQ(count, manager->write(fd, data.data() + written, count));
+    }
+    EXPECT_EQ(kDoublingSize + 2 * kFixedExtentSize, usedBytes());
+    ASSERT_EQ(0, manager->lseek(fd, 0, SEEK_SET));
+    vector<char> read_data(data.size() + 10);
+    size_t read_bytes = 0;
+
+    for (ssize_t res; (res = manager->read(fd, read_data.data() + read_bytes, 7001)) > 0; read_bytes += res) {
+    }
+    read_data.resize(read_bytes);
+    EXPECT_EQ(data, read_data);
+}
+
+TEST_F(tmpfs_file_manager, reads_zeros_after_truncating_and_extending_a_file) {
+    const int fd = open("/file", O_RDWR | O_CREAT);
+    const vector<char> data(3 * 4096 + 100, 'a');
+    ASSERT_EQ(data.size(), manager->write(fd, data.data(), data.size()));
+    int err = 0;
+
+    //  The new end of file is in the middle of the second extent, the third one is released
+    ASSERT_EQ(0, manager->ftruncate(fd, 5000, err));
+    EXPECT_EQ(5000, size(fd));
+    EXPECT_EQ(3 * 4096, usedBytes());
+
+    ASSERT_EQ(0, manager->ftruncate(fd, 20000, err));
+    EXPECT_EQ(20000, size(fd));
+    EXPECT_EQ(vector<char>(5000, 'a'), pread(fd, 5000, 0));
+    EXPECT_EQ(vector<char>(15000, 0), pread(fd, 15000, 5000));
+
+    //  The same with a write past the end of file
+    ASSERT_EQ(0, manager->ftruncate(fd, 100, err));
+    ASSERT_EQ(1, manager->pwrite(fd, "b", 1, 10000));
+    EXPECT_EQ(10001, size(fd));
+    EXPECT_EQ(vector<char>(100, 'a'), pread(fd, 100, 0));
+    EXPECT_EQ(vector<char>(9900, 0), pread(fd, 9900, 100));
+
+    ASSERT_EQ(0, manager->ftruncate(fd, 0, err));
+    EXPECT_EQ(0, usedBytes());
+    EXPECT_TRUE(pread(fd, 10, 0).empty());
+}
+
+TEST_F(tmpfs_file_manager, fails_with_enospc_when_the_filesystem_is_full) {
+    create(kDoublingSize);
+    const int other = open("/other", O_RDWR | O_CREAT);
+    const vector<char> data(100 * 1024, 'a');
+    ASSERT_EQ(3 * 4096, manager->write(other, data.data(), 3 * 4096));
+
+    //  The extents of 1 to 64 pages fit in what is left, the next one of 128 pages does not
+    const int fd = open("/file", O_RDWR | O_CREAT);
+    size_t written = 0;
+    ssize_t res;
+
+    while ((res = manager->write(fd, data.data(), data.size())) > 0) {
+        written += res;
+    }
+    EXPECT_EQ(ENOSPC, errno);
+    EXPECT_EQ(127 * 4096, written);
+    EXPECT_EQ(127 * 4096, size(fd));
+    EXPECT_EQ(130 * 4096, usedBytes());
+
+    int err = 0;
+    EXPECT_EQ(-1, manager->fallocate(fd, 0, 0, kDoublingSize, err));
+    EXPECT_EQ(ENOSPC, err);
+
+    //  The space is released with the last handle of the file removed
+    ASSERT_EQ(0, manager->unlink("/other", err));
+    EXPECT_EQ(130 * 4096, usedBytes());
+    ASSERT_EQ(0, manager->close(other));
+    EXPECT_EQ(127 * 4096, usedBytes());
+    EXPECT_EQ(1, manager->write(fd, "b", 1));
+
+    //  Once the file is as large as the filesystem it can't grow any more
+    while ((res = manager->write(fd, data.data(), data.size())) > 0) {
+        written += res;
+    }
+    EXPECT_EQ(EFBIG, errno);
+    EXPECT_EQ(kDoublingSize, size(fd));
+}
+
+TEST_F(tmpfs_file_manager, fails_with_efbig_past_the_size_of_the_filesystem) {
+    const int fd = open("/file", O_RDWR | O_CREAT);
+    int err = 0;
+
+    errno = 0;
+    EXPECT_EQ(-1, manager->pwrite(fd, "a", 1, kFileSystemSize));
+    EXPECT_EQ(EFBIG, errno);
+
+    ASSERT_EQ(kFileSystemSize, manager->lseek(fd, kFileSystemSize, SEEK_SET));
+    errno = 0;
+    EXPECT_EQ(-1, manager->write(fd, "a", 1));
+    EXPECT_EQ(EFBIG, errno);
+
+    EXPECT_EQ(-1, manager->ftruncate(fd, kFileSystemSize + 1, err));
+    EXPECT_EQ(EFBIG, err);
+
+    err = 0;
+    EXPECT_EQ(-1, manager->fallocate(fd, 0, kFileSystemSize - 10, 20, err));
+    EXPECT_EQ(EFBIG, err);
+
+    //  A write which crosses the limit is cut there
+    const vector<char> data(10, 'a');
+    EXPECT_EQ(4, manager->pwrite(fd, data.data(), data.size(), kFileSystemSize - 4));
+    EXPECT_EQ(kFileSystemSize, size(fd));
+}
+
+TEST_F(tmpfs_file_manager, renames_files_and_directories) {
+    int err = 0;
+    ASSERT_EQ(0, manager->mkdir("/dir", 0));
+    const int fd = open("/dir/file", O_RDWR | O_CREAT);
+    ASSERT_EQ(5, manager->write(fd, "hello", 5));
+
+    ASSERT_EQ(0, manager->rename("/dir/file", "/moved", err));
+    EXPECT_FALSE(exists("/dir/file"));
+    EXPECT_TRUE(exists("/moved"));
+
+    //  The handle follows the file
+    ASSERT_EQ(1, manager->write(fd, "!", 1));
+    const int moved = open("/moved", O_RDONLY);
+    EXPECT_EQ(vector<char>({'h', 'e', 'l', 'l', 'o', '!'}), pread(moved, 10, 0));
+
+    //  The target file is replaced
+    const int other = open("/other", O_RDWR | O_CREAT);
+    ASSERT_EQ(0, manager->rename("/other", "/moved", err));
+    EXPECT_FALSE(exists("/other"));
+    const int replaced = open("/moved", O_RDONLY);
+    EXPECT_EQ(0, size(replaced));
+    EXPECT_EQ(0, manager->close(other));
+
+    //  A directory is moved with its content
+    ASSERT_EQ(0, manager->mkdir("/dir/sub", 0));
+    ASSERT_EQ(0, manager->rename("/dir", "/renamed", err));
+    EXPECT_TRUE(exists("/renamed/sub"));
+    EXPECT_FALSE(exists("/dir"));
+}
+
+TEST_F(tmpfs_file_manager, rejects_invalid_renames) {
+    int err = 0;
+    ASSERT_EQ(0, manager->mkdir("/dir", 0));
+    ASSERT_EQ(0, manager->mkdir("/dir/sub", 0));
+    ASSERT_EQ(0, manager->mkdir("/empty", 0));
+    open("/dir/sub/file", O_RDWR | O_CREAT);
+    open("/file", O_RDWR | O_CREAT);
+
+    EXPECT_EQ(-1, manager->rename("/missing", "/new", err));
+    EXPECT_EQ(ENOENT, err);
+    EXPECT_EQ(-1, manager->rename("/file", "/missing/new", err));
+    EXPECT_EQ(ENOENT, err);
+    EXPECT_EQ(-1, manager->rename("/dir", "/dir/sub/dir", err));
+    EXPECT_EQ(EINVAL, err);
+    EXPECT_EQ(-1, manager->rename("/file", "/empty", err));
+    EXPECT_EQ(EISDIR, err);
+    EXPECT_EQ(-1, manager->rename("/empty", "/file", err));
+    EXPECT_EQ(ENOTDIR, err);
+    EXPECT_EQ(-1, manager->rename("/empty", "/dir", err));
+    EXPECT_EQ(ENOTEMPTY, err);
+
+    //  An empty directory is replaced
+    ASSERT_EQ(0, manager->rename("/dir", "/empty", err));
+    EXPECT_TRUE(exists("/empty/sub/file"));
+}
+
+TEST_F(tmpfs_file_manager, lists_the_entries_of_a_directory) {
+    ASSERT_EQ(0, manager->mkdir("/dir", 0));
+    ASSERT_EQ(0, manager->mkdir("/dir/sub", 0));
+    open("/dir/a", O_RDWR | O_CREAT);
+    open("/dir/b", O_RDWR | O_CREAT);
+    open("/dir/sub/c", O_RDWR | O_CREAT);
+
+    EXPECT_EQ(set<string>({"a", "b", "sub/"}), list("/dir"));
+    EXPECT_EQ(set<string>({"c"}), list("/dir/sub"));
+    EXPECT_EQ(set<string>({"dir/"}), list("/"));
+
+    //  The entries are those of the directory when it was opened
+    int err = 0;
+    void* dir = manager->opendir("/dir", err);
+    ASSERT_NE(nullptr, dir);
+    ASSERT_EQ(0, manager->unlink("/dir/a", err));
+    open("/dir/d", O_RDWR | O_CREAT);
+    set<string> names;
+
+    for (struct dirent64* entry = manager->readdir64(dir, err); entry != nullptr; entry = manager->readdir64(dir, err)) {
+        names.insert(entry->d_name);
+    }
+    EXPECT_EQ(set<string>({"a", "b", "sub"}), names);
+    EXPECT_EQ(0, manager->closedir(dir, err));
+    EXPECT_EQ(set<string>({"b", "d", "sub/"}), list("/dir"));
+
+    err = 0;
+    EXPECT_EQ(nullptr, manager->readdir(dir, err));
+    EXPECT_EQ(EBADF, err);
+    EXPECT_EQ(nullptr, manager->opendir("/dir/b", err));
+    EXPECT_EQ(ENOTDIR, err);
+    EXPECT_EQ(nullptr, manager->opendir("/missing", err));
+    EXPECT_EQ(ENOENT, err);
+}
+
+TEST_F(tmpfs_file_manager, appends_at_the_end_of_file) {
+    const int writer = open("/file", O_RDWR | O_CREAT);
+    ASSERT_EQ(3, manager->write(writer, "abc", 3));
+
+    const int appender = open("/file", O_WRONLY | O_APPEND);
+    ASSERT_EQ(0, manager->lseek(appender, 0, SEEK_SET));
+    ASSERT_EQ(2, manager->write(appender, "de", 2));
+
+    //  The end of file moved with another handle, the next append follows it
+    ASSERT_EQ(3, manager->pwrite(writer, "fgh", 3, 5));
+    ASSERT_EQ(1, manager->write(appender, "i", 1));
+    EXPECT_EQ(9, manager->lseek(appender, 0, SEEK_CUR));
+    EXPECT_EQ(vector<char>({'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i'}), pread(writer, 20, 0));
+}
+
+TEST_F(tmpfs_file_manager, fails_to_create_an_existing_file_exclusively) {
+    int err = 0;
+    const int fd = open("/file", O_RDWR | O_CREAT | O_EXCL);
+    ASSERT_EQ(3, manager->write(fd, "abc", 3));
+
+    EXPECT_EQ(-1, manager->open("/file", O_RDWR | O_CREAT | O_EXCL, err));
+    EXPECT_EQ(EEXIST, err);
+    err = 0;
+    EXPECT_EQ(nullptr, manager->fopen("/file", "wx", err));
+    EXPECT_EQ(EEXIST, err);
+
+    ASSERT_EQ(0, manager->mkdir("/dir", 0));
+    err = 0;
+    EXPECT_EQ(-1, manager->open("/dir", O_RDONLY | O_CREAT | O_EXCL, err));
+    EXPECT_EQ(EEXIST, err);
+
+    //  The file was not truncated, and O_EXCL without O_CREAT opens it
+    EXPECT_EQ(3, size(fd));
+    const int other = open("/file", O_RDONLY | O_EXCL);
+    EXPECT_EQ(vector<char>({'a', 'b', 'c'}), pread(other, 10, 0));
+}
+
+//  The filesystem is serialised and loaded into another one
+class tmpfs_file_manager_snapshot : public tmpfs_file_manager {
+protected:
+    vector<uint8_t> snapshot() {
+        vector<uint8_t> data;
+        manager->snapshot(data);
+        return data;
+    }
+
+    bool restore(const vector<uint8_t>& data) {
+        create(kFileSystemSize);
+        return manager->restore(data.data(), data.size());
+    }
+
+    void writeFile(const char* path, const vector<char>& data, const off_t offset = 0) {
+        const int fd = open(path, O_RDWR | O_CREAT);
+        ASSERT_EQ(data.size(), manager->pwrite(fd, data.data(), data.size(), offset));
+        ASSERT_EQ(0, manager->close(fd));
+    }
+
+    vector<char> readFile(const char* path) {
+        int err = 0;
+        const int fd = manager->open(path, O_RDONLY, err);
+
+        if (fd < 0) {
+            return vector<char>({'?'});
+        }
+        const vector<char> data = pread(fd, size(fd) + 1, 0);
+        EXPECT_EQ(0, manager->close(fd));
+        return data;
+    }
+
+    static void append(vector<uint8_t>& out, const void* data, const size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    //  Header of a snapshot of the given version
+    static vector<uint8_t> header(const uint32_t version) {
+        vector<uint8_t> data;
+        const uint32_t magic = 0x53465443;
+        append(data, &magic, sizeof(magic));
+        append(data, &version, sizeof(version));
+        return data;
+    }
+};
+
+TEST_F(tmpfs_file_manager_snapshot, restores_the_directories_and_the_files) {
+    ASSERT_EQ(0, manager->mkdir("/dir", 0));
+    ASSERT_EQ(0, manager->mkdir("/dir/empty", 0));
+    writeFile("/dir/file", content(kDoublingSize + 5000, 0));
+    writeFile("/empty", vector<char>());
+
+    //  Only the extent written is saved, and the extents allocated past the end of file are not
+    writeFile("/sparse", content(10, 0), kDoublingSize + kFixedExtentSize);
+    const int fd = open("/allocated", O_RDWR | O_CREAT);
+    ASSERT_EQ(3, manager->write(fd, "abc", 3));
+    int err = 0;
+    ASSERT_EQ(0, manager->fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, kFixedExtentSize, err));
+
+    //  A path longer than 64 KiB
+    string path;
+
+    for (int i = 0; i < 300; ++i) {
+        path += "/" + string(255, 'a' + i % 26);
+        ASSERT_EQ(0, manager->mkdir(path.c_str(), 0));
+    }
+    path += "/deep";
+    writeFile(path.c_str(), content(100, 0));
+
+    ASSERT_TRUE(restore(snapshot()));
+    EXPECT_EQ(set<string>({"dir/", "empty", "sparse", "allocated", string(255, 'a') + "/"}), list("/"));
+    EXPECT_EQ(set<string>({"empty/", "file"}), list("/dir"));
+    EXPECT_TRUE(list("/dir/empty").empty());
+    EXPECT_EQ(content(kDoublingSize + 5000, 0), readFile("/dir/file"));
+    EXPECT_TRUE(readFile("/empty").empty());
+    EXPECT_EQ(vector<char>({'a', 'b', 'c'}), readFile("/allocated"));
+    EXPECT_EQ(content(100, 0), readFile(path.c_str()));
+
+    vector<char> sparse(kDoublingSize + kFixedExtentSize, 0);
+    const vector<char> tail = content(10, 0);
+    sparse.insert(sparse.end(), tail.begin(), tail.end());
+    EXPECT_EQ(sparse, readFile("/sparse"));
+
+    //  The extents of the file, the one of /sparse, the first one of /allocated and those of the deep file
+    EXPECT_EQ(kDoublingSize + kFixedExtentSize + kFixedExtentSize + 4096 + 4096, usedBytes());
+}
+
+TEST_F(tmpfs_file_manager_snapshot, restores_a_version_1_snapshot) {
+    //  The paths had a length of 2 bytes
+    vector<uint8_t> data = header(1);
+    const uint8_t dir_record = 0;
+    const uint8_t file_record = 1;
+    const uint8_t end_record = 0xFF;
+    const uint16_t dir_length = 3;
+    const uint16_t file_length = 8;
+    const uint64_t file_size = 3;
+    const uint32_t num_extents = 1;
+    const uint32_t index = 0;
+    append(data, &dir_record, sizeof(dir_record));
+    append(data, &dir_length, sizeof(dir_length));
+    append(data, "dir", dir_length);
+    append(data, &file_record, sizeof(file_record));
+    append(data, &file_length, sizeof(file_length));
+    append(data, "dir/file", file_length);
+    append(data, &file_size, sizeof(file_size));
+    append(data, &num_extents, sizeof(num_extents));
+    append(data, &index, sizeof(index));
+    append(data, "abc", 3);
+    append(data, &end_record, sizeof(end_record));
+
+    ASSERT_TRUE(restore(data));
+    EXPECT_EQ(vector<char>({'a', 'b', 'c'}), readFile("/dir/file"));
+}
+
+TEST_F(tmpfs_file_manager_snapshot, rejects_a_truncated_snapshot) {
+    ASSERT_EQ(0, manager->mkdir("/dir", 0));
+    writeFile("/dir/file", content(5000, 0));
+    const vector<uint8_t> data = snapshot();
+
+    for (size_t size = 0; size < data.size(); ++size) {
+        EXPECT_FALSE(restore(vector<uint8_t>(data.begin(), data.begin() + size))) << size;
+    }
+    EXPECT_TRUE(restore(data));
+}
+
+TEST_F(tmpfs_file_manager_snapshot, rejects_a_malformed_snapshot) {
+    writeFile("/file", content(5000, 0));
+    const vector<uint8_t> data = snapshot();
+
+    //  Magic, version and type of the first record
+    for (const size_t offset : {0, 4, 8}) {
+        vector<uint8_t> modified(data);
+        modified[offset] ^= 0x20;
+        EXPECT_FALSE(restore(modified)) << offset;
+    }
+
+    //  Bytes after the end record
+    vector<uint8_t> trailing(data);
+    trailing.push_back(0);
+    EXPECT_FALSE(restore(trailing));
+
+    //  A path longer than the snapshot
+    vector<uint8_t> long_path(data);
+    long_path[9 + 3] = 0x01;
+    EXPECT_FALSE(restore(long_path));
+
+    //  An extent past the end of the file: the record is the path "file", the size and the number of extents
+    vector<uint8_t> far_extent(data);
+    far_extent[9 + 4 + 4 + 8 + 4] = 5;
+    EXPECT_FALSE(restore(far_extent));
+
+    //  A file larger than the filesystem
+    vector<uint8_t> large_file(data);
+    large_file[9 + 4 + 4 + 7] = 0x10;
+    EXPECT_FALSE(restore(large_file));
+
+    //  A file over a directory
+    vector<uint8_t> over_dir = header(2);
+    const uint8_t dir_record = 0;
+    const uint32_t length = 4;
+    append(over_dir, &dir_record, sizeof(dir_record));
+    append(over_dir, &length, sizeof(length));
+    append(over_dir, "file", length);
+    over_dir.insert(over_dir.end(), data.begin() + 8, data.end());
+    EXPECT_FALSE(restore(over_dir));
+
+    //  Random records
+    mt19937 generator(7);
+
+    for (int i = 0; i < 100; ++i) {
+        vector<uint8_t> garbage = header(2);
+
+        for (int j = 0; j < 64; ++j) {
+            garbage.push_back(generator() % 3 == 0 ? generator() % 2 : generator());
+        }
+        restore(garbage);
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -10,9 +10,18 @@ extern "C" {
     JNIEXPORT void JNICALL Java_com_r3_conclave_host_internal_fatfs_FileSystemHandler_cleanup(JNIEnv* input_env,
                                                                                               jobject input_obj);
 
+    JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_fatfs_FileSystemHandler_punchHole(JNIEnv* input_env,
+                                                                                                jobject input_obj,
+                                                                                                jstring path,
+                                                                                                jlong offset,
+                                                                                                jlong length);
 }
 
-long host_disk_get_size(const unsigned char drive, const unsigned long persistent_size);
+long host_disk_get_size(const unsigned char drive,
+                        const unsigned long persistent_size,
+                        unsigned int* sector_size,
+                        unsigned int* shuffle_group_size,
+                        unsigned int* layout);
 
 int host_disk_start(const unsigned char drive);
 
@@ -26,7 +35,15 @@ int host_disk_read(const unsigned char drive,
 
 int host_disk_write(const unsigned char drive,
                     const unsigned char* buf,
+                    const unsigned int buf_size,
                     const unsigned int sector_size,
                     const unsigned long sector);
 
+int host_disk_sync(const unsigned char drive);
+
+int host_disk_trim(const unsigned char drive,
+                   const unsigned long sector,
+                   const unsigned long num_sectors,
+                   const unsigned int sector_size);
+
 #endif
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <linux/falloc.h>
 #include <string>
 #include <stdexcept>
 #include "common.hpp"
@@ -58,12 +60,51 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_host_internal_fatfs_FileSystemHandle
     obj = NULL;
 }
 
+/*
+  This is called by Java/Kotlin (FileSystemHandler.kt) to release the storage of sectors that the Enclave
+  has trimmed. The JDK has no API to punch holes in a file, so we do it here on the path of the file.
+  The range keeps reading as zeros and the size of the file does not change.
+  It returns 0 on success, 1 when the filesystem of the Host does not support holes (the sectors are then
+  simply left in the file), or -1 on any other failure.
+*/
+JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_fatfs_FileSystemHandler_punchHole(JNIEnv* input_env,
+                                                                                            jobject,
+                                                                                            jstring path,
+                                                                                            jlong offset,
+                                                                                            jlong length) {
+    const char* file_path = input_env->GetStringUTFChars(path, NULL);
+
+    if (file_path == NULL) {
+        return -1;
+    }
+    const int fd = open(file_path, O_WRONLY);
+    input_env->ReleaseStringUTFChars(path, file_path);
+
+    if (fd < 0) {
+        return -1;
+    }
+    const int res = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+    const int error = errno;
+    close(fd);
+
+    if (res == 0) {
+        return 0;
+    }
+    return (error == EOPNOTSUPP || error == ENOSYS) ? 1 : -1;
+}
+
 /*
   Call the Java/Kotkin layer to get the size of the file that represents the filesystem,
   to understand if the file is present or needs to be created and then to establish if the
   filesystem needs to be initialized or just loaded.
+  The sector size, the shuffle group size and the layout proposed by the Enclave are recorded when
+  the file is created, otherwise they are replaced with the ones the filesystem was formatted with.
 */
-long host_disk_get_size(const unsigned char drive, const unsigned long persistent_size) {
+long host_disk_get_size(const unsigned char drive,
+                        const unsigned long persistent_size,
+                        unsigned int* sector_size,
+                        unsigned int* shuffle_group_size,
+                        unsigned int* layout) {
     DEBUG_PRINT_FUNCTION;
     JNIEnv* env = NULL;
     jint rs = jvm->AttachCurrentThread((void**)&env, NULL);
@@ -78,9 +119,12 @@ long host_disk_get_size(const unsigned char drive, const unsigned long persisten
         jvm->DetachCurrentThread();     
         return -1;
     }    
-    jmethodID mid = env->GetMethodID(cls, "getDriveSize", "(IJ)J");
+    jmethodID mid = env->GetMethodID(cls, "getDriveSize", "(IJIII)J");
+    jmethodID mid_sector_size = env->GetMethodID(cls, "getSectorSize", "(I)I");
+    jmethodID mid_shuffle_group_size = env->GetMethodID(cls, "getShuffleGroupSize", "(I)I");
+    jmethodID mid_layout = env->GetMethodID(cls, "getLayout", "(I)I");
     
-    if (mid == nullptr) {
+    if (mid == nullptr || mid_sector_size == nullptr || mid_shuffle_group_size == nullptr || mid_layout == nullptr) {
         FATFS_DEBUG_PRINT("Host not getting the file size of drive %d\n", drive);
         jvm->DetachCurrentThread();
         return -1;
@@ -88,7 +132,22 @@ long host_disk_get_size(const unsigned char drive, const unsigned long persisten
     long res = env->CallLongMethod(obj,
                                    mid,
                                    static_cast<int>(drive),
-                                   persistent_size);
+                                   persistent_size,
+                                   static_cast<int>(*sector_size),
+                                   static_cast<int>(*shuffle_group_size),
+                                   static_cast<int>(*layout));
+    if (!env->ExceptionCheck()) {
+        *sector_size = static_cast<unsigned int>(env->CallIntMethod(obj, mid_sector_size, static_cast<int>(drive)));
+    }
+
+    if (!env->ExceptionCheck()) {
+        *shuffle_group_size = static_cast<unsigned int>(env->CallIntMethod(obj, mid_shuffle_group_size, static_cast<int>(drive)));
+    }
+
+    if (!env->ExceptionCheck()) {
+        *layout = static_cast<unsigned int>(env->CallIntMethod(obj, mid_layout, static_cast<int>(drive)));
+    }
+
     if (env->ExceptionCheck()) {
         //  We rely on the DetachCurrentThread below to handle the pending exception and make the
         //  Host JNI aware of it (we could clear and rethrow it, but the effect would be the same).
@@ -152,12 +211,14 @@ int host_disk_read(const unsigned char drive,
 
 /*
   Call Java/Kotlin (FileSystemHandler.kt) to write bytes to the file that represents the filesystem.
+  The buffer contains one or more consecutive sectors, the first one being at index.
 */
 int host_disk_write(const unsigned char drive,
                     const unsigned char* buf,
+                    const unsigned int buf_size,
                     const unsigned int sector_size,
                     const unsigned long index) {
-    FATFS_DEBUG_PRINT_RW("Drive %d, Index %d, Sector size %d\n", drive, index, sector_size);
+    FATFS_DEBUG_PRINT_RW("Drive %d, Index %d, Size %d, Sector size %d\n", drive, index, buf_size, sector_size);
 
     JNIEnv* env = NULL;
     jint rs = jvm->AttachCurrentThread((void**)&env, NULL);
@@ -181,14 +242,14 @@ int host_disk_write(const unsigned char drive,
         return -1;
     }
 
-    jbyteArray jbuf_array = env->NewByteArray(sector_size);
+    jbyteArray jbuf_array = env->NewByteArray(buf_size);
 
     if (jbuf_array == NULL) {
         FATFS_DEBUG_PRINT("Host not writing to drive %d, byte array not created\n", drive);
         jvm->DetachCurrentThread();
         return -1;
     } 
-    env->SetByteArrayRegion(jbuf_array, 0, sector_size, (const jbyte*)buf);
+    env->SetByteArrayRegion(jbuf_array, 0, buf_size, (const jbyte*)buf);
 
     const int res = env->CallIntMethod(obj,
                                        mid,
@@ -200,3 +261,88 @@ int host_disk_write(const unsigned char drive,
     jvm->DetachCurrentThread();
     return res;
 }
+
+
+/*
+  Call Java/Kotlin (FileSystemHandler.kt) to flush the writes to the file that represents the filesystem
+  to the storage device.
+*/
+int host_disk_sync(const unsigned char drive) {
+    FATFS_DEBUG_PRINT_RW("Sync - Drive %d\n", drive);
+
+    JNIEnv* env = NULL;
+    jint rs = jvm->AttachCurrentThread((void**)&env, NULL);
+
+    if (rs != JNI_OK) {
+        FATFS_DEBUG_PRINT("JNI Crash %d\n", drive);
+        return -1;
+    }
+    auto cls = env->GetObjectClass(obj);
+
+    if (cls == nullptr) {
+        FATFS_DEBUG_PRINT("Class not found %d\n", drive);
+        jvm->DetachCurrentThread();
+        return -1;
+    }
+    jmethodID mid = env->GetMethodID(cls, "sync", "(I)I");
+
+    if (mid == nullptr) {
+        FATFS_DEBUG_PRINT("Host not syncing drive %d, method not found\n", drive);
+        jvm->DetachCurrentThread();
+        return -1;
+    }
+    int res = env->CallIntMethod(obj, mid, static_cast<int>(drive));
+
+    if (env->ExceptionCheck()) {
+        //  See host_disk_get_size
+        res = -1;
+    }
+    jvm->DetachCurrentThread();
+    return res;
+}
+
+
+/*
+  Call Java/Kotlin (FileSystemHandler.kt) to release the storage of sectors that the Enclave does not use anymore.
+*/
+int host_disk_trim(const unsigned char drive,
+                   const unsigned long sector,
+                   const unsigned long num_sectors,
+                   const unsigned int sector_size) {
+    FATFS_DEBUG_PRINT_RW("Trim - Sector %lu - Num %lu - Size %d - Drive %d\n", sector, num_sectors, sector_size, drive);
+
+    JNIEnv* env = NULL;
+    jint rs = jvm->AttachCurrentThread((void**)&env, NULL);
+
+    if (rs != JNI_OK) {
+        FATFS_DEBUG_PRINT("JNI Crash %d\n", drive);
+        return -1;
+    }
+    auto cls = env->GetObjectClass(obj);
+
+    if (cls == nullptr) {
+        FATFS_DEBUG_PRINT("Class not found %d\n", drive);
+        jvm->DetachCurrentThread();
+        return -1;
+    }
+    jmethodID mid = env->GetMethodID(cls, "trim", "(IJJI)I");
+
+    if (mid == nullptr) {
+        FATFS_DEBUG_PRINT("Host not trimming drive %d, method not found\n", drive);
+        jvm->DetachCurrentThread();
+        return -1;
+    }
+    int res = env->CallIntMethod(obj,
+                                 mid,
+                                 static_cast<int>(drive),
+                                 sector,
+                                 num_sectors,
+                                 sector_size);
+
+    if (env->ExceptionCheck()) {
+        //  See host_disk_get_size
+        res = -1;
+    }
+    jvm->DetachCurrentThread();
+    return res;
+}
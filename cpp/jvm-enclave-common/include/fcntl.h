@@ -16,6 +16,9 @@ extern "C" {
 #define O_TRUNC		00001000	/* not fcntl */
 #define O_APPEND	00002000
 
+/* fallocate modes, from linux/falloc.h */
+#define FALLOC_FL_KEEP_SIZE	0x01
+
 #ifdef __cplusplus
 }
 #endif
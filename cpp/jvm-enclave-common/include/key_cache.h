@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include <sgx_key.h>
+#include <sgx_error.h>
+
+namespace r3 { namespace conclave {
+
+/**
+ * This class caches the keys derived with sgx_get_key (EGETKEY), so that the keys the enclave keeps asking for,
+ * such as its sealing and persistence keys, are only derived once.
+ *
+ * A derived key only depends on the key request and on the enclave, so the cache is keyed by the full key request.
+ * The keys never leave enclave memory, the cache holds a bounded number of them and a key is zeroised when it is
+ * evicted and when the cache is cleared on enclave finalisation.
+ */
+class KeyCache {
+public:
+    static constexpr size_t capacity = 64;
+
+    /**
+     * Access the key cache instance
+     */
+    static KeyCache& instance();
+
+    /**
+     * Get the key for the given key request, deriving it with sgx_get_key if it is not cached.
+     *
+     * @param key_request The key request.
+     * @param key The key output.
+     *
+     * @return The sgx_get_key status, the key is only cached if it has been derived successfully.
+     */
+    sgx_status_t get_key(const sgx_key_request_t& key_request, sgx_key_128bit_t& key);
+
+    /**
+     * Zeroise and remove all the cached keys.
+     */
+    void clear();
+
+    ~KeyCache();
+
+private:
+    struct Entry {
+        sgx_key_request_t key_request;
+        sgx_key_128bit_t key;
+        uint64_t last_used;
+    };
+
+    Entry entries_[capacity];
+    size_t size_ = 0;
+    uint64_t clock_ = 0;
+    std::mutex mutex_;
+
+    KeyCache() = default;
+    KeyCache(const KeyCache&) = delete;
+    KeyCache& operator=(const KeyCache&) = delete;
+
+    void erase(Entry& entry);
+};
+
+}}
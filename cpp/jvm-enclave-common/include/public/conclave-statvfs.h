@@ -0,0 +1,48 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef unsigned long __fsblkcnt_t;
+    typedef unsigned long __fsfilcnt_t;
+    typedef unsigned long __fsblkcnt64_t;
+    typedef unsigned long __fsfilcnt64_t;
+
+    // From glibc 2.27 sysdeps/unix/sysv/linux/bits/statvfs.h (x86_64)
+
+    struct statvfs
+    {
+	unsigned long int f_bsize;
+	unsigned long int f_frsize;
+	__fsblkcnt_t f_blocks;
+	__fsblkcnt_t f_bfree;
+	__fsblkcnt_t f_bavail;
+	__fsfilcnt_t f_files;
+	__fsfilcnt_t f_ffree;
+	__fsfilcnt_t f_favail;
+	unsigned long int f_fsid;
+	unsigned long int f_flag;
+	unsigned long int f_namemax;
+	int __f_spare[6];
+    };
+
+    struct statvfs64
+    {
+	unsigned long int f_bsize;
+	unsigned long int f_frsize;
+	__fsblkcnt64_t f_blocks;
+	__fsblkcnt64_t f_bfree;
+	__fsblkcnt64_t f_bavail;
+	__fsfilcnt64_t f_files;
+	__fsfilcnt64_t f_ffree;
+	__fsfilcnt64_t f_favail;
+	unsigned long int f_fsid;
+	unsigned long int f_flag;
+	unsigned long int f_namemax;
+	int __f_spare[6];
+    };
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <startup_phase.h>
+#include <jvm_t.h>
+
+namespace r3 { namespace conclave {
+
+/**
+ * Marks the beginning and the end of a startup phase for the host, which times it. The host only records the first
+ * run of each phase of an enclave.
+ */
+class StartupPhaseGuard {
+public:
+    explicit StartupPhaseGuard(StartupPhase phase) : phase_(phase) {
+        startup_phase_ocall(static_cast<int>(phase_), 0);
+    }
+
+    ~StartupPhaseGuard() {
+        startup_phase_ocall(static_cast<int>(phase_), 1);
+    }
+
+    StartupPhaseGuard(const StartupPhaseGuard&) = delete;
+    StartupPhaseGuard& operator=(const StartupPhaseGuard&) = delete;
+
+private:
+    const StartupPhase phase_;
+};
+
+}}
@@ -37,9 +37,16 @@ extern "C" {
 											 jobject,
 											 jlong in_memory_size,											
 											 jlong persistent_size,
+											 jint persistent_layout,
+											 jint in_memory_backend,
 											 jstring in_memory_mount_path_in,
 											 jstring persistent_mount_path_in,
-											 jbyteArray encryption_key_in);
+											 jbyteArray encryption_key_in,
+											 jbyteArray in_memory_snapshot_in);
+
+    //  Function called by Kotlin Enclave to seal the content of the in-memory filesystem
+    JNIEXPORT jbyteArray JNICALL Java_com_r3_conclave_enclave_internal_Native_snapshotInMemoryFileSystem(JNIEnv *jniEnv,
+												       jobject);
 
     // Debug print and trace functions for stubs and debug output
     extern void debug_print_enclave(const char* msg, int length, bool allow_debug_print);
@@ -282,6 +289,7 @@ extern "C" {
     ssize_t write_impl(int fd, const void *buf, size_t count);
     ssize_t pwrite_impl(int fd, const void *buf, size_t count, off_t offset);
     int rename_impl(const char *oldpath, const char *newpath, int& err);
+    int fallocate_impl(int fd, int mode, off_t offset, off_t len, int& err);
     //sys/socket.h
     int socketpair_impl(int domain, int type, int protocol, int sv[2]);
 
@@ -292,6 +300,7 @@ extern "C" {
 
     int access_impl(const char* pathname, int mode, int& err);
     int ftruncate_impl(int fd, off_t offset, int& err);
+    int fsync_impl(int fd, int& err);
 
     int fchown_impl(int fd, uid_t owner, gid_t group, int& err);
     int fchmod_impl(int fd, mode_t mode, int& err);
@@ -304,6 +313,10 @@ extern "C" {
 
     int utimes_impl(const char *filename, const struct timeval times[2], int& err);
 
+    // sys/statvfs.h
+    int statvfs64_impl(const char* path, struct statvfs64* buf, int& err);
+    int fstatvfs64_impl(int fd, struct statvfs64* buf, int& err);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace r3 { namespace conclave {
+
+constexpr size_t x25519_key_size = 32;
+
+/**
+ * X25519 function of RFC 7748, in constant time. The scalar is clamped and the top bit of the point is ignored,
+ * as the RFC requires, so the result is the same as the Java implementation used by the mail (Curve25519.eval).
+ *
+ * @param out The 32-byte result, the shared secret or the public key.
+ * @param scalar The 32-byte private key.
+ * @param point The 32-byte public key of the peer, or nullptr for the base point (to compute the public key).
+ */
+void x25519(uint8_t out[x25519_key_size], const uint8_t scalar[x25519_key_size], const uint8_t point[x25519_key_size]);
+
+}}
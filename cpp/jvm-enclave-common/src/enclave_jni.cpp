@@ -7,14 +7,18 @@
 #include <dlsym_symbols.h>
 #include <enclave_thread.h>
 #include <aex_assert.h>
+#include <key_cache.h>
+#include <x25519.h>
 
 #include <sgx_eid.h>
 #include <sgx_tseal.h>
+#include <sgx_tcrypto.h>
 #include <sgx_errors.h>
 #include <sgx_trts.h>
 #include <sgx_utils.h>
 #include <se_memcpy.h>
 
+#include <new>
 #include <string>
 #include <vector>
 #include <cstdlib>
@@ -35,11 +39,14 @@ void abortOnJniException(JNIEnv *jniEnv) {
 // Helper function to validate needed sealing structure.
 bool validateArrayOffsetLength(JNIEnv* jniEnv, const jbyteArray arr, jint offset, jint size,
                                const std::string &fieldName) {
-    if (size > 0) {
+    if (offset < 0) {
+        raiseException(jniEnv, (fieldName + " has a negative offset").c_str());
+        return false;
+    } else if (size > 0) {
         if (!arr) {
             raiseException(jniEnv, ("invalid " + fieldName).c_str());
             return false;
-        } else if (jniEnv->GetArrayLength(arr) < (offset + size)) {
+        } else if (jniEnv->GetArrayLength(arr) < static_cast<int64_t>(offset) + size) {
             raiseException(jniEnv, (fieldName + " array too small").c_str());
             return false;
         }
@@ -72,6 +79,257 @@ bool validateSealDataArgs
     return true;
 }
 
+// Returns true if the two regions are in the same array and overlap.
+bool regionsOverlap(JNIEnv* jniEnv, const jbyteArray arr1, jint offset1, jint size1,
+                    const jbyteArray arr2, jint offset2, jint size2) {
+    return size1 > 0 && size2 > 0 && jniEnv->IsSameObject(arr1, arr2) &&
+           offset1 < offset2 + size2 && offset2 < offset1 + size1;
+}
+
+// Streaming sealing. Each stream is encrypted with its own random AES-GCM key, which is sealed with
+// sgx_seal_data into the header of the stream. The stream is then encrypted in chunks, each one with its
+// own tag. The IV and the authenticated data of a chunk hold its index and whether it is the last one,
+// so that the chunks cannot be reordered or dropped and a truncated stream is detected.
+const char sealStreamAuthenticatedData[] = "conclave-seal-stream-1";
+const uint32_t sealStreamAuthenticatedDataSize = sizeof(sealStreamAuthenticatedData) - 1;
+const uint32_t sealStreamTagSize = sizeof(sgx_aes_gcm_128bit_tag_t);
+
+// Generates a random key and seals it, with the given authenticated data, into the header.
+sgx_status_t sealRandomKey(const char* authenticatedData, uint32_t authenticatedDataSize,
+                           sgx_aes_gcm_128bit_key_t& key, uint8_t* header, uint32_t headerSize) {
+    auto ret = sgx_read_rand(reinterpret_cast<uint8_t*>(key), sizeof(key));
+    if (ret == SGX_SUCCESS) {
+        ret = sgx_seal_data(authenticatedDataSize,
+                            reinterpret_cast<const uint8_t*>(authenticatedData),
+                            sizeof(key),
+                            reinterpret_cast<const uint8_t*>(key),
+                            headerSize,
+                            reinterpret_cast<sgx_sealed_data_t*>(header));
+    }
+    return ret;
+}
+
+// Unseals the key sealed by sealRandomKey, checking its authenticated data.
+sgx_status_t unsealRandomKey(const char* authenticatedData, uint32_t authenticatedDataSize,
+                             const uint8_t* header, sgx_aes_gcm_128bit_key_t& key) {
+    uint8_t headerAuthenticatedData[64];
+    uint32_t headerAuthenticatedDataSize = sizeof(headerAuthenticatedData);
+    uint32_t keySize = sizeof(key);
+    auto ret = sgx_unseal_data(reinterpret_cast<const sgx_sealed_data_t*>(header),
+                               headerAuthenticatedData, &headerAuthenticatedDataSize,
+                               reinterpret_cast<uint8_t*>(key), &keySize);
+    if (ret == SGX_SUCCESS && (keySize != sizeof(key) ||
+                               headerAuthenticatedDataSize != authenticatedDataSize ||
+                               memcmp(headerAuthenticatedData, authenticatedData, authenticatedDataSize) != 0)) {
+        ret = SGX_ERROR_MAC_MISMATCH;
+    }
+    return ret;
+}
+
+struct SealStream {
+    sgx_aes_gcm_128bit_key_t key;
+    uint64_t nextChunk;
+    bool sealing;
+    bool finished;
+};
+
+struct SealStreamChunkParams {
+    uint8_t iv[SGX_AESGCM_IV_SIZE];
+    uint8_t authenticatedData[sizeof(uint64_t) + 1];
+
+    SealStreamChunkParams(uint64_t index, bool last) {
+        memset(iv, 0, sizeof(iv));
+        memcpy(iv + sizeof(iv) - sizeof(index), &index, sizeof(index));
+        memcpy(authenticatedData, &index, sizeof(index));
+        authenticatedData[sizeof(index)] = last ? 1 : 0;
+    }
+};
+
+SealStream* newSealStream(bool sealing) {
+    auto stream = new (std::nothrow) SealStream();
+    if (stream) {
+        stream->nextChunk = 0;
+        stream->sealing = sealing;
+        stream->finished = false;
+    }
+    return stream;
+}
+
+void deleteSealStream(SealStream* stream) {
+    memset_s(stream->key, sizeof(stream->key), 0, sizeof(stream->key));
+    delete stream;
+}
+
+// Encrypts or decrypts the next chunk of a stream. The sealed chunk is the ciphertext followed by the tag.
+void sealStreamUpdate(JNIEnv* jniEnv, jlong handle, bool sealing,
+                      jbyteArray input, jint inputOffset, jint inputSize,
+                      jbyteArray output, jint outputOffset, jboolean last) {
+    auto stream = reinterpret_cast<SealStream*>(handle);
+    if (!stream || stream->sealing != sealing || stream->finished) {
+        raiseException(jniEnv, "invalid seal stream");
+        return;
+    }
+    if (!sealing && inputSize < static_cast<jint>(sealStreamTagSize)) {
+        raiseException(jniEnv, "sealed chunk too small");
+        return;
+    }
+    if (sealing && inputSize > INT32_MAX - static_cast<jint>(sealStreamTagSize)) {
+        raiseException(jniEnv, "chunk too big");
+        return;
+    }
+    const jint outputSize = sealing ? inputSize + sealStreamTagSize : inputSize - sealStreamTagSize;
+    if (!validateArrayOffsetLength(jniEnv, input, inputOffset, inputSize, "input") ||
+        !validateArrayOffsetLength(jniEnv, output, outputOffset, outputSize, "output")) {
+        return;
+    }
+    if (regionsOverlap(jniEnv, input, inputOffset, inputSize, output, outputOffset, outputSize)) {
+        raiseException(jniEnv, "output overlaps input");
+        return;
+    }
+
+    JniPtr<uint8_t> jpInput(jniEnv, input);
+    JniPtr<uint8_t> jpOutput(jniEnv, output);
+    uint8_t empty = 0;
+    const uint8_t* in = jpInput.ptr ? jpInput.ptr + inputOffset : &empty;
+    uint8_t* out = jpOutput.ptr ? jpOutput.ptr + outputOffset : &empty;
+    const SealStreamChunkParams params(stream->nextChunk, last == JNI_TRUE);
+    sgx_status_t ret;
+
+    if (sealing) {
+        ret = sgx_rijndael128GCM_encrypt(&stream->key, in, inputSize, out,
+                                         params.iv, sizeof(params.iv),
+                                         params.authenticatedData, sizeof(params.authenticatedData),
+                                         reinterpret_cast<sgx_aes_gcm_128bit_tag_t*>(out + inputSize));
+    } else {
+        ret = sgx_rijndael128GCM_decrypt(&stream->key, in, outputSize, out,
+                                         params.iv, sizeof(params.iv),
+                                         params.authenticatedData, sizeof(params.authenticatedData),
+                                         reinterpret_cast<const sgx_aes_gcm_128bit_tag_t*>(in + outputSize));
+    }
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return;
+    }
+    stream->nextChunk++;
+    stream->finished = last == JNI_TRUE;
+    jpOutput.releaseMode = 0; // to write back to the jvm
+}
+
+// Batch sealing. sgx_seal_data derives a new sealing key (EGETKEY) for every blob, which dominates the cost
+// of sealing small records. A batch is instead encrypted with a single random AES-GCM key, sealed into the
+// header of the batch like the key of a stream, so that the sealing key is derived once per batch. The
+// records follow the header, each one being its ciphertext followed by its tag. The IV of a record is its
+// index and its authenticated data is its index and the number of records in the batch, so that records
+// cannot be swapped, dropped or moved to another batch. The records are delimited by a table of offsets
+// into the plaintext, record i being [offsets[i], offsets[i + 1]), which the caller keeps to unseal them.
+const char sealBatchAuthenticatedData[] = "conclave-seal-batch-1";
+const uint32_t sealBatchAuthenticatedDataSize = sizeof(sealBatchAuthenticatedData) - 1;
+
+uint32_t sealBatchHeaderSize() {
+    return sgx_calc_sealed_data_size(sealBatchAuthenticatedDataSize, sizeof(sgx_aes_gcm_128bit_key_t));
+}
+
+// Reads and validates the offsets table, returns the size of the sealed batch or -1 if it is invalid.
+int64_t readSealBatchOffsets(JNIEnv* jniEnv, jintArray offsetsIn, std::vector<jint>& offsets) {
+    const jsize count = offsetsIn ? jniEnv->GetArrayLength(offsetsIn) : 0;
+    if (count < 1) {
+        raiseException(jniEnv, "the offsets table must have at least one entry");
+        return -1;
+    }
+    offsets.resize(count);
+    jniEnv->GetIntArrayRegion(offsetsIn, 0, count, offsets.data());
+    if (offsets[0] < 0) {
+        raiseException(jniEnv, "negative record offset");
+        return -1;
+    }
+    for (jsize i = 1; i < count; i++) {
+        if (offsets[i] < offsets[i - 1]) {
+            raiseException(jniEnv, "the record offsets must be in increasing order");
+            return -1;
+        }
+    }
+    const int64_t recordCount = count - 1;
+    const int64_t size = int64_t(sealBatchHeaderSize()) + (offsets[count - 1] - offsets[0]) +
+                         recordCount * sealStreamTagSize;
+    if (size > INT32_MAX) {
+        raiseException(jniEnv, "batch too big");
+        return -1;
+    }
+    return size;
+}
+
+// AES-GCM with the SDK crypto (AES-NI). The input and the output can be the same region, for in-place
+// encryption and decryption, but must not overlap otherwise. The sealed output is the ciphertext followed
+// by the tag.
+void aesGcm(JNIEnv* jniEnv, bool encrypt, jbyteArray key, jbyteArray iv,
+            jbyteArray aad, jint aadOffset, jint aadSize,
+            jbyteArray input, jint inputOffset, jint inputSize,
+            jbyteArray output, jint outputOffset) {
+    const auto tagSize = static_cast<jint>(sizeof(sgx_aes_gcm_128bit_tag_t));
+    if (!key || jniEnv->GetArrayLength(key) != sizeof(sgx_aes_gcm_128bit_key_t)) {
+        raiseException(jniEnv, "AES-GCM key must be 128 bits");
+        return;
+    }
+    if (!iv || jniEnv->GetArrayLength(iv) != SGX_AESGCM_IV_SIZE) {
+        raiseException(jniEnv, "AES-GCM IV must be 12 bytes");
+        return;
+    }
+    if (encrypt ? inputSize > INT32_MAX - tagSize : inputSize < tagSize) {
+        raiseException(jniEnv, "invalid AES-GCM input size");
+        return;
+    }
+    const jint outputSize = encrypt ? inputSize + tagSize : inputSize - tagSize;
+    if ((aadSize && !validateArrayOffsetLength(jniEnv, aad, aadOffset, aadSize, "aad")) ||
+        !validateArrayOffsetLength(jniEnv, input, inputOffset, inputSize, "input") ||
+        !validateArrayOffsetLength(jniEnv, output, outputOffset, outputSize, "output")) {
+        return;
+    }
+    const bool inPlace = jniEnv->IsSameObject(input, output) && inputOffset == outputOffset;
+    if (!inPlace && regionsOverlap(jniEnv, input, inputOffset, inputSize, output, outputOffset, outputSize)) {
+        raiseException(jniEnv, "output overlaps input");
+        return;
+    }
+
+    JniPtr<uint8_t> jpKey(jniEnv, key);
+    JniPtr<uint8_t> jpIv(jniEnv, iv);
+    JniPtr<uint8_t> jpAad(jniEnv, aadSize ? aad : nullptr);
+    JniPtr<uint8_t> jpInput(jniEnv, input);
+    // For in-place operation the same elements have to be written back
+    JniPtr<uint8_t> jpOutput(jniEnv, inPlace ? nullptr : output);
+    auto& jpOut = inPlace ? jpInput : jpOutput;
+
+    uint8_t empty = 0;
+    const uint8_t* in = inputSize ? jpInput.ptr + inputOffset : &empty;
+    uint8_t* out = jpOut.ptr ? jpOut.ptr + outputOffset : &empty;
+    const uint8_t* aadPtr = aadSize ? jpAad.ptr + aadOffset : nullptr;
+    const auto cipherKey = reinterpret_cast<const sgx_aes_gcm_128bit_key_t*>(jpKey.ptr);
+    sgx_status_t ret;
+    if (encrypt) {
+        ret = sgx_rijndael128GCM_encrypt(cipherKey, in, inputSize, out, jpIv.ptr, SGX_AESGCM_IV_SIZE,
+                                         aadPtr, aadSize, reinterpret_cast<sgx_aes_gcm_128bit_tag_t*>(out + inputSize));
+    } else {
+        ret = sgx_rijndael128GCM_decrypt(cipherKey, in, outputSize, out, jpIv.ptr, SGX_AESGCM_IV_SIZE,
+                                         aadPtr, aadSize, reinterpret_cast<const sgx_aes_gcm_128bit_tag_t*>(in + outputSize));
+    }
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return;
+    }
+    jpOut.releaseMode = 0; // to write back to the jvm
+}
+
+struct SealBatchRecordParams {
+    uint8_t iv[SGX_AESGCM_IV_SIZE];
+    uint8_t authenticatedData[sizeof(uint64_t) + sizeof(uint32_t)];
+
+    SealBatchRecordParams(uint64_t index, uint32_t count) {
+        memset(iv, 0, sizeof(iv));
+        memcpy(iv + sizeof(iv) - sizeof(index), &index, sizeof(index));
+        memcpy(authenticatedData, &index, sizeof(index));
+        memcpy(authenticatedData + sizeof(index), &count, sizeof(count));
+    }
+};
+
 }
 
 extern "C" {
@@ -225,29 +483,31 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sealData
         return;
     }
 
-    try {
-        std::vector <uint8_t> buffer(sealedDataSize);
-
-        JniPtr<uint8_t> jpDataToEncrypt(jniEnv, plaintext);
-        JniPtr<uint8_t> jpAuthenticatedData(jniEnv, authenticatedData);
-
-        sgx_status_t ret = jpDataToEncrypt.ptr ? sgx_seal_data(authenticatedDataSize,
-                                                         reinterpret_cast<const uint8_t*>(jpAuthenticatedData.ptr),
-                                                         plaintextSize,
-                                                         reinterpret_cast<const uint8_t*>(jpDataToEncrypt.ptr),
-                                                         sealedDataSize,
-                                                         reinterpret_cast<sgx_sealed_data_t*>(&buffer[0]))
-                                         : SGX_ERROR_UNEXPECTED;
-
-        if (ret == SGX_SUCCESS) {
-            JniPtr<uint8_t> jpSealedOutput(jniEnv, output);
-            memcpy_s(jpSealedOutput.ptr + outputOffset, outputSize, &buffer[0], buffer.size());
-            jpSealedOutput.releaseMode = 0; // to write back to the jvm
-        } else {
-            raiseException(jniEnv, getErrorMessage(ret));
-        }
-    } catch (std::exception &e) {
-        raiseException(jniEnv, e.what());
+    // The data is sealed directly into the output array, which therefore must not overlap the inputs.
+    if (regionsOverlap(jniEnv, output, outputOffset, sealedDataSize, plaintext, plaintextOffset, plaintextSize) ||
+        regionsOverlap(jniEnv, output, outputOffset, sealedDataSize,
+                       authenticatedData, authenticatedDataOffset, authenticatedDataSize)) {
+        raiseException(jniEnv, "output overlaps the data to seal");
+        return;
+    }
+
+    JniPtr<uint8_t> jpDataToEncrypt(jniEnv, plaintext);
+    JniPtr<uint8_t> jpAuthenticatedData(jniEnv, authenticatedData);
+    JniPtr<uint8_t> jpSealedOutput(jniEnv, output);
+
+    sgx_status_t ret = jpDataToEncrypt.ptr && jpSealedOutput.ptr ?
+            sgx_seal_data(authenticatedDataSize,
+                          authenticatedDataSize ? jpAuthenticatedData.ptr + authenticatedDataOffset : nullptr,
+                          plaintextSize,
+                          jpDataToEncrypt.ptr + plaintextOffset,
+                          sealedDataSize,
+                          reinterpret_cast<sgx_sealed_data_t*>(jpSealedOutput.ptr + outputOffset))
+            : SGX_ERROR_UNEXPECTED;
+
+    if (ret == SGX_SUCCESS) {
+        jpSealedOutput.releaseMode = 0; // to write back to the jvm
+    } else {
+        raiseException(jniEnv, getErrorMessage(ret));
     }
 }
 
@@ -260,16 +520,22 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_unsealData
     JniPtr<uint8_t> jpSealedBlob(jniEnv, sealedBlob);
     JniPtr<uint8_t> jpDataOut(jniEnv, dataOut);
 
-    auto authenticatedDataOutDataLen = sgx_get_add_mac_txt_len(reinterpret_cast<sgx_sealed_data_t*>(jpSealedBlob.ptr));
-    auto decryptDataLen = sgx_get_encrypt_txt_len(reinterpret_cast<sgx_sealed_data_t*>(jpSealedBlob.ptr));
+    auto uiSealedBlobLength = static_cast<uint64_t>(sealedBlobLength);
+
+    if (jpSealedBlob.ptr == nullptr || sealedBlobOffset < 0 || uiSealedBlobLength < sizeof(sgx_sealed_data_t) ||
+        static_cast<uint64_t>(sealedBlobOffset) + uiSealedBlobLength > static_cast<uint64_t>(jpSealedBlob.size())) {
+        raiseException(jniEnv, getErrorMessage(SGX_ERROR_INVALID_PARAMETER));
+        return;
+    }
+    auto sealedData = reinterpret_cast<const sgx_sealed_data_t*>(jpSealedBlob.ptr + sealedBlobOffset);
+    auto authenticatedDataOutDataLen = sgx_get_add_mac_txt_len(sealedData);
+    auto decryptDataLen = sgx_get_encrypt_txt_len(sealedData);
 
     if (authenticatedDataOutDataLen == UINT32_MAX || decryptDataLen == UINT32_MAX) {
         raiseException(jniEnv, getErrorMessage(SGX_ERROR_UNEXPECTED));
         return;
     }
 
-    auto uiSealedBlobLength = static_cast<uint64_t>(sealedBlobLength);
-
     // Lambda helper to validate parameters. Returns true in case something is invalid.
     auto validateParameter = [](const JniPtr<uint8_t>& jniPtr, int offset, int length) {
         return jniPtr.ptr == nullptr
@@ -281,40 +547,51 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_unsealData
 
     if (validateParameter(jpSealedBlob, sealedBlobOffset, sealedBlobLength)
      || validateParameter(jpDataOut, dataOutOffset, dataOutLength) 
-     || (static_cast<uint64_t>(authenticatedDataOutDataLen) + static_cast<uint64_t>(decryptDataLen)) > uiSealedBlobLength) {
+     || (static_cast<uint64_t>(authenticatedDataOutDataLen) + static_cast<uint64_t>(decryptDataLen)) > uiSealedBlobLength
+     || static_cast<uint32_t>(dataOutLength) < decryptDataLen) {
         raiseException(jniEnv, getErrorMessage(SGX_ERROR_INVALID_PARAMETER));
         return;
     }
 
-    try {
-        std::vector<uint8_t> deAuthenticatedData(authenticatedDataOutDataLen);
-        std::vector<uint8_t> deData(decryptDataLen);
+    // The data is unsealed directly into the output array, only the authenticated data goes through
+    // a buffer when the caller asks for a part of it.
+    if (regionsOverlap(jniEnv, dataOut, dataOutOffset, decryptDataLen, sealedBlob, sealedBlobOffset, sealedBlobLength)) {
+        raiseException(jniEnv, "output overlaps the sealed blob");
+        return;
+    }
 
-        auto res = sgx_unseal_data(reinterpret_cast<sgx_sealed_data_t*>(jpSealedBlob.ptr + sealedBlobOffset),
-                                   authenticatedDataOutDataLen ? &deAuthenticatedData[0] : nullptr, 
-                                   authenticatedDataOutDataLen ? &authenticatedDataOutDataLen : nullptr, 
-                                   &deData[0], &decryptDataLen);
+    try {
+        JniPtr<uint8_t> jpAuthenticatedDataOut(jniEnv, authenticatedDataOut);
+        auto len = std::min<int>(authenticatedDataOutLength, authenticatedDataOutDataLen);
+        if (authenticatedDataOutLength && validateParameter(jpAuthenticatedDataOut, authenticatedDataOutOffset, len)) {
+            raiseException(jniEnv, getErrorMessage(SGX_ERROR_INVALID_PARAMETER));
+            return;
+        }
+        const bool directAuthenticatedData = authenticatedDataOutLength &&
+                static_cast<uint32_t>(authenticatedDataOutLength) >= authenticatedDataOutDataLen;
+        std::vector<uint8_t> deAuthenticatedData(directAuthenticatedData ? 0 : authenticatedDataOutDataLen);
+        uint8_t* authenticatedDataDest = directAuthenticatedData ?
+                jpAuthenticatedDataOut.ptr + authenticatedDataOutOffset : deAuthenticatedData.data();
+
+        auto res = sgx_unseal_data(sealedData,
+                                   authenticatedDataOutDataLen ? authenticatedDataDest : nullptr,
+                                   authenticatedDataOutDataLen ? &authenticatedDataOutDataLen : nullptr,
+                                   jpDataOut.ptr + dataOutOffset, &decryptDataLen);
         if (res != SGX_SUCCESS) {
             raiseException(jniEnv, getErrorMessage(res));
             return;
         }
 
         if (authenticatedDataOutLength) {
-            auto len = std::min<int>(authenticatedDataOutLength, authenticatedDataOutDataLen);
-            JniPtr<uint8_t> jpAuthenticatedDataOut(jniEnv, authenticatedDataOut);
-            if (validateParameter(jpAuthenticatedDataOut, authenticatedDataOutOffset, len)) {
-                raiseException(jniEnv, getErrorMessage(SGX_ERROR_INVALID_PARAMETER));
-                return;
+            if (!directAuthenticatedData) {
+                memcpy_s(jpAuthenticatedDataOut.ptr + authenticatedDataOutOffset,
+                         len,
+                         deAuthenticatedData.data(), len);
             }
-            memcpy_s(jpAuthenticatedDataOut.ptr + authenticatedDataOutOffset, 
-                     len,
-                     &deAuthenticatedData[0], deAuthenticatedData.size());
             // to write back to the jvm
             jpAuthenticatedDataOut.releaseMode = 0;
         }
 
-        memcpy_s(jpDataOut.ptr + dataOutOffset, dataOutLength, &deData[0], deData.size());
-
         // to write back to the jvm
         jpDataOut.releaseMode = 0;
     } catch (std::exception &e) {
@@ -322,14 +599,195 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_unsealData
     }
 }
 
+JNIEXPORT jint JNICALL Java_com_r3_conclave_enclave_internal_Native_sealStreamHeaderSize
+        (JNIEnv*, jclass) {
+    return static_cast<jint>(sgx_calc_sealed_data_size(sealStreamAuthenticatedDataSize,
+                                                       sizeof(sgx_aes_gcm_128bit_key_t)));
+}
+
+JNIEXPORT jlong JNICALL Java_com_r3_conclave_enclave_internal_Native_sealStreamInit
+        (JNIEnv* jniEnv, jclass, jbyteArray headerOut) {
+    const auto headerSize = sgx_calc_sealed_data_size(sealStreamAuthenticatedDataSize, sizeof(sgx_aes_gcm_128bit_key_t));
+    if (!validateArrayOffsetLength(jniEnv, headerOut, 0, headerSize, "header")) {
+        return 0;
+    }
+    auto stream = newSealStream(true);
+    if (!stream) {
+        raiseException(jniEnv, getErrorMessage(SGX_ERROR_OUT_OF_MEMORY));
+        return 0;
+    }
+
+    JniPtr<uint8_t> jpHeader(jniEnv, headerOut);
+    auto ret = sealRandomKey(sealStreamAuthenticatedData, sealStreamAuthenticatedDataSize,
+                             stream->key, jpHeader.ptr, headerSize);
+    if (ret != SGX_SUCCESS) {
+        deleteSealStream(stream);
+        raiseException(jniEnv, getErrorMessage(ret));
+        return 0;
+    }
+    jpHeader.releaseMode = 0; // to write back to the jvm
+    return reinterpret_cast<jlong>(stream);
+}
+
+JNIEXPORT jlong JNICALL Java_com_r3_conclave_enclave_internal_Native_unsealStreamInit
+        (JNIEnv* jniEnv, jclass, jbyteArray header, jint headerOffset, jint headerSize) {
+    if (!validateArrayOffsetLength(jniEnv, header, headerOffset, headerSize, "header")) {
+        return 0;
+    }
+    if (static_cast<uint32_t>(headerSize) !=
+        sgx_calc_sealed_data_size(sealStreamAuthenticatedDataSize, sizeof(sgx_aes_gcm_128bit_key_t))) {
+        raiseException(jniEnv, "invalid seal stream header");
+        return 0;
+    }
+    auto stream = newSealStream(false);
+    if (!stream) {
+        raiseException(jniEnv, getErrorMessage(SGX_ERROR_OUT_OF_MEMORY));
+        return 0;
+    }
+
+    JniPtr<uint8_t> jpHeader(jniEnv, header);
+    auto ret = unsealRandomKey(sealStreamAuthenticatedData, sealStreamAuthenticatedDataSize,
+                               jpHeader.ptr + headerOffset, stream->key);
+    if (ret != SGX_SUCCESS) {
+        deleteSealStream(stream);
+        raiseException(jniEnv, getErrorMessage(ret));
+        return 0;
+    }
+    return reinterpret_cast<jlong>(stream);
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sealStreamUpdate
+        (JNIEnv* jniEnv, jclass, jlong stream,
+         jbyteArray plaintext, jint plaintextOffset, jint plaintextSize,
+         jbyteArray output, jint outputOffset, jboolean last) {
+    sealStreamUpdate(jniEnv, stream, true, plaintext, plaintextOffset, plaintextSize, output, outputOffset, last);
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_unsealStreamUpdate
+        (JNIEnv* jniEnv, jclass, jlong stream,
+         jbyteArray sealedChunk, jint sealedChunkOffset, jint sealedChunkSize,
+         jbyteArray output, jint outputOffset, jboolean last) {
+    sealStreamUpdate(jniEnv, stream, false, sealedChunk, sealedChunkOffset, sealedChunkSize, output, outputOffset, last);
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sealStreamFree
+        (JNIEnv*, jclass, jlong stream) {
+    if (stream) {
+        deleteSealStream(reinterpret_cast<SealStream*>(stream));
+    }
+}
+
+JNIEXPORT jint JNICALL Java_com_r3_conclave_enclave_internal_Native_sealedBatchSize
+        (JNIEnv* jniEnv, jclass, jintArray offsetsIn) {
+    std::vector<jint> offsets;
+    return static_cast<jint>(readSealBatchOffsets(jniEnv, offsetsIn, offsets));
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sealDataBatch
+        (JNIEnv* jniEnv, jclass, jbyteArray plaintextIn, jintArray offsetsIn, jbyteArray sealedBatchOut) {
+    std::vector<jint> offsets;
+    const auto sealedBatchSize = readSealBatchOffsets(jniEnv, offsetsIn, offsets);
+    if (sealedBatchSize < 0) {
+        return;
+    }
+    const jint plaintextOffset = offsets.front();
+    const jint plaintextSize = offsets.back() - plaintextOffset;
+    if (!validateArrayOffsetLength(jniEnv, plaintextIn, plaintextOffset, plaintextSize, "plaintext") ||
+        !validateArrayOffsetLength(jniEnv, sealedBatchOut, 0, sealedBatchSize, "sealed batch")) {
+        return;
+    }
+    if (regionsOverlap(jniEnv, plaintextIn, plaintextOffset, plaintextSize, sealedBatchOut, 0, sealedBatchSize)) {
+        raiseException(jniEnv, "output overlaps input");
+        return;
+    }
+
+    JniPtr<uint8_t> jpPlaintext(jniEnv, plaintextIn);
+    JniPtr<uint8_t> jpSealedBatch(jniEnv, sealedBatchOut);
+    const uint32_t headerSize = sealBatchHeaderSize();
+    sgx_aes_gcm_128bit_key_t key;
+    auto ret = sealRandomKey(sealBatchAuthenticatedData, sealBatchAuthenticatedDataSize,
+                             key, jpSealedBatch.ptr, headerSize);
+
+    const uint32_t recordCount = offsets.size() - 1;
+    uint8_t* out = jpSealedBatch.ptr + headerSize;
+    for (uint32_t i = 0; i < recordCount && ret == SGX_SUCCESS; i++) {
+        const uint32_t size = offsets[i + 1] - offsets[i];
+        const SealBatchRecordParams params(i, recordCount);
+        // Empty records have no plaintext, their array may not even be pinned
+        const uint8_t* in = size > 0 ? jpPlaintext.ptr + offsets[i] : out;
+        ret = sgx_rijndael128GCM_encrypt(&key, in, size, out,
+                                         params.iv, sizeof(params.iv),
+                                         params.authenticatedData, sizeof(params.authenticatedData),
+                                         reinterpret_cast<sgx_aes_gcm_128bit_tag_t*>(out + size));
+        out += size + sealStreamTagSize;
+    }
+    memset_s(key, sizeof(key), 0, sizeof(key));
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return;
+    }
+    jpSealedBatch.releaseMode = 0; // to write back to the jvm
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_unsealDataBatch
+        (JNIEnv* jniEnv, jclass, jbyteArray sealedBatchIn, jint sealedBatchOffset, jint sealedBatchSize,
+         jintArray offsetsIn, jbyteArray plaintextOut) {
+    std::vector<jint> offsets;
+    const auto expectedSize = readSealBatchOffsets(jniEnv, offsetsIn, offsets);
+    if (expectedSize < 0) {
+        return;
+    }
+    if (sealedBatchSize != expectedSize) {
+        raiseException(jniEnv, "the sealed batch does not match the record offsets");
+        return;
+    }
+    const jint plaintextOffset = offsets.front();
+    const jint plaintextSize = offsets.back() - plaintextOffset;
+    if (!validateArrayOffsetLength(jniEnv, sealedBatchIn, sealedBatchOffset, sealedBatchSize, "sealed batch") ||
+        !validateArrayOffsetLength(jniEnv, plaintextOut, plaintextOffset, plaintextSize, "plaintext")) {
+        return;
+    }
+    if (regionsOverlap(jniEnv, sealedBatchIn, sealedBatchOffset, sealedBatchSize,
+                       plaintextOut, plaintextOffset, plaintextSize)) {
+        raiseException(jniEnv, "output overlaps input");
+        return;
+    }
+
+    JniPtr<uint8_t> jpSealedBatch(jniEnv, sealedBatchIn);
+    JniPtr<uint8_t> jpPlaintext(jniEnv, plaintextOut);
+    const uint8_t* in = jpSealedBatch.ptr + sealedBatchOffset;
+    sgx_aes_gcm_128bit_key_t key;
+    auto ret = unsealRandomKey(sealBatchAuthenticatedData, sealBatchAuthenticatedDataSize, in, key);
+
+    const uint32_t recordCount = offsets.size() - 1;
+    in += sealBatchHeaderSize();
+    for (uint32_t i = 0; i < recordCount && ret == SGX_SUCCESS; i++) {
+        const uint32_t size = offsets[i + 1] - offsets[i];
+        const SealBatchRecordParams params(i, recordCount);
+        uint8_t empty = 0;
+        uint8_t* out = size > 0 ? jpPlaintext.ptr + offsets[i] : &empty;
+        ret = sgx_rijndael128GCM_decrypt(&key, in, size, out,
+                                         params.iv, sizeof(params.iv),
+                                         params.authenticatedData, sizeof(params.authenticatedData),
+                                         reinterpret_cast<const sgx_aes_gcm_128bit_tag_t*>(in + size));
+        in += size + sealStreamTagSize;
+    }
+    memset_s(key, sizeof(key), 0, sizeof(key));
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return;
+    }
+    jpPlaintext.releaseMode = 0; // to write back to the jvm
+}
+
 JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_getKey
         (JNIEnv* jniEnv, jclass, jbyteArray keyRequestIn, jbyteArray keyOut) {
     auto *key_request = jniEnv->GetByteArrayElements(keyRequestIn, nullptr);
     auto *key = jniEnv->GetByteArrayElements(keyOut, nullptr);
 
-    auto return_code = sgx_get_key(
-            reinterpret_cast<const sgx_key_request_t *>(key_request),
-            reinterpret_cast<sgx_key_128bit_t *>(key)
+    auto return_code = r3::conclave::KeyCache::instance().get_key(
+            *reinterpret_cast<const sgx_key_request_t *>(key_request),
+            *reinterpret_cast<sgx_key_128bit_t *>(key)
     );
 
     jniEnv->ReleaseByteArrayElements(keyRequestIn, key_request, JNI_ABORT);
@@ -341,6 +799,169 @@ JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_getKey
     }
 }
 
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_getKeys
+        (JNIEnv* jniEnv, jclass, jbyteArray keyRequestsIn, jbyteArray keysOut) {
+    if (!keyRequestsIn) {
+        raiseException(jniEnv, "invalid key requests");
+        return;
+    }
+    const jsize requestsSize = jniEnv->GetArrayLength(keyRequestsIn);
+    if (requestsSize % sizeof(sgx_key_request_t) != 0) {
+        raiseException(jniEnv, "the key requests size is not a multiple of the key request size");
+        return;
+    }
+    const jsize count = requestsSize / sizeof(sgx_key_request_t);
+    if (!validateArrayOffsetLength(jniEnv, keysOut, 0, count * static_cast<jint>(sizeof(sgx_key_128bit_t)), "keys")) {
+        return;
+    }
+
+    JniPtr<uint8_t> jpKeyRequests(jniEnv, keyRequestsIn);
+    JniPtr<uint8_t> jpKeys(jniEnv, keysOut);
+    auto& cache = r3::conclave::KeyCache::instance();
+    for (jsize i = 0; i < count; i++) {
+        const auto ret = cache.get_key(
+                reinterpret_cast<const sgx_key_request_t*>(jpKeyRequests.ptr)[i],
+                reinterpret_cast<sgx_key_128bit_t*>(jpKeys.ptr)[i]
+        );
+        if (ret != SGX_SUCCESS) {
+            raiseException(jniEnv, getErrorMessage(ret));
+            return;
+        }
+    }
+    jpKeys.releaseMode = 0; // to write back to the jvm
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_aesGcmEncrypt
+        (JNIEnv* jniEnv, jclass, jbyteArray key, jbyteArray iv,
+         jbyteArray aad, jint aadOffset, jint aadSize,
+         jbyteArray plaintext, jint plaintextOffset, jint plaintextSize,
+         jbyteArray output, jint outputOffset) {
+    aesGcm(jniEnv, true, key, iv, aad, aadOffset, aadSize, plaintext, plaintextOffset, plaintextSize,
+           output, outputOffset);
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_aesGcmDecrypt
+        (JNIEnv* jniEnv, jclass, jbyteArray key, jbyteArray iv,
+         jbyteArray aad, jint aadOffset, jint aadSize,
+         jbyteArray ciphertext, jint ciphertextOffset, jint ciphertextSize,
+         jbyteArray output, jint outputOffset) {
+    aesGcm(jniEnv, false, key, iv, aad, aadOffset, aadSize, ciphertext, ciphertextOffset, ciphertextSize,
+           output, outputOffset);
+}
+
+JNIEXPORT jlong JNICALL Java_com_r3_conclave_enclave_internal_Native_sha256Init
+        (JNIEnv* jniEnv, jclass) {
+    sgx_sha_state_handle_t handle = nullptr;
+    const auto ret = sgx_sha256_init(&handle);
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return 0;
+    }
+    return reinterpret_cast<jlong>(handle);
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sha256Update
+        (JNIEnv* jniEnv, jclass, jlong handle, jbyteArray input, jint inputOffset, jint inputSize) {
+    if (!validateArrayOffsetLength(jniEnv, input, inputOffset, inputSize, "input") || inputSize == 0) {
+        return;
+    }
+    JniPtr<uint8_t> jpInput(jniEnv, input);
+    const auto ret = sgx_sha256_update(jpInput.ptr + inputOffset, inputSize,
+                                       reinterpret_cast<sgx_sha_state_handle_t>(handle));
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sha256Final
+        (JNIEnv* jniEnv, jclass, jlong handle, jbyteArray output, jint outputOffset) {
+    if (!validateArrayOffsetLength(jniEnv, output, outputOffset, sizeof(sgx_sha256_hash_t), "output")) {
+        return;
+    }
+    sgx_sha256_hash_t hash;
+    const auto ret = sgx_sha256_get_hash(reinterpret_cast<sgx_sha_state_handle_t>(handle), &hash);
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return;
+    }
+    jniEnv->SetByteArrayRegion(output, outputOffset, sizeof(hash), reinterpret_cast<const jbyte*>(hash));
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_sha256Free
+        (JNIEnv*, jclass, jlong handle) {
+    if (handle) {
+        sgx_sha256_close(reinterpret_cast<sgx_sha_state_handle_t>(handle));
+    }
+}
+
+JNIEXPORT jlong JNICALL Java_com_r3_conclave_enclave_internal_Native_hmacSha256Init
+        (JNIEnv* jniEnv, jclass, jbyteArray key) {
+    const jint keySize = key ? jniEnv->GetArrayLength(key) : 0;
+    if (keySize == 0) {
+        raiseException(jniEnv, "HMAC key must not be empty");
+        return 0;
+    }
+    JniPtr<uint8_t> jpKey(jniEnv, key);
+    sgx_hmac_state_handle_t handle = nullptr;
+    const auto ret = sgx_hmac256_init(jpKey.ptr, keySize, &handle);
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return 0;
+    }
+    return reinterpret_cast<jlong>(handle);
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_hmacSha256Update
+        (JNIEnv* jniEnv, jclass, jlong handle, jbyteArray input, jint inputOffset, jint inputSize) {
+    if (!validateArrayOffsetLength(jniEnv, input, inputOffset, inputSize, "input") || inputSize == 0) {
+        return;
+    }
+    JniPtr<uint8_t> jpInput(jniEnv, input);
+    const auto ret = sgx_hmac256_update(jpInput.ptr + inputOffset, inputSize,
+                                        reinterpret_cast<sgx_hmac_state_handle_t>(handle));
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_hmacSha256Final
+        (JNIEnv* jniEnv, jclass, jlong handle, jbyteArray output, jint outputOffset) {
+    if (!validateArrayOffsetLength(jniEnv, output, outputOffset, sizeof(sgx_sha256_hash_t), "output")) {
+        return;
+    }
+    sgx_sha256_hash_t mac;
+    const auto ret = sgx_hmac256_final(mac, sizeof(mac), reinterpret_cast<sgx_hmac_state_handle_t>(handle));
+    if (ret != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(ret));
+        return;
+    }
+    jniEnv->SetByteArrayRegion(output, outputOffset, sizeof(mac), reinterpret_cast<const jbyte*>(mac));
+    memset_s(mac, sizeof(mac), 0, sizeof(mac));
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_hmacSha256Free
+        (JNIEnv*, jclass, jlong handle) {
+    if (handle) {
+        sgx_hmac256_close(reinterpret_cast<sgx_hmac_state_handle_t>(handle));
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_r3_conclave_enclave_internal_Native_x25519
+        (JNIEnv* jniEnv, jclass, jbyteArray privateKey, jbyteArray publicKey, jbyteArray output, jint outputOffset) {
+    const jint keySize = r3::conclave::x25519_key_size;
+    if (!validateArrayOffsetLength(jniEnv, privateKey, 0, keySize, "privateKey") ||
+        (publicKey && !validateArrayOffsetLength(jniEnv, publicKey, 0, keySize, "publicKey")) ||
+        !validateArrayOffsetLength(jniEnv, output, outputOffset, keySize, "output")) {
+        return;
+    }
+    JniPtr<uint8_t> jpPrivateKey(jniEnv, privateKey);
+    JniPtr<uint8_t> jpPublicKey(jniEnv, publicKey);
+    uint8_t result[r3::conclave::x25519_key_size];
+    r3::conclave::x25519(result, jpPrivateKey.ptr, jpPublicKey.ptr);
+    jniEnv->SetByteArrayRegion(output, outputOffset, keySize, reinterpret_cast<const jbyte*>(result));
+    memset_s(result, sizeof(result), 0, sizeof(result));
+}
+
 DLSYM_STATIC {
     DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_jvmOCall);
     DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_createReport);
@@ -351,5 +972,26 @@ DLSYM_STATIC {
     DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_authenticatedDataSize);
     DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_plaintextSizeFromSealedData);
     DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_getKey);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_getKeys);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_aesGcmEncrypt);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_aesGcmDecrypt);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sha256Init);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sha256Update);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sha256Final);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sha256Free);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_hmacSha256Init);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_hmacSha256Update);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_hmacSha256Final);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_hmacSha256Free);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_x25519);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sealStreamHeaderSize);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sealStreamInit);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_unsealStreamInit);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sealStreamUpdate);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_unsealStreamUpdate);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sealStreamFree);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sealedBatchSize);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_sealDataBatch);
+    DLSYM_ADD(Java_com_r3_conclave_enclave_internal_Native_unsealDataBatch);
 };
 }
@@ -0,0 +1,71 @@
+#include "key_cache.h"
+
+#include <cstring>
+#include <sgx_utils.h>
+
+namespace r3 { namespace conclave {
+
+KeyCache& KeyCache::instance() {
+    static KeyCache cache;
+    return cache;
+}
+
+sgx_status_t KeyCache::get_key(const sgx_key_request_t& key_request, sgx_key_128bit_t& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clock_++;
+    for (size_t i = 0; i < size_; i++) {
+        auto& entry = entries_[i];
+        if (memcmp(&entry.key_request, &key_request, sizeof(key_request)) == 0) {
+            entry.last_used = clock_;
+            memcpy(key, entry.key, sizeof(key));
+            return SGX_SUCCESS;
+        }
+    }
+
+    // The lock is held while deriving, so that concurrent requests for the same key derive it once
+    sgx_key_128bit_t derived_key;
+    const auto ret = sgx_get_key(&key_request, &derived_key);
+    if (ret != SGX_SUCCESS) {
+        return ret;
+    }
+
+    Entry* entry;
+    if (size_ < capacity) {
+        entry = &entries_[size_++];
+    } else {
+        // Evict the least recently used key
+        entry = &entries_[0];
+        for (size_t i = 1; i < capacity; i++) {
+            if (entries_[i].last_used < entry->last_used) {
+                entry = &entries_[i];
+            }
+        }
+        erase(*entry);
+    }
+    memcpy(&entry->key_request, &key_request, sizeof(key_request));
+    memcpy(entry->key, derived_key, sizeof(derived_key));
+    entry->last_used = clock_;
+    memcpy(key, derived_key, sizeof(derived_key));
+    memset_s(derived_key, sizeof(derived_key), 0, sizeof(derived_key));
+    return SGX_SUCCESS;
+}
+
+void KeyCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < size_; i++) {
+        erase(entries_[i]);
+    }
+    size_ = 0;
+}
+
+KeyCache::~KeyCache() {
+    clear();
+}
+
+void KeyCache::erase(Entry& entry) {
+    memset_s(entry.key, sizeof(entry.key), 0, sizeof(entry.key));
+    memset_s(&entry.key_request, sizeof(entry.key_request), 0, sizeof(entry.key_request));
+    entry.last_used = 0;
+}
+
+}}
@@ -1,6 +1,35 @@
 //
-// OS Stubs for functions declared in statvfs.h
+// OS functions declared in sys/statvfs.h
 //
 #include "vm_enclave_layer.h"
+#include "conclave-statvfs.h"
 
-STUB(fstatvfs64);
\ No newline at end of file
+extern "C" {
+
+    int statvfs64(const char* path, struct statvfs64* buf) {
+        enclave_trace("statvfs64\n");
+        int err = 0;
+        const int res = statvfs64_impl(path, buf, err);
+        errno = err;
+        return res;
+    }
+
+    int fstatvfs64(int fd, struct statvfs64* buf) {
+        enclave_trace("fstatvfs64\n");
+        int err = 0;
+        const int res = fstatvfs64_impl(fd, buf, err);
+        errno = err;
+        return res;
+    }
+
+    // On x86_64 struct statvfs and struct statvfs64 have the same layout
+    int statvfs(const char* path, struct statvfs* buf) {
+        enclave_trace("statvfs\n");
+        return statvfs64(path, reinterpret_cast<struct statvfs64*>(buf));
+    }
+
+    int fstatvfs(int fd, struct statvfs* buf) {
+        enclave_trace("fstatvfs\n");
+        return fstatvfs64(fd, reinterpret_cast<struct statvfs64*>(buf));
+    }
+}
@@ -0,0 +1,330 @@
+//
+// X25519 with 64-bit limbs, based on the public domain curve25519-donna-c64 by Adam Langley.
+//
+// A field element is held in five 51-bit limbs and the products are computed with 128-bit integers, which is much
+// faster than the 26-bit limbs of the Java implementation. There are no branches or memory accesses which depend on
+// secret data: the Montgomery ladder uses conditional swaps and the inversion is a fixed exponentiation.
+//
+#include "x25519.h"
+
+#include <cstring>
+#include <utility>
+
+namespace r3 { namespace conclave {
+
+namespace {
+
+using limb = uint64_t;
+using felem = limb[5];
+using uint128 = unsigned __int128;
+
+constexpr limb mask51 = 0x7ffffffffffff;
+
+// out += in
+inline void fsum(felem out, const felem in) {
+    for (int i = 0; i < 5; i++) {
+        out[i] += in[i];
+    }
+}
+
+// out = in - out, adding 2p first so that the limbs don't go negative
+inline void fdifference_backwards(felem out, const felem in) {
+    constexpr limb two54m152 = (limb(1) << 54) - 152;
+    constexpr limb two54m8 = (limb(1) << 54) - 8;
+    out[0] = in[0] + two54m152 - out[0];
+    for (int i = 1; i < 5; i++) {
+        out[i] = in[i] + two54m8 - out[i];
+    }
+}
+
+// out = in * scalar
+inline void fscalar_product(felem out, const felem in, const limb scalar) {
+    uint128 a = uint128(in[0]) * scalar;
+    out[0] = limb(a) & mask51;
+    for (int i = 1; i < 5; i++) {
+        a = uint128(in[i]) * scalar + limb(a >> 51);
+        out[i] = limb(a) & mask51;
+    }
+    out[0] += limb(a >> 51) * 19;
+}
+
+// Carries the 128-bit products into out, reducing with 2^255 = 19
+inline void fcarry(felem out, uint128 t[5]) {
+    limb r0 = limb(t[0]) & mask51;
+    t[1] += limb(t[0] >> 51);
+    limb r1 = limb(t[1]) & mask51;
+    t[2] += limb(t[1] >> 51);
+    limb r2 = limb(t[2]) & mask51;
+    t[3] += limb(t[2] >> 51);
+    limb r3 = limb(t[3]) & mask51;
+    t[4] += limb(t[3] >> 51);
+    limb r4 = limb(t[4]) & mask51;
+    r0 += limb(t[4] >> 51) * 19;
+    limb c = r0 >> 51;
+    r0 &= mask51;
+    r1 += c;
+    c = r1 >> 51;
+    r1 &= mask51;
+    r2 += c;
+    out[0] = r0;
+    out[1] = r1;
+    out[2] = r2;
+    out[3] = r3;
+    out[4] = r4;
+}
+
+// out = in2 * in, out can be the same as an input
+inline void fmul(felem out, const felem in2, const felem in) {
+    limb r0 = in[0], r1 = in[1], r2 = in[2], r3 = in[3], r4 = in[4];
+    const limb s0 = in2[0], s1 = in2[1], s2 = in2[2], s3 = in2[3], s4 = in2[4];
+    uint128 t[5];
+
+    t[0] = uint128(r0) * s0;
+    t[1] = uint128(r0) * s1 + uint128(r1) * s0;
+    t[2] = uint128(r0) * s2 + uint128(r2) * s0 + uint128(r1) * s1;
+    t[3] = uint128(r0) * s3 + uint128(r3) * s0 + uint128(r1) * s2 + uint128(r2) * s1;
+    t[4] = uint128(r0) * s4 + uint128(r4) * s0 + uint128(r3) * s1 + uint128(r1) * s3 + uint128(r2) * s2;
+
+    r4 *= 19;
+    r1 *= 19;
+    r2 *= 19;
+    r3 *= 19;
+
+    t[0] += uint128(r4) * s1 + uint128(r1) * s4 + uint128(r2) * s3 + uint128(r3) * s2;
+    t[1] += uint128(r4) * s2 + uint128(r2) * s4 + uint128(r3) * s3;
+    t[2] += uint128(r4) * s3 + uint128(r3) * s4;
+    t[3] += uint128(r4) * s4;
+
+    fcarry(out, t);
+}
+
+// out = in^(2^count), out can be the same as in
+inline void fsquare_times(felem out, const felem in, int count) {
+    limb r0 = in[0], r1 = in[1], r2 = in[2], r3 = in[3], r4 = in[4];
+    uint128 t[5];
+
+    do {
+        const limb d0 = r0 * 2;
+        const limb d1 = r1 * 2;
+        const limb d2 = r2 * 2 * 19;
+        const limb d419 = r4 * 19;
+        const limb d4 = d419 * 2;
+
+        t[0] = uint128(r0) * r0 + uint128(d4) * r1 + uint128(d2) * r3;
+        t[1] = uint128(d0) * r1 + uint128(d4) * r2 + uint128(r3) * (r3 * 19);
+        t[2] = uint128(d0) * r2 + uint128(r1) * r1 + uint128(d4) * r3;
+        t[3] = uint128(d0) * r3 + uint128(d1) * r2 + uint128(r4) * d419;
+        t[4] = uint128(d0) * r4 + uint128(d1) * r3 + uint128(r2) * r2;
+
+        felem r;
+        fcarry(r, t);
+        r0 = r[0];
+        r1 = r[1];
+        r2 = r[2];
+        r3 = r[3];
+        r4 = r[4];
+    } while (--count);
+
+    out[0] = r0;
+    out[1] = r1;
+    out[2] = r2;
+    out[3] = r3;
+    out[4] = r4;
+}
+
+inline limb load_limb(const uint8_t* in) {
+    limb value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+}
+
+inline void store_limb(uint8_t* out, limb value) {
+    memcpy(out, &value, sizeof(value));
+}
+
+// Little-endian bytes to a field element, the top bit is ignored
+void fexpand(felem out, const uint8_t* in) {
+    out[0] = load_limb(in) & mask51;
+    out[1] = (load_limb(in + 6) >> 3) & mask51;
+    out[2] = (load_limb(in + 12) >> 6) & mask51;
+    out[3] = (load_limb(in + 19) >> 1) & mask51;
+    out[4] = (load_limb(in + 24) >> 12) & mask51;
+}
+
+// Field element to little-endian bytes, fully reduced modulo 2^255 - 19
+void fcontract(uint8_t* out, const felem in) {
+    uint128 t[5];
+    for (int i = 0; i < 5; i++) {
+        t[i] = in[i];
+    }
+
+    auto carry = [&t](bool wrap) {
+        t[1] += t[0] >> 51;
+        t[0] &= mask51;
+        t[2] += t[1] >> 51;
+        t[1] &= mask51;
+        t[3] += t[2] >> 51;
+        t[2] &= mask51;
+        t[4] += t[3] >> 51;
+        t[3] &= mask51;
+        if (wrap) {
+            t[0] += 19 * (t[4] >> 51);
+        }
+        t[4] &= mask51;
+    };
+
+    carry(true);
+    carry(true);
+
+    // t is now between 0 and 2^255 - 1. Adding 19 and carrying makes the values from 2^255 - 19 wrap around.
+    t[0] += 19;
+    carry(true);
+
+    // Subtract the 19 back by adding 2^255 - 19 and dropping the 2^255.
+    t[0] += 0x8000000000000 - 19;
+    for (int i = 1; i < 5; i++) {
+        t[i] += 0x8000000000000 - 1;
+    }
+    carry(false);
+
+    store_limb(out, limb(t[0]) | (limb(t[1]) << 51));
+    store_limb(out + 8, (limb(t[1]) >> 13) | (limb(t[2]) << 38));
+    store_limb(out + 16, (limb(t[2]) >> 26) | (limb(t[3]) << 25));
+    store_limb(out + 24, (limb(t[3]) >> 39) | (limb(t[4]) << 12));
+}
+
+// Swaps a and b if iswap is 1, in constant time
+inline void swap_conditional(felem a, felem b, limb iswap) {
+    const limb swap = -iswap;
+    for (int i = 0; i < 5; i++) {
+        const limb x = swap & (a[i] ^ b[i]);
+        a[i] ^= x;
+        b[i] ^= x;
+    }
+}
+
+// One step of the Montgomery ladder: (x2:z2) = 2Q and (x3:z3) = Q + Q', where Q = (x:z), Q' = (xprime:zprime) and
+// qmqp = Q - Q'. The inputs are clobbered.
+void fmonty(felem x2, felem z2, felem x3, felem z3,
+            felem x, felem z, felem xprime, felem zprime, const felem qmqp) {
+    felem origx, origxprime, zzz, xx, zz, xxprime, zzprime, zzzprime;
+
+    memcpy(origx, x, sizeof(felem));
+    fsum(x, z);
+    fdifference_backwards(z, origx);
+
+    memcpy(origxprime, xprime, sizeof(felem));
+    fsum(xprime, zprime);
+    fdifference_backwards(zprime, origxprime);
+    fmul(xxprime, xprime, z);
+    fmul(zzprime, x, zprime);
+    memcpy(origxprime, xxprime, sizeof(felem));
+    fsum(xxprime, zzprime);
+    fdifference_backwards(zzprime, origxprime);
+    fsquare_times(x3, xxprime, 1);
+    fsquare_times(zzzprime, zzprime, 1);
+    fmul(z3, zzzprime, qmqp);
+
+    fsquare_times(xx, x, 1);
+    fsquare_times(zz, z, 1);
+    fmul(x2, xx, zz);
+    fdifference_backwards(zz, xx);
+    fscalar_product(zzz, zz, 121665);
+    fsum(zzz, xx);
+    fmul(z2, zz, zzz);
+}
+
+// (resultx:resultz) = n * q
+void cmult(felem resultx, felem resultz, const uint8_t* n, const felem q) {
+    felem a = {0}, b = {1}, c = {1}, d = {0};
+    felem e = {0}, f = {1}, g = {0}, h = {1};
+    limb* nqpqx = a;
+    limb* nqpqz = b;
+    limb* nqx = c;
+    limb* nqz = d;
+    limb* nqpqx2 = e;
+    limb* nqpqz2 = f;
+    limb* nqx2 = g;
+    limb* nqz2 = h;
+
+    memcpy(nqpqx, q, sizeof(felem));
+
+    for (int i = 0; i < 32; i++) {
+        uint8_t byte = n[31 - i];
+        for (int j = 0; j < 8; j++) {
+            const limb bit = byte >> 7;
+
+            swap_conditional(nqx, nqpqx, bit);
+            swap_conditional(nqz, nqpqz, bit);
+            fmonty(nqx2, nqz2, nqpqx2, nqpqz2, nqx, nqz, nqpqx, nqpqz, q);
+            swap_conditional(nqx2, nqpqx2, bit);
+            swap_conditional(nqz2, nqpqz2, bit);
+
+            std::swap(nqx, nqx2);
+            std::swap(nqz, nqz2);
+            std::swap(nqpqx, nqpqx2);
+            std::swap(nqpqz, nqpqz2);
+
+            byte <<= 1;
+        }
+    }
+
+    memcpy(resultx, nqx, sizeof(felem));
+    memcpy(resultz, nqz, sizeof(felem));
+}
+
+// out = z^(p - 2) = 1 / z
+void crecip(felem out, const felem z) {
+    felem a, t0, b, c;
+
+    fsquare_times(a, z, 1);         // 2
+    fsquare_times(t0, a, 2);        // 8
+    fmul(b, t0, z);                 // 9
+    fmul(a, b, a);                  // 11
+    fsquare_times(t0, a, 1);        // 22
+    fmul(b, t0, b);                 // 2^5 - 2^0
+    fsquare_times(t0, b, 5);        // 2^10 - 2^5
+    fmul(b, t0, b);                 // 2^10 - 2^0
+    fsquare_times(t0, b, 10);       // 2^20 - 2^10
+    fmul(c, t0, b);                 // 2^20 - 2^0
+    fsquare_times(t0, c, 20);       // 2^40 - 2^20
+    fmul(t0, t0, c);                // 2^40 - 2^0
+    fsquare_times(t0, t0, 10);      // 2^50 - 2^10
+    fmul(b, t0, b);                 // 2^50 - 2^0
+    fsquare_times(t0, b, 50);       // 2^100 - 2^50
+    fmul(c, t0, b);                 // 2^100 - 2^0
+    fsquare_times(t0, c, 100);      // 2^200 - 2^100
+    fmul(t0, t0, c);                // 2^200 - 2^0
+    fsquare_times(t0, t0, 50);      // 2^250 - 2^50
+    fmul(t0, t0, b);                // 2^250 - 2^0
+    fsquare_times(t0, t0, 5);       // 2^255 - 2^5
+    fmul(out, t0, a);               // 2^255 - 21
+}
+
+const uint8_t base_point[x25519_key_size] = {9};
+
+}
+
+void x25519(uint8_t out[x25519_key_size], const uint8_t scalar[x25519_key_size], const uint8_t point[x25519_key_size]) {
+    uint8_t e[x25519_key_size];
+    felem bp, x, z, zmone;
+
+    memcpy(e, scalar, sizeof(e));
+    e[0] &= 248;
+    e[31] &= 127;
+    e[31] |= 64;
+
+    fexpand(bp, point ? point : base_point);
+    cmult(x, z, e, bp);
+    crecip(zmone, z);
+    fmul(z, x, zmone);
+    fcontract(out, z);
+
+    // The intermediate values depend on the private key
+    memset_s(e, sizeof(e), 0, sizeof(e));
+    memset_s(x, sizeof(x), 0, sizeof(x));
+    memset_s(z, sizeof(z), 0, sizeof(z));
+    memset_s(zmone, sizeof(zmone), 0, sizeof(zmone));
+}
+
+}}
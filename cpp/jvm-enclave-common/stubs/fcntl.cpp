@@ -39,4 +39,32 @@ extern "C" {
 	errno = err;
 	return res;
     }
+
+
+    int fallocate64(int fd, int mode, off64_t offset, off64_t len) {
+	enclave_trace("fallocate64(%d, %d)\n", fd, mode);
+	int err = 0;
+	const int res = fallocate_impl(fd, mode, static_cast<off_t>(offset), static_cast<off_t>(len), err);
+	errno = err;
+	return res;
+    }
+
+
+    int fallocate(int fd, int mode, off_t offset, off_t len) {
+	return fallocate64(fd, mode, offset, len);
+    }
+
+
+    // Unlike fallocate, posix_fallocate returns the error number instead of setting errno
+    int posix_fallocate64(int fd, off64_t offset, off64_t len) {
+	enclave_trace("posix_fallocate64(%d)\n", fd);
+	int err = 0;
+	const int res = fallocate_impl(fd, 0, static_cast<off_t>(offset), static_cast<off_t>(len), err);
+	return res == 0 ? 0 : err;
+    }
+
+
+    int posix_fallocate(int fd, off_t offset, off_t len) {
+	return posix_fallocate64(fd, offset, len);
+    }
 }
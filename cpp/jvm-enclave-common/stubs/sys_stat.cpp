@@ -114,10 +114,4 @@ extern "C" {
         errno = ENOSYS;
         return -1;
     }
-
-    int statvfs64 (const char *file, struct statvfs64 *buf) {
-        enclave_trace("statvfs64\n");
-        errno = ENOSYS;
-        return -1;
-    }    
 }
@@ -237,7 +237,10 @@ extern "C" {
 
     int fsync(int fd) {
         enclave_trace("fsync\n");
-        return 0;
+        int err = 0;
+        const int res = fsync_impl(fd, err);
+        errno = err;
+        return res;
     }
 
     pid_t getpid(void) {
@@ -273,7 +276,10 @@ extern "C" {
 
     int fdatasync(int fd) {
         enclave_trace("fsync\n");
-        return 0;
+        int err = 0;
+        const int res = fsync_impl(fd, err);
+        errno = err;
+        return res;
     }
 
     int ftruncate(int fd, off_t length) {
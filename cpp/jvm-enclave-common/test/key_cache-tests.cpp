@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <sgx_utils.h>
+
+using namespace std;
+
+// memset_s is provided by the SGX trusted libc, this one records the bytes that it zeroises
+static vector<vector<uint8_t>> zeroised;
+
+static int record_memset_s(void* dest, size_t destsz, int ch, size_t count) {
+    const auto* bytes = static_cast<const uint8_t*>(dest);
+    zeroised.emplace_back(bytes, bytes + count);
+    memset(dest, ch, count);
+    return 0;
+}
+
+#define memset_s(dest, destsz, ch, count) record_memset_s(dest, destsz, ch, count)
+
+// sgx_get_key (EGETKEY) derives a key which depends on all the bytes of the request
+static int get_key_calls = 0;
+static sgx_status_t get_key_status = SGX_SUCCESS;
+
+sgx_status_t sgx_get_key(const sgx_key_request_t* key_request, sgx_key_128bit_t* key) {
+    get_key_calls++;
+    if (get_key_status != SGX_SUCCESS) {
+        return get_key_status;
+    }
+    const auto* bytes = reinterpret_cast<const uint8_t*>(key_request);
+    memset(*key, 0, sizeof(sgx_key_128bit_t));
+    for (size_t i = 0; i < sizeof(sgx_key_request_t); i++) {
+        (*key)[i % sizeof(sgx_key_128bit_t)] = (*key)[i % sizeof(sgx_key_128bit_t)] * 31 + bytes[i] + 1;
+    }
+    return SGX_SUCCESS;
+}
+
+#include <key_cache.cpp>
+
+using namespace r3::conclave;
+
+// The requests differ in their last bytes, so that the whole request is compared
+static sgx_key_request_t request(uint32_t id) {
+    sgx_key_request_t key_request;
+    memset(&key_request, 0, sizeof(key_request));
+    memcpy(reinterpret_cast<uint8_t*>(&key_request) + sizeof(key_request) - sizeof(id), &id, sizeof(id));
+    return key_request;
+}
+
+static vector<uint8_t> derived(uint32_t id) {
+    const sgx_key_request_t key_request = request(id);
+    sgx_key_128bit_t key;
+    const int calls = get_key_calls;
+    sgx_get_key(&key_request, &key);
+    get_key_calls = calls;
+    return vector<uint8_t>(key, key + sizeof(key));
+}
+
+static bool was_zeroised(const vector<uint8_t>& bytes) {
+    return find(zeroised.begin(), zeroised.end(), bytes) != zeroised.end();
+}
+
+class key_cache : public ::testing::Test {
+protected:
+    void SetUp() override {
+        KeyCache::instance().clear();
+        zeroised.clear();
+        get_key_calls = 0;
+        get_key_status = SGX_SUCCESS;
+    }
+
+    // Returns the number of derivations needed to get the key
+    int get(uint32_t id) {
+        const int calls = get_key_calls;
+        sgx_key_128bit_t key;
+        EXPECT_EQ(SGX_SUCCESS, KeyCache::instance().get_key(request(id), key));
+        EXPECT_EQ(derived(id), vector<uint8_t>(key, key + sizeof(key))) << id;
+        return get_key_calls - calls;
+    }
+};
+
+TEST_F(key_cache, derives_a_key_once) {
+    EXPECT_EQ(1, get(1));
+    EXPECT_EQ(0, get(1));
+    EXPECT_EQ(1, get(1 << 24));
+    EXPECT_EQ(0, get(1));
+    EXPECT_EQ(0, get(1 << 24));
+}
+
+TEST_F(key_cache, evicts_the_least_recently_used_key) {
+    for (uint32_t id = 0; id < KeyCache::capacity; id++) {
+        EXPECT_EQ(1, get(id));
+    }
+    // The first key is used again, so the second one is the least recently used
+    EXPECT_EQ(0, get(0));
+    EXPECT_EQ(1, get(KeyCache::capacity));
+
+    EXPECT_EQ(0, get(0));
+    EXPECT_EQ(0, get(KeyCache::capacity));
+    for (uint32_t id = 2; id < KeyCache::capacity; id++) {
+        EXPECT_EQ(0, get(id)) << id;
+    }
+    EXPECT_EQ(1, get(1));
+}
+
+TEST_F(key_cache, zeroises_an_evicted_key) {
+    for (uint32_t id = 0; id < KeyCache::capacity; id++) {
+        get(id);
+    }
+    zeroised.clear();
+    get(KeyCache::capacity);
+
+    const sgx_key_request_t evicted_request = request(0);
+    const auto* request_bytes = reinterpret_cast<const uint8_t*>(&evicted_request);
+    EXPECT_TRUE(was_zeroised(derived(0)));
+    EXPECT_TRUE(was_zeroised(vector<uint8_t>(request_bytes, request_bytes + sizeof(evicted_request))));
+    EXPECT_FALSE(was_zeroised(derived(1)));
+}
+
+TEST_F(key_cache, zeroises_the_keys_when_cleared) {
+    for (uint32_t id = 0; id < 3; id++) {
+        get(id);
+    }
+    zeroised.clear();
+    KeyCache::instance().clear();
+
+    for (uint32_t id = 0; id < 3; id++) {
+        EXPECT_TRUE(was_zeroised(derived(id))) << id;
+        EXPECT_EQ(1, get(id)) << id;
+    }
+}
+
+TEST_F(key_cache, does_not_cache_a_failed_derivation) {
+    for (uint32_t id = 0; id < KeyCache::capacity; id++) {
+        get(id);
+    }
+    get_key_status = SGX_ERROR_INVALID_PARAMETER;
+    sgx_key_128bit_t key;
+    memset(key, 0xAA, sizeof(key));
+    EXPECT_EQ(SGX_ERROR_INVALID_PARAMETER, KeyCache::instance().get_key(request(KeyCache::capacity), key));
+    EXPECT_EQ(vector<uint8_t>(sizeof(key), 0xAA), vector<uint8_t>(key, key + sizeof(key)));
+
+    // Nothing was evicted, and the failed request is derived again
+    get_key_status = SGX_SUCCESS;
+    for (uint32_t id = 0; id < KeyCache::capacity; id++) {
+        EXPECT_EQ(0, get(id)) << id;
+    }
+    EXPECT_EQ(1, get(KeyCache::capacity));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
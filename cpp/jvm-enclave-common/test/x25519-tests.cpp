@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+
+// memset_s is provided by the SGX trusted libc
+#define memset_s(dest, destsz, ch, count) memset(dest, ch, count)
+
+#include <x25519.cpp>
+
+using namespace std;
+using namespace r3::conclave;
+
+static void from_hex(const string& hex, uint8_t* out) {
+    for (size_t i = 0; i < x25519_key_size; i++) {
+        out[i] = static_cast<uint8_t>(stoi(hex.substr(i * 2, 2), nullptr, 16));
+    }
+}
+
+static bool equals_hex(const uint8_t* bytes, const string& hex) {
+    uint8_t expected[x25519_key_size];
+    from_hex(hex, expected);
+    return memcmp(bytes, expected, x25519_key_size) == 0;
+}
+
+// Test vectors of RFC 7748 section 5.2
+TEST(x25519, rfc7748_vector) {
+    uint8_t scalar[x25519_key_size], point[x25519_key_size], out[x25519_key_size];
+    from_hex("a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4", scalar);
+    from_hex("e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c", point);
+    x25519(out, scalar, point);
+    EXPECT_TRUE(equals_hex(out, "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"));
+}
+
+TEST(x25519, rfc7748_iterations) {
+    uint8_t k[x25519_key_size] = {9}, u[x25519_key_size] = {9}, out[x25519_key_size];
+    for (int i = 1; i <= 1000; i++) {
+        x25519(out, k, u);
+        memcpy(u, k, x25519_key_size);
+        memcpy(k, out, x25519_key_size);
+        if (i == 1) {
+            EXPECT_TRUE(equals_hex(k, "422c8e7a6227d7bca1350b3e2bb7279f7897b87bb6854b783c60e80311ae3079"));
+        }
+    }
+    EXPECT_TRUE(equals_hex(k, "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51"));
+}
+
+// Diffie-Hellman example of RFC 7748 section 6.1
+TEST(x25519, rfc7748_diffie_hellman) {
+    uint8_t alice[x25519_key_size], bob[x25519_key_size];
+    uint8_t alice_public[x25519_key_size], bob_public[x25519_key_size];
+    uint8_t alice_shared[x25519_key_size], bob_shared[x25519_key_size];
+    from_hex("77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a", alice);
+    from_hex("5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb", bob);
+
+    x25519(alice_public, alice, nullptr);
+    x25519(bob_public, bob, nullptr);
+    EXPECT_TRUE(equals_hex(alice_public, "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a"));
+    EXPECT_TRUE(equals_hex(bob_public, "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f"));
+
+    x25519(alice_shared, alice, bob_public);
+    x25519(bob_shared, bob, alice_public);
+    EXPECT_TRUE(equals_hex(alice_shared, "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742"));
+    EXPECT_EQ(0, memcmp(alice_shared, bob_shared, x25519_key_size));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+namespace r3 { namespace conclave {
+/**
+ * The phases of the startup of an enclave which are timed by the host. The enclave marks the beginning and the end
+ * of the phases which run inside it with startup_phase_ocall, as the time it has access to is too coarse.
+ *
+ * The values are also the indexes of the array returned by Native.getStartupProfile, keep them in sync.
+ */
+enum class StartupPhase : int {
+    // sgx_create_enclave, which includes adding the enclave heap pages
+    LOAD = 0,
+    // ecall_initialise_enclave
+    INITIALISE = 1,
+    // graal_create_isolate, either in the warm-up ecall or lazily in the first jvm_ecall
+    ISOLATE_CREATE = 2,
+    // The first jvm_ecall, which creates the isolate unless the enclave has been warmed up
+    FIRST_ENTRY = 3,
+    // Mounting or formatting the in-memory and persistent filesystems
+    FILESYSTEM = 4,
+};
+
+constexpr int startup_phase_count = 5;
+
+}}
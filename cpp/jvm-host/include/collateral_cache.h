@@ -0,0 +1,104 @@
+#pragma once
+
+#include <sgx_ql_lib_common.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace r3::conclave::dcap {
+
+    constexpr size_t fmspc_size = 6;
+
+    /**
+     * Copy of the quote verification collateral returned by the quote provider library, without the \0 terminators.
+     */
+    struct Collateral {
+        uint32_t version = 0;
+        std::string pck_crl_issuer_chain;
+        std::string root_ca_crl;
+        std::string pck_crl;
+        std::string tcb_info_issuer_chain;
+        std::string tcb_info;
+        std::string qe_identity_issuer_chain;
+        std::string qe_identity;
+
+        Collateral() = default;
+        explicit Collateral(const sgx_ql_qve_collateral_t& collateral);
+
+        /**
+         * The earliest of the next update times of the TCB info, the QE identity and the two CRLs, after which the
+         * collateral must be fetched again. time_point::max() if none of them could be parsed.
+         */
+        std::chrono::system_clock::time_point next_update() const;
+    };
+
+    /**
+     * Cache of the quote verification collateral, keyed by FMSPC and PCK CA type, so that attestations don't wait for
+     * the PCCS/PCS round trip of the quote provider library.
+     *
+     * An entry is kept until the next update time of its collateral, capped by max_age. A background thread renews
+     * it refresh_margin before that, and the cached collateral is still served while the refresh is in progress or
+     * if it fails. Only the first request for a key, or a request for an entry which has expired because it couldn't
+     * be renewed, waits for the fetch. Concurrent requests for the same key share a single fetch.
+     */
+    class CollateralCache {
+    public:
+        typedef std::chrono::system_clock clock;
+
+        /**
+         * Fetches the collateral for the FMSPC and the PCK CA type, or returns nullptr and sets the error result.
+         */
+        typedef std::function<std::shared_ptr<const Collateral>(const uint8_t* fmspc, int pck_ca_type, quote3_error_t& result)> Fetcher;
+
+        struct Settings {
+            clock::duration max_age = std::chrono::hours(1);
+            clock::duration refresh_margin = std::chrono::minutes(5);
+            clock::duration retry_interval = std::chrono::seconds(30);
+            // Entries which haven't been requested for this long are dropped rather than renewed
+            clock::duration max_idle = std::chrono::hours(24);
+        };
+
+        explicit CollateralCache(Fetcher fetcher);
+        CollateralCache(Fetcher fetcher, const Settings& settings);
+        ~CollateralCache();
+
+        CollateralCache(const CollateralCache&) = delete;
+        CollateralCache& operator=(const CollateralCache&) = delete;
+
+        /**
+         * Returns the collateral for the FMSPC (fmspc_size bytes) and the PCK CA type, or nullptr with the error result
+         * of the fetch.
+         */
+        std::shared_ptr<const Collateral> get(const uint8_t* fmspc, int pck_ca_type, quote3_error_t& result);
+
+    private:
+        struct Entry {
+            std::shared_ptr<const Collateral> collateral;
+            clock::time_point expiry;
+            clock::time_point refresh_at;
+            clock::time_point last_used;
+            bool fetching = false;
+        };
+
+        void store(Entry& entry, std::shared_ptr<const Collateral> collateral, clock::time_point now);
+        void refresh(std::unique_lock<std::mutex>& lock, const std::string& key);
+        void refresh_loop();
+
+        const Fetcher fetcher;
+        const Settings settings;
+
+        std::mutex mutex;
+        std::condition_variable fetched;
+        std::condition_variable refresh_needed;
+        std::map<std::string, Entry> entries;
+        std::thread refresher;
+        bool stopping = false;
+    };
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "startup_phase.h"
+#include <sgx_eid.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace r3 { namespace conclave {
+
+/**
+ * Records how long each startup phase of the enclaves took. Only the first run of a phase is recorded, so that for
+ * example the first jvm_ecall is timed but not the following ones. Every call takes the lock, which is only held for
+ * the lookup of the enclave once its phases have been recorded.
+ */
+class StartupProfiler {
+public:
+    typedef std::chrono::steady_clock clock;
+    typedef std::array<int64_t, startup_phase_count> Profile;
+
+    static StartupProfiler& instance();
+
+    /**
+     * Marks the beginning of a phase, which is ignored if the phase has already been recorded for the enclave.
+     */
+    void begin(sgx_enclave_id_t enclave, StartupPhase phase);
+
+    /**
+     * Records the time since the matching call to begin.
+     */
+    void end(sgx_enclave_id_t enclave, StartupPhase phase);
+
+    void record(sgx_enclave_id_t enclave, StartupPhase phase, clock::duration duration);
+
+    /**
+     * The duration in nanoseconds of each phase of the enclave, indexed by StartupPhase, or -1 for the phases which
+     * haven't run.
+     */
+    Profile get(sgx_enclave_id_t enclave);
+
+    void free(sgx_enclave_id_t enclave);
+
+private:
+    struct Entry {
+        Profile durations;
+        std::array<clock::time_point, startup_phase_count> starts;
+
+        Entry();
+    };
+
+    Entry& entry(sgx_enclave_id_t enclave);
+    void set(Entry& entry, int index, clock::duration duration);
+
+    std::mutex mutex_;
+    std::map<sgx_enclave_id_t, Entry> entries_;
+};
+
+}}
@@ -0,0 +1,308 @@
+#include <collateral_cache.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace r3::conclave::dcap {
+
+    namespace {
+        typedef CollateralCache::clock clock;
+
+        std::string copy_field(const char* data, uint32_t size) {
+            // The sizes include the \0 terminator
+            if (data == nullptr || size < 1) {
+                return std::string();
+            }
+            return std::string(data, size - 1);
+        }
+
+        bool to_time_point(int year, int month, int day, int hour, int minute, int second, clock::time_point& out) {
+            struct tm tm = {};
+            tm.tm_year = year - 1900;
+            tm.tm_mon = month - 1;
+            tm.tm_mday = day;
+            tm.tm_hour = hour;
+            tm.tm_min = minute;
+            tm.tm_sec = second;
+            const time_t time = timegm(&tm);
+            if (time == -1) {
+                return false;
+            }
+            out = clock::from_time_t(time);
+            return true;
+        }
+
+        // "nextUpdate":"2023-06-08T12:35:32Z" of the signed TCB info and QE identity JSON
+        bool json_next_update(const std::string& json, clock::time_point& out) {
+            const char* name = "\"nextUpdate\"";
+            auto pos = json.find(name);
+            if (pos == std::string::npos) {
+                return false;
+            }
+            pos = json.find('"', json.find(':', pos + strlen(name)));
+            if (pos == std::string::npos) {
+                return false;
+            }
+            int year, month, day, hour, minute, second;
+            if (sscanf(json.c_str() + pos + 1, "%4d-%2d-%2dT%2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) != 6) {
+                return false;
+            }
+            return to_time_point(year, month, day, hour, minute, second, out);
+        }
+
+        std::string base64_decode(const std::string& in) {
+            std::string out;
+            uint32_t bits = 0;
+            int count = 0;
+            for (const char c : in) {
+                int value;
+                if (c >= 'A' && c <= 'Z') value = c - 'A';
+                else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+                else if (c >= '0' && c <= '9') value = c - '0' + 52;
+                else if (c == '+') value = 62;
+                else if (c == '/') value = 63;
+                else continue;
+                bits = (bits << 6) | value;
+                count += 6;
+                if (count >= 8) {
+                    count -= 8;
+                    out.push_back(static_cast<char>((bits >> count) & 0xFF));
+                }
+            }
+            return out;
+        }
+
+        // Reads the tag and the length of the DER element at pos, and moves pos to its content
+        bool der_header(const std::string& der, size_t& pos, uint8_t& tag, size_t& length) {
+            if (pos + 2 > der.size()) {
+                return false;
+            }
+            tag = static_cast<uint8_t>(der[pos++]);
+            length = static_cast<uint8_t>(der[pos++]);
+            if (length & 0x80) {
+                const size_t length_bytes = length & 0x7F;
+                if (length_bytes == 0 || length_bytes > sizeof(size_t) || pos + length_bytes > der.size()) {
+                    return false;
+                }
+                length = 0;
+                for (size_t i = 0; i < length_bytes; i++) {
+                    length = (length << 8) | static_cast<uint8_t>(der[pos++]);
+                }
+            }
+            return length <= der.size() - pos;
+        }
+
+        bool der_time(const std::string& der, size_t pos, uint8_t tag, size_t length, clock::time_point& out) {
+            const std::string time = der.substr(pos, length);
+            int year, month, day, hour, minute, second;
+            if (tag == 0x17) {
+                // UTCTime, YYMMDDHHMMSSZ
+                if (sscanf(time.c_str(), "%2d%2d%2d%2d%2d%2d", &year, &month, &day, &hour, &minute, &second) != 6) {
+                    return false;
+                }
+                year += year >= 50 ? 1900 : 2000;
+            } else {
+                // GeneralizedTime, YYYYMMDDHHMMSSZ
+                if (sscanf(time.c_str(), "%4d%2d%2d%2d%2d%2d", &year, &month, &day, &hour, &minute, &second) != 6) {
+                    return false;
+                }
+            }
+            return to_time_point(year, month, day, hour, minute, second, out);
+        }
+
+        // nextUpdate of a PEM or DER X.509 CRL:
+        //   CertificateList ::= SEQUENCE { tbsCertList SEQUENCE { version INTEGER OPTIONAL, signature SEQUENCE,
+        //                                  issuer SEQUENCE, thisUpdate Time, nextUpdate Time OPTIONAL, ... }, ... }
+        bool crl_next_update(const std::string& crl, clock::time_point& out) {
+            std::string der = crl;
+            const char* pem_header = "-----BEGIN X509 CRL-----";
+            const auto begin = crl.find(pem_header);
+            if (begin != std::string::npos) {
+                const auto start = begin + strlen(pem_header);
+                der = base64_decode(crl.substr(start, crl.find("-----END", start) - start));
+            }
+
+            size_t pos = 0;
+            uint8_t tag;
+            size_t length;
+            // Into the CertificateList and tbsCertList sequences
+            for (int i = 0; i < 2; i++) {
+                if (!der_header(der, pos, tag, length) || tag != 0x30) {
+                    return false;
+                }
+            }
+            if (!der_header(der, pos, tag, length)) {
+                return false;
+            }
+            if (tag == 0x02) {
+                pos += length;
+                if (!der_header(der, pos, tag, length)) {
+                    return false;
+                }
+            }
+            // Skip the signature algorithm, the issuer and thisUpdate
+            for (int i = 0; i < 2; i++) {
+                pos += length;
+                if (!der_header(der, pos, tag, length)) {
+                    return false;
+                }
+            }
+            pos += length;
+            if (!der_header(der, pos, tag, length) || (tag != 0x17 && tag != 0x18)) {
+                return false;
+            }
+            return der_time(der, pos, tag, length, out);
+        }
+    }
+
+    Collateral::Collateral(const sgx_ql_qve_collateral_t& collateral)
+            : version(collateral.version),
+              pck_crl_issuer_chain(copy_field(collateral.pck_crl_issuer_chain, collateral.pck_crl_issuer_chain_size)),
+              root_ca_crl(copy_field(collateral.root_ca_crl, collateral.root_ca_crl_size)),
+              pck_crl(copy_field(collateral.pck_crl, collateral.pck_crl_size)),
+              tcb_info_issuer_chain(copy_field(collateral.tcb_info_issuer_chain, collateral.tcb_info_issuer_chain_size)),
+              tcb_info(copy_field(collateral.tcb_info, collateral.tcb_info_size)),
+              qe_identity_issuer_chain(copy_field(collateral.qe_identity_issuer_chain, collateral.qe_identity_issuer_chain_size)),
+              qe_identity(copy_field(collateral.qe_identity, collateral.qe_identity_size)) {
+    }
+
+    clock::time_point Collateral::next_update() const {
+        auto earliest = clock::time_point::max();
+        clock::time_point time;
+        if (json_next_update(tcb_info, time)) earliest = std::min(earliest, time);
+        if (json_next_update(qe_identity, time)) earliest = std::min(earliest, time);
+        if (crl_next_update(root_ca_crl, time)) earliest = std::min(earliest, time);
+        if (crl_next_update(pck_crl, time)) earliest = std::min(earliest, time);
+        return earliest;
+    }
+
+    CollateralCache::CollateralCache(Fetcher fetcher) : CollateralCache(std::move(fetcher), Settings()) {
+    }
+
+    CollateralCache::CollateralCache(Fetcher fetcher, const Settings& settings)
+            : fetcher(std::move(fetcher)), settings(settings) {
+    }
+
+    CollateralCache::~CollateralCache() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        refresh_needed.notify_all();
+        if (refresher.joinable()) {
+            refresher.join();
+        }
+    }
+
+    std::shared_ptr<const Collateral> CollateralCache::get(const uint8_t* fmspc, int pck_ca_type, quote3_error_t& result) {
+        std::string key(reinterpret_cast<const char*>(fmspc), fmspc_size);
+        key.push_back(static_cast<char>(pck_ca_type));
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            auto& entry = entries[key];
+            entry.last_used = clock::now();
+            // An entry which is due to be renewed is still served, the refresher renews it in the background
+            if (entry.collateral && entry.last_used < entry.expiry) {
+                result = SGX_QL_SUCCESS;
+                return entry.collateral;
+            }
+            if (!entry.fetching) {
+                entry.fetching = true;
+                break;
+            }
+            // Another thread is already fetching it
+            fetched.wait(lock);
+        }
+
+        lock.unlock();
+        auto collateral = fetcher(fmspc, pck_ca_type, result);
+        lock.lock();
+
+        // Look the entry up again, the map may have changed
+        auto& entry = entries[key];
+        entry.fetching = false;
+        fetched.notify_all();
+        if (collateral == nullptr) {
+            if (entry.collateral == nullptr) {
+                entries.erase(key);
+            }
+            return nullptr;
+        }
+        store(entry, collateral, clock::now());
+        return collateral;
+    }
+
+    void CollateralCache::store(Entry& entry, std::shared_ptr<const Collateral> collateral, clock::time_point now) {
+        // Collateral past its next update is still kept for a little while, rather than fetched for every request
+        auto expiry = now + settings.max_age;
+        const auto next_update = collateral->next_update();
+        if (next_update < expiry) {
+            expiry = std::max(next_update, now + settings.retry_interval);
+        }
+        entry.collateral = std::move(collateral);
+        entry.expiry = expiry;
+        // At the latest halfway to the expiry, for collateral which doesn't live much longer than the margin
+        entry.refresh_at = expiry - std::min(settings.refresh_margin, (expiry - now) / 2);
+
+        if (!refresher.joinable()) {
+            refresher = std::thread(&CollateralCache::refresh_loop, this);
+        } else {
+            refresh_needed.notify_one();
+        }
+    }
+
+    void CollateralCache::refresh(std::unique_lock<std::mutex>& lock, const std::string& key) {
+        entries[key].fetching = true;
+        lock.unlock();
+        quote3_error_t result;
+        auto collateral = fetcher(reinterpret_cast<const uint8_t*>(key.data()), static_cast<int>(key[fmspc_size]), result);
+        lock.lock();
+
+        auto& entry = entries[key];
+        entry.fetching = false;
+        fetched.notify_all();
+        if (collateral != nullptr) {
+            store(entry, collateral, clock::now());
+        } else {
+            // Keep serving the current collateral until it expires, and try again
+            entry.refresh_at = clock::now() + settings.retry_interval;
+        }
+    }
+
+    void CollateralCache::refresh_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            const auto now = clock::now();
+            auto next_refresh = clock::time_point::max();
+            const std::string* due = nullptr;
+            for (auto it = entries.begin(); it != entries.end();) {
+                auto& entry = it->second;
+                if (entry.fetching || entry.collateral == nullptr) {
+                    ++it;
+                } else if (entry.refresh_at > now) {
+                    next_refresh = std::min(next_refresh, entry.refresh_at);
+                    ++it;
+                } else if (now - entry.last_used >= settings.max_idle) {
+                    it = entries.erase(it);
+                } else {
+                    if (due == nullptr) {
+                        due = &it->first;
+                    }
+                    ++it;
+                }
+            }
+
+            if (due != nullptr) {
+                // Copied as the entry may be erased while the lock is released
+                refresh(lock, std::string(*due));
+            } else if (next_refresh == clock::time_point::max()) {
+                refresh_needed.wait(lock);
+            } else {
+                refresh_needed.wait_until(lock, next_refresh);
+            }
+        }
+    }
+}
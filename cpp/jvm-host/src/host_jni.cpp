@@ -3,6 +3,7 @@
 #include <jvm_u.h>
 #include <iostream>
 #include <string>
+#include <cstring>
 #include <ecall_context.h>
 #include <sgx_errors.h>
 #include <sgx_device_status.h>
@@ -15,10 +16,13 @@
 #include <munmap_guard.h>
 #include <enclave_platform.h>
 #include <dcap.h>
+#include <collateral_cache.h>
 #include <mutex>
+#include <atomic>
 #include "enclave_console.h"
 #include "host_shared_data.h"
 #include "enclave_init.h"
+#include "startup_profiler.h"
 #include <signal.h>
 //  This is the file in the "fatfs/host" directory,
 //    not the one in fatfs/enclave
@@ -36,6 +40,16 @@ void debug_print_edl(const char *str, int n) {
     enclave_console(str, n);
 }
 
+void startup_phase_ocall(int phase, int end) {
+    auto& profiler = r3::conclave::StartupProfiler::instance();
+    const auto enclave_id = EcallContext::getEnclaveId();
+    if (end) {
+        profiler.end(enclave_id, static_cast<r3::conclave::StartupPhase>(phase));
+    } else {
+        profiler.begin(enclave_id, static_cast<r3::conclave::StartupPhase>(phase));
+    }
+}
+
 static bool signal_registered = false;
 
 JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_getDeviceStatus(JNIEnv *, jclass) {
@@ -84,7 +98,11 @@ static void initialise_enclave(sgx_enclave_id_t enclave_id) {
 
     // Exchange configuration with the enclave
     r3::conclave::EnclaveInit ei;
+    const auto start = r3::conclave::StartupProfiler::clock::now();
     ecall_initialise_enclave(enclave_id, &ei, sizeof(ei));
+    r3::conclave::StartupProfiler::instance().record(enclave_id,
+                                                     r3::conclave::StartupPhase::INITIALISE,
+                                                     r3::conclave::StartupProfiler::clock::now() - start);
 
     // We have patched the SGX SDK to automatically arbitrate threads and
     // handle deadlocks when there are more host threads calling into the 
@@ -104,8 +122,12 @@ jlong JNICALL Java_com_r3_conclave_host_internal_Native_createEnclave(JNIEnv *jn
     sgx_launch_token_t token = {0};
     sgx_enclave_id_t enclave_id = {0};
     int updated = 0;
+    const auto start = r3::conclave::StartupProfiler::clock::now();
     auto returnCode = sgx_create_enclave(path.c_str, isDebug, &token, &updated, &enclave_id, nullptr);
     if (returnCode == SGX_SUCCESS) {
+        r3::conclave::StartupProfiler::instance().record(enclave_id,
+                                                         r3::conclave::StartupPhase::LOAD,
+                                                         r3::conclave::StartupProfiler::clock::now() - start);
         initialise_enclave(enclave_id);
         return enclave_id;
     } else {
@@ -138,6 +160,26 @@ void JNICALL Java_com_r3_conclave_host_internal_Native_destroyEnclave(JNIEnv *jn
 
     // Shutdown any shared data associated with this enclave
     r3::conclave::HostSharedData::instance().free(static_cast<sgx_enclave_id_t>(enclaveId));
+    r3::conclave::StartupProfiler::instance().free(static_cast<sgx_enclave_id_t>(enclaveId));
+}
+
+void JNICALL Java_com_r3_conclave_host_internal_Native_warmUpEnclave(JNIEnv *jniEnv,
+                                                                     jclass,
+                                                                     jlong enclaveId) {
+    EcallContext _(static_cast<sgx_enclave_id_t>(enclaveId), jniEnv, {});
+    const auto returnCode = ecall_warm_up_enclave(static_cast<sgx_enclave_id_t>(enclaveId));
+    if (returnCode != SGX_SUCCESS) {
+        raiseException(jniEnv, getErrorMessage(returnCode));
+    }
+}
+
+JNIEXPORT jlongArray JNICALL Java_com_r3_conclave_host_internal_Native_getStartupProfile(JNIEnv *jniEnv,
+                                                                                        jclass,
+                                                                                        jlong enclaveId) {
+    const auto profile = r3::conclave::StartupProfiler::instance().get(static_cast<sgx_enclave_id_t>(enclaveId));
+    jlongArray array = jniEnv->NewLongArray(profile.size());
+    jniEnv->SetLongArrayRegion(array, 0, profile.size(), reinterpret_cast<const jlong*>(profile.data()));
+    return array;
 }
 
 void JNICALL Java_com_r3_conclave_host_internal_Native_jvmECall(JNIEnv *jniEnv,
@@ -155,11 +197,14 @@ void JNICALL Java_com_r3_conclave_host_internal_Native_jvmECall(JNIEnv *jniEnv,
 
         // Set the enclave ID TLS so that OCALLs have access to it
         EcallContext context(static_cast<sgx_enclave_id_t>(enclaveId), jniEnv, {});
+        auto& profiler = r3::conclave::StartupProfiler::instance();
+        profiler.begin(static_cast<sgx_enclave_id_t>(enclaveId), r3::conclave::StartupPhase::FIRST_ENTRY);
         auto returnCode = jvm_ecall(static_cast<sgx_enclave_id_t>(enclaveId),
                                     callTypeID,
                                     messageTypeID,
                                     inputBuffer,
                                     size);
+        profiler.end(static_cast<sgx_enclave_id_t>(enclaveId), r3::conclave::StartupPhase::FIRST_ENTRY);
         jniEnv->ReleaseByteArrayElements(data, inputBuffer, 0);
 
         if (returnCode != SGX_SUCCESS) {
@@ -305,53 +350,100 @@ void host_encrypted_read_ocall(int* res,
 void host_encrypted_write_ocall(int* res,
                                 const unsigned char drive,
                                 const unsigned char* buf,
+                                const unsigned int buf_size,
                                 const unsigned int sector_size,
                                 const unsigned long sector) {
-    const int res_f = host_disk_write(drive, buf, sector_size, sector);
+    const int res_f = host_disk_write(drive, buf, buf_size, sector_size, sector);
     *res = res_f;
 }
 
 void host_disk_get_size_ocall(long* res,
                               const unsigned char drive,
-                              const unsigned long persistent_size) {
-    const long res_f = host_disk_get_size(drive, persistent_size);
+                              const unsigned long persistent_size,
+                              unsigned int* sector_size,
+                              unsigned int* shuffle_group_size,
+                              unsigned int* layout) {
+    const long res_f = host_disk_get_size(drive, persistent_size, sector_size, shuffle_group_size, layout);
+    *res = res_f;
+}
+
+void host_disk_sync_ocall(int* res, const unsigned char drive) {
+    const int res_f = host_disk_sync(drive);
+    *res = res_f;
+}
+
+void host_disk_trim_ocall(int* res,
+                          const unsigned char drive,
+                          const unsigned long sector,
+                          const unsigned long num_sectors,
+                          const unsigned int sector_size) {
+    const int res_f = host_disk_trim(drive, sector, num_sectors, sector_size);
     *res = res_f;
 }
 
 // End OCalls for Persistent Filesystem
 
-static r3::conclave::dcap::QuotingAPI* quoting_lib = nullptr;
-static std::mutex dcap_mutex;
+// quoting_lib and collateral_cache are created once by initDCAP, under dcap_init_mutex, and are only read afterwards.
+// They are published with release stores and read with acquire loads, as the quote and collateral calls don't take
+// dcap_init_mutex. Quotes and collateral have separate locks, so that quote generation doesn't queue behind the
+// PCCS/PCS round trip of a collateral fetch.
+static std::atomic<r3::conclave::dcap::QuotingAPI*> quoting_lib(nullptr);
+static std::atomic<r3::conclave::dcap::CollateralCache*> collateral_cache(nullptr);
+static std::mutex dcap_init_mutex;
+// The calls into the quoting enclave, which only has a single thread
+static std::mutex quoting_mutex;
+// The quote provider library keeps the last collateral in quoting_lib until it is freed
+static std::mutex collateral_mutex;
+// The quote size only depends on the attestation key of the quoting enclave, which is the same for every enclave
+static std::atomic<uint32_t> cached_quote_size(0);
+
+static std::shared_ptr<const r3::conclave::dcap::Collateral> fetchCollateral(const uint8_t* fmspc,
+                                                                             int pck_ca_type,
+                                                                             quote3_error_t& eval_result) {
+    std::lock_guard<std::mutex> lock(collateral_mutex);
+
+    auto lib = quoting_lib.load(std::memory_order_acquire);
+    sgx_ql_qve_collateral_t* collateral = lib->get_quote_verification_collateral(fmspc, pck_ca_type, eval_result);
+    if (collateral == nullptr) {
+        return nullptr;
+    }
+    auto copy = std::make_shared<const r3::conclave::dcap::Collateral>(*collateral);
+    if (!lib->free_quote_verification_collateral(eval_result)) {
+        return nullptr;
+    }
+    return copy;
+}
 
 jint initDCAP(JNIEnv *jniEnv, jstring bundle, jboolean loadQuotingLibraries) {
 
     JniString jpath(jniEnv, bundle);
 
-    if (quoting_lib != nullptr)
+    if (quoting_lib.load(std::memory_order_acquire) != nullptr)
         return 0;
 
     r3::conclave::dcap::QuotingAPI::Errors errors;
+    r3::conclave::dcap::QuotingAPI* lib = nullptr;
     try {
         std::string path(std::string(jpath.c_str));
 
-        quoting_lib = new r3::conclave::dcap::QuotingAPI();
+        lib = new r3::conclave::dcap::QuotingAPI();
 
-        if (!quoting_lib->init(path, loadQuotingLibraries, errors)) {
+        if (!lib->init(path, loadQuotingLibraries, errors)) {
             std::string message("failed to initialize DCAP: ");
             for(auto &err : errors)
                 message += err + ";";
 
-            delete quoting_lib;
-            quoting_lib = nullptr;
+            delete lib;
             raiseException(jniEnv, message.c_str());
             return -1;
         }
+
+        // Only published once fully initialised
+        collateral_cache.store(new r3::conclave::dcap::CollateralCache(fetchCollateral), std::memory_order_release);
+        quoting_lib.store(lib, std::memory_order_release);
     }
     catch(...){
-        if (quoting_lib != nullptr) {
-            delete quoting_lib;
-            quoting_lib = nullptr;
-        }
+        delete lib;
 
         raiseException(jniEnv, "failed to initialize DCAP: unknown error");
         return -1;
@@ -368,7 +460,7 @@ JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_initQuoteDCAP(J
 
     JniPtr<sgx_target_info_t> request(jniEnv, targetInfoOut);
 
-    std::lock_guard<std::mutex> lock(dcap_mutex);
+    std::lock_guard<std::mutex> lock(dcap_init_mutex);
 
     if (initDCAP(jniEnv, bundle, loadQuotingLibraries) != 0) {
         return -1;
@@ -381,8 +473,17 @@ JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_initQuoteDCAP(J
         return 0;
     }
 
-    quote3_error_t eval_result;
-    if (quoting_lib->get_target_info((sgx_target_info_t*)request.ptr, eval_result)) {
+    // The target info of the quoting enclave is the same for every enclave, it is only requested once
+    static sgx_target_info_t target_info;
+    static bool target_info_cached = false;
+
+    quote3_error_t eval_result = SGX_QL_SUCCESS;
+    if (!target_info_cached) {
+        std::lock_guard<std::mutex> quoting_lock(quoting_mutex);
+        target_info_cached = quoting_lib.load(std::memory_order_acquire)->get_target_info(&target_info, eval_result);
+    }
+    if (target_info_cached) {
+        memcpy(request.ptr, &target_info, sizeof(target_info));
         request.releaseMode = 0;
         return 0;
     } else {
@@ -394,11 +495,16 @@ JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_initQuoteDCAP(J
 JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_calcQuoteSizeDCAP(JNIEnv *jniEnv,
                                                                                    jclass) {
 
-    std::lock_guard<std::mutex> lock(dcap_mutex);
+    uint32_t quote_size = cached_quote_size.load();
+    if (quote_size != 0) {
+        return (jint)quote_size;
+    }
+
+    std::lock_guard<std::mutex> lock(quoting_mutex);
 
-    uint32_t quote_size;
     quote3_error_t eval_result;
-    if (quoting_lib->get_quote_size(&quote_size, eval_result)) {
+    if (quoting_lib.load(std::memory_order_acquire)->get_quote_size(&quote_size, eval_result)) {
+        cached_quote_size.store(quote_size);
         return (jint)quote_size;
     } else {
         raiseException(jniEnv, getQuotingErrorMessage(eval_result));
@@ -414,11 +520,12 @@ JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_getQuoteDCAP(JN
     JniPtr<const sgx_get_quote_request> request(jniEnv, getQuoteRequestIn);
     JniPtr<sgx_quote_t> quote(jniEnv, quoteOut);
 
-    std::lock_guard<std::mutex> lock(dcap_mutex);
+    std::lock_guard<std::mutex> lock(quoting_mutex);
 
     quote3_error_t eval_result;
-    if (quoting_lib->get_quote(const_cast<sgx_report_t*>(&request.ptr->p_report),
-                               static_cast<uint32_t>(quote.size()), (uint8_t*)quote.ptr, eval_result)) {
+    auto lib = quoting_lib.load(std::memory_order_acquire);
+    if (lib->get_quote(const_cast<sgx_report_t*>(&request.ptr->p_report),
+                       static_cast<uint32_t>(quote.size()), (uint8_t*)quote.ptr, eval_result)) {
         quote.releaseMode = 0;
     } else {
         raiseException(jniEnv, getQuotingErrorMessage(eval_result));
@@ -427,16 +534,9 @@ JNIEXPORT jint JNICALL Java_com_r3_conclave_host_internal_Native_getQuoteDCAP(JN
     return (int)eval_result;
 }
 
-jbyteArray jbyteArrayFromCharPtr(JNIEnv *jniEnv, unsigned int size, char* data) {
-    if (size < 1) {
-        raiseException(jniEnv, "Failed to create byte array, data too short.");
-    }
-    if (data == nullptr) {
-        raiseException(jniEnv, "Failed to create byte array, data is null.");
-    }
-    unsigned int sizeActual = size - 1; // Drop the \0 terminator
-    jbyteArray array = jniEnv->NewByteArray(sizeActual);
-    jniEnv->SetByteArrayRegion(array, 0, sizeActual, (jbyte*)data);
+static jbyteArray jbyteArrayFromString(JNIEnv *jniEnv, const std::string& data) {
+    jbyteArray array = jniEnv->NewByteArray(data.size());
+    jniEnv->SetByteArrayRegion(array, 0, data.size(), (const jbyte*)data.data());
     return array;
 }
 
@@ -446,11 +546,14 @@ JNIEXPORT jobjectArray JNICALL Java_com_r3_conclave_host_internal_Native_getQuot
                                                                                             jint pck_ca_type) {
 
     JniPtr<uint8_t> p_fmspc(jniEnv, fmspc);
+    if (p_fmspc.size() != static_cast<int>(r3::conclave::dcap::fmspc_size)) {
+        raiseException(jniEnv, "Invalid FMSPC size");
+        return nullptr;
+    }
 
-    std::lock_guard<std::mutex> lock(dcap_mutex);
-
+    // The collateral is cached and renewed in the background, collateral_mutex is only held when it is actually fetched
     quote3_error_t eval_result_get;
-    sgx_ql_qve_collateral_t* collateral = quoting_lib->get_quote_verification_collateral(p_fmspc.ptr, pck_ca_type, eval_result_get);
+    auto collateral = collateral_cache.load(std::memory_order_acquire)->get(p_fmspc.ptr, pck_ca_type, eval_result_get);
 
     if (collateral == nullptr){
         raiseException(jniEnv, getQuotingErrorMessage(eval_result_get));
@@ -479,20 +582,13 @@ JNIEXPORT jobjectArray JNICALL Java_com_r3_conclave_host_internal_Native_getQuot
         jobject wrappedVersion = jniEnv->NewObject(integerClass, integerConstructor, static_cast<jint>(collateral->version));
 
         jniEnv->SetObjectArrayElement(arr,0,wrappedVersion);
-        jniEnv->SetObjectArrayElement(arr,1,jbyteArrayFromCharPtr(jniEnv, collateral->pck_crl_issuer_chain_size, collateral->pck_crl_issuer_chain));
-        jniEnv->SetObjectArrayElement(arr,2,jbyteArrayFromCharPtr(jniEnv, collateral->root_ca_crl_size, collateral->root_ca_crl));
-        jniEnv->SetObjectArrayElement(arr,3,jbyteArrayFromCharPtr(jniEnv, collateral->pck_crl_size, collateral->pck_crl));
-        jniEnv->SetObjectArrayElement(arr,4,jbyteArrayFromCharPtr(jniEnv, collateral->tcb_info_issuer_chain_size, collateral->tcb_info_issuer_chain));
-        jniEnv->SetObjectArrayElement(arr,5,jbyteArrayFromCharPtr(jniEnv, collateral->tcb_info_size, collateral->tcb_info));
-        jniEnv->SetObjectArrayElement(arr,6,jbyteArrayFromCharPtr(jniEnv, collateral->qe_identity_issuer_chain_size, collateral->qe_identity_issuer_chain));
-        jniEnv->SetObjectArrayElement(arr,7,jbyteArrayFromCharPtr(jniEnv, collateral->qe_identity_size, collateral->qe_identity));
-        
-        quote3_error_t eval_result_free;
-        
-        if (!quoting_lib->free_quote_verification_collateral(eval_result_free)) {
-            raiseException(jniEnv, getQuotingErrorMessage(eval_result_free));
-            return nullptr;
-        }           
+        jniEnv->SetObjectArrayElement(arr,1,jbyteArrayFromString(jniEnv, collateral->pck_crl_issuer_chain));
+        jniEnv->SetObjectArrayElement(arr,2,jbyteArrayFromString(jniEnv, collateral->root_ca_crl));
+        jniEnv->SetObjectArrayElement(arr,3,jbyteArrayFromString(jniEnv, collateral->pck_crl));
+        jniEnv->SetObjectArrayElement(arr,4,jbyteArrayFromString(jniEnv, collateral->tcb_info_issuer_chain));
+        jniEnv->SetObjectArrayElement(arr,5,jbyteArrayFromString(jniEnv, collateral->tcb_info));
+        jniEnv->SetObjectArrayElement(arr,6,jbyteArrayFromString(jniEnv, collateral->qe_identity_issuer_chain));
+        jniEnv->SetObjectArrayElement(arr,7,jbyteArrayFromString(jniEnv, collateral->qe_identity));
         return arr;
     }
 }
@@ -0,0 +1,86 @@
+#include "startup_profiler.h"
+
+namespace r3 { namespace conclave {
+
+namespace {
+    bool is_valid(int index) {
+        return index >= 0 && index < startup_phase_count;
+    }
+}
+
+StartupProfiler::Entry::Entry() {
+    durations.fill(-1);
+    starts.fill(clock::time_point());
+}
+
+StartupProfiler& StartupProfiler::instance() {
+    static StartupProfiler profiler;
+    return profiler;
+}
+
+StartupProfiler::Entry& StartupProfiler::entry(sgx_enclave_id_t enclave) {
+    return entries_.emplace(enclave, Entry()).first->second;
+}
+
+void StartupProfiler::set(Entry& entry, int index, clock::duration duration) {
+    if (entry.durations[index] == -1) {
+        entry.durations[index] = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+}
+
+void StartupProfiler::begin(sgx_enclave_id_t enclave, StartupPhase phase) {
+    const auto now = clock::now();
+    const auto index = static_cast<int>(phase);
+    if (!is_valid(index)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Enclaves are profiled from their load, after which their entry exists
+    const auto it = entries_.find(enclave);
+    if (it == entries_.end()) {
+        return;
+    }
+    auto& e = it->second;
+    // Concurrent calls into a new enclave only time the first one
+    if (e.durations[index] == -1 && e.starts[index] == clock::time_point()) {
+        e.starts[index] = now;
+    }
+}
+
+void StartupProfiler::end(sgx_enclave_id_t enclave, StartupPhase phase) {
+    const auto now = clock::now();
+    const auto index = static_cast<int>(phase);
+    if (!is_valid(index)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(enclave);
+    if (it != entries_.end() && it->second.starts[index] != clock::time_point()) {
+        set(it->second, index, now - it->second.starts[index]);
+    }
+}
+
+void StartupProfiler::record(sgx_enclave_id_t enclave, StartupPhase phase, clock::duration duration) {
+    const auto index = static_cast<int>(phase);
+    if (!is_valid(index)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    set(entry(enclave), index, duration);
+}
+
+StartupProfiler::Profile StartupProfiler::get(sgx_enclave_id_t enclave) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(enclave);
+    return it != entries_.end() ? it->second.durations : Entry().durations;
+}
+
+void StartupProfiler::free(sgx_enclave_id_t enclave) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(enclave);
+    if (it != entries_.end()) {
+        entries_.erase(it);
+    }
+}
+
+}}
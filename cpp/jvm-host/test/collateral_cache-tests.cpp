@@ -0,0 +1,304 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Include the module under test
+#include <collateral_cache.cpp>
+
+using namespace std;
+using namespace std::chrono;
+using namespace r3::conclave::dcap;
+
+//  CRL with its nextUpdate on 2030-01-31 12:00:00 (UTCTime)
+static const char* kPemCrl =
+        "-----BEGIN X509 CRL-----\n"
+        "MIGoMFECAQEwCgYIKoZIzj0EAwIwEjEQMA4GA1UEAwwHVGVzdCBDQRcNMzAwMTAx\n"
+        "MDAwMDAwWhcNMzAwMTMxMTIwMDAwWqAOMAwwCgYDVR0UBAMCAQEwCgYIKoZIzj0E\n"
+        "AwIDRwAwRAIgV8zOcAcaeqJBcVfdcNuuFB5cDJStRf8V/n3rzHX9ls0CIFhg7wHQ\n"
+        "oZuLT4NV4Lt6A13XyV1dF6kGqnRWrjjt2j7n\n"
+        "-----END X509 CRL-----\n";
+
+//  CRL with its nextUpdate on 2055-06-15 08:30:00 (GeneralizedTime)
+static const unsigned char kDerCrl[] = {
+        0x30, 0x81, 0xaa, 0x30, 0x53, 0x02, 0x01, 0x01, 0x30, 0x0a, 0x06, 0x08,
+        0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02, 0x30, 0x12, 0x31, 0x10,
+        0x30, 0x0e, 0x06, 0x03, 0x55, 0x04, 0x03, 0x0c, 0x07, 0x54, 0x65, 0x73,
+        0x74, 0x20, 0x43, 0x41, 0x17, 0x0d, 0x33, 0x30, 0x30, 0x31, 0x30, 0x31,
+        0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x5a, 0x18, 0x0f, 0x32, 0x30, 0x35,
+        0x35, 0x30, 0x36, 0x31, 0x35, 0x30, 0x38, 0x33, 0x30, 0x30, 0x30, 0x5a,
+        0xa0, 0x0e, 0x30, 0x0c, 0x30, 0x0a, 0x06, 0x03, 0x55, 0x1d, 0x14, 0x04,
+        0x03, 0x02, 0x01, 0x02, 0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce,
+        0x3d, 0x04, 0x03, 0x02, 0x03, 0x47, 0x00, 0x30, 0x44, 0x02, 0x20, 0x42,
+        0xb6, 0x52, 0x93, 0x87, 0x0b, 0x03, 0xd7, 0x2f, 0x4f, 0x42, 0x18, 0xc5,
+        0xb6, 0xa7, 0xdf, 0x33, 0x05, 0x88, 0x8c, 0x0e, 0xb7, 0x35, 0xa2, 0xb3,
+        0x89, 0xa9, 0xc8, 0x60, 0x36, 0x7d, 0x4a, 0x02, 0x20, 0x1a, 0x67, 0x0a,
+        0x6c, 0xf0, 0xf1, 0xee, 0x95, 0xd1, 0x5e, 0x7c, 0x7c, 0x3c, 0x35, 0x8d,
+        0x40, 0x52, 0x2b, 0x4f, 0x28, 0x01, 0x16, 0x0c, 0x74, 0xaa, 0xcf, 0xfa,
+        0xaa, 0xa8, 0x81, 0x64, 0x6c};
+
+static const uint8_t kFmspc[fmspc_size] = {0x00, 0x90, 0x6e, 0xa1, 0x00, 0x00};
+
+static CollateralCache::clock::time_point utc(int year, int month, int day, int hour, int minute, int second) {
+    struct tm tm = {};
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    return CollateralCache::clock::from_time_t(timegm(&tm));
+}
+
+static string signedJson(const char* name, const char* next_update) {
+    return string("{\"") + name + "\":{\"version\":2,\"issueDate\":\"2030-01-01T00:00:00Z\",\"nextUpdate\":\"" +
+           next_update + "\",\"tcbLevels\":[]},\"signature\":\"00\"}";
+}
+
+//  Waits for the condition, which the background refresh of the cache makes true
+static bool eventually(const function<bool()>& condition) {
+    const auto deadline = steady_clock::now() + seconds(10);
+    while (!condition()) {
+        if (steady_clock::now() > deadline) {
+            return false;
+        }
+        this_thread::sleep_for(milliseconds(5));
+    }
+    return true;
+}
+
+//  Stand-in for the quote provider library, each collateral it returns has the number of the fetch as its version
+class FakeProvider {
+public:
+    atomic<int> fetches{0};
+    atomic<bool> failing{false};
+    string next_update = "2099-01-01T00:00:00Z";
+
+    CollateralCache::Fetcher fetcher() {
+        return [this](const uint8_t* fmspc, int pck_ca_type, quote3_error_t& result) {
+            return fetch(fmspc, pck_ca_type, result);
+        };
+    }
+
+    //  Holds the following fetches until release
+    void hold() {
+        lock_guard<mutex> lock(mutex_);
+        held_ = true;
+    }
+
+    void release() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            held_ = false;
+        }
+        released_.notify_all();
+    }
+
+private:
+    mutex mutex_;
+    condition_variable released_;
+    bool held_ = false;
+
+    shared_ptr<const Collateral> fetch(const uint8_t* fmspc, int pck_ca_type, quote3_error_t& result) {
+        const int number = ++fetches;
+        {
+            unique_lock<mutex> lock(mutex_);
+            released_.wait(lock, [this] { return !held_; });
+        }
+        EXPECT_EQ(memcmp(fmspc, kFmspc, fmspc_size), 0);
+        if (failing) {
+            result = SGX_QL_ERROR_UNEXPECTED;
+            return nullptr;
+        }
+        auto collateral = make_shared<Collateral>();
+        collateral->version = number * 10 + pck_ca_type;
+        collateral->tcb_info = signedJson("tcbInfo", next_update.c_str());
+        result = SGX_QL_SUCCESS;
+        return collateral;
+    }
+};
+
+static int version(CollateralCache& cache, int pck_ca_type = 1) {
+    quote3_error_t result = SGX_QL_ERROR_UNEXPECTED;
+    auto collateral = cache.get(kFmspc, pck_ca_type, result);
+    if (collateral == nullptr) {
+        return -result;
+    }
+    EXPECT_EQ(result, SGX_QL_SUCCESS);
+    return collateral->version;
+}
+
+TEST(collateral_cache, serves_the_cached_collateral) {
+    FakeProvider provider;
+    CollateralCache cache(provider.fetcher());
+
+    EXPECT_EQ(version(cache), 11);
+    EXPECT_EQ(version(cache), 11);
+    EXPECT_EQ(provider.fetches, 1);
+}
+
+TEST(collateral_cache, caches_per_fmspc_and_pck_ca_type) {
+    FakeProvider provider;
+    CollateralCache cache(provider.fetcher());
+
+    EXPECT_EQ(version(cache, 1), 11);
+    EXPECT_EQ(version(cache, 2), 22);
+    EXPECT_EQ(version(cache, 1), 11);
+    EXPECT_EQ(version(cache, 2), 22);
+    EXPECT_EQ(provider.fetches, 2);
+}
+
+TEST(collateral_cache, does_not_cache_a_failed_first_fetch) {
+    FakeProvider provider;
+    CollateralCache cache(provider.fetcher());
+
+    provider.failing = true;
+    EXPECT_EQ(version(cache), -SGX_QL_ERROR_UNEXPECTED);
+    provider.failing = false;
+    EXPECT_EQ(version(cache), 21);
+    EXPECT_EQ(provider.fetches, 2);
+}
+
+TEST(collateral_cache, shares_the_fetch_of_concurrent_first_requests) {
+    FakeProvider provider;
+    CollateralCache cache(provider.fetcher());
+
+    provider.hold();
+    vector<int> versions(8);
+    vector<thread> threads;
+    for (auto& v : versions) {
+        threads.emplace_back([&cache, &v] { v = version(cache); });
+    }
+    ASSERT_TRUE(eventually([&] { return provider.fetches == 1; }));
+    //  Gives the other requests the time to queue behind the fetch
+    this_thread::sleep_for(milliseconds(100));
+    provider.release();
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(versions, vector<int>(8, 11));
+    EXPECT_EQ(provider.fetches, 1);
+}
+
+TEST(collateral_cache, serves_the_stale_collateral_while_it_is_renewed) {
+    FakeProvider provider;
+    CollateralCache::Settings settings;
+    settings.max_age = milliseconds(1000);
+    settings.refresh_margin = milliseconds(700);
+    CollateralCache cache(provider.fetcher(), settings);
+
+    EXPECT_EQ(version(cache), 11);
+    //  The renewal starts halfway to the expiry, and is held
+    provider.hold();
+    ASSERT_TRUE(eventually([&] { return provider.fetches == 2; }));
+    EXPECT_EQ(version(cache), 11);
+
+    provider.release();
+    ASSERT_TRUE(eventually([&] { return version(cache) == 21; }));
+    EXPECT_EQ(provider.fetches, 2);
+}
+
+TEST(collateral_cache, expires_the_collateral_which_cannot_be_renewed) {
+    FakeProvider provider;
+    CollateralCache::Settings settings;
+    settings.max_age = milliseconds(1000);
+    settings.refresh_margin = milliseconds(700);
+    settings.retry_interval = milliseconds(50);
+    CollateralCache cache(provider.fetcher(), settings);
+    const auto start = steady_clock::now();
+
+    EXPECT_EQ(version(cache), 11);
+    provider.failing = true;
+    //  The renewals fail, but the collateral is still served until it expires
+    ASSERT_TRUE(eventually([&] { return provider.fetches >= 3; }));
+    if (steady_clock::now() - start < milliseconds(900)) {
+        EXPECT_EQ(version(cache), 11);
+    }
+
+    this_thread::sleep_until(start + milliseconds(1100));
+    EXPECT_EQ(version(cache), -SGX_QL_ERROR_UNEXPECTED);
+    provider.failing = false;
+    EXPECT_GT(version(cache), 11);
+}
+
+TEST(collateral_cache, renews_the_collateral_at_its_next_update) {
+    FakeProvider provider;
+    provider.next_update = "2000-01-01T00:00:00Z";
+    CollateralCache::Settings settings;
+    settings.retry_interval = milliseconds(200);
+    CollateralCache cache(provider.fetcher(), settings);
+
+    //  The collateral is past its next update, so it is renewed after the retry interval rather than the hour
+    EXPECT_EQ(version(cache), 11);
+    ASSERT_TRUE(eventually([&] { return provider.fetches >= 2; }));
+    ASSERT_TRUE(eventually([&] { return version(cache) > 11; }));
+}
+
+TEST(collateral_next_update, is_the_earliest_of_the_json_and_crl_next_updates) {
+    Collateral collateral;
+    collateral.tcb_info = signedJson("tcbInfo", "2030-02-01T00:00:00Z");
+    collateral.qe_identity = signedJson("enclaveIdentity", "2030-01-20T10:00:00Z");
+    collateral.root_ca_crl = kPemCrl;
+    collateral.pck_crl = string(reinterpret_cast<const char*>(kDerCrl), sizeof(kDerCrl));
+    EXPECT_EQ(collateral.next_update(), utc(2030, 1, 20, 10, 0, 0));
+
+    collateral.qe_identity.clear();
+    EXPECT_EQ(collateral.next_update(), utc(2030, 1, 31, 12, 0, 0));
+
+    collateral.root_ca_crl.clear();
+    EXPECT_EQ(collateral.next_update(), utc(2030, 2, 1, 0, 0, 0));
+
+    collateral.tcb_info.clear();
+    EXPECT_EQ(collateral.next_update(), utc(2055, 6, 15, 8, 30, 0));
+}
+
+TEST(collateral_next_update, reads_the_json_with_spaces) {
+    Collateral collateral;
+    collateral.tcb_info = "{ \"tcbInfo\" : { \"nextUpdate\" : \"2031-07-04T23:59:58Z\" } }";
+    EXPECT_EQ(collateral.next_update(), utc(2031, 7, 4, 23, 59, 58));
+}
+
+TEST(collateral_next_update, ignores_what_cannot_be_parsed) {
+    Collateral collateral;
+    EXPECT_EQ(collateral.next_update(), CollateralCache::clock::time_point::max());
+
+    collateral.tcb_info = "{\"tcbInfo\":{\"nextUpdate\":\"soon\"}}";
+    collateral.qe_identity = "{\"enclaveIdentity\":{}}";
+    collateral.root_ca_crl = "-----BEGIN X509 CRL-----\nMAA=\n-----END X509 CRL-----\n";
+    collateral.pck_crl = string(reinterpret_cast<const char*>(kDerCrl), 40);
+    EXPECT_EQ(collateral.next_update(), CollateralCache::clock::time_point::max());
+
+    collateral.pck_crl = string(reinterpret_cast<const char*>(kDerCrl), sizeof(kDerCrl));
+    EXPECT_EQ(collateral.next_update(), utc(2055, 6, 15, 8, 30, 0));
+}
+
+TEST(collateral, copies_the_fields_without_their_terminators) {
+    char tcb_info[] = "{\"tcbInfo\":{}}";
+    char pck_crl[] = "crl";
+    sgx_ql_qve_collateral_t ql_collateral = {};
+    ql_collateral.version = 3;
+    ql_collateral.tcb_info = tcb_info;
+    ql_collateral.tcb_info_size = sizeof(tcb_info);
+    ql_collateral.pck_crl = pck_crl;
+    ql_collateral.pck_crl_size = sizeof(pck_crl);
+
+    const Collateral collateral(ql_collateral);
+    EXPECT_EQ(collateral.version, 3u);
+    EXPECT_EQ(collateral.tcb_info, "{\"tcbInfo\":{}}");
+    EXPECT_EQ(collateral.pck_crl, "crl");
+    EXPECT_EQ(collateral.root_ca_crl, "");
+    EXPECT_EQ(collateral.qe_identity, "");
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
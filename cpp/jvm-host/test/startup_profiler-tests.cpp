@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+// Include the module under test
+#include <startup_profiler.cpp>
+
+using namespace std;
+using namespace std::chrono;
+using namespace r3::conclave;
+
+static const sgx_enclave_id_t kEnclave = 2;
+static const sgx_enclave_id_t kOtherEnclave = 3;
+
+class startup_profiler : public ::testing::Test {
+protected:
+    StartupProfiler profiler;
+
+    int64_t duration(sgx_enclave_id_t enclave, StartupPhase phase) {
+        return profiler.get(enclave)[static_cast<int>(phase)];
+    }
+
+    //  Enclaves are profiled from their load
+    void load(sgx_enclave_id_t enclave) {
+        profiler.record(enclave, StartupPhase::LOAD, milliseconds(5));
+    }
+
+    void timeFirstEntry(sgx_enclave_id_t enclave, milliseconds sleep) {
+        profiler.begin(enclave, StartupPhase::FIRST_ENTRY);
+        this_thread::sleep_for(sleep);
+        profiler.end(enclave, StartupPhase::FIRST_ENTRY);
+    }
+};
+
+TEST_F(startup_profiler, phases_which_have_not_run_are_negative) {
+    for (auto value : profiler.get(kEnclave)) {
+        EXPECT_EQ(-1, value);
+    }
+    load(kEnclave);
+    const auto profile = profiler.get(kEnclave);
+    EXPECT_EQ(5000000, profile[static_cast<int>(StartupPhase::LOAD)]);
+    for (int i = 1; i < startup_phase_count; i++) {
+        EXPECT_EQ(-1, profile[i]);
+    }
+}
+
+TEST_F(startup_profiler, record_keeps_the_first_duration) {
+    profiler.record(kEnclave, StartupPhase::INITIALISE, microseconds(10));
+    profiler.record(kEnclave, StartupPhase::INITIALISE, microseconds(20));
+    EXPECT_EQ(10000, duration(kEnclave, StartupPhase::INITIALISE));
+}
+
+TEST_F(startup_profiler, begin_and_end_time_the_phase) {
+    load(kEnclave);
+    profiler.begin(kEnclave, StartupPhase::ISOLATE_CREATE);
+    this_thread::sleep_for(milliseconds(20));
+    profiler.end(kEnclave, StartupPhase::ISOLATE_CREATE);
+    EXPECT_GE(duration(kEnclave, StartupPhase::ISOLATE_CREATE), 20000000);
+}
+
+TEST_F(startup_profiler, end_without_begin_is_ignored) {
+    load(kEnclave);
+    profiler.end(kEnclave, StartupPhase::FILESYSTEM);
+    EXPECT_EQ(-1, duration(kEnclave, StartupPhase::FILESYSTEM));
+}
+
+TEST_F(startup_profiler, enclaves_which_have_not_been_loaded_are_ignored) {
+    timeFirstEntry(kEnclave, milliseconds(1));
+    EXPECT_EQ(-1, duration(kEnclave, StartupPhase::FIRST_ENTRY));
+}
+
+TEST_F(startup_profiler, only_the_first_entry_is_timed) {
+    load(kEnclave);
+    timeFirstEntry(kEnclave, milliseconds(20));
+    const auto first = duration(kEnclave, StartupPhase::FIRST_ENTRY);
+    EXPECT_GE(first, 20000000);
+
+    timeFirstEntry(kEnclave, milliseconds(1));
+    timeFirstEntry(kEnclave, milliseconds(40));
+    EXPECT_EQ(first, duration(kEnclave, StartupPhase::FIRST_ENTRY));
+}
+
+TEST_F(startup_profiler, concurrent_first_entries_time_the_first_one) {
+    load(kEnclave);
+    profiler.begin(kEnclave, StartupPhase::FIRST_ENTRY);
+    this_thread::sleep_for(milliseconds(20));
+    //  A second thread enters while the first one is still in the enclave
+    profiler.begin(kEnclave, StartupPhase::FIRST_ENTRY);
+    profiler.end(kEnclave, StartupPhase::FIRST_ENTRY);
+    profiler.end(kEnclave, StartupPhase::FIRST_ENTRY);
+    EXPECT_GE(duration(kEnclave, StartupPhase::FIRST_ENTRY), 20000000);
+}
+
+TEST_F(startup_profiler, enclaves_are_timed_separately) {
+    load(kEnclave);
+    load(kOtherEnclave);
+    timeFirstEntry(kEnclave, milliseconds(1));
+    EXPECT_NE(-1, duration(kEnclave, StartupPhase::FIRST_ENTRY));
+    EXPECT_EQ(-1, duration(kOtherEnclave, StartupPhase::FIRST_ENTRY));
+
+    timeFirstEntry(kOtherEnclave, milliseconds(20));
+    EXPECT_GE(duration(kOtherEnclave, StartupPhase::FIRST_ENTRY), 20000000);
+}
+
+TEST_F(startup_profiler, free_forgets_the_enclave) {
+    load(kEnclave);
+    load(kOtherEnclave);
+    timeFirstEntry(kEnclave, milliseconds(1));
+    profiler.free(kEnclave);
+    for (auto value : profiler.get(kEnclave)) {
+        EXPECT_EQ(-1, value);
+    }
+    EXPECT_NE(-1, duration(kOtherEnclave, StartupPhase::LOAD));
+
+    //  The id of a destroyed enclave can be reused, the new enclave is timed from scratch
+    load(kEnclave);
+    timeFirstEntry(kEnclave, milliseconds(20));
+    EXPECT_GE(duration(kEnclave, StartupPhase::FIRST_ENTRY), 20000000);
+}
+
+TEST_F(startup_profiler, invalid_phases_are_ignored) {
+    load(kEnclave);
+    profiler.record(kEnclave, static_cast<StartupPhase>(startup_phase_count), milliseconds(1));
+    profiler.begin(kEnclave, static_cast<StartupPhase>(-1));
+    profiler.end(kEnclave, static_cast<StartupPhase>(-1));
+    const auto profile = profiler.get(kEnclave);
+    for (int i = 1; i < startup_phase_count; i++) {
+        EXPECT_EQ(-1, profile[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -15,6 +15,7 @@
 #include "vm_enclave_layer.h"
 #include "substrate_jvm.h"
 #include "enclave_shared_data.h"
+#include "key_cache.h"
 #include "enclave_init.h"
 
 using namespace std;
@@ -53,10 +54,17 @@ void ecall_initialise_enclave(void* initStruct, int initStructLen) {
     ei->deadlock_timeout_seconds = deadlock_timeout;
 }
 
+void ecall_warm_up_enclave() {
+    enclave_trace("ecall_warm_up_enclave\n");
+    // Creates the isolate now rather than in the first jvm_ecall
+    r3::conclave::Jvm::jniEnv();
+}
+
 void ecall_finalize_enclave() {
     enclave_trace("ecall_finalize_enclave\n");
     using namespace r3::conclave;
     Jvm::instance().close();
+    KeyCache::instance().clear();
 }
 
 void throw_jvm_runtime_exception(const char *message) {
@@ -1,6 +1,7 @@
 #include <aex_assert.h>
 #include <substrate_jvm.h>
 #include <os_support.h>
+#include <startup_phase_guard.h>
 #include <mutex>
 #include <set>
 
@@ -93,7 +94,11 @@ private:
     // Initialize the JVM
     std::shared_ptr<graal_isolatethread_t> init_vm() {
         graal_isolatethread_t* thread = nullptr;
-        auto ret = graal_create_isolate(nullptr, &isolate_, &thread);
+        int ret;
+        {
+            StartupPhaseGuard phase(StartupPhase::ISOLATE_CREATE);
+            ret = graal_create_isolate(nullptr, &isolate_, &thread);
+        }
         aex_assert(ret == 0);
         threads_.insert(thread);
         return std::shared_ptr<graal_isolatethread_t>(thread, GraalThreadDeleter(&owner_));
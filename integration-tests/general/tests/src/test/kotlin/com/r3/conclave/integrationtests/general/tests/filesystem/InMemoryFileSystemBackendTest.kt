@@ -0,0 +1,79 @@
+package com.r3.conclave.integrationtests.general.tests.filesystem
+
+import com.r3.conclave.host.EnclaveHost
+import com.r3.conclave.host.EnclaveLoadException
+import com.r3.conclave.integrationtests.general.common.tasks.DeleteFile
+import com.r3.conclave.integrationtests.general.common.tasks.FilesExists
+import com.r3.conclave.integrationtests.general.common.tasks.FilesReadAllBytes
+import com.r3.conclave.integrationtests.general.common.tasks.FilesWrite
+import com.r3.conclave.integrationtests.general.commontest.AbstractEnclaveActionTest
+import com.r3.conclave.integrationtests.general.commontest.TestUtils
+import com.r3.conclave.integrationtests.general.commontest.TestUtils.graalvmOnlyTest
+import org.assertj.core.api.Assertions.assertThat
+import org.assertj.core.api.Assertions.assertThatThrownBy
+import org.junit.jupiter.api.Test
+import org.junit.jupiter.params.ParameterizedTest
+import org.junit.jupiter.params.provider.ValueSource
+import kotlin.random.Random
+
+/**
+ * The default enclave keeps its in-memory filesystem with the FatFs backend, the other one with the tmpfs backend.
+ */
+class InMemoryFileSystemBackendTest : AbstractEnclaveActionTest() {
+    companion object {
+        const val FATFS_ENCLAVE_CLASS_NAME = "com.r3.conclave.integrationtests.general.defaultenclave.DefaultEnclave"
+        const val TMPFS_ENCLAVE_CLASS_NAME =
+            "com.r3.conclave.integrationtests.general.tmpfsinmemoryenclave.TmpFsInMemoryEnclave"
+    }
+
+    @ParameterizedTest
+    @ValueSource(strings = [TMPFS_ENCLAVE_CLASS_NAME, FATFS_ENCLAVE_CLASS_NAME])
+    fun `files can be written, read back and deleted`(enclaveClassName: String) {
+        graalvmOnlyTest() // CON-1264: Gramine: accessing filesystem and devices causes InvalidKeyException: Invalid AES key length: 0 bytes
+        val data = Random.nextBytes(300_000)
+        callEnclave(FilesWrite("/dir-file.bin", data), enclaveClassName)
+        assertThat(callEnclave(FilesReadAllBytes("/dir-file.bin"), enclaveClassName)).isEqualTo(data)
+
+        callEnclave(DeleteFile("/dir-file.bin", nioApi = true), enclaveClassName)
+        assertThat(callEnclave(FilesExists("/dir-file.bin"), enclaveClassName)).isFalse
+    }
+
+    @Test
+    fun `the tmpfs backend restores a snapshot`() {
+        graalvmOnlyTest()
+        val data = Random.nextBytes(10_000)
+        val snapshot = startHost(TMPFS_ENCLAVE_CLASS_NAME, null).use { host ->
+            callEnclave(host, FilesWrite("/snapshot-file.bin", data))
+            host.snapshotInMemoryFileSystem()
+        }
+        assertThat(snapshot).isNotNull
+
+        startHost(TMPFS_ENCLAVE_CLASS_NAME, snapshot).use { host ->
+            assertThat(callEnclave(host, FilesReadAllBytes("/snapshot-file.bin"))).isEqualTo(data)
+        }
+    }
+
+    @Test
+    fun `the FatFs backend has no snapshot and rejects one`() {
+        graalvmOnlyTest()
+        val snapshot = startHost(TMPFS_ENCLAVE_CLASS_NAME, null).use { host -> host.snapshotInMemoryFileSystem() }
+
+        startHost(FATFS_ENCLAVE_CLASS_NAME, null).use { host ->
+            assertThat(host.snapshotInMemoryFileSystem()).isNull()
+        }
+        assertThatThrownBy { startHost(FATFS_ENCLAVE_CLASS_NAME, snapshot).close() }
+            .isInstanceOf(EnclaveLoadException::class.java)
+            .hasStackTraceContaining("can only be restored with the tmpfs backend")
+    }
+
+    private fun startHost(enclaveClassName: String, snapshot: ByteArray?): EnclaveHost {
+        val host = EnclaveHost.load(enclaveClassName)
+        try {
+            host.start(TestUtils.getAttestationParams(host), null, null, null, snapshot) { }
+        } catch (e: Exception) {
+            host.close()
+            throw e
+        }
+        return host
+    }
+}
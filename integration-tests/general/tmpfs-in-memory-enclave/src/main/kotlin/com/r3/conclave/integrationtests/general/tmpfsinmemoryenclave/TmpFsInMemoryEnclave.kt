@@ -0,0 +1,8 @@
+package com.r3.conclave.integrationtests.general.tmpfsinmemoryenclave
+
+import com.r3.conclave.integrationtests.general.commonenclave.AbstractTestActionEnclave
+
+/**
+ * This enclave uses the tmpfs backend for its in-memory filesystem, see its build.gradle.
+ */
+class TmpFsInMemoryEnclave : AbstractTestActionEnclave()
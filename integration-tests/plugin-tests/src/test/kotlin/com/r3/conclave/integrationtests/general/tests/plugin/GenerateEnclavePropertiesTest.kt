@@ -65,6 +65,28 @@ class GenerateEnclavePropertiesTest : AbstractPluginTaskTest() {
         assertThat(enclaveProperties()).containsEntry(name, newRawValue.toString())
     }
 
+    @ParameterizedTest
+    @ValueSource(strings = ["log", "LOG"])
+    fun `persistentFileSystemLayout config in enclave properties`(newValue: String) {
+        assertThat(buildGradleFile).content().doesNotContain("persistentFileSystemLayout")
+        runTaskAfterInputChangeAndAssertItsIncremental {
+            assertThat(enclaveProperties()).containsEntry("persistentFileSystemLayout", "IN_PLACE")
+            addSimpleEnclaveConfig("persistentFileSystemLayout", newValue)
+        }
+        assertThat(enclaveProperties()).containsEntry("persistentFileSystemLayout", "LOG")
+    }
+
+    @ParameterizedTest
+    @ValueSource(strings = ["tmpfs", "TMPFS"])
+    fun `inMemoryFileSystemBackend config in enclave properties`(newValue: String) {
+        assertThat(buildGradleFile).content().doesNotContain("inMemoryFileSystemBackend")
+        runTaskAfterInputChangeAndAssertItsIncremental {
+            assertThat(enclaveProperties()).containsEntry("inMemoryFileSystemBackend", "FATFS")
+            addSimpleEnclaveConfig("inMemoryFileSystemBackend", newValue)
+        }
+        assertThat(enclaveProperties()).containsEntry("inMemoryFileSystemBackend", "TMPFS")
+    }
+
     @Test
     fun `kds-kdsEnclaveConstraint`() {
         assertThat(buildGradleFile).content().doesNotContain("kdsEnclaveConstraint")
@@ -29,6 +29,10 @@ open class ConclaveExtension @Inject constructor(objects: ObjectFactory) {
     @get:Input
     val persistentFileSystemSize: Property<String> = objects.property(String::class.java).convention("0")
     @get:Input
+    val persistentFileSystemLayout: Property<String> = objects.property(String::class.java).convention("in_place")
+    @get:Input
+    val inMemoryFileSystemBackend: Property<String> = objects.property(String::class.java).convention("fatfs")
+    @get:Input
     val maxThreads: Property<Int> = objects.property(Int::class.java).convention(100)
     @get:Input
     val deadlockTimeout: Property<Int> = objects.property(Int::class.java).convention(10)
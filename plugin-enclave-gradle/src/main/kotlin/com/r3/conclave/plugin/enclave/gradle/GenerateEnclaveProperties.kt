@@ -1,6 +1,8 @@
 package com.r3.conclave.plugin.enclave.gradle
 
 import com.r3.conclave.common.EnclaveConstraint
+import com.r3.conclave.common.internal.InMemoryFileSystemBackend
+import com.r3.conclave.common.internal.PersistentFileSystemLayout
 import com.r3.conclave.common.kds.MasterKeyType
 import org.gradle.api.GradleException
 import org.gradle.api.file.RegularFileProperty
@@ -103,6 +105,28 @@ open class GenerateEnclaveProperties @Inject constructor(objects: ObjectFactory)
             useOwnCodeSignerAndProductID.toString()
     }
 
+    private fun getPersistentFileSystemLayout(layoutString: String): PersistentFileSystemLayout {
+        return try {
+            PersistentFileSystemLayout.valueOf(layoutString.uppercase())
+        } catch (e: IllegalArgumentException) {
+            throw GradleException(
+                "Invalid persistent filesystem layout '$layoutString'. Valid values are: " +
+                        PersistentFileSystemLayout.values().joinToString(", ") { it.name.lowercase() }
+            )
+        }
+    }
+
+    private fun getInMemoryFileSystemBackend(backendString: String): InMemoryFileSystemBackend {
+        return try {
+            InMemoryFileSystemBackend.valueOf(backendString.uppercase())
+        } catch (e: IllegalArgumentException) {
+            throw GradleException(
+                "Invalid in-memory filesystem backend '$backendString'. Valid values are: " +
+                        InMemoryFileSystemBackend.values().joinToString(", ") { it.name.lowercase() }
+            )
+        }
+    }
+
     override fun action() {
         // TODO Use inputs.properties to enumerate all property values and automatically dump them into the
         //  properties file
@@ -118,6 +142,10 @@ open class GenerateEnclaveProperties @Inject constructor(objects: ObjectFactory)
             GenerateEnclaveConfig.getSizeBytes(conclave.inMemoryFileSystemSize.get()).toString()
         properties["persistentFileSystemSize"] =
             GenerateEnclaveConfig.getSizeBytes(conclave.persistentFileSystemSize.get()).toString()
+        properties["persistentFileSystemLayout"] =
+            getPersistentFileSystemLayout(conclave.persistentFileSystemLayout.get()).toString()
+        properties["inMemoryFileSystemBackend"] =
+            getInMemoryFileSystemBackend(conclave.inMemoryFileSystemBackend.get()).toString()
 
         applyKDSConfig(properties)
 